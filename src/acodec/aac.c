@@ -173,6 +173,7 @@ static int aac_decode(void *ctx, fmed_filt *d)
 	r = ffaac_decode(&a->aac);
 	if (r == FFAAC_RERR) {
 		warnlog(core, d->trk, NULL, "ffaac_decode(): %s", ffaac_errstr(&a->aac));
+		d->codec_err = 1;
 		return FMED_RMORE;
 
 	} else if (r == FFAAC_RMORE) {
@@ -0,0 +1,482 @@
+/** FLAC multi-threaded encoder.
+Input audio is split into chunks, each chunk is encoded by a separate thread,
+ then the frames are numbered and passed to the next filter in the original order.
+Copyright (c) 2018 Simon Zolin */
+
+#include <fmedia.h>
+
+#include <FF/audio/flac.h>
+#include <FF/audio/flac-fmt.h>
+#include <FF/crypto/md5.h>
+#include <FFOS/thread.h>
+#include <FFOS/semaphore.h>
+
+
+extern const fmed_core *core;
+
+
+enum {
+	/* The max. number of samples in a chunk.
+	The actual size is a multiple of the encoder's block size,
+	 so all frames within a chunk have the same size and the numbering is continuous. */
+	CHUNK_SAMPLES = 36864 * 8,
+	MAX_CHANNELS = 8,
+};
+
+
+/** Encode frame number as "UTF-8" (up to 36 bits). */
+static uint frnum_write(byte *dst, uint64 val)
+{
+	uint n;
+	if (val < 0x80) {
+		dst[0] = (byte)val;
+		return 1;
+	}
+
+	for (n = 2;  n != 7;  n++) {
+		if (val < ((uint64)1 << (5 * n + 1)))
+			break;
+	}
+
+	dst[0] = (byte)((0xff00 >> n) | (val >> (6 * (n - 1))));
+	for (uint i = 1;  i != n;  i++) {
+		dst[i] = 0x80 | ((val >> (6 * (n - 1 - i))) & 0x3f);
+	}
+	return n;
+}
+
+/** Get the number of bytes in "UTF-8" frame number by its first byte. */
+static uint frnum_size(uint b)
+{
+	uint n = 0;
+	while (n != 8 && (b & (0x80 >> n)))
+		n++;
+	return (n == 0) ? 1 : n;
+}
+
+/** Copy FLAC frame setting a new number in its header:
+ frame number for fixed block size stream or sample number for variable block size stream.
+@dst: must have 6 bytes more than @len
+Return the size of new frame;  0 on error. */
+size_t flac_frame_renumber(byte *dst, const byte *fr, size_t len, uint64 num)
+{
+	if (len < 4 + 1 + 1 + 2 || fr[0] != 0xff || (fr[1] & 0xfe) != 0xf8)
+		return 0;
+
+	uint nsize = frnum_size(fr[4]);
+	uint extra = 0;
+	switch (fr[2] >> 4) {
+	case 6:
+		extra += 1;  break;
+	case 7:
+		extra += 2;  break;
+	}
+	switch (fr[2] & 0x0f) {
+	case 12:
+		extra += 1;  break;
+	case 13:
+	case 14:
+		extra += 2;  break;
+	}
+
+	size_t hdr = 4 + nsize + extra; //offset of CRC-8
+	if (hdr + 1 + 2 > len)
+		return 0;
+
+	ffmemcpy(dst, fr, 4);
+	size_t k = 4 + frnum_write(dst + 4, num);
+	ffmemcpy(dst + k, fr + 4 + nsize, extra);
+	k += extra;
+	dst[k] = flac_crc8(dst, k);
+	k++;
+
+	size_t body = len - (hdr + 1) - 2;
+	ffmemcpy(dst + k, fr + hdr + 1, body);
+	k += body;
+
+	uint c = flac_crc16(dst, k);
+	dst[k++] = (byte)(c >> 8);
+	dst[k++] = (byte)c;
+	return k;
+}
+
+
+struct frame {
+	size_t off;
+	uint len;
+	uint samples;
+};
+
+struct chunk {
+	struct flac_mt *m;
+	ffatomic done;
+	uint busy :1;
+	uint err :1;
+
+	void *pcm[MAX_CHANNELS];
+	uint samples;
+	uint64 first_frame;
+
+	ffarr out; //renumbered frames
+	ffarr frames; //struct frame[]
+	uint iframe; //next frame to pass to the next filter
+};
+
+typedef struct flac_mt {
+	void *trk;
+	const fmed_track *track;
+	ffpcmex fmt;
+	uint level;
+	uint sampsize; //bytes per sample of one channel
+	uint blocksize; //samples per frame, set by the encoder
+	uint chunk_samples;
+
+	struct chunk *chunks;
+	uint nchunks;
+	uint ifill; //chunk being filled with input data
+	uint iout; //chunk being output
+	uint64 nframes; //frames in the chunks already started
+
+	// thread pool: each started chunk is taken by one of the threads
+	ffthd *thds;
+	uint nthds;
+	ffsem sem; //the number of started chunks not yet taken by a thread
+	fflock lk;
+	uint itake; //next chunk to be taken by a thread
+	uint quit;
+	uint closing; //the track may be freed: don't wake it up.  Protected by 'lk'.
+
+	const void **in; //input data: non-interleaved
+	size_t inlen; //samples
+	size_t inoff; //samples
+
+	ffatomic waiting; //1: track is suspended until a chunk is encoded
+	FFMD5_CTX md5;
+	uint md5_on :1;
+	uint minframe, maxframe;
+	uint fin :1;
+} flac_mt;
+
+/** Encode one chunk.  Thread: pool. */
+static void chunk_encode(struct chunk *c)
+{
+	flac_mt *m = c->m;
+	ffflac_enc e;
+	ffpcmex fmt = m->fmt;
+	int r;
+
+	ffflac_enc_init(&e);
+	e.opts |= FFFLAC_ENC_NOMD5;
+	e.level = m->level;
+	if (0 != ffflac_create(&e, (void*)&fmt)) {
+		errlog(core, m->trk, "flac", "ffflac_create(): %s", ffflac_enc_errstr(&e));
+		c->err = 1;
+		goto end;
+	}
+
+	e.pcm = (const void**)c->pcm;
+	e.pcmlen = c->samples * m->sampsize * fmt.channels;
+	ffflac_enc_fin(&e);
+
+	uint64 num = c->first_frame;
+	for (;;) {
+		r = ffflac_encode(&e);
+		if (r == FFFLAC_RDONE)
+			break;
+		if (r != FFFLAC_RDATA) {
+			errlog(core, m->trk, "flac", "ffflac_encode(): %s", ffflac_enc_errstr(&e));
+			c->err = 1;
+			break;
+		}
+
+		struct frame *fr;
+		if (NULL == ffarr_grow(&c->out, e.datalen + 6, 0)
+			|| NULL == (fr = ffarr_pushgrowT(&c->frames, 64, struct frame))) {
+			c->err = 1;
+			break;
+		}
+		fr->off = c->out.len;
+		fr->samples = e.frsamps;
+		fr->len = flac_frame_renumber((byte*)c->out.ptr + c->out.len, (void*)e.data, e.datalen, num++);
+		if (fr->len == 0) {
+			errlog(core, m->trk, "flac", "bad frame header from encoder");
+			c->err = 1;
+			break;
+		}
+		c->out.len += fr->len;
+	}
+
+end:
+	ffflac_enc_close(&e);
+	ffatom_fence_rel();
+	ffatom_set(&c->done, 1);
+
+	fflk_lock(&m->lk);
+	if (!m->closing && ffatom_cmpset(&m->waiting, 1, 0))
+		m->track->cmd(m->trk, FMED_TRACK_WAKE);
+	fflk_unlock(&m->lk);
+}
+
+/** Encode the started chunks until the encoder is closed.  Thread: pool. */
+static FFTHDCALL int pool_worker(void *param)
+{
+	flac_mt *m = param;
+	for (;;) {
+		ffsem_wait(m->sem, -1);
+		if (FF_READONCE(&m->quit))
+			break;
+
+		fflk_lock(&m->lk);
+		struct chunk *c = &m->chunks[m->itake];
+		m->itake = (m->itake + 1) % m->nchunks;
+		fflk_unlock(&m->lk);
+
+		chunk_encode(c);
+	}
+	return 0;
+}
+
+static void chunk_reset(struct chunk *c)
+{
+	ffatom_set(&c->done, 0);
+	c->busy = 0;
+	c->err = 0;
+	c->samples = 0;
+	c->out.len = 0;
+	c->frames.len = 0;
+	c->iframe = 0;
+}
+
+void flac_mt_free(flac_mt *m)
+{
+	// a pool thread must not wake the track after this point
+	fflk_lock(&m->lk);
+	m->closing = 1;
+	fflk_unlock(&m->lk);
+
+	if (m->thds != NULL) {
+		// wait until the running chunks are encoded, then stop the threads
+		FF_WRITEONCE(&m->quit, 1);
+		for (uint i = 0;  i != m->nthds;  i++) {
+			ffsem_post(m->sem);
+		}
+		for (uint i = 0;  i != m->nthds;  i++) {
+			ffthd_join(m->thds[i], -1, NULL);
+		}
+		ffmem_free(m->thds);
+	}
+	if (m->sem != FFSEM_INV)
+		ffsem_close(m->sem);
+
+	if (m->chunks != NULL) {
+		for (uint i = 0;  i != m->nchunks;  i++) {
+			struct chunk *c = &m->chunks[i];
+			for (uint ch = 0;  ch != m->fmt.channels;  ch++) {
+				ffmem_safefree(c->pcm[ch]);
+			}
+			ffarr_free(&c->out);
+			ffarr_free(&c->frames);
+		}
+		ffmem_free(m->chunks);
+	}
+	ffmem_free(m);
+}
+
+/** Create multi-threaded encoder with a pool of @nthreads threads.
+@blocksize: block size used by the encoder
+Return NULL if the format isn't supported: the caller should use a single-threaded encoder. */
+flac_mt* flac_mt_create(fmed_filt *d, const ffpcmex *fmt, uint level, uint nthreads, uint md5, uint blocksize)
+{
+	flac_mt *m;
+
+	switch (fmt->format) {
+	case FFPCM_8:
+	case FFPCM_16:
+	case FFPCM_24:
+		break;
+	default:
+		return NULL; //MD5 requires the samples in their packed form
+	}
+	if (fmt->ileaved || fmt->channels > MAX_CHANNELS
+		|| blocksize == 0 || blocksize > CHUNK_SAMPLES)
+		return NULL;
+
+	if (NULL == (m = ffmem_new(flac_mt)))
+		return NULL;
+	m->sem = FFSEM_INV;
+	m->trk = d->trk;
+	m->track = d->track;
+	m->fmt = *fmt;
+	m->level = level;
+	m->sampsize = ffpcm_bits(fmt->format) / 8;
+	m->blocksize = blocksize;
+	m->chunk_samples = CHUNK_SAMPLES / blocksize * blocksize;
+	m->minframe = (uint)-1;
+	m->md5_on = !!md5;
+	FFMD5_Init(&m->md5);
+	fflk_init(&m->lk);
+
+	// one chunk more than threads, so the input is buffered while the oldest chunk is being output
+	m->nchunks = nthreads + 1;
+	if (NULL == (m->chunks = ffmem_callocT(m->nchunks, struct chunk)))
+		goto err;
+	for (uint i = 0;  i != m->nchunks;  i++) {
+		struct chunk *c = &m->chunks[i];
+		c->m = m;
+		for (uint ch = 0;  ch != fmt->channels;  ch++) {
+			if (NULL == (c->pcm[ch] = ffmem_alloc(m->chunk_samples * m->sampsize)))
+				goto err;
+		}
+	}
+
+	if (FFSEM_INV == (m->sem = ffsem_open(NULL, 0, 0))) {
+		syserrlog(core, d->trk, "flac", "%s", "ffsem_open()");
+		goto err;
+	}
+	if (NULL == (m->thds = ffmem_callocT(nthreads, ffthd)))
+		goto err;
+	for (m->nthds = 0;  m->nthds != nthreads;  m->nthds++) {
+		if (FFTHD_INV == (m->thds[m->nthds] = ffthd_create(&pool_worker, m, 0))) {
+			syserrlog(core, d->trk, "flac", "%s", ffthd_create_S);
+			goto err;
+		}
+	}
+
+	dbglog(core, d->trk, "flac", "using %u encoder threads, block size:%u, chunk:%u samples"
+		, nthreads, blocksize, m->chunk_samples);
+	return m;
+
+err:
+	flac_mt_free(m);
+	return NULL;
+}
+
+/** Add interleaved little-endian samples to MD5. */
+static void mt_md5(flac_mt *m, size_t off, size_t samples)
+{
+	byte buf[4096 * 3];
+	uint nch = m->fmt.channels, ss = m->sampsize;
+	size_t n = sizeof(buf) / (ss * nch);
+
+	while (samples != 0) {
+		n = ffmin(n, samples);
+		byte *p = buf;
+		for (size_t i = 0;  i != n;  i++) {
+			for (uint ch = 0;  ch != nch;  ch++) {
+				ffmemcpy(p, (byte*)m->in[ch] + (off + i) * ss, ss);
+				p += ss;
+			}
+		}
+		FFMD5_Update(&m->md5, buf, p - buf);
+		off += n;
+		samples -= n;
+	}
+}
+
+/** Pass the filled chunk to the thread pool. */
+static void chunk_start(flac_mt *m, struct chunk *c)
+{
+	c->first_frame = m->nframes;
+	m->nframes += (c->samples + m->blocksize - 1) / m->blocksize;
+	c->busy = 1;
+	ffsem_post(m->sem);
+}
+
+/** Copy input data to the chunk being filled.  Start encoding of the full chunks. */
+static int mt_fill(flac_mt *m, uint last)
+{
+	for (;;) {
+		struct chunk *c = &m->chunks[m->ifill];
+		if (c->busy)
+			return 0; //wait until the chunk is output
+
+		size_t n = ffmin(m->inlen - m->inoff, m->chunk_samples - c->samples);
+		if (n != 0) {
+			for (uint ch = 0;  ch != m->fmt.channels;  ch++) {
+				ffmemcpy((byte*)c->pcm[ch] + c->samples * m->sampsize
+					, (byte*)m->in[ch] + m->inoff * m->sampsize, n * m->sampsize);
+			}
+			if (m->md5_on)
+				mt_md5(m, m->inoff, n);
+			c->samples += n;
+			m->inoff += n;
+		}
+
+		if (c->samples == m->chunk_samples
+			|| (last && m->inoff == m->inlen && c->samples != 0)) {
+			chunk_start(m, c);
+			m->ifill = (m->ifill + 1) % m->nchunks;
+			continue;
+		}
+
+		return 0;
+	}
+}
+
+/** Take the input data passed with this call, if any. */
+void flac_mt_input(flac_mt *m, fmed_filt *d)
+{
+	if (d->flags & FMED_FFWD) {
+		m->in = (const void**)d->datani;
+		m->inlen = d->datalen / (m->sampsize * m->fmt.channels);
+		m->inoff = 0;
+		d->datalen = 0;
+	}
+}
+
+/**
+Return enum FMED_R. */
+int flac_mt_encode(flac_mt *m, fmed_filt *d, ffflac_info *info)
+{
+	flac_mt_input(m, d);
+	uint last = !!(d->flags & FMED_FLAST);
+
+	if (0 != mt_fill(m, last))
+		return FMED_RERR;
+
+	for (;;) {
+		struct chunk *c = &m->chunks[m->iout];
+
+		if (!c->busy) {
+			if (m->inoff != m->inlen)
+				return FMED_RERR; //all chunks are free, but not all input is consumed
+			if (!last)
+				return FMED_RMORE;
+
+			// all chunks are output
+			if (m->md5_on)
+				FFMD5_Final(info->md5, &m->md5);
+			if (m->minframe != (uint)-1) {
+				info->minframe = m->minframe;
+				info->maxframe = m->maxframe;
+			}
+			d->out = (void*)info,  d->outlen = sizeof(*info);
+			return FMED_RDONE;
+		}
+
+		if (0 == ffatom_get(&c->done)) {
+			ffatom_set(&m->waiting, 1);
+			if (0 == ffatom_get(&c->done)
+				|| !ffatom_cmpset(&m->waiting, 1, 0))
+				return FMED_RASYNC; //the encoder thread will wake us up
+		}
+		ffatom_fence_acq();
+
+		if (c->err)
+			return FMED_RERR;
+
+		if (c->iframe != c->frames.len) {
+			const struct frame *fr = (struct frame*)c->frames.ptr + c->iframe++;
+			m->minframe = ffmin(m->minframe, fr->len);
+			m->maxframe = ffmax(m->maxframe, fr->len);
+			fmed_setval("flac_in_frsamples", fr->samples);
+			d->out = c->out.ptr + fr->off,  d->outlen = fr->len;
+			return FMED_RDATA;
+		}
+
+		chunk_reset(c);
+		m->iout = (m->iout + 1) % m->nchunks;
+		if (0 != mt_fill(m, last))
+			return FMED_RERR;
+	}
+}
@@ -4,6 +4,7 @@ Copyright (c) 2015 Simon Zolin */
 #include <fmedia.h>
 
 #include <FF/audio/flac.h>
+#include <FFOS/process.h>
 
 
 const fmed_core *core;
@@ -13,6 +14,12 @@ extern const fmed_filter fmed_flac_output;
 extern const fmed_filter fmed_flac_input;
 extern int flac_out_config(ffpars_ctx *conf);
 
+typedef struct flac_mt flac_mt;
+extern flac_mt* flac_mt_create(fmed_filt *d, const ffpcmex *fmt, uint level, uint nthreads, uint md5, uint blocksize);
+extern void flac_mt_free(flac_mt *m);
+extern void flac_mt_input(flac_mt *m, fmed_filt *d);
+extern int flac_mt_encode(flac_mt *m, fmed_filt *d, ffflac_info *info);
+
 struct flac_dec {
 	ffflac_dec fl;
 	ffpcmex fmt;
@@ -21,11 +28,13 @@ struct flac_dec {
 typedef struct flac_enc {
 	ffflac_enc fl;
 	uint state;
+	flac_mt *mt;
 } flac_enc;
 
 static struct flac_out_conf_t {
 	byte level;
 	byte md5;
+	uint threads;
 } flac_out_conf;
 
 
@@ -59,6 +68,7 @@ static const fmed_filter mod_flac_enc = {
 static const ffpars_arg flac_enc_conf_args[] = {
 	{ "compression",  FFPARS_TINT | FFPARS_F8BIT,  FFPARS_DSTOFF(struct flac_out_conf_t, level) },
 	{ "md5",	FFPARS_TBOOL | FFPARS_F8BIT,  FFPARS_DSTOFF(struct flac_out_conf_t, md5) },
+	{ "threads",	FFPARS_TINT,  FFPARS_DSTOFF(struct flac_out_conf_t, threads) },
 };
 
 
@@ -169,6 +179,7 @@ static int flac_dec_decode(void *ctx, fmed_filt *d)
 	case FFFLAC_RWARN:
 		warnlog(core, d->trk, "flac", "ffflac_decode(): %s"
 			, ffflac_dec_errstr(&f->fl));
+		d->codec_err = 1;
 		return FMED_RMORE;
 	}
 
@@ -187,6 +198,7 @@ static int flac_enc_config(ffpars_ctx *conf)
 {
 	flac_out_conf.level = 6;
 	flac_out_conf.md5 = 1;
+	flac_out_conf.threads = 1;
 	ffpars_setargs(conf, &flac_out_conf, flac_enc_conf_args, FFCNT(flac_enc_conf_args));
 	return 0;
 }
@@ -208,6 +220,8 @@ static void* flac_enc_create(fmed_filt *d)
 static void flac_enc_free(void *ctx)
 {
 	flac_enc *f = ctx;
+	if (f->mt != NULL)
+		flac_mt_free(f->mt);
 	ffflac_enc_close(&f->fl);
 	ffmem_free(f);
 }
@@ -252,12 +266,40 @@ static int flac_enc_encode(void *ctx, fmed_filt *d)
 			errlog(core, d->trk, NULL, "unsupported input PCM format");
 			return FMED_RERR;
 		}
+
+		{
+		uint n = flac_out_conf.threads;
+		if (n == 0) {
+			ffsysconf sc;
+			ffsc_init(&sc);
+			n = ffsc_get(&sc, _SC_NPROCESSORS_ONLN);
+		}
+		if (n > 1
+			&& NULL != (f->mt = flac_mt_create(d, &d->audio.convfmt, f->fl.level, n
+				, !(f->fl.opts & FFFLAC_ENC_NOMD5), f->fl.info.minblock))) {
+			// the chunks are encoded by their own encoders
+			ffflac_info info = f->fl.info;
+			ffflac_enc_close(&f->fl);
+			ffflac_enc_init(&f->fl);
+			f->fl.info = info;
+		}
+		}
 		break;
 
 	case 3:
 		break;
 	}
 
+	if (f->mt != NULL) {
+		if (f->state != 3) {
+			f->state = 3;
+			flac_mt_input(f->mt, d); // the first input buffer is encoded on the next call
+			d->out = (void*)&f->fl.info,  d->outlen = sizeof(ffflac_info);
+			return FMED_RDATA;
+		}
+		return flac_mt_encode(f->mt, d, &f->fl.info);
+	}
+
 	if (d->flags & FMED_FFWD) {
 		f->fl.pcm = (const void**)d->datani;
 		f->fl.pcmlen = d->datalen;
@@ -33,6 +33,8 @@ static const fmed_mod fmed_mpeg_mod = {
 extern const fmed_filter fmed_mpeg_input;
 extern const fmed_filter fmed_mpeg_output;
 extern int mpeg_out_config(ffpars_ctx *ctx);
+extern int mpeg_in_config(ffpars_ctx *ctx);
+extern void mpeg_in_conf_destroy(void);
 extern const fmed_filter fmed_mpeg_copy;
 
 //DECODE
@@ -94,6 +96,8 @@ static int mpeg_mod_conf(const char *name, ffpars_ctx *ctx)
 		return mpeg_enc_config(ctx);
 	if (!ffsz_cmp(name, "out"))
 		return mpeg_out_config(ctx);
+	if (!ffsz_cmp(name, "in"))
+		return mpeg_in_config(ctx);
 	return -1;
 }
 
@@ -113,6 +117,7 @@ static int mpeg_sig(uint signo)
 
 static void mpeg_destroy(void)
 {
+	mpeg_in_conf_destroy();
 }
 
 
@@ -182,6 +187,7 @@ static int mpeg_dec_process(void *ctx, fmed_filt *d)
 	case FFMPG_RWARN:
 		errlog(core, d->trk, "mpeg", "ffmpg_decode(): %s. Near sample %U"
 			, ffmpg_errstr(&m->mpg), d->audio.pos);
+		d->codec_err = 1;
 		continue;
 	}
 	}
@@ -198,6 +198,7 @@ static int opus_in_decode(void *ctx, fmed_filt *d)
 
 	case FFOPUS_RWARN:
 		warnlog(core, d->trk, NULL, "ffopus_decode(): %s", ffopus_errstr(&o->opus));
+		d->codec_err = 1;
 		// break
 
 	case FFOPUS_RMORE:
@@ -193,6 +193,7 @@ static int vorbis_in_decode(void *ctx, fmed_filt *d)
 
 	case FFVORBIS_RWARN:
 		warnlog(core, d->trk, NULL, "ffvorbis_decode(): %s", ffvorbis_errstr(&v->vorbis));
+		d->codec_err = 1;
 		// break
 
 	case FFVORBIS_RMORE:
@@ -0,0 +1,54 @@
+/** Adaptive fill limit of audio device output buffer.
+Copyright (c) 2018 Simon Zolin */
+
+#include <fmedia.h>
+
+
+void fmed_adev_adapt_init(fmed_adev_adapt *a, fmed_filt *d, uint min, uint stable)
+{
+	ffmem_tzero(a);
+	a->min = min;
+	a->stable = stable;
+	ffmem_tzero(&d->adev);
+	d->adev.fill_min = 100;
+}
+
+size_t fmed_adev_adapt_update(fmed_adev_adapt *a, fmed_filt *d, size_t filled, size_t bufsize
+	, uint frsize, uint rate)
+{
+	uint fill = (uint64)filled * 100 / bufsize;
+	a->buf_msec = (uint64)bufsize * 1000 / (frsize * rate);
+	d->adev.fill = fill;
+
+	if (a->running && fill < d->adev.fill_min)
+		d->adev.fill_min = fill;
+
+	if (a->min == 0) {
+		d->adev.buf_msec = a->buf_msec;
+		return bufsize - filled;
+	}
+
+	if (a->limit == 0)
+		a->limit = ffmin(a->min, a->buf_msec);
+	else if (a->limit > a->min
+		&& a->written >= (uint64)a->stable * rate / 1000 * frsize) {
+		a->limit = ffmax(a->limit / 2, a->min);
+		a->written = 0;
+	}
+	d->adev.buf_msec = a->limit;
+
+	size_t lim = (uint64)a->limit * rate / 1000 * frsize;
+	if (filled >= lim)
+		return 0;
+	return lim - filled;
+}
+
+void fmed_adev_adapt_xrun(fmed_adev_adapt *a, fmed_filt *d)
+{
+	d->adev.xruns++;
+	a->running = 0;
+	if (a->min != 0 && a->limit != 0 && a->limit < a->buf_msec) {
+		a->limit = ffmin(a->limit * 2, a->buf_msec);
+		a->written = 0;
+	}
+}
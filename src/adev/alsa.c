@@ -14,6 +14,7 @@ typedef struct alsa_mod {
 	ffalsa_buf out;
 	ffpcmex fmt;
 	alsa_out *usedby;
+	fflock lk; //protects 'usedby' and the device handover: tracks may run on different workers
 	const fmed_track *track;
 	uint devidx;
 	uint out_valid :1;
@@ -29,11 +30,19 @@ struct alsa_out {
 	ffalsa_dev dev;
 	uint devidx;
 
+	char *dst; //region of the device buffer lent to the converter
+	snd_pcm_uframes_t dstoff;
+	ffarr rest; //data from the lent region that couldn't be committed
+
+	fmed_adev_adapt adapt;
+	fftmrq_entry tmr; //wakes the track when the buffer fill level drops below the adaptive limit
+
 	struct {
 		fftask_handler handler;
 		void *param;
 	} task;
 	uint stop :1;
+	uint nommap :1; //device doesn't support direct access to its buffer
 };
 
 enum { I_TRYOPEN, I_OPEN, I_DATA };
@@ -42,6 +51,9 @@ static struct alsa_out_conf_t {
 	uint idev;
 	uint buflen;
 	uint nfy_rate;
+	uint adapt_min;
+	uint adapt_stable;
+	byte mmap;
 } alsa_out_conf;
 
 //FMEDIA MODULE
@@ -70,9 +82,16 @@ static const ffpars_arg alsa_out_conf_args[] = {
 	{ "device_index",	FFPARS_TINT,  FFPARS_DSTOFF(struct alsa_out_conf_t, idev) },
 	{ "buffer_length",	FFPARS_TINT | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct alsa_out_conf_t, buflen) },
 	{ "notify_rate",	FFPARS_TINT,  FFPARS_DSTOFF(struct alsa_out_conf_t, nfy_rate) },
+	{ "mmap",	FFPARS_TBOOL8,  FFPARS_DSTOFF(struct alsa_out_conf_t, mmap) },
+	{ "adaptive_buffer",	FFPARS_TINT,  FFPARS_DSTOFF(struct alsa_out_conf_t, adapt_min) },
+	{ "adaptive_stable_time",	FFPARS_TINT | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct alsa_out_conf_t, adapt_stable) },
 };
 
 static void alsa_onplay(void *udata);
+static void alsa_ontmr(void *udata);
+static void alsa_lend(alsa_out *a, fmed_filt *d);
+static int alsa_commit(alsa_out *a, fmed_filt *d);
+static void alsa_release(alsa_out *a);
 
 //INPUT
 static void* alsa_in_open(fmed_filt *d);
@@ -158,6 +177,7 @@ static int alsa_sig(uint signo)
 	case FMED_OPEN:
 		if (NULL == (mod = ffmem_tcalloc1(alsa_mod)))
 			return -1;
+		fflk_init(&mod->lk);
 
 		if (NULL == (ain = ffmem_tcalloc1(alsa_mod_in))) {
 			ffmem_free0(mod);
@@ -259,6 +279,9 @@ static int alsa_out_config(ffpars_ctx *ctx)
 	alsa_out_conf.idev = 0;
 	alsa_out_conf.buflen = 500;
 	alsa_out_conf.nfy_rate = 0;
+	alsa_out_conf.mmap = 0;
+	alsa_out_conf.adapt_min = 0;
+	alsa_out_conf.adapt_stable = 10000;
 	ffpars_setargs(ctx, &alsa_out_conf, alsa_out_conf_args, FFCNT(alsa_out_conf_args));
 	return 0;
 }
@@ -278,6 +301,9 @@ static void* alsa_open(fmed_filt *d)
 		return NULL;
 	a->task.handler = d->handler;
 	a->task.param = d->trk;
+	a->tmr.handler = &alsa_ontmr;
+	a->tmr.param = a;
+	fmed_adev_adapt_init(&a->adapt, d, alsa_out_conf.adapt_min, alsa_out_conf.adapt_stable);
 	return a;
 }
 
@@ -286,8 +312,12 @@ static void alsa_close(void *ctx)
 	alsa_out *a = ctx;
 	int r;
 
+	core->timer(&a->tmr, 0, 0);
+
+	fflk_lock(&mod->lk);
 	if (mod->usedby == a) {
 		void *trk = a->task.param;
+		alsa_release(a);
 
 		if (FMED_NULL != mod->track->getval(trk, "stopped")) {
 			ffalsa_close(&mod->out);
@@ -303,8 +333,10 @@ static void alsa_close(void *ctx)
 
 		mod->usedby = NULL;
 	}
+	fflk_unlock(&mod->lk);
 
 	ffalsa_devdestroy(&a->dev);
+	ffarr_free(&a->rest);
 	ffmem_free(a);
 }
 
@@ -433,6 +465,112 @@ static void alsa_onplay(void *udata)
 	a->task.handler(a->task.param);
 }
 
+/** Timer handler runs in the track's worker: the timer is set from there. */
+static void alsa_ontmr(void *udata)
+{
+	alsa_out *a = udata;
+	mod->track->cmd(a->task.param, FMED_TRACK_WAKE);
+}
+
+/** Size of the free space in device buffer, limited by the adaptive fill limit.
+An underrun is detected by the device state:  ffalsa_write() or alsa_commit() recovers the device after that. */
+static size_t alsa_room(alsa_out *a, fmed_filt *d)
+{
+	if (snd_pcm_state(mod->out.pcm) == SND_PCM_STATE_XRUN) {
+		dbglog(core, d->trk, "alsa", "underrun");
+		fmed_adev_adapt_xrun(&a->adapt, d);
+	}
+	return fmed_adev_adapt_update(&a->adapt, d, ffalsa_filled(&mod->out), ffalsa_bufsize(&mod->out)
+		, mod->out.frsize, mod->fmt.sample_rate);
+}
+
+/** Lend the free contiguous region of the device buffer to the converter,
+ so that it writes the next chunk of audio there and we avoid copying the data. */
+static void alsa_lend(alsa_out *a, fmed_filt *d)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t off, frames;
+	snd_pcm_sframes_t avail;
+	int r;
+
+	d->a_dstbuf = NULL;
+	if (!alsa_out_conf.mmap || a->nommap || !mod->fmt.ileaved)
+		return;
+
+	if (0 >= (avail = snd_pcm_avail_update(mod->out.pcm)))
+		return; // buffer is full or needs recovery: use ffalsa_write()
+
+	if (a->adapt.limit != 0) {
+		size_t filled = ffalsa_filled(&mod->out), lim = ffpcm_bytes(&mod->fmt, a->adapt.limit);
+		if (filled >= lim)
+			return;
+		avail = ffmin((size_t)avail, (lim - filled) / mod->out.frsize);
+		if (avail == 0)
+			return;
+	}
+
+	frames = avail;
+	if (0 != (r = snd_pcm_mmap_begin(mod->out.pcm, &areas, &off, &frames))
+		|| areas[0].first != 0 || areas[0].step != mod->out.frsize * 8) {
+		dbglog(core, d->trk, "alsa", "direct buffer access isn't supported: (%d) %s"
+			, r, ffalsa_errstr(r));
+		a->nommap = 1;
+		return;
+	}
+
+	a->dst = (char*)areas[0].addr + off * mod->out.frsize;
+	a->dstoff = off;
+	d->a_dstbuf = a->dst;
+	d->a_dstcap = frames * mod->out.frsize;
+}
+
+/** Commit the audio data the converter has written into the lent region.
+If the device needs recovery (underrun), the data is copied out of the device buffer
+ so that it's written with ffalsa_write() after the device is prepared again.
+Return 0 if the data is committed;  1 if the data must be written with ffalsa_write();  -1 on error. */
+static int alsa_commit(alsa_out *a, fmed_filt *d)
+{
+	snd_pcm_uframes_t n = d->datalen / mod->out.frsize;
+	snd_pcm_sframes_t r = snd_pcm_mmap_commit(mod->out.pcm, a->dstoff, n);
+	a->dst = NULL;
+	if (r >= 0 && (snd_pcm_uframes_t)r == n) {
+		d->datalen = 0;
+		dbglog(core, d->trk, "alsa", "committed %L bytes (%u%% filled)"
+			, n * mod->out.frsize, ffalsa_filled(&mod->out) * 100 / ffalsa_bufsize(&mod->out));
+		return 0;
+	}
+
+	if (r < 0) {
+		warnlog(core, d->trk, "alsa", "snd_pcm_mmap_commit(): (%d) %s", (int)r, ffalsa_errstr((int)r));
+		int e = snd_pcm_recover(mod->out.pcm, (int)r, 1);
+		if (e != 0) {
+			errlog(core, d->trk, "alsa", "snd_pcm_recover(): (%d) %s", e, ffalsa_errstr(e));
+			return -1;
+		}
+		r = 0;
+	}
+
+	// the device buffer may be overwritten by the next write: keep the rest of data in our own buffer
+	size_t done = r * mod->out.frsize;
+	a->rest.len = 0;
+	if (NULL == ffarr_append(&a->rest, (char*)d->data + done, d->datalen - done)) {
+		syserrlog(core, d->trk, "alsa", "%s", ffmem_alloc_S);
+		return -1;
+	}
+	d->data = a->rest.ptr;
+	d->datalen = a->rest.len;
+	return 1;
+}
+
+/** Return the lent region to the device if the converter hasn't used it. */
+static void alsa_release(alsa_out *a)
+{
+	if (a->dst == NULL)
+		return;
+	snd_pcm_mmap_commit(mod->out.pcm, a->dstoff, 0);
+	a->dst = NULL;
+}
+
 static int alsa_write(void *ctx, fmed_filt *d)
 {
 	alsa_out *a = ctx;
@@ -441,26 +579,48 @@ static int alsa_write(void *ctx, fmed_filt *d)
 	switch (a->state) {
 	case I_TRYOPEN:
 	case I_OPEN:
-		if (0 != (r = alsa_create(a, d)))
+		fflk_lock(&mod->lk);
+		r = alsa_create(a, d);
+		fflk_unlock(&mod->lk);
+		if (r != 0)
 			return r;
 		a->state = I_DATA;
+		alsa_lend(a, d);
 		return FMED_RMORE;
 
 	case I_DATA:
 		break;
 	}
 
+	d->a_dstbuf = NULL;
+
 	if (a->stop || (d->flags & FMED_FSTOP)) {
+		alsa_release(a);
 		d->outlen = 0;
 		return FMED_RDONE;
 	}
 
+	if (a->dst != NULL) {
+		// the data is already in the device buffer if the converter has used the lent region
+		if (d->datalen != 0 && d->data == a->dst) {
+			alsa_room(a, d);
+			size_t n = d->datalen;
+			r = alsa_commit(a, d);
+			if (r < 0)
+				goto err;
+			else if (r == 0)
+				a->adapt.written += n;
+		} else
+			alsa_release(a);
+	}
+
 	if (d->snd_output_clear) {
 		d->snd_output_clear = 0;
 		ffalsa_stop(&mod->out);
 		ffalsa_clear(&mod->out);
 		ffalsa_async(&mod->out, 0);
 		a->dataoff = 0;
+		a->adapt.running = 0;
 		return FMED_RMORE;
 	}
 
@@ -468,21 +628,34 @@ static int alsa_write(void *ctx, fmed_filt *d)
 		d->snd_output_pause = 0;
 		d->track->cmd(d->trk, FMED_TRACK_PAUSE);
 		ffalsa_stop(&mod->out);
+		a->adapt.running = 0;
 		return FMED_RASYNC;
 	}
 
 	while (d->datalen != 0) {
 
-		r = ffalsa_write(&mod->out, d->data, d->datalen, a->dataoff);
+		size_t n = alsa_room(a, d);
+		if (n == 0) {
+			a->adapt.running = 1;
+			if (a->adapt.min != 0)
+				core->timer(&a->tmr, -(int)ffmax(a->adapt.limit / 4, 1), 0);
+			else
+				ffalsa_async(&mod->out, 1);
+			return FMED_RASYNC;
+		}
+
+		r = ffalsa_write(&mod->out, d->data, ffmin(d->datalen, n), a->dataoff);
 		if (r < 0) {
 			errlog(core, d->trk, "alsa", "ffalsa_write(): (%d) %s", r, ffalsa_errstr(r));
 			goto err;
 
 		} else if (r == 0) {
+			a->adapt.running = 1;
 			ffalsa_async(&mod->out, 1);
 			return FMED_RASYNC;
 		}
 
+		a->adapt.written += r;
 		a->dataoff += r;
 		d->datalen -= r;
 		dbglog(core, d->trk, "alsa", "written %u bytes (%u%% filled)"
@@ -493,6 +666,7 @@ static int alsa_write(void *ctx, fmed_filt *d)
 
 	if ((d->flags & FMED_FLAST) && d->datalen == 0) {
 
+		a->adapt.running = 0;
 		r = ffalsa_stoplazy(&mod->out);
 		if (r == 1)
 			return FMED_RDONE;
@@ -505,13 +679,16 @@ static int alsa_write(void *ctx, fmed_filt *d)
 		return FMED_RASYNC; //wait until all filled bytes are played
 	}
 
+	alsa_lend(a, d);
 	return FMED_ROK;
 
 err:
+	fflk_lock(&mod->lk);
 	ffalsa_close(&mod->out);
 	ffmem_tzero(&mod->out);
 	mod->out_valid = 0;
 	mod->usedby = NULL;
+	fflk_unlock(&mod->lk);
 	return FMED_RERR;
 }
 
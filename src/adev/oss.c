@@ -11,26 +11,29 @@ static const fmed_core *core;
 typedef struct oss_out oss_out;
 
 typedef struct oss_mod {
-	ffoss_buf out;
-	ffpcm fmt;
-	oss_out *usedby;
+	ffoss_buf *idle; //device of the finished track, kept for the next track with the same format and device
+	ffpcm idle_fmt;
+	uint idle_devidx;
+	fflock lk; //protects 'idle*': tracks may run on different workers
 	const fmed_track *track;
-	uint devidx;
-	uint out_valid :1;
 	uint init_ok :1;
 } oss_mod;
 
 static oss_mod *mod;
 
+/** Each track has its own device handle, so several tracks may play at once. */
 struct oss_out {
 	uint state;
 	size_t dataoff;
 
+	ffoss_buf *out;
+	ffpcm fmt;
 	ffoss_dev dev;
 	uint devidx;
+	fmed_adev_adapt adapt;
+	fftmrq_entry tmr; //wakes the track when there's free space in the buffer
 
 	void *trk;
-	uint stop :1;
 };
 
 enum { I_TRYOPEN, I_OPEN, I_DATA };
@@ -38,6 +41,8 @@ enum { I_TRYOPEN, I_OPEN, I_DATA };
 static struct oss_out_conf_t {
 	uint idev;
 	uint buflen;
+	uint adapt_min;
+	uint adapt_stable;
 } oss_out_conf;
 
 //FMEDIA MODULE
@@ -68,6 +73,8 @@ static const fmed_filter fmed_oss_out = {
 static const ffpars_arg oss_out_conf_args[] = {
 	{ "device_index",	FFPARS_TINT,  FFPARS_DSTOFF(struct oss_out_conf_t, idev) },
 	{ "buffer_length",	FFPARS_TINT,  FFPARS_DSTOFF(struct oss_out_conf_t, buflen) },
+	{ "adaptive_buffer",	FFPARS_TINT,  FFPARS_DSTOFF(struct oss_out_conf_t, adapt_min) },
+	{ "adaptive_stable_time",	FFPARS_TINT | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct oss_out_conf_t, adapt_stable) },
 };
 
 static void oss_onplay(void *udata);
@@ -115,6 +122,7 @@ static int oss_sig(uint signo)
 	case FMED_OPEN:
 		if (NULL == (mod = ffmem_new(oss_mod)))
 			return -1;
+		fflk_init(&mod->lk);
 
 		mod->track = core->getmod("#core.track");
 		return 0;
@@ -122,11 +130,17 @@ static int oss_sig(uint signo)
 	return 0;
 }
 
+static void oss_buf_free(ffoss_buf *out)
+{
+	ffoss_close(out);
+	ffmem_free(out);
+}
+
 static void oss_destroy(void)
 {
 	if (mod != NULL) {
-		if (mod->out_valid)
-			ffoss_close(&mod->out);
+		if (mod->idle != NULL)
+			oss_buf_free(mod->idle);
 		ffmem_free(mod);
 		mod = NULL;
 	}
@@ -210,6 +224,8 @@ static int oss_out_config(ffpars_ctx *ctx)
 {
 	oss_out_conf.idev = 0;
 	oss_out_conf.buflen = 500;
+	oss_out_conf.adapt_min = 0;
+	oss_out_conf.adapt_stable = 10000;
 	ffpars_setargs(ctx, &oss_out_conf, oss_out_conf_args, FFCNT(oss_out_conf_args));
 	return 0;
 }
@@ -224,6 +240,9 @@ static void* oss_open(fmed_filt *d)
 	if (NULL == (o = ffmem_new(oss_out)))
 		return NULL;
 	o->trk = d->trk;
+	o->tmr.handler = &oss_onplay;
+	o->tmr.param = o;
+	fmed_adev_adapt_init(&o->adapt, d, oss_out_conf.adapt_min, oss_out_conf.adapt_stable);
 	return o;
 }
 
@@ -232,21 +251,29 @@ static void oss_close(void *ctx)
 	oss_out *o = ctx;
 	int r;
 
-	if (mod->usedby == o) {
-		void *trk = o->trk;
+	core->timer(&o->tmr, 0, 0);
 
-		if (FMED_NULL != mod->track->getval(trk, "stopped")) {
-			ffoss_close(&mod->out);
-			ffmem_tzero(&mod->out);
-			mod->out_valid = 0;
+	if (o->out != NULL) {
+		void *trk = o->trk;
 
-		} else {
-			if (0 != (r = ffoss_stop(&mod->out)))
+		fflk_lock(&mod->lk);
+		if (FMED_NULL == mod->track->getval(trk, "stopped")
+			&& mod->idle == NULL) {
+			// the next track in the list will probably use the same format: keep the device open
+			if (0 != (r = ffoss_stop(o->out)))
 				errlog(core, trk,  "oss", "ffoss_stop(): (%d) %s", r, ffoss_errstr(r));
-			ffoss_clear(&mod->out);
+			ffoss_clear(o->out);
+			mod->idle = o->out;
+			mod->idle_fmt = o->fmt;
+			mod->idle_devidx = o->devidx;
+			o->out = NULL;
 		}
+		fflk_unlock(&mod->lk);
 
-		mod->usedby = NULL;
+		if (o->out != NULL) {
+			oss_buf_free(o->out);
+			o->out = NULL;
+		}
 	}
 
 	ffoss_devdestroy(&o->dev);
@@ -276,29 +303,25 @@ static int oss_create(oss_out *o, fmed_filt *d)
 
 	ffpcm_fmtcopy(&fmt, &d->audio.convfmt);
 
-	if (mod->out_valid) {
+	fflk_lock(&mod->lk);
+	ffoss_buf *out = mod->idle;
+	ffpcm idle_fmt = mod->idle_fmt;
+	uint idle_devidx = mod->idle_devidx;
+	mod->idle = NULL;
+	fflk_unlock(&mod->lk);
 
-		if (mod->usedby != NULL) {
-			oss_out *o = mod->usedby;
-			mod->usedby = NULL;
-			o->stop = 1;
-			oss_onplay(o);
-		}
-
-		if (fmt.channels == mod->fmt.channels
-			&& fmt.format == mod->fmt.format
-			&& fmt.sample_rate == mod->fmt.sample_rate
-			&& mod->devidx == o->devidx) {
+	if (out != NULL) {
+		if (fmt.channels == idle_fmt.channels
+			&& fmt.format == idle_fmt.format
+			&& fmt.sample_rate == idle_fmt.sample_rate
+			&& idle_devidx == o->devidx) {
 
-			ffoss_stop(&mod->out);
-			ffoss_clear(&mod->out);
+			o->out = out;
 			reused = 1;
 			goto fin;
 		}
 
-		ffoss_close(&mod->out);
-		ffmem_tzero(&mod->out);
-		mod->out_valid = 0;
+		oss_buf_free(out);
 	}
 
 	if (0 != oss_devbyidx(&o->dev, o->devidx, FFOSS_DEV_PLAYBACK)) {
@@ -306,8 +329,10 @@ static int oss_create(oss_out *o, fmed_filt *d)
 		goto done;
 	}
 
+	if (NULL == (o->out = ffmem_new(ffoss_buf)))
+		goto done;
 	in_fmt = fmt;
-	r = ffoss_open(&mod->out, o->dev.id, &fmt, oss_out_conf.buflen, FFOSS_DEV_PLAYBACK);
+	r = ffoss_open(o->out, o->dev.id, &fmt, oss_out_conf.buflen, FFOSS_DEV_PLAYBACK);
 
 	if (r == -FFOSS_EFMT && o->state == I_TRYOPEN) {
 
@@ -322,6 +347,8 @@ static int oss_create(oss_out *o, fmed_filt *d)
 			if (fmt.channels != in_fmt.channels)
 				d->audio.convfmt.channels = fmt.channels;
 
+			ffmem_free0(o->out);
+			ffoss_devdestroy(&o->dev);
 			o->state = I_OPEN;
 			return FMED_RMORE;
 		}
@@ -329,18 +356,16 @@ static int oss_create(oss_out *o, fmed_filt *d)
 
 	if (r != 0) {
 		errlog(core, d->trk, "oss", "ffoss_open(): (%d) %s", r, ffoss_errstr(r));
+		ffmem_free0(o->out);
 		goto done;
 	}
 
 	ffoss_devdestroy(&o->dev);
-	mod->out_valid = 1;
-	mod->fmt = fmt;
-	mod->devidx = o->devidx;
 
 fin:
-	mod->usedby = o;
+	o->fmt = fmt;
 	dbglog(core, d->trk, "oss", "%s buffer %ums, %uHz"
-		, reused ? "reused" : "opened", ffpcm_bytes2time(&fmt, ffoss_bufsize(&mod->out))
+		, reused ? "reused" : "opened", ffpcm_bytes2time(&fmt, ffoss_bufsize(o->out))
 		, fmt.sample_rate);
 	return 0;
 
@@ -354,6 +379,20 @@ static void oss_onplay(void *udata)
 	mod->track->cmd(o->trk, FMED_TRACK_WAKE);
 }
 
+/** OSS doesn't notify about free buffer space: check again after a quarter of the buffer is played.
+The timer is stopped in oss_close(), which runs on the same worker.
+Return 0 on success. */
+static int oss_wait(oss_out *o)
+{
+	uint msec = (o->adapt.min != 0) ? o->adapt.limit : ffpcm_bytes2time(&o->fmt, ffoss_bufsize(o->out));
+	msec /= 4;
+	if (0 != core->timer(&o->tmr, -(int)ffmax(msec, 1), 0)) {
+		errlog(core, o->trk, "oss", "can't start timer");
+		return -1;
+	}
+	return 0;
+}
+
 static int oss_write(void *ctx, fmed_filt *d)
 {
 	oss_out *o = ctx;
@@ -372,41 +411,60 @@ static int oss_write(void *ctx, fmed_filt *d)
 		break;
 	}
 
-	if (o->stop || (d->flags & FMED_FSTOP)) {
+	if (d->flags & FMED_FSTOP) {
 		d->outlen = 0;
 		return FMED_RDONE;
 	}
 
 	if (d->snd_output_clear) {
 		d->snd_output_clear = 0;
-		ffoss_stop(&mod->out);
-		ffoss_clear(&mod->out);
+		ffoss_stop(o->out);
+		ffoss_clear(o->out);
 		o->dataoff = 0;
+		o->adapt.running = 0;
 		return FMED_RMORE;
 	}
 
 	while (d->datalen != 0) {
 
-		r = ffoss_write(&mod->out, d->data, d->datalen, o->dataoff);
+		// OSS doesn't report underruns: the buffer was full, and now it's empty
+		if (o->adapt.running && ffoss_filled(o->out) == 0)
+			fmed_adev_adapt_xrun(&o->adapt, d);
+
+		size_t n = fmed_adev_adapt_update(&o->adapt, d, ffoss_filled(o->out), ffoss_bufsize(o->out)
+			, ffpcm_size1(&o->fmt), o->fmt.sample_rate);
+		if (n == 0) {
+			o->adapt.running = 1;
+			if (0 != oss_wait(o))
+				goto err;
+			return FMED_RASYNC;
+		}
+
+		r = ffoss_write(o->out, d->data, ffmin(d->datalen, n), o->dataoff);
 		if (r < 0) {
 			errlog(core, d->trk, "oss", "ffoss_write(): (%d) %s", r, ffoss_errstr(r));
 			goto err;
 
 		} else if (r == 0) {
+			o->adapt.running = 1;
+			if (0 != oss_wait(o))
+				goto err;
 			return FMED_RASYNC;
 		}
 
+		o->adapt.written += r;
 		o->dataoff += r;
 		d->datalen -= r;
 		dbglog(core, d->trk, "oss", "written %u bytes (%u%% filled)"
-			, r, ffoss_filled(&mod->out) * 100 / ffoss_bufsize(&mod->out));
+			, r, ffoss_filled(o->out) * 100 / ffoss_bufsize(o->out));
 	}
 
 	o->dataoff = 0;
 
 	if ((d->flags & FMED_FLAST) && d->datalen == 0) {
 
-		r = ffoss_drain(&mod->out);
+		o->adapt.running = 0;
+		r = ffoss_drain(o->out);
 		if (r == 1)
 			return FMED_RDONE;
 		else if (r < 0) {
@@ -414,15 +472,15 @@ static int oss_write(void *ctx, fmed_filt *d)
 			goto err;
 		}
 
+		if (0 != oss_wait(o))
+			goto err;
 		return FMED_RASYNC; //wait until all filled bytes are played
 	}
 
 	return FMED_ROK;
 
 err:
-	ffoss_close(&mod->out);
-	ffmem_tzero(&mod->out);
-	mod->out_valid = 0;
-	mod->usedby = NULL;
+	oss_buf_free(o->out);
+	o->out = NULL;
 	return FMED_RERR;
 }
@@ -1,9 +1,10 @@
-/** Pulse output.
+/** Pulse input/output.
 Copyright (c) 2017 Simon Zolin */
 
 #include <fmedia.h>
 
 #include <FF/adev/pulse.h>
+#include <pulse/pulseaudio.h>
 
 
 static const fmed_core *core;
@@ -11,26 +12,38 @@ static const fmed_core *core;
 typedef struct pulse_out pulse_out;
 
 typedef struct pulse_mod {
-	ffpulse_buf out;
-	ffpcm fmt;
-	pulse_out *usedby;
+	ffpulse_buf *idle; //stream of the finished track, kept for the next track with the same format and device
+	ffpcm idle_fmt;
+	uint idle_devidx;
+	fflock lk; //protects 'idle*': tracks may run on different workers
 	const fmed_track *track;
-	uint devidx;
-	uint out_valid :1;
 	uint init_ok :1;
 } pulse_mod;
 
 static pulse_mod *mod;
 
+/** Output stream.
+FF calls the handler with 'udata' that points to this object for the whole life of the stream,
+ so the handler never gets a track context that is already freed. */
+struct pulse_stm {
+	ffpulse_buf buf; //must be the first
+	pulse_out *owner; //NULL: the stream is idle.  Protected by pulse_mod.lk.
+};
+
+/** Each track has its own output stream, so several tracks may play at once. */
 struct pulse_out {
 	uint state;
 	size_t dataoff;
 
+	ffpulse_buf *out;
+	ffpcm fmt;
 	ffpulse_dev dev;
 	uint devidx;
 
+	fmed_adev_adapt adapt;
+	fftmrq_entry tmr; //wakes the track when the buffer fill level drops below the adaptive limit
+
 	void *trk;
-	uint stop :1;
 };
 
 enum { I_OPEN, I_DATA };
@@ -39,6 +52,8 @@ static struct pulse_out_conf_t {
 	uint idev;
 	uint buflen;
 	uint nfy_rate;
+	uint adapt_min;
+	uint adapt_stable;
 } pulse_out_conf;
 
 //FMEDIA MODULE
@@ -70,9 +85,55 @@ static const ffpars_arg pulse_out_conf_args[] = {
 	{ "device_index",	FFPARS_TINT,  FFPARS_DSTOFF(struct pulse_out_conf_t, idev) },
 	{ "buffer_length",	FFPARS_TINT | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct pulse_out_conf_t, buflen) },
 	{ "notify_rate",	FFPARS_TINT,  FFPARS_DSTOFF(struct pulse_out_conf_t, nfy_rate) },
+	{ "adaptive_buffer",	FFPARS_TINT,  FFPARS_DSTOFF(struct pulse_out_conf_t, adapt_min) },
+	{ "adaptive_stable_time",	FFPARS_TINT | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct pulse_out_conf_t, adapt_stable) },
 };
 
 static void pulse_onplay(void *udata);
+static void pulse_ontmr(void *udata);
+
+//INPUT
+static void* pulse_in_open(fmed_filt *d);
+static int pulse_in_read(void *ctx, fmed_filt *d);
+static void pulse_in_close(void *ctx);
+static int pulse_in_config(ffpars_ctx *ctx);
+static const fmed_filter fmed_pulse_in = {
+	&pulse_in_open, &pulse_in_read, &pulse_in_close
+};
+
+/** Capture stream with its own threaded main loop.
+The stream callbacks run in the main loop's thread: they only wake up the track. */
+typedef struct pulse_in {
+	pa_threaded_mainloop *ml;
+	pa_context *ctx;
+	pa_stream *stm;
+	void *trk;
+	uint frsize;
+	uint64 total_samps;
+
+	uint64 lat_max; //usec
+	uint overruns; //set by the overflow callback
+	uint overruns_shown;
+	uint64 lost; //bytes
+
+	uint peeked :1 //pa_stream_drop() is needed before the next read
+		, want_read :1
+		, ctx_failed :1;
+} pulse_in;
+
+static struct pulse_in_conf_t {
+	uint idev;
+	uint buflen;
+	uint fragment;
+	byte low_latency;
+} pulse_in_conf;
+
+static const ffpars_arg pulse_in_conf_args[] = {
+	{ "device_index",	FFPARS_TINT,  FFPARS_DSTOFF(struct pulse_in_conf_t, idev) },
+	{ "buffer_length",	FFPARS_TINT | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct pulse_in_conf_t, buflen) },
+	{ "fragment",	FFPARS_TINT | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct pulse_in_conf_t, fragment) },
+	{ "low_latency",	FFPARS_TBOOL8,  FFPARS_DSTOFF(struct pulse_in_conf_t, low_latency) },
+};
 
 //ADEV
 static int pulse_adev_list(fmed_adev_ent **ents, uint flags);
@@ -94,6 +155,8 @@ static const void* pulse_iface(const char *name)
 {
 	if (!ffsz_cmp(name, "out")) {
 		return &fmed_pulse_out;
+	} else if (!ffsz_cmp(name, "in")) {
+		return &fmed_pulse_in;
 	} else if (!ffsz_cmp(name, "adev")) {
 		return &fmed_pulse_adev;
 	}
@@ -104,6 +167,8 @@ static int pulse_conf(const char *name, ffpars_ctx *ctx)
 {
 	if (!ffsz_cmp(name, "out"))
 		return pulse_out_config(ctx);
+	else if (!ffsz_cmp(name, "in"))
+		return pulse_in_config(ctx);
 	return -1;
 }
 
@@ -117,6 +182,7 @@ static int pulse_sig(uint signo)
 	case FMED_OPEN:
 		if (NULL == (mod = ffmem_new(pulse_mod)))
 			return -1;
+		fflk_init(&mod->lk);
 
 		mod->track = core->getmod("#core.track");
 		return 0;
@@ -124,11 +190,17 @@ static int pulse_sig(uint signo)
 	return 0;
 }
 
+static void pulse_buf_free(ffpulse_buf *out)
+{
+	ffpulse_close(out);
+	ffmem_free(out);
+}
+
 static void pulse_destroy(void)
 {
 	if (mod != NULL) {
-		if (mod->out_valid)
-			ffpulse_close(&mod->out);
+		if (mod->idle != NULL)
+			pulse_buf_free(mod->idle);
 		ffmem_free(mod);
 		mod = NULL;
 	}
@@ -213,6 +285,8 @@ static int pulse_out_config(ffpars_ctx *ctx)
 	pulse_out_conf.idev = 0;
 	pulse_out_conf.buflen = 500;
 	pulse_out_conf.nfy_rate = 0;
+	pulse_out_conf.adapt_min = 0;
+	pulse_out_conf.adapt_stable = 10000;
 	ffpars_setargs(ctx, &pulse_out_conf, pulse_out_conf_args, FFCNT(pulse_out_conf_args));
 	return 0;
 }
@@ -227,6 +301,9 @@ static void* pulse_open(fmed_filt *d)
 	if (NULL == (a = ffmem_new(pulse_out)))
 		return NULL;
 	a->trk = d->trk;
+	a->tmr.handler = &pulse_ontmr;
+	a->tmr.param = a;
+	fmed_adev_adapt_init(&a->adapt, d, pulse_out_conf.adapt_min, pulse_out_conf.adapt_stable);
 	return a;
 }
 
@@ -235,22 +312,38 @@ static void pulse_close(void *ctx)
 	pulse_out *a = ctx;
 	int r;
 
-	if (mod->usedby == a) {
+	core->timer(&a->tmr, 0, 0);
+
+	if (a->out != NULL) {
 		void *trk = a->trk;
 
-		if (FMED_NULL != mod->track->getval(trk, "stopped")) {
-			ffpulse_close(&mod->out);
-			ffmem_tzero(&mod->out);
-			mod->out_valid = 0;
+		// the handler won't wake this track anymore: 'a' can be freed
+		fflk_lock(&mod->lk);
+		((struct pulse_stm*)a->out)->owner = NULL;
+		fflk_unlock(&mod->lk);
 
-		} else {
-			if (0 != (r = ffpulse_stop(&mod->out)))
+		if (FMED_NULL == mod->track->getval(trk, "stopped")) {
+			// the next track in the list will probably use the same format: keep the stream
+			// (FF's calls are made without our lock: FF may call the handler while holding its own lock)
+			if (0 != (r = ffpulse_stop(a->out)))
 				errlog(core, trk,  "pulse", "ffpulse_stop(): (%d) %s", r, ffpulse_errstr(r));
-			ffpulse_clear(&mod->out);
-			ffpulse_async(&mod->out, 0);
+			ffpulse_clear(a->out);
+			ffpulse_async(a->out, 0);
+
+			fflk_lock(&mod->lk);
+			if (mod->idle == NULL) {
+				mod->idle = a->out;
+				mod->idle_fmt = a->fmt;
+				mod->idle_devidx = a->devidx;
+				a->out = NULL;
+			}
+			fflk_unlock(&mod->lk);
 		}
 
-		mod->usedby = NULL;
+		if (a->out != NULL) {
+			pulse_buf_free(a->out);
+			a->out = NULL;
+		}
 	}
 
 	ffpulse_devdestroy(&a->dev);
@@ -280,30 +373,25 @@ static int pulse_create(pulse_out *a, fmed_filt *d)
 
 	ffpcm_fmtcopy(&fmt, &d->audio.convfmt);
 
-	if (mod->out_valid) {
-
-		if (mod->usedby != NULL) {
-			pulse_out *a = mod->usedby;
-			mod->usedby = NULL;
-			a->stop = 1;
-			pulse_onplay(a);
-		}
+	fflk_lock(&mod->lk);
+	ffpulse_buf *out = mod->idle;
+	ffpcm idle_fmt = mod->idle_fmt;
+	uint idle_devidx = mod->idle_devidx;
+	mod->idle = NULL;
+	fflk_unlock(&mod->lk);
 
-		if (fmt.channels == mod->fmt.channels
-			&& fmt.format == mod->fmt.format
-			&& fmt.sample_rate == mod->fmt.sample_rate
-			&& mod->devidx == a->devidx) {
+	if (out != NULL) {
+		if (fmt.channels == idle_fmt.channels
+			&& fmt.format == idle_fmt.format
+			&& fmt.sample_rate == idle_fmt.sample_rate
+			&& idle_devidx == a->devidx) {
 
-			ffpulse_stop(&mod->out);
-			ffpulse_clear(&mod->out);
-			ffpulse_async(&mod->out, 0);
+			a->out = out;
 			reused = 1;
 			goto fin;
 		}
 
-		ffpulse_close(&mod->out);
-		ffmem_tzero(&mod->out);
-		mod->out_valid = 0;
+		pulse_buf_free(out);
 	}
 
 	if (0 != pulse_devbyidx(&a->dev, a->devidx, FFPULSE_DEV_PLAYBACK)) {
@@ -311,27 +399,32 @@ static int pulse_create(pulse_out *a, fmed_filt *d)
 		goto done;
 	}
 
-	mod->out.handler = &pulse_onplay;
-	mod->out.autostart = 1;
+	struct pulse_stm *stm;
+	if (NULL == (stm = ffmem_new(struct pulse_stm)))
+		goto done;
+	a->out = &stm->buf;
+	a->out->handler = &pulse_onplay;
+	a->out->udata = stm;
+	a->out->autostart = 1;
 	if (pulse_out_conf.nfy_rate != 0)
-		mod->out.nfy_interval = ffpcm_bytes2time(&fmt, pulse_out_conf.buflen) / pulse_out_conf.nfy_rate;
-	r = ffpulse_open(&mod->out, a->dev.id, &fmt, pulse_out_conf.buflen);
+		a->out->nfy_interval = ffpcm_bytes2time(&fmt, pulse_out_conf.buflen) / pulse_out_conf.nfy_rate;
+	r = ffpulse_open(a->out, a->dev.id, &fmt, pulse_out_conf.buflen);
 
 	if (r != 0) {
 		errlog(core, d->trk, "pulse", "ffpulse_open(): (%d) %s", r, ffpulse_errstr(r));
+		ffmem_free0(a->out);
 		goto done;
 	}
 
 	ffpulse_devdestroy(&a->dev);
-	mod->out_valid = 1;
-	mod->fmt = fmt;
-	mod->devidx = a->devidx;
 
 fin:
-	mod->out.udata = a;
-	mod->usedby = a;
+	fflk_lock(&mod->lk);
+	((struct pulse_stm*)a->out)->owner = a;
+	fflk_unlock(&mod->lk);
+	a->fmt = fmt;
 	dbglog(core, d->trk, "pulse", "%s buffer %ums, %uHz"
-		, reused ? "reused" : "opened", ffpcm_bytes2time(&fmt, ffpulse_bufsize(&mod->out))
+		, reused ? "reused" : "opened", ffpcm_bytes2time(&fmt, ffpulse_bufsize(a->out))
 		, fmt.sample_rate);
 	return 0;
 
@@ -339,7 +432,18 @@ done:
 	return FMED_RERR;
 }
 
+/** FF's handler: wake the track that owns the stream.  Thread: any. */
 static void pulse_onplay(void *udata)
+{
+	struct pulse_stm *stm = udata;
+	fflk_lock(&mod->lk);
+	if (stm->owner != NULL) //otherwise, the stream is idle
+		mod->track->cmd(stm->owner->trk, FMED_TRACK_WAKE);
+	fflk_unlock(&mod->lk);
+}
+
+/** Timer handler runs in the track's worker: the timer is set from there. */
+static void pulse_ontmr(void *udata)
 {
 	pulse_out *a = udata;
 	mod->track->cmd(a->trk, FMED_TRACK_WAKE);
@@ -362,51 +466,75 @@ static int pulse_write(void *ctx, fmed_filt *d)
 		break;
 	}
 
-	if (a->stop || (d->flags & FMED_FSTOP)) {
+	if (d->flags & FMED_FSTOP) {
 		d->outlen = 0;
 		return FMED_RDONE;
 	}
 
 	if (d->snd_output_clear) {
 		d->snd_output_clear = 0;
-		ffpulse_stop(&mod->out);
-		ffpulse_clear(&mod->out);
-		ffpulse_async(&mod->out, 0);
+		ffpulse_stop(a->out);
+		ffpulse_clear(a->out);
+		ffpulse_async(a->out, 0);
 		a->dataoff = 0;
+		a->adapt.running = 0;
 		return FMED_RMORE;
 	}
 
 	if (d->snd_output_pause) {
 		d->snd_output_pause = 0;
 		d->track->cmd(d->trk, FMED_TRACK_PAUSE);
-		ffpulse_stop(&mod->out);
-		ffpulse_async(&mod->out, 0);
+		ffpulse_stop(a->out);
+		ffpulse_async(a->out, 0);
+		a->adapt.running = 0;
 		return FMED_RMORE;
 	}
 
 	while (d->datalen != 0) {
 
-		r = ffpulse_write(&mod->out, d->data, d->datalen, a->dataoff);
+		/* The stream's main loop is owned by FF and its lock isn't available here,
+		 so we can't install a stream callback safely:
+		 an underrun is detected when the buffer was full, and now it's empty. */
+		if (a->adapt.running && ffpulse_filled(a->out) == 0) {
+			dbglog(core, d->trk, "pulse", "underrun");
+			fmed_adev_adapt_xrun(&a->adapt, d);
+		}
+
+		size_t n = fmed_adev_adapt_update(&a->adapt, d, ffpulse_filled(a->out), ffpulse_bufsize(a->out)
+			, ffpcm_size1(&a->fmt), a->fmt.sample_rate);
+		if (n == 0) {
+			a->adapt.running = 1;
+			if (a->adapt.min != 0)
+				core->timer(&a->tmr, -(int)ffmax(a->adapt.limit / 4, 1), 0);
+			else
+				ffpulse_async(a->out, 1);
+			return FMED_RASYNC;
+		}
+
+		r = ffpulse_write(a->out, d->data, ffmin(d->datalen, n), a->dataoff);
 		if (r < 0) {
 			errlog(core, d->trk, "pulse", "ffpulse_write(): (%d) %s", r, ffpulse_errstr(r));
 			goto err;
 
 		} else if (r == 0) {
-			ffpulse_async(&mod->out, 1);
+			a->adapt.running = 1;
+			ffpulse_async(a->out, 1);
 			return FMED_RASYNC;
 		}
 
+		a->adapt.written += r;
 		a->dataoff += r;
 		d->datalen -= r;
 		dbglog(core, d->trk, "pulse", "written %u bytes (%u%% filled)"
-			, r, ffpulse_filled(&mod->out) * 100 / ffpulse_bufsize(&mod->out));
+			, r, ffpulse_filled(a->out) * 100 / ffpulse_bufsize(a->out));
 	}
 
 	a->dataoff = 0;
 
 	if ((d->flags & FMED_FLAST) && d->datalen == 0) {
 
-		r = ffpulse_drain(&mod->out);
+		a->adapt.running = 0;
+		r = ffpulse_drain(a->out);
 		if (r == 1)
 			return FMED_RDONE;
 		else if (r < 0) {
@@ -414,16 +542,311 @@ static int pulse_write(void *ctx, fmed_filt *d)
 			goto err;
 		}
 
-		ffpulse_async(&mod->out, 1);
+		ffpulse_async(a->out, 1);
 		return FMED_RASYNC; //wait until all filled bytes are played
 	}
 
 	return FMED_ROK;
 
 err:
-	ffpulse_close(&mod->out);
-	ffmem_tzero(&mod->out);
-	mod->out_valid = 0;
-	mod->usedby = NULL;
+	pulse_buf_free(a->out);
+	a->out = NULL;
 	return FMED_RERR;
 }
+
+
+static int pulse_in_config(ffpars_ctx *ctx)
+{
+	pulse_in_conf.idev = 0;
+	pulse_in_conf.buflen = 500;
+	pulse_in_conf.fragment = 20;
+	pulse_in_conf.low_latency = 1;
+	ffpars_setargs(ctx, &pulse_in_conf, pulse_in_conf_args, FFCNT(pulse_in_conf_args));
+	return 0;
+}
+
+static void pulse_in_onstate(pa_context *c, void *udata)
+{
+	pulse_in *a = udata;
+	switch (pa_context_get_state(c)) {
+	case PA_CONTEXT_READY:
+		break;
+	case PA_CONTEXT_FAILED:
+	case PA_CONTEXT_TERMINATED:
+		a->ctx_failed = 1;
+		break;
+	default:
+		return;
+	}
+	pa_threaded_mainloop_signal(a->ml, 0);
+}
+
+static void pulse_in_onstmstate(pa_stream *s, void *udata)
+{
+	pulse_in *a = udata;
+	switch (pa_stream_get_state(s)) {
+	case PA_STREAM_READY:
+	case PA_STREAM_FAILED:
+	case PA_STREAM_TERMINATED:
+		pa_threaded_mainloop_signal(a->ml, 0);
+		if (a->want_read) {
+			a->want_read = 0;
+			mod->track->cmd(a->trk, FMED_TRACK_WAKE);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void pulse_in_oncapt(pa_stream *s, size_t nbytes, void *udata)
+{
+	pulse_in *a = udata;
+	if (a->want_read) {
+		a->want_read = 0;
+		mod->track->cmd(a->trk, FMED_TRACK_WAKE);
+	}
+}
+
+/** The server has dropped captured data because the client buffer is full. */
+static void pulse_in_onoverflow(pa_stream *s, void *udata)
+{
+	pulse_in *a = udata;
+	a->overruns++;
+}
+
+static const byte pulse_fmts[] = {
+	FFPCM_16, FFPCM_24, FFPCM_32, FFPCM_FLOAT,
+};
+static const byte pulse_pafmts[] = {
+	PA_SAMPLE_S16LE, PA_SAMPLE_S24LE, PA_SAMPLE_S32LE, PA_SAMPLE_FLOAT32LE,
+};
+
+static void* pulse_in_open(fmed_filt *d)
+{
+	pulse_in *a;
+	ffpulse_dev dev;
+	pa_sample_spec spec;
+	pa_buffer_attr attr;
+	int idx, r;
+
+	if (NULL == (a = ffmem_new(pulse_in)))
+		return NULL;
+	a->trk = d->trk;
+
+	if (FMED_NULL == (idx = (int)d->track->getval(d->trk, "capture_device")))
+		idx = pulse_in_conf.idev;
+	if (0 != pulse_devbyidx(&dev, idx, FFPULSE_DEV_CAPTURE)) {
+		errlog(core, d->trk, "pulse", "no audio device by index #%u", idx);
+		ffmem_free(a);
+		return NULL;
+	}
+
+	// the server converts the data to any format, but the filters support only these
+	int i;
+	for (i = 0;  i != FFCNT(pulse_fmts);  i++) {
+		if (pulse_fmts[i] == d->audio.fmt.format)
+			break;
+	}
+	if (i == FFCNT(pulse_fmts)) {
+		if (d->audio.convfmt.format == 0)
+			d->audio.convfmt.format = d->audio.fmt.format;
+		d->audio.fmt.format = FFPCM_16;
+		i = 0;
+	}
+	d->audio.fmt.ileaved = 1;
+	spec.format = pulse_pafmts[i];
+	spec.rate = d->audio.fmt.sample_rate;
+	spec.channels = d->audio.fmt.channels;
+	a->frsize = ffpcm_size(d->audio.fmt.format, d->audio.fmt.channels);
+
+	if (NULL == (a->ml = pa_threaded_mainloop_new())
+		|| NULL == (a->ctx = pa_context_new(pa_threaded_mainloop_get_api(a->ml), "fmedia"))) {
+		errlog(core, d->trk, "pulse", "pa_context_new()", 0);
+		goto fail;
+	}
+	pa_context_set_state_callback(a->ctx, &pulse_in_onstate, a);
+	if (0 != pa_context_connect(a->ctx, NULL, 0, NULL)
+		|| 0 != pa_threaded_mainloop_start(a->ml)) {
+		errlog(core, d->trk, "pulse", "pa_context_connect(): %s", pa_strerror(pa_context_errno(a->ctx)));
+		goto fail;
+	}
+
+	pa_threaded_mainloop_lock(a->ml);
+
+	while (pa_context_get_state(a->ctx) != PA_CONTEXT_READY && !a->ctx_failed)
+		pa_threaded_mainloop_wait(a->ml);
+	if (a->ctx_failed) {
+		errlog(core, d->trk, "pulse", "pa_context_connect(): %s", pa_strerror(pa_context_errno(a->ctx)));
+		goto fail_locked;
+	}
+
+	if (NULL == (a->stm = pa_stream_new(a->ctx, "fmedia", &spec, NULL))) {
+		errlog(core, d->trk, "pulse", "pa_stream_new(): %s", pa_strerror(pa_context_errno(a->ctx)));
+		goto fail_locked;
+	}
+	pa_stream_set_state_callback(a->stm, &pulse_in_onstmstate, a);
+	pa_stream_set_read_callback(a->stm, &pulse_in_oncapt, a);
+	pa_stream_set_overflow_callback(a->stm, &pulse_in_onoverflow, a);
+
+	/* The server sends the data in blocks of 'fragsize' bytes.
+	With PA_STREAM_ADJUST_LATENCY it also configures the source latency to this value,
+	 so the fragment size is the capture latency. */
+	attr.maxlength = pa_usec_to_bytes((uint64)pulse_in_conf.buflen * 1000, &spec);
+	attr.fragsize = pa_usec_to_bytes((uint64)pulse_in_conf.fragment * 1000, &spec);
+	attr.tlength = attr.prebuf = attr.minreq = (uint)-1;
+	uint flags = PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE;
+	if (pulse_in_conf.low_latency)
+		flags |= PA_STREAM_ADJUST_LATENCY;
+	if (0 != pa_stream_connect_record(a->stm, dev.id, &attr, flags)) {
+		errlog(core, d->trk, "pulse", "pa_stream_connect_record(): %s", pa_strerror(pa_context_errno(a->ctx)));
+		goto fail_locked;
+	}
+
+	for (;;) {
+		r = pa_stream_get_state(a->stm);
+		if (r == PA_STREAM_READY)
+			break;
+		else if (r == PA_STREAM_FAILED || r == PA_STREAM_TERMINATED) {
+			errlog(core, d->trk, "pulse", "pa_stream_connect_record(): %s", pa_strerror(pa_context_errno(a->ctx)));
+			goto fail_locked;
+		}
+		pa_threaded_mainloop_wait(a->ml);
+	}
+
+	const pa_buffer_attr *ba = pa_stream_get_buffer_attr(a->stm);
+	dbglog(core, d->trk, "pulse", "opened capture buffer %ums, fragment %ums, %uHz"
+		, (uint)(pa_bytes_to_usec(ba->maxlength, &spec) / 1000)
+		, (uint)(pa_bytes_to_usec(ba->fragsize, &spec) / 1000)
+		, spec.rate);
+	pa_threaded_mainloop_unlock(a->ml);
+
+	ffpulse_devdestroy(&dev);
+	d->datatype = "pcm";
+	return a;
+
+fail_locked:
+	pa_threaded_mainloop_unlock(a->ml);
+fail:
+	ffpulse_devdestroy(&dev);
+	pulse_in_close(a);
+	return NULL;
+}
+
+static void pulse_in_close(void *ctx)
+{
+	pulse_in *a = ctx;
+
+	if (a->ml != NULL)
+		pa_threaded_mainloop_lock(a->ml);
+	if (a->stm != NULL) {
+		// the track is being closed: no more wake-ups
+		pa_stream_set_state_callback(a->stm, NULL, NULL);
+		pa_stream_set_read_callback(a->stm, NULL, NULL);
+		pa_stream_set_overflow_callback(a->stm, NULL, NULL);
+		if (a->peeked)
+			pa_stream_drop(a->stm);
+		pa_stream_disconnect(a->stm);
+		pa_stream_unref(a->stm);
+	}
+	if (a->ctx != NULL) {
+		pa_context_set_state_callback(a->ctx, NULL, NULL);
+		pa_context_disconnect(a->ctx);
+		pa_context_unref(a->ctx);
+	}
+	if (a->ml != NULL) {
+		pa_threaded_mainloop_unlock(a->ml);
+		pa_threaded_mainloop_stop(a->ml);
+		pa_threaded_mainloop_free(a->ml);
+	}
+
+	dbglog(core, a->trk, "pulse", "max. latency:%Uus  overruns:%u  lost:%U bytes"
+		, a->lat_max, a->overruns, a->lost);
+	ffmem_free(a);
+}
+
+/** Update latency and overrun counters and expose them as track properties:
+ "capture_latency", "capture_latency_max" (usec), "capture_overruns". */
+static void pulse_in_stat(pulse_in *a, fmed_filt *d)
+{
+	pa_usec_t lat;
+	int neg;
+
+	if (a->overruns != a->overruns_shown) {
+		a->overruns_shown = a->overruns;
+		d->track->setval(d->trk, "capture_overruns", a->overruns);
+		warnlog(core, d->trk, "pulse", "capture overrun #%u", a->overruns);
+	}
+
+	if (0 == pa_stream_get_latency(a->stm, &lat, &neg) && !neg) {
+		d->track->setval(d->trk, "capture_latency", lat);
+		if (lat > a->lat_max) {
+			a->lat_max = lat;
+			d->track->setval(d->trk, "capture_latency_max", lat);
+		}
+	}
+}
+
+static int pulse_in_read(void *ctx, fmed_filt *d)
+{
+	pulse_in *a = ctx;
+	const void *data;
+	size_t n;
+	int r = FMED_ROK;
+
+	pa_threaded_mainloop_lock(a->ml);
+
+	if (a->peeked) {
+		a->peeked = 0;
+		pa_stream_drop(a->stm);
+	}
+
+	if (d->flags & FMED_FSTOP) {
+		d->outlen = 0;
+		r = FMED_RDONE;
+		goto end;
+	}
+
+	for (;;) {
+		if (pa_stream_get_state(a->stm) != PA_STREAM_READY) {
+			errlog(core, d->trk, "pulse", "capture stream: %s", pa_strerror(pa_context_errno(a->ctx)));
+			r = FMED_RERR;
+			goto end;
+		}
+
+		if (0 == (n = pa_stream_readable_size(a->stm))) {
+			a->want_read = 1;
+			r = FMED_RASYNC;
+			goto end;
+		}
+		pulse_in_stat(a, d);
+
+		if (0 != pa_stream_peek(a->stm, &data, &n)) {
+			errlog(core, d->trk, "pulse", "pa_stream_peek(): %s", pa_strerror(pa_context_errno(a->ctx)));
+			r = FMED_RERR;
+			goto end;
+		}
+
+		if (data == NULL) {
+			if (n != 0) {
+				// a hole in the stream: the data was lost
+				a->lost += n;
+				a->total_samps += n / a->frsize;
+				pa_stream_drop(a->stm);
+			}
+			continue;
+		}
+		break;
+	}
+
+	a->peeked = 1;
+	d->out = data;
+	d->outlen = n;
+	dbglog(core, d->trk, "pulse", "read %L bytes", n);
+	d->audio.pos = a->total_samps; //position of the first sample in the block
+	a->total_samps += n / a->frsize;
+
+end:
+	pa_threaded_mainloop_unlock(a->ml);
+	return r;
+}
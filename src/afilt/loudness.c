@@ -0,0 +1,512 @@
+/** EBU R128 loudness analysis (ITU-R BS.1770-4, EBU Tech 3341, 3342):
+ integrated loudness, loudness range, true peak.
+The values for the whole album are computed from all tracks analyzed during the session.
+Copyright (c) 2018 Simon Zolin */
+
+#include <fmedia.h>
+
+#include <FF/audio/pcm.h>
+#include <FF/array.h>
+#include <FFOS/thread.h>
+#include <math.h>
+
+
+#undef dbglog
+#undef errlog
+#define dbglog(trk, ...)  fmed_dbglog(core, trk, "loudness", __VA_ARGS__)
+#define errlog(trk, ...)  fmed_errlog(core, trk, "loudness", __VA_ARGS__)
+
+
+static const fmed_core *core;
+
+//FMEDIA MODULE
+static const void* ln_iface(const char *name);
+static int ln_sig(uint signo);
+static void ln_destroy(void);
+static int ln_conf(const char *name, ffpars_ctx *ctx);
+static const fmed_mod fmed_ln_mod = {
+	.ver = FMED_VER_FULL, .ver_core = FMED_VER_CORE,
+	&ln_iface, &ln_sig, &ln_destroy, &ln_conf
+};
+
+//ANALYZE
+static void* ln_open(fmed_filt *d);
+static void ln_close(void *ctx);
+static int ln_process(void *ctx, fmed_filt *d);
+static const fmed_filter fmed_ln_analyze = {
+	&ln_open, &ln_process, &ln_close
+};
+
+
+enum {
+	LN_MAXCHAN = 8,
+	LN_HIST_MIN = -70, //LUFS; absolute gate
+	LN_HIST_MAX = 10,
+	LN_HIST_BINS = (LN_HIST_MAX - LN_HIST_MIN) * 10, //0.1 LU per bin
+	LN_BLOCK_SUB = 4, //100ms sub-blocks in 400ms block (momentary loudness)
+	LN_SHORTTERM_SUB = 30, //100ms sub-blocks in 3s block (short-term loudness)
+	LN_TP_TAPS = 12, //true peak: FIR taps per phase
+	LN_TP_MAXFACTOR = 4,
+};
+
+#define LN_REF_RG  (-18.0) //ReplayGain 2.0 reference level, LUFS
+
+/** Histogram of block energies. */
+struct ln_hist {
+	uint64 count[LN_HIST_BINS];
+	double energy[LN_HIST_BINS];
+};
+
+struct biquad {
+	double b0, b1, b2, a1, a2;
+};
+
+struct ln_chan {
+	double s1[2], s2[2]; //K-weighting filter state (2 biquads, transposed direct form II)
+	double sum; //sum of squares in the current sub-block
+	float *tpbuf; //true peak: the last input samples + the current chunk
+};
+
+struct loudness {
+	uint state;
+	uint channels;
+	uint rate;
+	struct biquad shelf, hipass;
+	double weight[LN_MAXCHAN];
+	struct ln_chan ch[LN_MAXCHAN];
+
+	uint sub_len; //samples in 100ms sub-block
+	uint sub_n; //samples in the current sub-block
+	double sub[LN_SHORTTERM_SUB]; //weighted mean squares of the last sub-blocks
+	uint64 nsub;
+
+	struct ln_hist blocks;
+	struct ln_hist shortterm;
+
+	uint tp_factor;
+	float tp_coef[LN_TP_MAXFACTOR][LN_TP_TAPS]; //reversed for each phase
+	ffarr tpbuf;
+	float peak;
+};
+
+/** Aggregated data of all analyzed tracks. */
+static struct {
+	fflock lk;
+	struct ln_hist blocks;
+	float peak;
+	uint ntracks;
+} *album;
+
+
+FF_EXP const fmed_mod* fmed_getmod(const fmed_core *_core)
+{
+	core = _core;
+	return &fmed_ln_mod;
+}
+
+static const void* ln_iface(const char *name)
+{
+	if (ffsz_eq(name, "analyze"))
+		return &fmed_ln_analyze;
+	return NULL;
+}
+
+static void ln_album_print(void);
+
+static int ln_sig(uint signo)
+{
+	switch (signo) {
+	case FMED_SIG_INIT:
+		ffmem_init();
+		if (NULL == (album = ffmem_calloc(1, sizeof(*album))))
+			return 1;
+		fflk_init(&album->lk);
+		return 0;
+
+	case FMED_STOP:
+		ln_album_print();
+		break;
+	}
+	return 0;
+}
+
+static void ln_destroy(void)
+{
+	ffmem_safefree0(album);
+}
+
+static int ln_conf(const char *name, ffpars_ctx *ctx)
+{
+	return -1;
+}
+
+
+static double ln_lufs(double energy)
+{
+	return -0.691 + 10 * log10(energy);
+}
+
+static void hist_add(struct ln_hist *h, double energy)
+{
+	double l = ln_lufs(energy);
+	if (!(l >= LN_HIST_MIN))
+		return; //absolute gate
+	uint i = (uint)((l - LN_HIST_MIN) * 10);
+	i = ffmin(i, LN_HIST_BINS - 1);
+	h->count[i]++;
+	h->energy[i] += energy;
+}
+
+static void hist_merge(struct ln_hist *dst, const struct ln_hist *src)
+{
+	for (uint i = 0;  i != LN_HIST_BINS;  i++) {
+		dst->count[i] += src->count[i];
+		dst->energy[i] += src->energy[i];
+	}
+}
+
+/** Get the first bin above relative gate: @rel LU below the mean of the blocks. */
+static uint hist_relgate(const struct ln_hist *h, double rel, uint64 *n)
+{
+	double sum = 0;
+	uint64 cnt = 0;
+	for (uint i = 0;  i != LN_HIST_BINS;  i++) {
+		sum += h->energy[i];
+		cnt += h->count[i];
+	}
+	*n = cnt;
+	if (cnt == 0)
+		return LN_HIST_BINS;
+
+	double gate = ln_lufs(sum / cnt) + rel;
+	if (gate < LN_HIST_MIN)
+		return 0;
+	return ffmin((uint)((gate - LN_HIST_MIN) * 10), LN_HIST_BINS);
+}
+
+/** Integrated loudness (gated with -10 LU relative gate), LUFS.
+Return -HUGE_VAL if there's no data. */
+static double hist_integrated(const struct ln_hist *h)
+{
+	uint64 n;
+	uint i = hist_relgate(h, -10, &n);
+	double sum = 0;
+	n = 0;
+	for (;  i < LN_HIST_BINS;  i++) {
+		sum += h->energy[i];
+		n += h->count[i];
+	}
+	if (n == 0)
+		return -HUGE_VAL;
+	return ln_lufs(sum / n);
+}
+
+/** Loudness range: the difference between 95th and 10th percentiles
+ of short-term loudness distribution (gated with -20 LU relative gate), LU. */
+static double hist_range(const struct ln_hist *h)
+{
+	uint64 n;
+	uint first = hist_relgate(h, -20, &n), i;
+	n = 0;
+	for (i = first;  i < LN_HIST_BINS;  i++) {
+		n += h->count[i];
+	}
+	if (n == 0)
+		return 0;
+
+	uint64 lo_n = (uint64)((n - 1) * 0.10), hi_n = (uint64)((n - 1) * 0.95), k = 0;
+	uint lo = first, hi = first;
+	for (i = first;  i < LN_HIST_BINS;  i++) {
+		if (k <= lo_n)
+			lo = i;
+		k += h->count[i];
+		if (k > hi_n) {
+			hi = i;
+			break;
+		}
+	}
+	if (k <= lo_n)
+		lo = hi;
+	return (double)(hi - lo) / 10;
+}
+
+
+/** Prepare K-weighting filter coefficients for any sample rate. */
+static void kweight_init(struct loudness *l, uint rate)
+{
+	// stage 1: high shelf, models the acoustic effect of the head
+	double f0 = 1681.974450955533, G = 3.999843853973347, Q = 0.7071752369554196;
+	double K = tan(M_PI * f0 / rate);
+	double Vh = pow(10, G / 20);
+	double Vb = pow(Vh, 0.4996667741545416);
+	double a0 = 1 + K / Q + K * K;
+	l->shelf.b0 = (Vh + Vb * K / Q + K * K) / a0;
+	l->shelf.b1 = 2 * (K * K - Vh) / a0;
+	l->shelf.b2 = (Vh - Vb * K / Q + K * K) / a0;
+	l->shelf.a1 = 2 * (K * K - 1) / a0;
+	l->shelf.a2 = (1 - K / Q + K * K) / a0;
+
+	// stage 2: high pass (RLB weighting)
+	f0 = 38.13547087602444;
+	Q = 0.5003270373238773;
+	K = tan(M_PI * f0 / rate);
+	a0 = 1 + K / Q + K * K;
+	l->hipass.b0 = 1;
+	l->hipass.b1 = -2;
+	l->hipass.b2 = 1;
+	l->hipass.a1 = 2 * (K * K - 1) / a0;
+	l->hipass.a2 = (1 - K / Q + K * K) / a0;
+}
+
+/** Prepare polyphase interpolation filter for true peak measurement:
+ 4x oversampling below 96kHz, 2x below 192kHz. */
+static void truepeak_init(struct loudness *l, uint rate)
+{
+	l->tp_factor = (rate < 96000) ? 4 : (rate < 192000) ? 2 : 1;
+	if (l->tp_factor == 1)
+		return;
+
+	uint L = l->tp_factor, N = L * LN_TP_TAPS;
+	for (uint j = 0;  j != N;  j++) {
+		double m = j - (double)(N - 1) / 2;
+		double c = 1;
+		if (fabs(m) > 1e-6)
+			c = sin(m * M_PI / L) / (m * M_PI / L);
+		double w = 0.5 * (1 - cos(2 * M_PI * j / (N - 1))); //Hann window
+		l->tp_coef[j % L][LN_TP_TAPS - 1 - j / L] = c * w;
+	}
+}
+
+/** Apply K-weighting filter.
+Return the sum of squares of the filtered samples. */
+static double kweight_run(const struct loudness *l, struct ln_chan *c, const float *x, size_t n)
+{
+	const struct biquad *f = &l->shelf, *g = &l->hipass;
+	double s1a = c->s1[0], s2a = c->s2[0], s1b = c->s1[1], s2b = c->s2[1];
+	double sum = 0;
+
+	for (size_t i = 0;  i != n;  i++) {
+		double in = x[i];
+		double y = f->b0 * in + s1a;
+		s1a = f->b1 * in - f->a1 * y + s2a;
+		s2a = f->b2 * in - f->a2 * y;
+
+		double z = g->b0 * y + s1b;
+		s1b = g->b1 * y - g->a1 * z + s2b;
+		s2b = g->b2 * y - g->a2 * z;
+
+		sum += z * z;
+	}
+
+	c->s1[0] = s1a,  c->s2[0] = s2a,  c->s1[1] = s1b,  c->s2[1] = s2b;
+	return sum;
+}
+
+/** Get the peak value of the oversampled signal.
+The inner loops run over contiguous arrays so that the compiler can vectorize them. */
+static float truepeak_run(const struct loudness *l, struct ln_chan *c, const float *x, size_t n)
+{
+	float peak = 0;
+
+	if (l->tp_factor == 1) {
+		for (size_t i = 0;  i != n;  i++) {
+			float v = fabsf(x[i]);
+			peak = (v > peak) ? v : peak;
+		}
+		return peak;
+	}
+
+	float *buf = c->tpbuf;
+	ffmemcpy(buf + LN_TP_TAPS - 1, x, n * sizeof(float));
+
+	for (size_t i = 0;  i != n;  i++) {
+		const float *win = buf + i;
+		for (uint p = 0;  p != l->tp_factor;  p++) {
+			const float *coef = l->tp_coef[p];
+			float y = 0;
+			for (uint k = 0;  k != LN_TP_TAPS;  k++) {
+				y += coef[k] * win[k];
+			}
+			y = fabsf(y);
+			peak = (y > peak) ? y : peak;
+		}
+	}
+
+	memmove(buf, buf + n, (LN_TP_TAPS - 1) * sizeof(float));
+	return peak;
+}
+
+/** 100ms sub-block is complete: add 400ms and 3s blocks (75% overlap) to histograms. */
+static void ln_subblock(struct loudness *l)
+{
+	double e = 0;
+	for (uint i = 0;  i != l->channels;  i++) {
+		e += l->weight[i] * l->ch[i].sum;
+		l->ch[i].sum = 0;
+	}
+	l->sub[l->nsub % LN_SHORTTERM_SUB] = e / l->sub_len;
+	l->nsub++;
+	l->sub_n = 0;
+
+	if (l->nsub >= LN_BLOCK_SUB) {
+		e = 0;
+		for (uint i = 0;  i != LN_BLOCK_SUB;  i++) {
+			e += l->sub[(l->nsub - 1 - i) % LN_SHORTTERM_SUB];
+		}
+		hist_add(&l->blocks, e / LN_BLOCK_SUB);
+	}
+
+	if (l->nsub >= LN_SHORTTERM_SUB) {
+		e = 0;
+		for (uint i = 0;  i != LN_SHORTTERM_SUB;  i++) {
+			e += l->sub[i];
+		}
+		hist_add(&l->shortterm, e / LN_SHORTTERM_SUB);
+	}
+}
+
+static void* ln_open(fmed_filt *d)
+{
+	struct loudness *l = ffmem_new(struct loudness);
+	if (l == NULL)
+		return NULL;
+	return l;
+}
+
+static void ln_close(void *ctx)
+{
+	struct loudness *l = ctx;
+	ffarr_free(&l->tpbuf);
+	ffmem_free(l);
+}
+
+static int ln_init(struct loudness *l, fmed_filt *d)
+{
+	l->channels = d->audio.convfmt.channels;
+	l->rate = d->audio.convfmt.sample_rate;
+	if (l->channels > LN_MAXCHAN) {
+		errlog(d->trk, "too many channels: %u", l->channels);
+		return -1;
+	}
+
+	// channel weights: L R C LFE Ls Rs; LFE is not measured
+	for (uint i = 0;  i != l->channels;  i++) {
+		l->weight[i] = 1;
+	}
+	if (l->channels == 5) {
+		l->weight[3] = l->weight[4] = 1.41;
+	} else if (l->channels >= 6) {
+		l->weight[3] = 0;
+		l->weight[4] = l->weight[5] = 1.41;
+	}
+
+	kweight_init(l, l->rate);
+	truepeak_init(l, l->rate);
+	l->sub_len = l->rate / 10;
+
+	if (l->tp_factor != 1) {
+		size_t n = LN_TP_TAPS - 1 + l->sub_len;
+		if (NULL == ffarr_alloczT(&l->tpbuf, n * l->channels, float)) {
+			errlog(d->trk, "%s", ffmem_alloc_S);
+			return -1;
+		}
+		for (uint i = 0;  i != l->channels;  i++) {
+			l->ch[i].tpbuf = (float*)l->tpbuf.ptr + i * n;
+		}
+	}
+	return 0;
+}
+
+/** Print the results for the track and save them as ReplayGain meta. */
+static void ln_result(struct loudness *l, fmed_filt *d)
+{
+	double integrated = hist_integrated(&l->blocks);
+	double range = hist_range(&l->shortterm);
+	double peak_db = ffpcm_gain2db(l->peak);
+	const char *fn = d->track->getvalstr(d->trk, "input");
+
+	if (integrated == -HUGE_VAL) {
+		core->log(FMED_LOG_USER, d->trk, NULL, "%s: loudness: too short or silent", fn);
+		return;
+	}
+
+	core->log(FMED_LOG_USER, d->trk, NULL, "%s: integrated:%.1F LUFS  range:%.1F LU  true peak:%.2F dBTP  ReplayGain:%.2F dB"
+		, fn, integrated, range, peak_db, LN_REF_RG - integrated);
+
+	char buf[64];
+	ffstr name, val;
+	ffstr_setz(&name, "replaygain_track_gain");
+	val.ptr = buf;
+	val.len = ffs_fmt(buf, buf + sizeof(buf), "%.2F dB", LN_REF_RG - integrated);
+	d->track->meta_set(d->trk, &name, &val, FMED_QUE_OVWRITE);
+
+	ffstr_setz(&name, "replaygain_track_peak");
+	val.len = ffs_fmt(buf, buf + sizeof(buf), "%.6F", (double)l->peak);
+	d->track->meta_set(d->trk, &name, &val, FMED_QUE_OVWRITE);
+
+	fflk_lock(&album->lk);
+	hist_merge(&album->blocks, &l->blocks);
+	album->peak = ffmax(album->peak, l->peak);
+	album->ntracks++;
+	fflk_unlock(&album->lk);
+}
+
+static void ln_album_print(void)
+{
+	if (album == NULL || album->ntracks < 2)
+		return;
+
+	double integrated = hist_integrated(&album->blocks);
+	core->log(FMED_LOG_USER, NULL, NULL, "Album (%u tracks): integrated:%.1F LUFS  true peak:%.2F dBTP  ReplayGain:%.2F dB"
+		, album->ntracks, integrated, ffpcm_gain2db(album->peak), LN_REF_RG - integrated);
+}
+
+static int ln_process(void *ctx, fmed_filt *d)
+{
+	struct loudness *l = ctx;
+
+	switch (l->state) {
+	case 0:
+		d->audio.convfmt.format = FFPCM_FLOAT;
+		d->audio.convfmt.ileaved = 0;
+		l->state = 1;
+		return FMED_RMORE;
+
+	case 1:
+		if (d->audio.convfmt.format != FFPCM_FLOAT || d->audio.convfmt.ileaved) {
+			errlog(d->trk, "input must be non-interleaved float PCM");
+			return FMED_RERR;
+		}
+		if (0 != ln_init(l, d))
+			return FMED_RERR;
+		l->state = 2;
+		break;
+	}
+
+	const float **data = (void*)d->datani;
+	size_t samples = d->datalen / (sizeof(float) * l->channels);
+	size_t off = 0;
+
+	while (off != samples) {
+		size_t n = ffmin(samples - off, l->sub_len - l->sub_n);
+
+		for (uint i = 0;  i != l->channels;  i++) {
+			struct ln_chan *c = &l->ch[i];
+			c->sum += kweight_run(l, c, data[i] + off, n);
+			float peak = truepeak_run(l, c, data[i] + off, n);
+			l->peak = ffmax(l->peak, peak);
+		}
+
+		off += n;
+		l->sub_n += n;
+		if (l->sub_n == l->sub_len)
+			ln_subblock(l);
+	}
+
+	d->datalen = 0;
+	if (d->flags & FMED_FLAST) {
+		ln_result(l, d);
+		return FMED_RDONE;
+	}
+	return FMED_RMORE;
+}
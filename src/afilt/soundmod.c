@@ -6,7 +6,16 @@ Copyright (c) 2015 Simon Zolin */
 #include <FF/audio/pcm.h>
 #include <FF/array.h>
 #include <FF/crc.h>
-#include <FF/ring.h>
+#include <FF/path.h>
+#include <FFOS/thread.h>
+#include <FFOS/dir.h>
+#include <FFOS/error.h>
+#include <FFOS/process.h>
+
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 #define infolog(trk, ...)  fmed_infolog(core, trk, FILT_NAME, __VA_ARGS__)
@@ -33,9 +42,10 @@ enum {
 static const void* sndmod_iface(const char *name);
 static int sndmod_sig(uint signo);
 static void sndmod_destroy(void);
+static int sndmod_conf(const char *name, ffpars_ctx *ctx);
 static const fmed_mod fmed_sndmod_mod = {
 	.ver = FMED_VER_FULL, .ver_core = FMED_VER_CORE,
-	&sndmod_iface, &sndmod_sig, &sndmod_destroy
+	&sndmod_iface, &sndmod_sig, &sndmod_destroy, &sndmod_conf
 };
 
 //CONVERTER
@@ -113,10 +123,46 @@ static const struct fmed_filter sndmod_stoplev = {
 static void* membuf_open(fmed_filt *d);
 static void membuf_close(void *ctx);
 static int membuf_write(void *ctx, fmed_filt *d);
+static int membuf_config(ffpars_ctx *ctx);
 static const struct fmed_filter sndmod_membuf = {
 	&membuf_open, &membuf_write, &membuf_close
 };
 
+static struct membuf_conf_t {
+	uint64 max_memory; //max. size of a buffer in memory;  a larger buffer is backed by a file
+	char *spill_dir;
+} membuf_conf = { 64 * 1024 * 1024, NULL };
+
+//TEE
+static void* tee_open(fmed_filt *d);
+static void tee_close(void *ctx);
+static int tee_process(void *ctx, fmed_filt *d);
+static const struct fmed_filter sndmod_tee = {
+	&tee_open, &tee_process, &tee_close
+};
+
+//CUE SPLIT
+static void* cuesplit_open(fmed_filt *d);
+static int cuesplit_process(void *ctx, fmed_filt *d);
+static const struct fmed_filter sndmod_cuesplit = {
+	&cuesplit_open, &cuesplit_process, &tee_close
+};
+
+//SEGMENT SPLIT
+static void* split_open(fmed_filt *d);
+static int split_process(void *ctx, fmed_filt *d);
+static const struct fmed_filter sndmod_split = {
+	&split_open, &split_process, &tee_close
+};
+
+//TEE-INPUT
+static void* teein_open(fmed_filt *d);
+static void teein_close(void *ctx);
+static int teein_process(void *ctx, fmed_filt *d);
+static const struct fmed_filter sndmod_teein = {
+	&teein_open, &teein_process, &teein_close
+};
+
 
 const fmed_mod* fmed_getmod_sndmod(const fmed_core *_core)
 {
@@ -141,6 +187,10 @@ static const struct submod submods[] = {
 	{ "startlevel", &sndmod_startlev },
 	{ "stoplevel", &sndmod_stoplev },
 	{ "membuf", &sndmod_membuf },
+	{ "tee", &sndmod_tee },
+	{ "tee-in", &sndmod_teein },
+	{ "cuesplit", &sndmod_cuesplit },
+	{ "split", &sndmod_split },
 };
 
 static const void* sndmod_iface(const char *name)
@@ -160,6 +210,14 @@ static int sndmod_sig(uint signo)
 
 static void sndmod_destroy(void)
 {
+	ffmem_safefree0(membuf_conf.spill_dir);
+}
+
+static int sndmod_conf(const char *name, ffpars_ctx *ctx)
+{
+	if (ffsz_eq(name, "membuf"))
+		return membuf_config(ctx);
+	return -1;
 }
 
 
@@ -319,6 +377,15 @@ static int sndmod_conv_process(void *ctx, fmed_filt *d)
 		return FMED_RMORE;
 	}
 
+	// write directly into the device buffer if the output filter has lent it to us
+	void *obuf = c->buf.ptr;
+	if (d->a_dstbuf != NULL && c->outpcm.ileaved
+		&& d->a_dstcap >= c->out_samp_size) {
+		obuf = d->a_dstbuf;
+		samples = ffmin(samples, d->a_dstcap / c->out_samp_size);
+		d->a_dstbuf = NULL;
+	}
+
 	void *in[8];
 	const void *data;
 	if (!c->inpcm.ileaved) {
@@ -330,11 +397,11 @@ static int sndmod_conv_process(void *ctx, fmed_filt *d)
 		data = (char*)d->data + c->off * c->inpcm.channels;
 	}
 
-	if (0 != ffpcm_convert(&c->outpcm, c->buf.ptr, &c->inpcm, data, samples)) {
+	if (0 != ffpcm_convert(&c->outpcm, obuf, &c->inpcm, data, samples)) {
 		return FMED_RERR;
 	}
 
-	d->out = c->buf.ptr;
+	d->out = obuf;
 	d->outlen = samples * c->out_samp_size;
 	d->datalen -= samples * ffpcm_size1(&c->inpcm);
 	c->off += samples * ffpcm_size(c->inpcm.format, 1);
@@ -692,6 +759,7 @@ struct silgen {
 	uint state;
 	void *buf;
 	size_t cap;
+	uint64 pos; //samples
 };
 
 static void* silgen_open(fmed_filt *d)
@@ -738,6 +806,8 @@ static int silgen_process(void *ctx, fmed_filt *d)
 		break;
 	}
 
+	d->audio.pos = c->pos;
+	c->pos += c->cap / ffpcm_size1(&d->audio.convfmt);
 	d->out = c->buf,  d->outlen = c->cap;
 	return FMED_RDATA;
 }
@@ -917,54 +987,1360 @@ static int stoplev_process(void *ctx, fmed_filt *d)
 #undef FILT_NAME
 
 
+/*
+Memory buffer: keep the last N seconds of recorded audio (--prebuffer)
+ and pass them further when the user starts saving the track.
+
+The data is stored in its original layout: one ring for interleaved data or one ring per channel.
+A buffer larger than "max_memory" is placed in a preallocated file mapped into memory:
+ the system writes the older pages to disk and keeps in RAM only the recently used ones.
+*/
+
+#define FILT_NAME  "#soundmod.membuf"
+
+enum {
+	MEMBUF_MAXCHAN = 8,
+	MEMBUF_SPILL_TRIES = 16,
+};
+
+#ifdef FF_WIN
+#define MEMBUF_SPILL_DIR  "%TMP%"
+#else
+#define MEMBUF_SPILL_DIR  "/tmp"
+#endif
+
+static const ffpars_arg membuf_conf_args[] = {
+	{ "max_memory",	FFPARS_TSIZE | FFPARS_F64BIT,  FFPARS_DSTOFF(struct membuf_conf_t, max_memory) },
+	{ "spill_dir",	FFPARS_TCHARPTR | FFPARS_FSTRZ | FFPARS_FCOPY | FFPARS_FNOTEMPTY,  FFPARS_DSTOFF(struct membuf_conf_t, spill_dir) },
+};
+
+static int membuf_config(ffpars_ctx *ctx)
+{
+	ffpars_setargs(ctx, &membuf_conf, membuf_conf_args, FFCNT(membuf_conf_args));
+	return 0;
+}
+
 struct membuf {
-	ffringbuf buf;
+	char *ptr; //planes[nplanes]
 	size_t size;
+	size_t cap; //number of samples in a plane
+	size_t w; //the next sample to write
+	size_t len; //number of stored samples
+	uint nplanes; //1: interleaved;  or the number of channels
+	uint ssize; //size of 1 sample in a plane
+	void *ni[MEMBUF_MAXCHAN];
+
+	fffd fd;
+	fffd hmap;
+	char *fn;
 };
 
+static ffatomic membuf_spill_seq; //the number of the next buffer file
+
+/** Create a file of the buffer's size and map it into memory. */
+static int membuf_spill_open(struct membuf *m, fmed_filt *d)
+{
+	char *dir;
+	const char *s;
+	ffarr a = {0};
+	int r = -1;
+
+	if (membuf_conf.spill_dir != NULL)
+		dir = core->env_expand(NULL, 0, membuf_conf.spill_dir);
+#ifdef FF_UNIX
+	else if (NULL != (s = getenv("TMPDIR")) && s[0] != '\0')
+		dir = ffsz_alcopyz(s);
+#endif
+	else
+		dir = core->env_expand(NULL, 0, MEMBUF_SPILL_DIR);
+	if (dir == NULL)
+		goto end;
+
+	// The file is created exclusively: the name is unique within the process,
+	//  and an existing file (e.g. a leftover with the same PID) is skipped
+	for (uint i = 0;  i != MEMBUF_SPILL_TRIES;  i++) {
+		a.len = 0;
+		if (0 == ffstr_catfmt(&a, "%s/fmedia-membuf-%u-%u.tmp%Z"
+			, dir, (uint)ffps_curid(), (uint)ffatom_incret(&membuf_spill_seq))) {
+			ffarr_free(&a);
+			goto end;
+		}
+
+		m->fd = fffile_open(a.ptr, FFO_CREATENEW | O_RDWR);
+		if (m->fd == FF_BADFD && fferr_nofile(fferr_last())) {
+			if (0 != ffdir_make_path(a.ptr, 0))
+				break;
+			m->fd = fffile_open(a.ptr, FFO_CREATENEW | O_RDWR);
+		}
+		if (!(m->fd == FF_BADFD && fferr_exist(fferr_last())))
+			break;
+	}
+	m->fn = a.ptr;
+	if (m->fd == FF_BADFD) {
+		syserrlog(core, d->trk, FILT_NAME, "%s: %s", fffile_open_S, m->fn);
+		goto end;
+	}
+
+	if (0 != fffile_trunc(m->fd, m->size)) {
+		syserrlog(core, d->trk, FILT_NAME, "%s: %s", "fffile_trunc", m->fn);
+		goto end;
+	}
+
+	if (FF_BADFD == (m->hmap = ffmap_create(m->fd, m->size, FFMAP_PAGERW))
+		|| NULL == (m->ptr = ffmap_open(m->hmap, 0, m->size, PROT_READ | PROT_WRITE, MAP_SHARED))) {
+		syserrlog(core, d->trk, FILT_NAME, "%s: %s", "ffmap_open", m->fn);
+		goto end;
+	}
+
+	dbglog(core, d->trk, FILT_NAME, "buffer: %U bytes in file %s", (uint64)m->size, m->fn);
+
+#ifdef FF_UNIX
+	// the data stays available until the file is unmapped
+	fffile_rm(m->fn);
+	ffmem_free0(m->fn);
+#endif
+	r = 0;
+
+end:
+	ffmem_safefree(dir);
+	return r;
+}
+
 static void* membuf_open(fmed_filt *d)
 {
-	if (!d->audio.fmt.ileaved) {
-		errlog(core, d->trk, "#soundmod.membuf", "non-interleaved audio format isn't supported");
+	const ffpcmex *fmt = &d->audio.fmt;
+	if (!fmt->ileaved && fmt->channels > MEMBUF_MAXCHAN) {
+		errlog(core, d->trk, FILT_NAME, "too many channels: %u", fmt->channels);
 		return NULL;
 	}
 
 	struct membuf *m = ffmem_new(struct membuf);
 	if (m == NULL)
 		return NULL;
+	m->fd = FF_BADFD;
+	m->hmap = FF_BADFD;
 
-	size_t size = ffpcm_bytes(&d->audio.fmt, d->a_prebuffer);
-	m->size = size;
-	size = ff_align_power2(size + 1);
-	void *p = ffmem_alloc(size);
-	if (p == NULL) {
-		ffmem_free(m);
-		return NULL;
+	m->nplanes = (fmt->ileaved) ? 1 : fmt->channels;
+	m->ssize = ffpcm_size1(fmt) / m->nplanes;
+	m->cap = ffmax(ffpcm_samples(d->a_prebuffer, fmt->sample_rate), 1);
+	m->size = m->cap * ffpcm_size1(fmt);
+
+	if (m->size > membuf_conf.max_memory) {
+		if (0 != membuf_spill_open(m, d))
+			goto err;
+
+	} else if (NULL == (m->ptr = ffmem_alloc(m->size))) {
+		errlog(core, d->trk, FILT_NAME, "%s", ffmem_alloc_S);
+		goto err;
 	}
-	ffringbuf_init(&m->buf, p, size);
+
 	return m;
+
+err:
+	membuf_close(m);
+	return NULL;
 }
 
 static void membuf_close(void *ctx)
 {
 	struct membuf *m = ctx;
-	ffmem_free(ffringbuf_data(&m->buf));
+
+	if (m->fd == FF_BADFD)
+		ffmem_safefree(m->ptr);
+	else if (m->ptr != NULL)
+		ffmap_unmap(m->ptr, m->size);
+	FF_SAFECLOSE(m->hmap, FF_BADFD, ffmap_close);
+	FF_SAFECLOSE(m->fd, FF_BADFD, fffile_close);
+	if (m->fn != NULL) {
+		fffile_rm(m->fn);
+		ffmem_free(m->fn);
+	}
+	ffmem_free(m);
 }
 
 static int membuf_write(void *ctx, fmed_filt *d)
 {
 	struct membuf *m = ctx;
+	size_t off, n, k;
 
 	if (d->save_trk) {
-		ffstr s;
-		ffringbuf_readptr(&m->buf, &s, m->size);
-		d->out = s.ptr,  d->outlen = s.len;
-		return (s.len == 0) ? FMED_RDONE : FMED_RDATA;
+		// output the stored data, from the oldest sample up to the end of the ring
+		off = (m->w + m->cap - m->len) % m->cap;
+		n = ffmin(m->len, m->cap - off);
+		m->len -= n;
+
+		if (m->nplanes == 1) {
+			d->out = m->ptr + off * m->ssize;
+		} else {
+			for (uint i = 0;  i != m->nplanes;  i++) {
+				m->ni[i] = m->ptr + (i * m->cap + off) * m->ssize;
+			}
+			d->outni = m->ni;
+		}
+		d->outlen = n * m->ssize * m->nplanes;
+		return (n == 0) ? FMED_RDONE : FMED_RDATA;
 	}
 
 	if (d->flags & FMED_FSTOP)
 		return FMED_RFIN;
 
-	ffringbuf_overwrite(&m->buf, d->data, d->datalen);
+	n = d->datalen / (m->ssize * m->nplanes);
+	off = 0;
+	if (n > m->cap) {
+		// only the last part fits
+		off = n - m->cap;
+		n = m->cap;
+	}
+
+	while (n != 0) {
+		k = ffmin(n, m->cap - m->w);
+		for (uint i = 0;  i != m->nplanes;  i++) {
+			const char *src = (m->nplanes == 1) ? d->data : d->datani[i];
+			ffmemcpy(m->ptr + (i * m->cap + m->w) * m->ssize, src + off * m->ssize, k * m->ssize);
+		}
+		m->w = (m->w + k) % m->cap;
+		m->len = ffmin(m->len + k, m->cap);
+		off += k;
+		n -= k;
+	}
 	return FMED_RMORE;
 }
+
+#undef FILT_NAME
+
+
+/*
+Tee: pass audio data from one track to several branch tracks:
+
+ ... -> #soundmod.tee -> #soundmod.autoconv -> ENCODER -> OUTPUT
+          |
+          +--> (track) #soundmod.tee-in -> #soundmod.autoconv -> ENCODER -> OUTPUT
+          +--> (track) #soundmod.tee-in -> ...
+
+The parent track copies each data block into a ring of blocks shared by all branches.
+It waits only if the oldest block isn't yet processed by all branches.
+A block is released when all branches have passed it to their next filter.
+
+CUE split: the same, but there's only one branch at a time: one branch track per CUE track.
+
+ ... -> #soundmod.cuesplit
+          |
+          +--> (track #1) #soundmod.tee-in -> #soundmod.autoconv -> ENCODER -> OUTPUT
+          +--> (track #2) ...
+
+The image is read and decoded only once.
+The block crossing a CUE track boundary is cut, its first part is the last block of the branch.
+The next branch is created after the previous one has received its last block.
+
+Segment split: recording is written to a new output file each time the segment duration or size is reached.
+
+ (capture) -> #soundmod.split
+          |
+          +--> (segment #1) #soundmod.tee-in -> #soundmod.autoconv -> ENCODER -> OUTPUT
+          +--> (segment #2) ...
+
+Each block belongs to one segment;  a branch skips the blocks of the other segments.
+The branch for the next segment is created in advance, so the capture track doesn't wait
+ while the encoder and the output file for a new segment are being prepared.
+A branch leaves the list after its last block, so it doesn't hold the ring while finishing its file.
+
+Silence split: the input data is analyzed in short windows (RMS and peak of all channels).
+When the signal stays below the threshold for the specified time, the current segment is finished.
+The silent data that follows isn't written;  the next segment starts when the signal resumes.
+*/
+
+#define FILT_NAME  "#soundmod.tee"
+
+enum {
+	TEE_BLOCKS = 4,
+	TEE_MAXCHAN = 8,
+};
+
+struct tee_block {
+	ffarr buf;
+	void *ni[TEE_MAXCHAN];
+	size_t len;
+	uint64 pos;
+	uint readers; //branches that haven't yet processed this block
+	uint seg; //segment number
+	uint last :1;
+};
+
+struct teein;
+
+struct cuetrk {
+	uint64 from, to; //samples from the beginning of the parent track.  to=0: until the end
+	ffstr meta; //"NAME\0VAL\0..."
+};
+
+struct tee {
+	void *trk;
+	const fmed_track *track;
+	fftask task;
+	fflock lk;
+	uint ref; //parent + branches
+
+	char *outputs; //"OUT2\0OUT3\0...\0\0"
+	fmed_trk info; //properties for the branch tracks
+	ffpcmex fmt;
+
+	ffarr branches; //struct teein*[]
+	struct tee_block blocks[TEE_BLOCKS];
+	uint64 published; //number of published blocks
+
+	uint state;
+	uint parent_waiting :1;
+	uint parent_closed :1;
+	uint err :1;
+
+	//CUE split:
+	char *cuedata; //data for struct cuetrk.meta
+	ffarr cuetrks; //struct cuetrk[]
+	uint icue; //the CUE track being written
+	uint64 off; //samples of the current input block already processed
+
+	//segment split:
+	uint64 split_samples; //max. segment duration;  0: unlimited
+	uint64 split_size; //max. segment output size (bytes);  0: unlimited
+	uint64 seg_start; //sample at which the current segment starts
+	uint64 seg_written; //output bytes of the current segment, reported by its branch
+	uint iseg; //the segment being written
+	uint nseg_created; //number of branches created for segments
+	uint creating :1; //a branch for the next segment is being created
+
+	//silence split:
+	uint sil_skip :1; //dropping silent data until the signal resumes
+	double sil_level; //squared RMS threshold;  0: disabled
+	uint64 sil_samples; //min. silence duration
+	uint64 sil_run; //samples of the current silence
+	uint sil_window; //analysis window (samples)
+};
+
+struct teein {
+	struct tee *tee;
+	void *trk;
+	uint64 next; //the block being output or the next block to output
+	uint seg; //segment number
+	uint output :1; //the block is passed to the next filter
+	uint waiting :1;
+	uint split :1; //branch for a segment
+	uint have_data :1;
+	uint detached :1; //removed from the list of branches
+};
+
+static void tee_unref(struct tee *t)
+{
+	fflk_lock(&t->lk);
+	uint n = --t->ref;
+	fflk_unlock(&t->lk);
+	if (n != 0)
+		return;
+
+	for (uint i = 0;  i != TEE_BLOCKS;  i++) {
+		ffarr_free(&t->blocks[i].buf);
+	}
+	ffarr_free(&t->branches);
+	ffmem_safefree(t->outputs);
+	ffarr_free(&t->cuetrks);
+	ffmem_safefree(t->cuedata);
+	ffmem_free(t);
+}
+
+/** Wake up the branches waiting for a new block.  Lock must be held. */
+static void tee_wake_branches(struct tee *t)
+{
+	struct teein **pb;
+	FFARR_WALKT(&t->branches, pb, struct teein*) {
+		struct teein *b = *pb;
+		if (b->waiting) {
+			b->waiting = 0;
+			t->track->cmd(b->trk, FMED_TRACK_WAKE);
+		}
+	}
+}
+
+static void* tee_open(fmed_filt *d)
+{
+	const char *outputs = d->track->getvalstr(d->trk, "tee_outputs");
+	if (outputs == FMED_PNULL)
+		return FMED_FILT_SKIP;
+
+	if (!d->audio.fmt.ileaved && d->audio.fmt.channels > TEE_MAXCHAN) {
+		errlog(core, d->trk, FILT_NAME, "too many channels: %u", d->audio.fmt.channels);
+		return NULL;
+	}
+
+	struct tee *t = ffmem_new(struct tee);
+	if (t == NULL)
+		return NULL;
+	const char *end = outputs;
+	while (*end != '\0')
+		end += ffsz_len(end) + 1;
+	if (NULL == (t->outputs = ffmem_alloc(end + 1 - outputs))) {
+		ffmem_free(t);
+		return NULL;
+	}
+	ffmemcpy(t->outputs, outputs, end + 1 - outputs);
+	fflk_init(&t->lk);
+	t->ref = 1;
+	t->trk = d->trk;
+	t->track = d->track;
+	return t;
+}
+
+static void tee_close(void *ctx)
+{
+	struct tee *t = ctx;
+	fflk_lock(&t->lk);
+	t->parent_closed = 1;
+	tee_wake_branches(t);
+	fflk_unlock(&t->lk);
+	tee_unref(t);
+}
+
+/** Create a track which receives data from the parent track and writes it to @out.
+@ct: CUE track or NULL
+@seg: segment number;  -1: not a segment */
+static int tee_branch_add(struct tee *t, const ffstr *out, const struct cuetrk *ct, int seg)
+{
+	struct teein *b, **pb;
+	const char *input;
+	void *f, *trk;
+
+	trk = t->track->create(FMED_TRK_TYPE_TEE, NULL);
+	if (trk == NULL || trk == FMED_TRK_EFMT)
+		return -1;
+
+	fmed_trk *ti = t->track->conf(trk);
+	t->track->copy_info(ti, &t->info);
+	ti->audio.convfmt = ti->audio.fmt;
+	ti->audio.seek = FMED_NULL;
+	// the audio is already processed by the parent track
+	ti->a_start_level = 0;
+	ti->a_stop_level = 0;
+	ti->use_dynanorm = 0;
+	if (ct != NULL) {
+		ti->audio.abs_seek = 0;
+		ti->audio.until = FMED_NULL;
+		if (ct->to != 0)
+			ti->audio.total = ct->to - ct->from;
+		else if ((int64)ti->audio.total != FMED_NULL)
+			ti->audio.total = (ti->audio.total > ct->from) ? ti->audio.total - ct->from : 0;
+	}
+	if (seg >= 0) {
+		ti->audio.until = FMED_NULL;
+		ti->audio.total = (t->split_samples != 0) ? t->split_samples : (uint64)FMED_NULL;
+		ti->out_written = 0;
+		t->track->setval(trk, "split_segment", seg);
+	}
+
+	if (FMED_PNULL != (input = t->track->getvalstr(t->trk, "input")))
+		t->track->setvalstr4(trk, "input", ffsz_alcopyz(input), FMED_TRK_FACQUIRE);
+	t->track->setvalstr4(trk, "output", ffsz_alcopy(out->ptr, out->len), FMED_TRK_FACQUIRE);
+	t->track->cmd(trk, FMED_TRACK_META_COPYFROM, t->trk);
+	if (ct != NULL) {
+		ffstr m = ct->meta, val;
+		while (m.len != 0) {
+			const char *name = m.ptr;
+			ffstr_shift(&m, ffsz_len(name) + 1);
+			ffstr_setz(&val, m.ptr);
+			ffstr_shift(&m, val.len + 1);
+			t->track->setvalstr4(trk, name, (void*)&val, FMED_TRK_META | FMED_TRK_VALSTR);
+		}
+	}
+
+	if (NULL == (f = (void*)t->track->cmd(trk, FMED_TRACK_FILT_ADDFIRST, "#soundmod.tee-in"))
+		|| NULL == (b = (void*)t->track->cmd(trk, FMED_TRACK_FILT_INSTANCE, f)))
+		goto err;
+
+	size_t n;
+	fflk_lock(&t->lk);
+	pb = ffarr_pushgrowT(&t->branches, 4, struct teein*);
+	n = t->branches.len;
+	if (pb != NULL) {
+		*pb = b;
+		b->tee = t;
+		b->trk = trk;
+		b->next = t->published;
+		b->seg = (seg >= 0) ? seg : 0;
+		b->split = (seg >= 0);
+		t->ref++;
+	}
+	fflk_unlock(&t->lk);
+	if (pb == NULL)
+		goto err;
+
+	dbglog(core, t->trk, FILT_NAME, "output #%L: %S", n, out);
+	t->track->cmd(trk, FMED_TRACK_XSTART);
+	return 0;
+
+err:
+	t->track->cmd(trk, FMED_TRACK_STOP);
+	return -1;
+}
+
+/** Create branch tracks.  Thread: main. */
+static void tee_branches_create(void *param)
+{
+	struct tee *t = param;
+	ffstr out;
+
+	for (const char *s = t->outputs;  *s != '\0';  s += out.len + 1) {
+		ffstr_setz(&out, s);
+		if (0 != tee_branch_add(t, &out, NULL, -1))
+			errlog(core, t->trk, FILT_NAME, "can't create track for output %S", &out);
+	}
+
+	t->track->cmd(t->trk, FMED_TRACK_WAKE);
+}
+
+/** Copy input data to the block.
+@off: offset (in samples) within the input data
+@n: number of samples */
+static int tee_block_fill(struct tee *t, struct tee_block *blk, const fmed_filt *d, size_t off, size_t n)
+{
+	size_t samp = ffpcm_size1(&t->fmt);
+	blk->buf.len = 0;
+	if (n != 0 && NULL == ffarr_realloc(&blk->buf, n * samp))
+		return -1;
+
+	if (t->fmt.ileaved) {
+		ffmemcpy(blk->buf.ptr, (char*)d->data + off * samp, n * samp);
+
+	} else {
+		size_t chsamp = samp / t->fmt.channels;
+		for (uint i = 0;  i != t->fmt.channels;  i++) {
+			blk->ni[i] = blk->buf.ptr + i * n * chsamp;
+			ffmemcpy(blk->ni[i], (char*)d->datani[i] + off * chsamp, n * chsamp);
+		}
+	}
+
+	blk->len = n * samp;
+	blk->pos = d->audio.pos + off;
+	blk->seg = t->iseg;
+	blk->last = !!(d->flags & FMED_FLAST);
+	return 0;
+}
+
+static int tee_process(void *ctx, fmed_filt *d)
+{
+	struct tee *t = ctx;
+
+	switch (t->state) {
+	case 0:
+		// create branch tracks on the main thread and wait until they are ready
+		d->track->copy_info(&t->info, d);
+		t->fmt = d->audio.fmt;
+		t->state = 1;
+		fftask_set(&t->task, &tee_branches_create, t);
+		core->cmd(FMED_TASK_XPOST, &t->task, 0);
+		return FMED_RASYNC;
+
+	case 1:
+		// process the first data block
+		t->state = 2;
+		break;
+	}
+
+	fflk_lock(&t->lk);
+	struct tee_block *blk = &t->blocks[t->published % TEE_BLOCKS];
+	if (blk->readers != 0) {
+		t->parent_waiting = 1;
+		fflk_unlock(&t->lk);
+		return FMED_RASYNC; //wait until the slowest branch releases the block
+	}
+	size_t nbranches = t->branches.len;
+	fflk_unlock(&t->lk);
+
+	if (nbranches != 0) {
+		if (0 != tee_block_fill(t, blk, d, 0, d->datalen / ffpcm_size1(&t->fmt))) {
+			errlog(core, d->trk, FILT_NAME, "%s", ffmem_alloc_S);
+			return FMED_RERR;
+		}
+
+		fflk_lock(&t->lk);
+		blk->readers = t->branches.len;
+		t->published++;
+		tee_wake_branches(t);
+		fflk_unlock(&t->lk);
+	}
+
+	d->out = d->data;
+	d->outlen = d->datalen;
+	d->datalen = 0;
+	if (d->flags & FMED_FLAST)
+		return FMED_RDONE;
+	return FMED_ROK;
+}
+
+static void* teein_open(fmed_filt *d)
+{
+	struct teein *b = ffmem_new(struct teein);
+	if (b == NULL)
+		return NULL;
+	return b;
+}
+
+/** The block is processed by the branch.  Lock must be held. */
+static void teein_release(struct teein *b, struct tee_block *blk)
+{
+	struct tee *t = b->tee;
+	if (--blk->readers == 0 && t->parent_waiting && !t->parent_closed) {
+		t->parent_waiting = 0;
+		t->track->cmd(t->trk, FMED_TRACK_WAKE);
+	}
+}
+
+/** Stop receiving data: release the remaining blocks and leave the list of branches.  Lock must be held. */
+static void teein_detach(struct teein *b)
+{
+	struct tee *t = b->tee;
+	struct teein **pb;
+
+	for (;  b->next != t->published;  b->next++) {
+		teein_release(b, &t->blocks[b->next % TEE_BLOCKS]);
+	}
+	FFARR_WALKT(&t->branches, pb, struct teein*) {
+		if (*pb == b) {
+			*pb = ((struct teein**)t->branches.ptr)[t->branches.len - 1];
+			t->branches.len--;
+			break;
+		}
+	}
+	b->detached = 1;
+	if (t->parent_waiting && !t->parent_closed) {
+		t->parent_waiting = 0;
+		t->track->cmd(t->trk, FMED_TRACK_WAKE);
+	}
+}
+
+static void teein_close(void *ctx)
+{
+	struct teein *b = ctx;
+	struct tee *t = b->tee;
+
+	if (t != NULL) {
+		fflk_lock(&t->lk);
+		if (!b->detached)
+			teein_detach(b);
+		fflk_unlock(&t->lk);
+		tee_unref(t);
+	}
+	ffmem_free(b);
+}
+
+static int teein_process(void *ctx, fmed_filt *d)
+{
+	struct teein *b = ctx;
+	struct tee *t = b->tee;
+	struct tee_block *blk;
+
+	if (d->flags & FMED_FSTOP) {
+		d->outlen = 0;
+		return FMED_RLASTOUT;
+	}
+
+	fflk_lock(&t->lk);
+
+	if (t->split_size != 0 && b->seg == t->iseg)
+		t->seg_written = d->out_written;
+
+	if (b->output) {
+		// the next filter has processed the block
+		b->output = 0;
+		blk = &t->blocks[b->next++ % TEE_BLOCKS];
+		uint last = blk->last;
+		teein_release(b, blk);
+		if (last) {
+			// don't hold the next blocks while the rest of the track is finishing
+			teein_detach(b);
+			fflk_unlock(&t->lk);
+			d->outlen = 0;
+			return FMED_RDONE;
+		}
+	}
+
+	for (;;) {
+		if (b->next == t->published) {
+			if (t->parent_closed) {
+				// the parent track is stopped
+				fflk_unlock(&t->lk);
+				d->outlen = 0;
+				if (b->split && !b->have_data)
+					return FMED_RFIN; //the segment hasn't started: don't create an empty file
+				return FMED_RDONE;
+			}
+			b->waiting = 1;
+			fflk_unlock(&t->lk);
+			return FMED_RASYNC;
+		}
+
+		blk = &t->blocks[b->next % TEE_BLOCKS];
+		if (blk->seg == b->seg)
+			break;
+		// the block belongs to another segment
+		b->next++;
+		teein_release(b, blk);
+	}
+
+	b->output = 1;
+	b->have_data = 1;
+	fflk_unlock(&t->lk);
+
+	if (t->fmt.ileaved)
+		d->out = blk->buf.ptr;
+	else
+		d->outni = blk->ni;
+	d->outlen = blk->len;
+	d->audio.pos = blk->pos;
+	return FMED_RDATA;
+}
+
+/** Copy a field of CUE tracks list, replacing the escape sequences "\t", "\n" and "\\" with the characters.
+@dst may point into @src: the output is never longer than the input.
+Return the end of output data. */
+static char* cuesplit_unescape(char *dst, const char *src, size_t len)
+{
+	for (size_t i = 0;  i != len;  i++) {
+		if (src[i] == '\\' && i + 1 != len) {
+			i++;
+			switch (src[i]) {
+			case 't':
+				*dst++ = '\t';  continue;
+			case 'n':
+				*dst++ = '\n';  continue;
+			}
+		}
+		*dst++ = src[i];
+	}
+	return dst;
+}
+
+/** Parse CUE tracks list:
+"FROM TO\n(NAME\tVAL\n)*\n..."
+FROM, TO: CD frames (1/75 sec) from the beginning of the audio file.
+'\\', TAB and LF within NAME and VAL are escaped with '\\'. */
+static int cuesplit_parse(struct tee *t, uint rate)
+{
+	ffstr s, ln, sfrom, sto;
+	struct cuetrk *ct = NULL;
+	uint64 base = 0, from, to;
+
+	ffstr_setz(&s, t->cuedata);
+	while (s.len != 0) {
+		ffs_split2by(s.ptr, s.len, '\n', &ln, &s);
+
+		if (ln.len == 0) {
+			ct = NULL;
+			continue;
+
+		} else if (ct != NULL) {
+			// "NAME\tVAL" -> "NAME\0VAL\0", appended to the track's meta
+			char *tab = ffs_find(ln.ptr, ln.len, '\t');
+			if (tab == ffarr_end(&ln))
+				return -1;
+			char *w = ct->meta.ptr + ct->meta.len;
+			w = cuesplit_unescape(w, ln.ptr, tab - ln.ptr);
+			*w++ = '\0';
+			w = cuesplit_unescape(w, tab + 1, ffarr_end(&ln) - (tab + 1));
+			*w++ = '\0';
+			ct->meta.len = w - ct->meta.ptr;
+			continue;
+		}
+
+		ffs_split2by(ln.ptr, ln.len, ' ', &sfrom, &sto);
+		if (!ffstr_toint(&sfrom, &from, FFS_INT64)
+			|| !ffstr_toint(&sto, &to, FFS_INT64))
+			return -1;
+		if (t->cuetrks.len == 0)
+			base = from;
+		if (from < base || (to != 0 && to <= from))
+			return -1;
+
+		if (NULL == (ct = ffarr_pushgrowT(&t->cuetrks, 8, struct cuetrk)))
+			return -1;
+		ct->from = (from - base) * rate / 75;
+		ct->to = (to != 0) ? (to - base) * rate / 75 : 0;
+		ffstr_set(&ct->meta, s.ptr, 0);
+	}
+	return (t->cuetrks.len != 0) ? 0 : -1;
+}
+
+#undef FILT_NAME
+#define FILT_NAME  "#soundmod.cuesplit"
+
+static void* cuesplit_open(fmed_filt *d)
+{
+	const char *cue = d->track->getvalstr(d->trk, "cue_split")
+		, *output = d->track->getvalstr(d->trk, "output");
+	if (cue == FMED_PNULL || output == FMED_PNULL)
+		return FMED_FILT_SKIP;
+
+	if (!d->audio.fmt.ileaved && d->audio.fmt.channels > TEE_MAXCHAN) {
+		errlog(core, d->trk, FILT_NAME, "too many channels: %u", d->audio.fmt.channels);
+		return NULL;
+	}
+
+	struct tee *t = ffmem_new(struct tee);
+	if (t == NULL)
+		return NULL;
+	fflk_init(&t->lk);
+	t->ref = 1;
+	t->trk = d->trk;
+	t->track = d->track;
+
+	if (NULL == (t->outputs = ffsz_alcopyz(output))
+		|| NULL == (t->cuedata = ffsz_alcopyz(cue))) {
+		tee_unref(t);
+		return NULL;
+	}
+
+	if (0 != cuesplit_parse(t, d->audio.fmt.sample_rate)) {
+		errlog(core, d->trk, FILT_NAME, "invalid CUE tracks list");
+		tee_unref(t);
+		return NULL;
+	}
+	return t;
+}
+
+/** Create branch track for the current CUE track.  Thread: main. */
+static void cuesplit_branch_create(void *param)
+{
+	struct tee *t = param;
+	ffstr out;
+	ffstr_setz(&out, t->outputs);
+	const struct cuetrk *ct = &((struct cuetrk*)t->cuetrks.ptr)[t->icue];
+
+	if (0 != tee_branch_add(t, &out, ct, -1)) {
+		errlog(core, t->trk, FILT_NAME, "can't create track for CUE track #%u", t->icue + 1);
+		t->err = 1;
+	}
+
+	t->track->cmd(t->trk, FMED_TRACK_WAKE);
+}
+
+static int cuesplit_process(void *ctx, fmed_filt *d)
+{
+	enum { I_NEWTRK, I_CREATING, I_DATA };
+	struct tee *t = ctx;
+
+	if (t->fmt.channels == 0) {
+		// properties for all branch tracks
+		d->track->copy_info(&t->info, d);
+		t->fmt = d->audio.fmt;
+	}
+	uint samp = ffpcm_size1(&t->fmt);
+
+	for (;;) {
+
+	if (t->icue == t->cuetrks.len) {
+		// all CUE tracks are written
+		d->outlen = 0;
+		return FMED_RLASTOUT;
+	}
+	const struct cuetrk *ct = &((struct cuetrk*)t->cuetrks.ptr)[t->icue];
+
+	switch (t->state) {
+	case I_NEWTRK:
+		fflk_lock(&t->lk);
+		if (t->branches.len != 0) {
+			// the previous branch is still active
+			t->parent_waiting = 1;
+			fflk_unlock(&t->lk);
+			return FMED_RASYNC;
+		}
+		fflk_unlock(&t->lk);
+
+		t->state = I_CREATING;
+		fftask_set(&t->task, &cuesplit_branch_create, t);
+		core->cmd(FMED_TASK_XPOST, &t->task, 0);
+		return FMED_RASYNC;
+
+	case I_CREATING:
+		if (t->err)
+			return FMED_RERR;
+		t->state = I_DATA;
+		break;
+	}
+
+	uint64 pos = d->audio.pos + t->off;
+	size_t n = d->datalen / samp - t->off;
+
+	if (pos < ct->from) {
+		// skip the gap before CUE track
+		size_t skip = ffmin(ct->from - pos, n);
+		t->off += skip;
+		n -= skip;
+		pos += skip;
+	}
+
+	ffbool last = 0;
+	if (ct->to != 0 && pos + n >= ct->to) {
+		n = (ct->to > pos) ? ct->to - pos : 0;
+		last = 1;
+	} else if (d->flags & FMED_FLAST)
+		last = 1;
+
+	if (n == 0 && !last) {
+		t->off = 0;
+		d->datalen = 0;
+		return FMED_RMORE;
+	}
+
+	fflk_lock(&t->lk);
+	struct tee_block *blk = &t->blocks[t->published % TEE_BLOCKS];
+	if (blk->readers != 0) {
+		t->parent_waiting = 1;
+		fflk_unlock(&t->lk);
+		return FMED_RASYNC; //wait until the branch releases the block
+	}
+	fflk_unlock(&t->lk);
+
+	if (0 != tee_block_fill(t, blk, d, t->off, n)) {
+		errlog(core, d->trk, FILT_NAME, "%s", ffmem_alloc_S);
+		return FMED_RERR;
+	}
+	blk->pos -= ct->from;
+	blk->last = last;
+	t->off += n;
+
+	fflk_lock(&t->lk);
+	blk->readers = t->branches.len;
+	t->published++;
+	tee_wake_branches(t);
+	fflk_unlock(&t->lk);
+
+	if (last) {
+		dbglog(core, d->trk, FILT_NAME, "CUE track #%u: finished at sample #%U"
+			, t->icue + 1, pos + n);
+		t->icue++;
+		t->state = I_NEWTRK;
+		if ((d->flags & FMED_FLAST) && t->off == d->datalen / samp)
+			t->icue = t->cuetrks.len; //no more input data for the next CUE tracks
+	}
+	}
+}
+
+#undef FILT_NAME
+#define FILT_NAME  "#soundmod.split"
+
+enum {
+	SPLIT_SILENCE_DEF_TIME = 2000, //msec
+	SPLIT_SILENCE_WINDOW = 20, //msec
+};
+
+/** Signal level of a block of samples. */
+struct pcm_level {
+	double peak; //max. absolute value (0..1.0)
+	double sumsq; //sum of squared values (-1.0..1.0)
+	size_t n; //number of values
+};
+
+static void level_i16(struct pcm_level *lev, const short *d, size_t n)
+{
+	size_t i = 0;
+	int max = 0, min = 0;
+	uint64 sum = 0;
+
+#ifdef __SSE2__
+	__m128i vmax = _mm_setzero_si128(), vmin = _mm_setzero_si128()
+		, vsum = _mm_setzero_si128(), zero = _mm_setzero_si128();
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i x = _mm_loadu_si128((void*)(d + i));
+		vmax = _mm_max_epi16(vmax, x);
+		vmin = _mm_min_epi16(vmin, x);
+		// a pair of squares is at most 2^31: it fits in uint32
+		__m128i sq = _mm_madd_epi16(x, x);
+		vsum = _mm_add_epi64(vsum, _mm_unpacklo_epi32(sq, zero));
+		vsum = _mm_add_epi64(vsum, _mm_unpackhi_epi32(sq, zero));
+	}
+
+	short amax[8], amin[8];
+	uint64 asum[2];
+	_mm_storeu_si128((void*)amax, vmax);
+	_mm_storeu_si128((void*)amin, vmin);
+	_mm_storeu_si128((void*)asum, vsum);
+	for (uint k = 0;  k != 8;  k++) {
+		max = ffmax(max, amax[k]);
+		min = ffmin(min, amin[k]);
+	}
+	sum = asum[0] + asum[1];
+#endif
+
+	for (;  i != n;  i++) {
+		int v = d[i];
+		max = ffmax(max, v);
+		min = ffmin(min, v);
+		sum += (uint)(v * v);
+	}
+
+	double peak = (double)ffmax(max, -min) / 32768;
+	lev->peak = ffmax(lev->peak, peak);
+	lev->sumsq += (double)sum / (32768.0 * 32768.0);
+	lev->n += n;
+}
+
+static void level_f32(struct pcm_level *lev, const float *d, size_t n)
+{
+	size_t i = 0;
+	float max = 0;
+	double sum = 0;
+
+#ifdef __SSE2__
+	__m128 vmax = _mm_setzero_ps(), vsum = _mm_setzero_ps();
+	const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	for (;  i + 4 <= n;  i += 4) {
+		__m128 x = _mm_loadu_ps(d + i);
+		vmax = _mm_max_ps(vmax, _mm_and_ps(x, absmask));
+		vsum = _mm_add_ps(vsum, _mm_mul_ps(x, x));
+	}
+
+	float amax[4], asum[4];
+	_mm_storeu_ps(amax, vmax);
+	_mm_storeu_ps(asum, vsum);
+	for (uint k = 0;  k != 4;  k++) {
+		max = ffmax(max, amax[k]);
+		sum += asum[k];
+	}
+#endif
+
+	for (;  i != n;  i++) {
+		float v = d[i];
+		max = ffmax(max, ffabs(v));
+		sum += v * v;
+	}
+
+	lev->peak = ffmax(lev->peak, (double)max);
+	lev->sumsq += sum;
+	lev->n += n;
+}
+
+/** 24- and 32-bit integer samples. */
+static void level_int(struct pcm_level *lev, const byte *d, size_t n, uint width)
+{
+	double max = 0, sum = 0;
+	for (size_t i = 0;  i != n;  i++) {
+		int v;
+		if (width == 24) {
+			v = (int)(((uint)d[0] << 8) | ((uint)d[1] << 16) | ((uint)d[2] << 24)) >> 8;
+			d += 3;
+		} else {
+			v = *(int*)d;
+			d += 4;
+		}
+		double f = (width == 24) ? (double)v / 0x800000 : (double)v / 0x80000000U;
+		max = ffmax(max, ffabs(f));
+		sum += f * f;
+	}
+
+	lev->peak = ffmax(lev->peak, max);
+	lev->sumsq += sum;
+	lev->n += n;
+}
+
+/** Add samples of all channels to the level stats.
+@off: offset (in samples) within the input data
+Return -1 if the format isn't supported. */
+static int pcm_level_add(struct pcm_level *lev, const ffpcmex *fmt, const fmed_filt *d, size_t off, size_t samples)
+{
+	uint ich, nch = 1;
+	size_t n = samples * fmt->channels, chsamp = ffpcm_bits(fmt->format) / 8;
+	const void *data = (char*)d->data + off * chsamp * fmt->channels;
+	if (!fmt->ileaved) {
+		nch = fmt->channels;
+		n = samples;
+	}
+
+	for (ich = 0;  ich != nch;  ich++) {
+		if (!fmt->ileaved)
+			data = (char*)d->datani[ich] + off * chsamp;
+
+		switch (fmt->format) {
+		case FFPCM_16:
+			level_i16(lev, data, n);
+			break;
+		case FFPCM_24:
+			level_int(lev, data, n, 24);
+			break;
+		case FFPCM_32:
+			level_int(lev, data, n, 32);
+			break;
+		case FFPCM_FLOAT:
+			level_f32(lev, data, n);
+			break;
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** Find where the silence becomes long enough to finish the segment.
+Return the number of samples to write to the current segment;  t->sil_skip is set if the segment is finished. */
+static size_t split_silence_find(struct tee *t, const fmed_filt *d, size_t off, size_t n)
+{
+	size_t i;
+	for (i = 0;  i < n;  i += t->sil_window) {
+		size_t m = ffmin(t->sil_window, n - i);
+		struct pcm_level lev = {0};
+		pcm_level_add(&lev, &t->fmt, d, off + i, m);
+
+		if (lev.sumsq >= t->sil_level * lev.n) {
+			t->sil_run = 0;
+			continue;
+		}
+
+		t->sil_run += m;
+		if (t->sil_run >= t->sil_samples) {
+			dbglog(core, d->trk, FILT_NAME, "segment #%u: silence for %u msec"
+				, t->iseg + 1, (int)ffpcm_time(t->sil_run, t->fmt.sample_rate));
+			t->sil_skip = 1;
+			return i + m;
+		}
+	}
+	return n;
+}
+
+/** Skip silent data.
+Return the number of samples to drop;  t->sil_skip is reset when the signal resumes. */
+static size_t split_silence_skip(struct tee *t, const fmed_filt *d, size_t off, size_t n)
+{
+	size_t i;
+	for (i = 0;  i < n;  i += t->sil_window) {
+		size_t m = ffmin(t->sil_window, n - i);
+		struct pcm_level lev = {0};
+		pcm_level_add(&lev, &t->fmt, d, off + i, m);
+
+		if (lev.sumsq >= t->sil_level * lev.n) {
+			dbglog(core, d->trk, FILT_NAME, "signal at sample #%U  peak:%.2FdB  rms:%.2FdB"
+				, d->audio.pos + off + i
+				, ffpcm_gain2db(lev.peak), ffpcm_gain2db(sqrt(lev.sumsq / lev.n)));
+			t->sil_skip = 0;
+			t->sil_run = 0;
+			return i;
+		}
+	}
+	return n;
+}
+
+static void* split_open(fmed_filt *d)
+{
+	int64 msec = d->track->getval(d->trk, "split_time")
+		, size = d->track->getval(d->trk, "split_size")
+		, sil = d->track->getval(d->trk, "split_silence");
+	const char *output = d->track->getvalstr(d->trk, "output");
+	if ((msec == FMED_NULL && size == FMED_NULL && sil == FMED_NULL) || output == FMED_PNULL)
+		return FMED_FILT_SKIP;
+
+	if (sil != FMED_NULL) {
+		switch (d->audio.fmt.format) {
+		case FFPCM_16:
+		case FFPCM_24:
+		case FFPCM_32:
+		case FFPCM_FLOAT:
+			break;
+		default:
+			errlog(core, d->trk, FILT_NAME, "silence detection: unsupported format: %s"
+				, ffpcm_fmtstr(d->audio.fmt.format));
+			return NULL;
+		}
+	}
+
+	if (!d->audio.fmt.ileaved && d->audio.fmt.channels > TEE_MAXCHAN) {
+		errlog(core, d->trk, FILT_NAME, "too many channels: %u", d->audio.fmt.channels);
+		return NULL;
+	}
+
+	struct tee *t = ffmem_new(struct tee);
+	if (t == NULL)
+		return NULL;
+	fflk_init(&t->lk);
+	t->ref = 1;
+	t->trk = d->trk;
+	t->track = d->track;
+
+	if (NULL == ffsz_findc(output, '$')) {
+		// "NAME.EXT" -> "NAME-$segment.EXT":  each segment needs its own file name
+		ffstr name, ext;
+		ffarr a = {0};
+		ffpath_splitname(output, ffsz_len(output), &name, &ext);
+		if (0 != ffstr_catfmt(&a, "%S-$segment.%S%Z", &name, &ext))
+			t->outputs = a.ptr;
+	} else
+		t->outputs = ffsz_alcopyz(output);
+	if (t->outputs == NULL) {
+		tee_unref(t);
+		return NULL;
+	}
+
+	if (msec != FMED_NULL)
+		t->split_samples = ffpcm_samples(msec, d->audio.fmt.sample_rate);
+	if (size != FMED_NULL)
+		t->split_size = size;
+	if (sil != FMED_NULL) {
+		// "split_silence" is -dB*100
+		double gain = ffpcm_db2gain(-(double)sil / 100);
+		t->sil_level = gain * gain;
+		int64 sil_time = d->track->getval(d->trk, "split_silence_time");
+		if (sil_time == FMED_NULL)
+			sil_time = SPLIT_SILENCE_DEF_TIME;
+		t->sil_samples = ffpcm_samples(sil_time, d->audio.fmt.sample_rate);
+		t->sil_window = ffmax(ffpcm_samples(SPLIT_SILENCE_WINDOW, d->audio.fmt.sample_rate), 1);
+		t->sil_skip = 1; //the first segment starts with the signal
+	}
+	dbglog(core, d->trk, FILT_NAME, "segment duration:%U samples  size:%U bytes  silence:%.2FdB for %U samples"
+		, t->split_samples, t->split_size, -(double)((sil != FMED_NULL) ? sil : 0) / 100, t->sil_samples);
+	return t;
+}
+
+/** Create branch track for the next segment.  Thread: main. */
+static void split_branch_create(void *param)
+{
+	struct tee *t = param;
+	ffstr out;
+	int r = 0;
+
+	fflk_lock(&t->lk);
+	uint closed = t->parent_closed;
+	fflk_unlock(&t->lk);
+
+	if (!closed) {
+		ffstr_setz(&out, t->outputs);
+		if (0 != (r = tee_branch_add(t, &out, NULL, t->nseg_created)))
+			errlog(core, t->trk, FILT_NAME, "can't create track for segment #%u", t->nseg_created + 1);
+	}
+
+	fflk_lock(&t->lk);
+	t->creating = 0;
+	if (r != 0)
+		t->err = 1;
+	else
+		t->nseg_created++;
+	if (t->parent_waiting && !t->parent_closed) {
+		t->parent_waiting = 0;
+		t->track->cmd(t->trk, FMED_TRACK_WAKE);
+	}
+	fflk_unlock(&t->lk);
+	tee_unref(t);
+}
+
+/** Start creating a branch for the next segment.  Lock must be held. */
+static void split_branch_prepare(struct tee *t)
+{
+	t->creating = 1;
+	t->ref++;
+	fftask_set(&t->task, &split_branch_create, t);
+	core->cmd(FMED_TASK_XPOST, &t->task, 0);
+}
+
+static int split_process(void *ctx, fmed_filt *d)
+{
+	struct tee *t = ctx;
+
+	if (t->fmt.channels == 0) {
+		// properties for all branch tracks
+		d->track->copy_info(&t->info, d);
+		t->fmt = d->audio.fmt;
+		t->seg_start = d->audio.pos;
+	}
+	uint samp = ffpcm_size1(&t->fmt);
+	size_t total = d->datalen / samp;
+
+	for (;;) {
+
+	if (t->off == total && (d->flags & FMED_FLAST)) {
+		d->outlen = 0;
+		return FMED_RLASTOUT;
+	}
+
+	fflk_lock(&t->lk);
+	if (t->err) {
+		fflk_unlock(&t->lk);
+		return FMED_RERR;
+	}
+
+	if (t->nseg_created <= t->iseg) {
+		// the branch for the current segment isn't ready yet
+		if (!t->creating)
+			split_branch_prepare(t);
+		t->parent_waiting = 1;
+		fflk_unlock(&t->lk);
+		return FMED_RASYNC;
+	}
+
+	if (t->nseg_created == t->iseg + 1 && !t->creating)
+		split_branch_prepare(t); // the branch for the next segment will be ready when it's needed
+
+	uint size_reached = (t->split_size != 0 && t->seg_written >= t->split_size);
+	fflk_unlock(&t->lk);
+
+	if (t->sil_skip) {
+		// drop silence between segments
+		t->off += split_silence_skip(t, d, t->off, total - t->off);
+		if (t->sil_skip) {
+			if (d->flags & FMED_FLAST)
+				continue;
+			t->off = 0;
+			d->datalen = 0;
+			return FMED_RMORE;
+		}
+		t->seg_start = d->audio.pos + t->off;
+		size_reached = 0;
+	}
+
+	uint64 pos = d->audio.pos + t->off;
+	size_t n = total - t->off;
+
+	ffbool last = 0;
+	if (t->split_samples != 0 && pos + n >= t->seg_start + t->split_samples) {
+		n = t->seg_start + t->split_samples - pos;
+		last = 1;
+	} else if (size_reached) {
+		last = 1;
+	}
+
+	if (n == 0 && !last) {
+		t->off = 0;
+		d->datalen = 0;
+		return FMED_RMORE;
+	}
+
+	fflk_lock(&t->lk);
+	struct tee_block *blk = &t->blocks[t->published % TEE_BLOCKS];
+	if (blk->readers != 0) {
+		t->parent_waiting = 1;
+		fflk_unlock(&t->lk);
+		return FMED_RASYNC; //wait until the branch releases the block
+	}
+	fflk_unlock(&t->lk);
+
+	if (t->sil_level != 0 && n != 0) {
+		n = split_silence_find(t, d, t->off, n);
+		if (t->sil_skip)
+			last = 1;
+	}
+
+	if (0 != tee_block_fill(t, blk, d, t->off, n)) {
+		errlog(core, d->trk, FILT_NAME, "%s", ffmem_alloc_S);
+		return FMED_RERR;
+	}
+	blk->pos -= t->seg_start;
+	t->off += n;
+	blk->last = last || ((d->flags & FMED_FLAST) && t->off == total);
+
+	fflk_lock(&t->lk);
+	blk->readers = t->branches.len;
+	t->published++;
+	tee_wake_branches(t);
+	if (last) {
+		dbglog(core, d->trk, FILT_NAME, "segment #%u: finished at sample #%U"
+			, t->iseg + 1, pos + n);
+		t->iseg++;
+		t->seg_start = pos + n;
+		t->seg_written = 0;
+	}
+	fflk_unlock(&t->lk);
+	}
+}
+
+#undef FILT_NAME
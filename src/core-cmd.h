@@ -30,8 +30,13 @@ typedef struct fmed_cmd {
 	byte mix;
 	byte tags;
 	byte info;
+	byte probe;
 	uint seek_time;
 	uint until_time;
+	uint split_time; //msec
+	uint64 split_size;
+	float split_silence; //dB
+	uint split_silence_time; //msec
 	uint prebuffer;
 	float start_level; //dB
 	float stop_level; //dB
@@ -39,6 +44,7 @@ typedef struct fmed_cmd {
 	uint stop_level_mintime; //msec
 	uint64 fseek;
 	ffstr meta;
+	byte edit_tags;
 	ffarr2 include_files; //ffstr[]
 	ffarr2 exclude_files; //ffstr[]
 
@@ -46,6 +52,7 @@ typedef struct fmed_cmd {
 	byte volume;
 	byte pcm_peaks;
 	byte pcm_crc;
+	byte loudness;
 	byte dynanorm;
 
 	float vorbis_qual;
@@ -64,8 +71,14 @@ typedef struct fmed_cmd {
 	byte notui;
 	byte gui;
 	byte print_time;
+	byte decode_only;
+	uint bench;
+	uint bench_cpu;
+	byte profile;
+	char *profile_json;
 	byte debug;
 	byte cue_gaps;
+	byte cue_split;
 
 	ffstr outfn;
 	byte overwrite;
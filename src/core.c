@@ -109,6 +109,7 @@ static void mod_freeiface(core_mod *m);
 
 static int wrk_init(struct worker *w, uint thread);
 static void wrk_destroy(struct worker *w);
+static void wrk_sched(struct worker *w);
 static int FFTHDCALL core_work(void *param);
 
 static const void* core_iface(const char *name);
@@ -177,8 +178,17 @@ static const char *const im_enumstr[] = {
 };
 static const ffpars_enumlist im_enum = { im_enumstr, FFCNT(im_enumstr), FFPARS_DSTOFF(fmed_config, instance_mode) };
 
+// enum RT_POLICY
+static const char *const rtpol_enumstr[] = {
+	"fifo", "rr"
+};
+static const ffpars_enumlist rtpol_enum = { rtpol_enumstr, FFCNT(rtpol_enumstr), FFPARS_DSTOFF(fmed_config, rt_policy) };
+
 static const ffpars_arg fmed_conf_args[] = {
 	{ "workers",  FFPARS_TINT8, FFPARS_DSTOFF(fmed_config, workers) },
+	{ "cpu_affinity",  FFPARS_TBOOL8, FFPARS_DSTOFF(fmed_config, cpu_affinity) },
+	{ "rt_priority",  FFPARS_TINT8, FFPARS_DSTOFF(fmed_config, rt_priority) },
+	{ "rt_policy",  FFPARS_TENUM | FFPARS_F8BIT, FFPARS_DST(&rtpol_enum) },
 	{ "mod",  FFPARS_TSTR | FFPARS_FNOTEMPTY | FFPARS_FSTRZ | FFPARS_FCOPY | FFPARS_FMULTI, FFPARS_DST(&fmed_conf_mod) }
 	, { "mod_conf",  FFPARS_TOBJ | FFPARS_FOBJ1 | FFPARS_FNOTEMPTY | FFPARS_FMULTI, FFPARS_DST(&fmed_conf_modconf) }
 	, { "output",  FFPARS_TSTR | FFPARS_FNOTEMPTY | FFPARS_FMULTI, FFPARS_DST(&fmed_conf_output) }
@@ -607,6 +617,7 @@ static int cmd_init(fmed_cmd *cmd)
 	cmd->flac_complevel = 0xff;
 
 	cmd->lbdev_name = (uint)-1;
+	cmd->bench_cpu = (uint)-1;
 	cmd->volume = 100;
 	cmd->cue_gaps = 255;
 	return 0;
@@ -621,6 +632,7 @@ static void cmd_destroy(fmed_cmd *cmd)
 	ffmem_safefree(cmd->aac_profile);
 	ffmem_safefree(cmd->trackno);
 	ffmem_safefree(cmd->conf_fn);
+	ffmem_safefree(cmd->profile_json);
 
 	ffmem_safefree(cmd->globcmd_pipename);
 	ffstr_free(&cmd->globcmd);
@@ -1168,15 +1180,23 @@ static int core_open(void)
 #if defined FF_WIN && FF_WIN < 0x0600
 	ffkqu_init();
 #endif
+	ffsysconf sc;
+	ffsc_init(&sc);
+	fmed->ncpu = ffmax(ffsc_get(&sc, _SC_NPROCESSORS_ONLN), 1);
 	uint n = fmed->conf.workers;
-	if (n == 0) {
-		ffsysconf sc;
-		ffsc_init(&sc);
-		n = ffsc_get(&sc, _SC_NPROCESSORS_ONLN);
+	if (n == 0)
+		n = fmed->ncpu;
+
+	// audio device tracks get an additional worker, so they don't wait for conversions and UI
+	uint nw = n;
+	if (fmed->conf.rt_priority != 0) {
+		fmed->rt_worker = n;
+		nw++;
 	}
-	if (NULL == ffarr_alloczT(&fmed->workers, n, struct worker))
+
+	if (NULL == ffarr_alloczT(&fmed->workers, nw, struct worker))
 		return 1;
-	fmed->workers.len = n;
+	fmed->workers.len = nw;
 	struct worker *w = (void*)fmed->workers.ptr;
 	if (0 != wrk_init(w, 0))
 		return 1;
@@ -1219,6 +1239,56 @@ static int wrk_init(struct worker *w, uint thread)
 	return 0;
 }
 
+/** Pin the current thread to a CPU;  set real-time scheduling policy for the low-latency worker.
+On failure the worker continues with the default settings. */
+static void wrk_sched(struct worker *w)
+{
+	uint i = w - (struct worker*)fmed->workers.ptr;
+	ffbool lowlat = (i != 0 && i == fmed->rt_worker);
+
+	if (fmed->conf.cpu_affinity && fmed->cmd.bench_cpu == (uint)-1) {
+		// the low-latency worker owns the last CPU;  the other workers are spread over the rest
+		uint cpu;
+		if (lowlat)
+			cpu = fmed->ncpu - 1;
+		else
+			cpu = i % ffmax(fmed->ncpu - (fmed->rt_worker != 0), 1);
+
+#if defined FF_LINUX
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (0 != sched_setaffinity(0, sizeof(set), &set))
+			syswarnlog(NULL, "sched_setaffinity(): worker #%u: CPU #%u", i, cpu);
+		else
+			dbglog0("worker #%u: pinned to CPU #%u", i, cpu);
+
+#elif defined FF_WIN
+		if (0 == SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu))
+			syswarnlog(NULL, "SetThreadAffinityMask(): worker #%u: CPU #%u", i, cpu);
+		else
+			dbglog0("worker #%u: pinned to CPU #%u", i, cpu);
+#endif
+	}
+
+	if (lowlat) {
+#if defined FF_LINUX
+		int policy = (fmed->conf.rt_policy == RT_RR) ? SCHED_RR : SCHED_FIFO;
+		struct sched_param sp = {};
+		sp.sched_priority = ffmin(fmed->conf.rt_priority, sched_get_priority_max(policy));
+		if (0 != sched_setscheduler(0, policy, &sp))
+			syswarnlog(NULL, "sched_setscheduler(): worker #%u: priority %u: using the default scheduling"
+				, i, sp.sched_priority);
+		else
+			dbglog0("worker #%u: real-time priority %u", i, sp.sched_priority);
+
+#elif defined FF_WIN
+		if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+			syswarnlog(NULL, "SetThreadPriority(): worker #%u: using the default priority", i);
+#endif
+	}
+}
+
 static void wrk_destroy(struct worker *w)
 {
 	if (w->thd != FFTHD_INV) {
@@ -1239,13 +1309,21 @@ uint core_job_new(uint flags)
 	struct worker *w, *ww = (void*)fmed->workers.ptr;
 	uint id = 0, j = -1;
 
-	if (flags == 0) {
+	if (flags == CORE_JOB_LOWLAT && fmed->rt_worker != 0) {
+		id = fmed->rt_worker;
+		w = &ww[id];
+		goto init;
+	}
+
+	if (flags != CORE_JOB_ANY) {
 		id = 0;
 		w = &ww[0];
 		goto done;
 	}
 
 	FFARR_WALKT(&fmed->workers, w, struct worker) {
+		if (fmed->rt_worker != 0 && w == &ww[fmed->rt_worker])
+			continue;
 		if (w->njobs < j) {
 			id = w - ww;
 			j = w->njobs;
@@ -1255,6 +1333,7 @@ uint core_job_new(uint flags)
 	}
 	w = &ww[id];
 
+init:
 	if (!w->init
 		&& 0 != wrk_init(w, 1)) {
 		id = 0;
@@ -1298,6 +1377,7 @@ static int FFTHDCALL core_work(void *param)
 {
 	struct worker *w = param;
 	w->id = ffthd_curid();
+	wrk_sched(w);
 	ffkqu_entry *ents = ffmem_callocT(FMED_KQ_EVS, ffkqu_entry);
 	if (ents == NULL)
 		return -1;
@@ -1445,6 +1525,19 @@ static ssize_t core_cmd(uint signo, ...)
 		break;
 	}
 
+	case FMED_WORKER_INFO: {
+		uint wid = va_arg(va, uint);
+		fmed_worker_info *wi = va_arg(va, fmed_worker_info*);
+		if (wid >= fmed->workers.len) {
+			r = -1;
+			break;
+		}
+		const struct worker *w = ffarr_itemT(&fmed->workers, wid, struct worker);
+		wi->njobs = w->njobs;
+		wi->running = w->init;
+		break;
+	}
+
 #ifdef FF_WIN
 	case FMED_WOH_INIT:
 		if (fmed->woh == NULL)
@@ -1500,13 +1593,28 @@ static void core_task(fftask *task, uint cmd)
 	}
 }
 
+/** Get the worker running in the current thread.
+Return the main worker for a non-worker thread. */
+static struct worker* wrk_cur(void)
+{
+	struct worker *w;
+	ffthd_id id = ffthd_curid();
+	FFARR_WALKT(&fmed->workers, w, struct worker) {
+		if (w->init && w->id == id)
+			return w;
+	}
+	return (void*)fmed->workers.ptr;
+}
+
+/** Each worker has its own timer queue:
+ a timer is processed in the worker that sets it, so it must be set and stopped from the same worker. */
 static int core_timer(fftmrq_entry *tmr, int64 _interval, uint flags)
 {
-	struct worker *w = (void*)fmed->workers.ptr;
+	struct worker *w = wrk_cur();
 	int interval = _interval;
 	uint period = ffmin((uint)ffabs(interval), TMR_INT);
-	dbglog(core, NULL, "core", "timer:%p  interval:%d  handler:%p  param:%p"
-		, tmr, interval, tmr->handler, tmr->param);
+	dbglog(core, NULL, "core", "timer:%p  interval:%d  handler:%p  param:%p  worker:%u"
+		, tmr, interval, tmr->handler, tmr->param, (uint)(w - (struct worker*)fmed->workers.ptr));
 
 	if (w->kq == FF_BADFD) {
 		dbglog0("timer's not ready", 0);
@@ -1558,6 +1666,19 @@ static int64 core_getval(const char *name)
 		return fmed->cmd.tags;
 	else if (!ffsz_cmp(name, "cue_gaps") && fmed->cmd.cue_gaps != 255)
 		return fmed->cmd.cue_gaps;
+	else if (!ffsz_cmp(name, "cue_split"))
+		return fmed->cmd.cue_split;
+	else if (!ffsz_cmp(name, "parallel")) {
+		// batch processing: process the tracks on all workers at once
+		uint nw = fmed->workers.len - (fmed->rt_worker != 0);
+		if ((fmed->cmd.loudness || fmed->cmd.edit_tags) && !fmed->cmd.gui)
+			return nw;
+		// header reads are short and wait mostly for I/O: keep more files open than there are workers.
+		// The queue starts these tracks with FMED_TRACK_XSTART, so they are spread among all workers.
+		if (fmed->cmd.probe && !fmed->cmd.gui)
+			return nw * 8;
+		return FMED_NULL;
+	}
 	else if (!ffsz_cmp(name, "instance_mode"))
 		return fmed->conf.instance_mode;
 	return FMED_NULL;
@@ -1567,22 +1688,67 @@ static const char *const loglevs[] = {
 	"error", "warning", "info", "info", "debug",
 };
 
+/** Cached "hh:mm:ss" part of log time, so the local time is computed once per second. */
+static struct {
+	ffatomic seq; //odd value: the data is being updated
+	uint64 sec;
+	uint len;
+	char hms[24];
+} logtime;
+
+/** Get "hh:mm:ss.msc" string for the current time. */
+static size_t log_time(char *stime, size_t cap)
+{
+	fftime t;
+	size_t seq, r;
+	uint64 sec;
+
+	fftime_now(&t);
+	sec = fftime_sec(&t);
+
+	seq = ffatom_get(&logtime.seq);
+	ffatom_fence_acq();
+	if (!(seq & 1) && logtime.sec == sec && logtime.len != 0) {
+		r = logtime.len;
+		ffmemcpy(stime, logtime.hms, r);
+		ffatom_fence_acq();
+		if (seq == ffatom_get(&logtime.seq))
+			return r + ffs_fmt(stime + r, stime + cap, ".%03u", (int)(fftime_usec(&t) / 1000));
+	}
+
+	ffdtm dt;
+	fftime_split(&dt, &t, FFTIME_TZLOCAL);
+	r = fftime_tostr(&dt, stime, cap, FFTIME_HMS_MSEC);
+	if (r <= FFSLEN(".msc"))
+		return r;
+
+	// update the cache, unless another thread is doing it
+	if (!(seq & 1) && ffatom_cmpset(&logtime.seq, seq, seq + 1)) {
+		ffatom_fence_rel();
+		logtime.sec = sec;
+		logtime.len = r - FFSLEN(".msc");
+		ffmemcpy(logtime.hms, stime, logtime.len);
+		ffatom_fence_rel();
+		ffatom_set(&logtime.seq, seq + 2);
+	}
+	return r;
+}
+
 static void core_log(uint flags, void *trk, const char *module, const char *fmt, ...)
 {
 	char stime[32];
-	ffdtm dt;
-	fftime t;
 	size_t r;
 	fmed_logdata ld;
 	uint lev = flags & _FMED_LOG_LEVMASK;
 	int e;
 
+	if (lev > core->loglev)
+		return;
+
 	if (flags & FMED_LOG_SYS)
 		e = fferr_last();
 
-	fftime_now(&t);
-	fftime_split(&dt, &t, FFTIME_TZLOCAL);
-	r = fftime_tostr(&dt, stime, sizeof(stime), FFTIME_HMS_MSEC);
+	r = log_time(stime, sizeof(stime) - 1);
 	stime[r] = '\0';
 	ld.stime = stime;
 	ld.tid = ffthd_curid();
@@ -23,6 +23,9 @@ typedef struct fmed_config {
 	byte instance_mode;
 	byte prevent_sleep;
 	byte workers;
+	byte cpu_affinity;
+	byte rt_priority;
+	byte rt_policy; //enum RT_POLICY
 	ffpcm inp_pcm;
 	const fmed_modinfo *output;
 	const fmed_modinfo *input;
@@ -33,8 +36,15 @@ typedef struct fmed_config {
 	uint skip_line :1;
 } fmed_config;
 
+enum RT_POLICY {
+	RT_FIFO,
+	RT_RR,
+};
+
 typedef struct fmedia {
 	ffarr workers; //worker[]
+	uint rt_worker; //index of the low-latency worker for audio device tracks;  0: not used
+	uint ncpu;
 	ffkqu_time kqutime;
 
 	uint stopped :1
@@ -64,8 +74,15 @@ extern fmed_core *core;
 extern const fmed_track _fmed_track;
 
 
+enum CORE_JOB {
+	CORE_JOB_MAIN, //run on the main worker
+	CORE_JOB_ANY, //run on the least busy worker
+	CORE_JOB_LOWLAT, //run on the low-latency worker (or the main worker if it's not used)
+};
+
 /** Find the worker with the least number of active jobs.
 Initialize data and create a thread if necessary.
+flags: enum CORE_JOB
 Return worker ID. */
 extern uint core_job_new(uint flags);
 
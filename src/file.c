@@ -12,6 +12,13 @@ Copyright (c) 2015 Simon Zolin */
 #include <FFOS/dir.h>
 #include <FF/path.h>
 
+#ifdef FF_LINUX
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#endif
+
 
 #undef dbglog
 #undef errlog
@@ -26,11 +33,13 @@ struct file_in_conf_t {
 	size_t bsize;
 	size_t align;
 	byte directio;
+	byte io_uring;
 };
 
 struct file_out_conf_t {
 	size_t bsize;
 	size_t prealloc;
+	byte io_uring;
 	uint file_del :1;
 	uint prealloc_grow :1;
 };
@@ -47,8 +56,32 @@ typedef struct databuf {
 	char *ptr;
 	uint64 off;
 	uint len;
+	uint ready :1 //io_uring: read is complete, but the previous buffers aren't yet
+		, busy :1; //io_uring: write is in progress
 } databuf;
 
+#ifdef FF_LINUX
+/** io_uring instance.  Completions are signalled via eventfd attached to the worker's kqueue. */
+typedef struct uring {
+	int fd;
+	ffkevent kev;
+	uint nqueued; //requests submitted but not yet reaped
+
+	uint *sq_tail, *sq_mask, *sq_array;
+	uint *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+} uring;
+
+static int uring_init(uring *u, uint entries, const databuf *bufs, uint nbufs, size_t bsize
+	, fffd kq, void (*handler)(void *udata), void *udata);
+static void uring_close(uring *u);
+static int uring_submit(uring *u, uint op, fffd fd, uint ibuf, void *ptr, size_t len, uint64 off);
+static int uring_reap(uring *u, struct io_uring_cqe *cqe);
+#endif
+
 typedef struct fmed_file {
 	const char *fn;
 	fffd fd;
@@ -61,6 +94,10 @@ typedef struct fmed_file {
 	uint64 fsize;
 	uint64 foff; //current read position
 	ffaio_filetask ftask;
+#ifdef FF_LINUX
+	uring *ring;
+	uint inflight; //io_uring: buffers being read, starting at 'wdata'
+#endif
 	int64 seek; //user's read position
 
 	fmed_handler handler;
@@ -89,6 +126,15 @@ typedef struct fmed_fileout {
 	fftime modtime;
 	uint ok :1;
 
+#ifdef FF_LINUX
+	uring *ring;
+	databuf wbufs[4];
+	uint wcur; //io_uring: buffer being filled
+	size_t wbsize;
+	uint err :1
+		, want_write :1;
+#endif
+
 	struct {
 		uint nmwrite;
 		uint nfwrite;
@@ -101,6 +147,11 @@ typedef struct stdin_ctx {
 	ffarr buf;
 } stdin_ctx;
 
+typedef struct null_ctx {
+	void *trk;
+	uint64 size;
+} null_ctx;
+
 typedef struct stdout_ctx {
 	fffd fd;
 	ffarr buf;
@@ -133,12 +184,18 @@ static const fmed_filter fmed_file_input = {
 };
 
 static void file_read(void *udata);
+#ifdef FF_LINUX
+static int file_uring_open(fmed_file *f, fffd kq);
+static void file_uring_submit(fmed_file *f);
+static void file_uring_complete(void *udata);
+#endif
 
 static const ffpars_arg file_in_conf_args[] = {
 	{ "buffer_size",  FFPARS_TSIZE | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct file_in_conf_t, bsize) }
 	, { "buffers",  FFPARS_TINT | FFPARS_F8BIT,  FFPARS_DSTOFF(struct file_in_conf_t, nbufs) }
 	, { "align",  FFPARS_TSIZE | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct file_in_conf_t, align) }
 	, { "direct_io",  FFPARS_TBOOL | FFPARS_F8BIT,  FFPARS_DSTOFF(struct file_in_conf_t, directio) }
+	, { "io_uring",  FFPARS_TBOOL | FFPARS_F8BIT,  FFPARS_DSTOFF(struct file_in_conf_t, io_uring) }
 };
 
 
@@ -153,10 +210,18 @@ static const fmed_filter fmed_file_output = {
 
 static int fileout_writedata(fmed_fileout *f, const char *data, size_t len, fmed_filt *d);
 static char* fileout_getname(fmed_fileout *f, fmed_filt *d);
+static void fileout_prealloc(fmed_fileout *f, size_t len);
+#ifdef FF_LINUX
+static int fileout_uring_open(fmed_fileout *f, size_t bsize, fffd kq);
+static int fileout_uring_write(fmed_fileout *f, fmed_filt *d);
+static int fileout_uring_flush(fmed_fileout *f, fmed_filt *d);
+static void fileout_uring_complete(void *udata);
+#endif
 
 static const ffpars_arg file_out_conf_args[] = {
 	{ "buffer_size",  FFPARS_TSIZE | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct file_out_conf_t, bsize) }
 	, { "preallocate",  FFPARS_TSIZE | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct file_out_conf_t, prealloc) }
+	, { "io_uring",  FFPARS_TBOOL | FFPARS_F8BIT,  FFPARS_DSTOFF(struct file_out_conf_t, io_uring) }
 };
 
 //STDIN
@@ -175,6 +240,14 @@ static const fmed_filter file_stdout = {
 	&file_stdout_open, &file_stdout_write, &file_stdout_close
 };
 
+//NULL
+static void* file_null_open(fmed_filt *d);
+static int file_null_write(void *ctx, fmed_filt *d);
+static void file_null_close(void *ctx);
+static const fmed_filter file_null = {
+	&file_null_open, &file_null_write, &file_null_close
+};
+
 
 const fmed_mod* fmed_getmod_file(const fmed_core *_core)
 {
@@ -190,6 +263,129 @@ const fmed_mod* fmed_getmod_file(const fmed_core *_core)
 }
 
 
+#ifdef FF_LINUX
+/** Create io_uring with 'entries' slots, register data buffers and attach completion eventfd to kqueue. */
+static int uring_init(uring *u, uint entries, const databuf *bufs, uint nbufs, size_t bsize
+	, fffd kq, void (*handler)(void *udata), void *udata)
+{
+	struct io_uring_params p;
+	struct iovec iov[8];
+	ffmem_tzero(&p);
+	ffkev_init(&u->kev);
+	u->sq_ring = u->cq_ring = u->sqes = MAP_FAILED;
+
+	if (nbufs > FFCNT(iov)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (-1 == (u->fd = syscall(__NR_io_uring_setup, entries, &p)))
+		return -1;
+
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED)
+		return -1;
+
+	u->sq_tail = (uint*)((char*)u->sq_ring + p.sq_off.tail);
+	u->sq_mask = (uint*)((char*)u->sq_ring + p.sq_off.ring_mask);
+	u->sq_array = (uint*)((char*)u->sq_ring + p.sq_off.array);
+	u->cq_head = (uint*)((char*)u->cq_ring + p.cq_off.head);
+	u->cq_tail = (uint*)((char*)u->cq_ring + p.cq_off.tail);
+	u->cq_mask = (uint*)((char*)u->cq_ring + p.cq_off.ring_mask);
+	u->cqes = (void*)((char*)u->cq_ring + p.cq_off.cqes);
+
+	// the kernel pins the buffers once, so the fixed-buffer requests don't map user pages each time
+	for (uint i = 0;  i != nbufs;  i++) {
+		iov[i].iov_base = bufs[i].ptr;
+		iov[i].iov_len = bsize;
+	}
+	if (0 != syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, iov, nbufs))
+		return -1;
+
+	if (-1 == (u->kev.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)))
+		return -1;
+	if (0 != syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_EVENTFD, &u->kev.fd, 1))
+		return -1;
+	u->kev.oneshot = 0;
+	u->kev.handler = handler;
+	u->kev.udata = udata;
+	if (0 != ffkev_attach(&u->kev, kq, FFKQU_READ))
+		return -1;
+	return 0;
+}
+
+/** Wait until all requests are complete and free resources.
+The kernel may still write to the registered buffers while a request is in progress. */
+static void uring_close(uring *u)
+{
+	struct io_uring_cqe cqe;
+	while (u->nqueued != 0) {
+		if (-1 == syscall(__NR_io_uring_enter, u->fd, 0, u->nqueued, IORING_ENTER_GETEVENTS, NULL, 0)
+			&& errno != EINTR) {
+			syserrlog(NULL, "%s", "io_uring_enter()");
+			break;
+		}
+		while (0 != uring_reap(u, &cqe)) {
+		}
+	}
+
+	if (u->kev.fd != FF_BADFD)
+		close(u->kev.fd);
+	if (u->sqes != MAP_FAILED)
+		munmap(u->sqes, u->sqes_size);
+	if (u->cq_ring != MAP_FAILED)
+		munmap(u->cq_ring, u->cq_ring_size);
+	if (u->sq_ring != MAP_FAILED)
+		munmap(u->sq_ring, u->sq_ring_size);
+	if (u->fd != -1)
+		close(u->fd);
+}
+
+/** Submit a fixed-buffer read or write request.  Buffer index is returned as user_data on completion. */
+static int uring_submit(uring *u, uint op, fffd fd, uint ibuf, void *ptr, size_t len, uint64 off)
+{
+	uint tail = *u->sq_tail;
+	uint i = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[i];
+	ffmem_tzero(sqe);
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (size_t)ptr;
+	sqe->len = len;
+	sqe->off = off;
+	sqe->buf_index = ibuf;
+	sqe->user_data = ibuf;
+	u->sq_array[i] = i;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (1 != syscall(__NR_io_uring_enter, u->fd, 1, 0, 0, NULL, 0)) {
+		__atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+		return -1;
+	}
+	u->nqueued++;
+	return 0;
+}
+
+/** Get the next completion entry.
+Return 0 if there are no more entries. */
+static int uring_reap(uring *u, struct io_uring_cqe *cqe)
+{
+	uint head = *u->cq_head;
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+	*cqe = u->cqes[head & *u->cq_mask];
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	u->nqueued--;
+	return 1;
+}
+#endif //FF_LINUX
+
+
 static const void* file_iface(const char *name)
 {
 	if (!ffsz_cmp(name, "in")) {
@@ -200,6 +396,8 @@ static const void* file_iface(const char *name)
 		return &file_stdin;
 	else if (!ffsz_cmp(name, "stdout"))
 		return &file_stdout;
+	else if (!ffsz_cmp(name, "null"))
+		return &file_null;
 	return NULL;
 }
 
@@ -234,6 +432,7 @@ static int file_in_conf(ffpars_ctx *ctx)
 	mod->in_conf.bsize = 64 * 1024;
 	mod->in_conf.nbufs = 3;
 	mod->in_conf.directio = 1;
+	mod->in_conf.io_uring = 0;
 	ffpars_setargs(ctx, &mod->in_conf, file_in_conf_args, FFCNT(file_in_conf_args));
 	return 0;
 }
@@ -278,14 +477,6 @@ static void* file_open(fmed_filt *d)
 
 	dbglog(d->trk, "opened %s (%U kbytes)", f->fn, f->fsize / 1024);
 
-	ffaio_finit(&f->ftask, f->fd, f);
-	f->ftask.kev.udata = f;
-	fffd kq = (fffd)d->track->cmd(d->trk, FMED_TRACK_KQ);
-	if (0 != ffaio_fattach(&f->ftask, kq, !!(flags & O_DIRECT))) {
-		syserrlog(d->trk, "%s: %s", ffkqu_attach_S, f->fn);
-		goto done;
-	}
-
 	if (NULL == (f->data = ffmem_callocT(mod->in_conf.nbufs, databuf)))
 		goto done;
 	for (i = 0;  i != mod->in_conf.nbufs;  i++) {
@@ -296,6 +487,23 @@ static void* file_open(fmed_filt *d)
 		f->data[i].off = (uint64)-1;
 	}
 
+	fffd kq = (fffd)d->track->cmd(d->trk, FMED_TRACK_KQ);
+#ifdef FF_LINUX
+	if (mod->in_conf.io_uring && 0 == file_uring_open(f, kq))
+		goto opened;
+#endif
+
+	ffaio_finit(&f->ftask, f->fd, f);
+	f->ftask.kev.udata = f;
+	if (0 != ffaio_fattach(&f->ftask, kq, !!(flags & O_DIRECT))) {
+		syserrlog(d->trk, "%s: %s", ffkqu_attach_S, f->fn);
+		goto done;
+	}
+
+#ifdef FF_LINUX
+opened:
+#endif
+
 	d->input.size = f->fsize;
 
 	if (d->out_preserve_date) {
@@ -323,6 +531,13 @@ static void file_close(void *ctx)
 	if (f->async)
 		return; //wait until async operation is completed
 
+#ifdef FF_LINUX
+	if (f->ring != NULL) {
+		uring_close(f->ring);
+		ffmem_free0(f->ring);
+	}
+#endif
+
 	if (f->data != NULL) {
 		for (i = 0;  i < mod->in_conf.nbufs;  i++) {
 			if (f->data[i].ptr != NULL)
@@ -366,6 +581,16 @@ static int file_getdata(void *ctx, fmed_filt *d)
 		dbglog(d->trk, "seeking to %xU", seek);
 		f->seek = seek;
 		f->cancelled = f->async;
+#ifdef FF_LINUX
+		if (f->ring != NULL) {
+			// drop the data read ahead;  wait for the in-progress reads before reusing their buffers
+			for (uint i = 0;  i != mod->in_conf.nbufs;  i++) {
+				f->data[i].ready = 0;
+			}
+			f->inflight = 0;
+			f->cancelled = (f->ring->nqueued != 0);
+		}
+#endif
 
 		if (NULL != (b = find_buf(f, seek))) {
 			dbglog(d->trk, "hit cached buf#%u  offset:%xU"
@@ -383,6 +608,12 @@ static int file_getdata(void *ctx, fmed_filt *d)
 		f->done = (f->foff >= f->fsize);
 	}
 
+#ifdef FF_LINUX
+	if (f->ring != NULL) {
+		if (!f->done)
+			file_uring_submit(f);
+	} else
+#endif
 	if (!f->async && !f->done)
 		file_read(f);
 
@@ -494,12 +725,117 @@ ok:
 }
 
 
+#ifdef FF_LINUX
+static int file_uring_open(fmed_file *f, fffd kq)
+{
+	if (NULL == (f->ring = ffmem_new(uring)))
+		return -1;
+	if (0 != uring_init(f->ring, mod->in_conf.nbufs, f->data, mod->in_conf.nbufs, mod->in_conf.bsize
+		, kq, &file_uring_complete, f)) {
+		dbglog(f->trk, "io_uring isn't available: %E", fferr_last());
+		uring_close(f->ring);
+		ffmem_free0(f->ring);
+		return -1;
+	}
+	dbglog(f->trk, "using io_uring", 0);
+	return 0;
+}
+
+/** Start reading into all free buffers. */
+static void file_uring_submit(fmed_file *f)
+{
+	uint nbufs = mod->in_conf.nbufs;
+	if (f->cancelled)
+		return;
+
+	while (f->unread_bufs + f->inflight != nbufs) {
+		uint64 off = f->foff + (uint64)f->inflight * mod->in_conf.bsize;
+		if (off >= f->fsize)
+			break;
+
+		uint i = (f->wdata + f->inflight) % nbufs;
+		databuf *b = &f->data[i];
+		b->off = off;
+		b->len = 0;
+		if (0 != uring_submit(f->ring, IORING_OP_READ_FIXED, f->fd, i, b->ptr, mod->in_conf.bsize, off)) {
+			syserrlog(f->trk, "%s: %s  buf#%u offset:%xU"
+				, "io_uring_enter()", f->fn, i, off);
+			f->err = 1;
+			break;
+		}
+		dbglog(f->trk, "buf#%u: async read, offset:%xU", i, off);
+		f->inflight++;
+	}
+}
+
+/** Reap completed reads, pass the buffers to the reader in file order and start new reads. */
+static void file_uring_complete(void *udata)
+{
+	fmed_file *f = udata;
+	struct io_uring_cqe cqe;
+	uint64 n;
+	databuf *b;
+
+	if (-1 == read(f->ring->kev.fd, &n, sizeof(n)) && errno != EAGAIN)
+		syserrlog(NULL, "%s", "eventfd read");
+
+	while (0 != uring_reap(f->ring, &cqe)) {
+		b = &f->data[cqe.user_data];
+		if (f->cancelled) {
+			b->off = (uint64)-1;
+			continue;
+		}
+		if (cqe.res < 0) {
+			errno = -cqe.res;
+			syserrlog(f->trk, "%s: %s  buf#%u offset:%xU"
+				, fffile_read_S, f->fn, (uint)cqe.user_data, b->off);
+			b->off = (uint64)-1;
+			f->err = 1;
+			continue;
+		}
+		b->len = cqe.res;
+		b->ready = 1;
+		dbglog(f->trk, "buf#%u: read %u bytes at offset %xU"
+			, (uint)cqe.user_data, b->len, b->off);
+	}
+
+	if (f->cancelled && f->ring->nqueued == 0)
+		f->cancelled = 0;
+
+	while (f->inflight != 0 && !f->done) {
+		b = &f->data[f->wdata];
+		if (!b->ready)
+			break;
+		b->ready = 0;
+		f->inflight--;
+		if (b->len == 0) {
+			f->done = 1;
+			break;
+		}
+		f->unread_bufs++;
+		f->foff = b->off + b->len;
+		f->done = (b->len != mod->in_conf.bsize || f->foff >= f->fsize);
+		f->wdata = ffint_cycleinc(f->wdata, mod->in_conf.nbufs);
+	}
+
+	if (!f->done && !f->err)
+		file_uring_submit(f);
+
+	if ((f->unread_bufs != 0 || f->done || f->err) && f->want_read) {
+		f->want_read = 0;
+		f->handler(f->trk);
+	}
+}
+#endif //FF_LINUX
+
+
 static int fileout_config(ffpars_ctx *ctx)
 {
 	mod->out_conf.bsize = 64 * 1024;
 	mod->out_conf.prealloc = 1 * 1024 * 1024;
 	mod->out_conf.prealloc_grow = 1;
 	mod->out_conf.file_del = 1;
+	mod->out_conf.io_uring = 0;
 	ffpars_setargs(ctx, &mod->out_conf, file_out_conf_args, FFCNT(file_out_conf_args));
 	return 0;
 }
@@ -508,6 +844,7 @@ enum VARS {
 	VAR_DATE,
 	VAR_FNAME,
 	VAR_FPATH,
+	VAR_SEGMENT,
 	VAR_TIME,
 	VAR_TIMEMS,
 	VAR_YEAR,
@@ -517,6 +854,7 @@ static const char* const vars[] = {
 	"date",
 	"filename",
 	"filepath",
+	"segment",
 	"time",
 	"timems",
 	"year",
@@ -609,6 +947,15 @@ static FFINL char* fileout_getname(fmed_fileout *f, fmed_filt *d)
 					goto syserr;
 				break;
 
+			case VAR_SEGMENT: {
+				int64 seg = d->track->getval(d->trk, "split_segment");
+				if (seg == FMED_NULL)
+					continue;
+				if (0 == ffstr_catfmt(&buf, "%03u", (uint)seg + 1))
+					goto syserr;
+				break;
+			}
+
 			case VAR_YEAR:
 				ffstr_setcz(&val, "date");
 				if (FMED_PNULL == (tstr = d->track->getvalstr3(d->trk, &val, FMED_TRK_META | FMED_TRK_NAMESTR)))
@@ -700,6 +1047,11 @@ static void* fileout_open(fmed_filt *d)
 	int64 n;
 	if (FMED_NULL != (n = fmed_popval("out_bufsize")))
 		bfsz = n; //Note: a large value can slow down the thread because we write to a file synchronously
+#ifdef FF_LINUX
+	if (mod->out_conf.io_uring)
+		fileout_uring_open(f, bfsz, (fffd)d->track->cmd(d->trk, FMED_TRACK_KQ));
+	if (f->ring == NULL)
+#endif
 	if (NULL == ffarr_alloc(&f->buf, bfsz)) {
 		syserrlog(d->trk, "%s", ffmem_alloc_S);
 		goto done;
@@ -726,6 +1078,17 @@ static void fileout_close(void *ctx)
 {
 	fmed_fileout *f = ctx;
 
+#ifdef FF_LINUX
+	if (f->ring != NULL) {
+		uring_close(f->ring);
+		ffmem_free0(f->ring);
+	}
+	for (uint i = 0;  i != FFCNT(f->wbufs);  i++) {
+		if (f->wbufs[i].ptr != NULL)
+			ffmem_alignfree(f->wbufs[i].ptr);
+	}
+#endif
+
 	if (f->fd != FF_BADFD) {
 
 		fffile_trunc(f->fd, f->fsize);
@@ -758,9 +1121,9 @@ static void fileout_close(void *ctx)
 	ffmem_free(f);
 }
 
-static int fileout_writedata(fmed_fileout *f, const char *data, size_t len, fmed_filt *d)
+/** Extend the file before writing 'len' bytes at its end. */
+static void fileout_prealloc(fmed_fileout *f, size_t len)
 {
-	size_t r;
 	if (f->prealloc_by != 0 && f->fsize + len > f->preallocated) {
 		uint64 n = ff_align_ceil(f->fsize + len, f->prealloc_by);
 		if (0 == fffile_trunc(f->fd, n)) {
@@ -772,6 +1135,12 @@ static int fileout_writedata(fmed_fileout *f, const char *data, size_t len, fmed
 			f->stat.nprealloc++;
 		}
 	}
+}
+
+static int fileout_writedata(fmed_fileout *f, const char *data, size_t len, fmed_filt *d)
+{
+	size_t r;
+	fileout_prealloc(f, len);
 
 	r = fffile_write(f->fd, data, len);
 	if (r != len) {
@@ -796,6 +1165,11 @@ static int fileout_write(void *ctx, fmed_filt *d)
 		seek = d->output.seek;
 		d->output.seek = FMED_NULL;
 
+#ifdef FF_LINUX
+		if (f->ring != NULL && 0 != fileout_uring_flush(f, d))
+			return FMED_RERR;
+#endif
+
 		if (f->buf.len != 0) {
 			if (-1 == fileout_writedata(f, f->buf.ptr, f->buf.len, d))
 				return FMED_RERR;
@@ -828,11 +1202,17 @@ static int fileout_write(void *ctx, fmed_filt *d)
 		d->datalen = 0;
 	}
 
+#ifdef FF_LINUX
+	if (f->ring != NULL)
+		return fileout_uring_write(f, d);
+#endif
+
 	for (;;) {
 
 		r = ffbuf_add(&f->buf, d->data, d->datalen, &dst);
 		d->data += r;
 		d->datalen -= r;
+		d->out_written += r;
 		if (dst.len == 0) {
 			f->stat.nmwrite++;
 			if (!(d->flags & FMED_FLAST) || f->buf.len == 0)
@@ -854,6 +1234,142 @@ static int fileout_write(void *ctx, fmed_filt *d)
 	return FMED_ROK;
 }
 
+#ifdef FF_LINUX
+static int fileout_uring_open(fmed_fileout *f, size_t bsize, fffd kq)
+{
+	for (uint i = 0;  i != FFCNT(f->wbufs);  i++) {
+		if (NULL == (f->wbufs[i].ptr = ffmem_align(bsize, 4096)))
+			goto fail;
+	}
+	if (NULL == (f->ring = ffmem_new(uring)))
+		goto fail;
+	if (0 != uring_init(f->ring, FFCNT(f->wbufs), f->wbufs, FFCNT(f->wbufs), bsize
+		, kq, &fileout_uring_complete, f)) {
+		dbglog(NULL, "io_uring isn't available: %E", fferr_last());
+		uring_close(f->ring);
+		goto fail;
+	}
+	f->wbsize = bsize;
+	dbglog(NULL, "using io_uring", 0);
+	return 0;
+
+fail:
+	ffmem_free0(f->ring);
+	for (uint i = 0;  i != FFCNT(f->wbufs);  i++) {
+		if (f->wbufs[i].ptr != NULL)
+			ffmem_alignfree(f->wbufs[i].ptr);
+		f->wbufs[i].ptr = NULL;
+	}
+	return -1;
+}
+
+/** Start writing the buffer at the end of file. */
+static int fileout_uring_submitbuf(fmed_fileout *f, databuf *b, fmed_filt *d)
+{
+	fileout_prealloc(f, b->len);
+	b->off = f->fsize;
+	if (0 != uring_submit(f->ring, IORING_OP_WRITE_FIXED, f->fd, b - f->wbufs, b->ptr, b->len, b->off)) {
+		syserrlog(d->trk, "%s: %s", "io_uring_enter()", f->fname.ptr);
+		return -1;
+	}
+	b->busy = 1;
+	f->stat.nfwrite++;
+	dbglog(d->trk, "buf#%L: async write %u bytes at offset %U"
+		, b - f->wbufs, b->len, b->off);
+	f->fsize += b->len;
+	f->wcur = ffint_cycleinc(f->wcur, FFCNT(f->wbufs));
+	return 0;
+}
+
+/** Reap completed writes. */
+static void fileout_uring_reap(fmed_fileout *f)
+{
+	struct io_uring_cqe cqe;
+	while (0 != uring_reap(f->ring, &cqe)) {
+		databuf *b = &f->wbufs[cqe.user_data];
+		if (cqe.res < 0 || (uint)cqe.res != b->len) {
+			if (cqe.res < 0)
+				errno = -cqe.res;
+			syserrlog(f->d->trk, "%s: %s  offset:%U", fffile_write_S, f->fname.ptr, b->off);
+			f->err = 1;
+		}
+		b->busy = 0;
+		b->len = 0;
+	}
+}
+
+static void fileout_uring_complete(void *udata)
+{
+	fmed_fileout *f = udata;
+	uint64 n;
+	if (-1 == read(f->ring->kev.fd, &n, sizeof(n)) && errno != EAGAIN)
+		syserrlog(NULL, "%s", "eventfd read");
+
+	fileout_uring_reap(f);
+
+	if (f->want_write) {
+		f->want_write = 0;
+		f->d->handler(f->d->trk);
+	}
+}
+
+/** Write the buffered data and wait until all writes are complete. */
+static int fileout_uring_flush(fmed_fileout *f, fmed_filt *d)
+{
+	databuf *b = &f->wbufs[f->wcur];
+	if (!b->busy && b->len != 0
+		&& 0 != fileout_uring_submitbuf(f, b, d))
+		return -1;
+
+	while (f->ring->nqueued != 0) {
+		if (-1 == syscall(__NR_io_uring_enter, f->ring->fd, 0, f->ring->nqueued, IORING_ENTER_GETEVENTS, NULL, 0)
+			&& errno != EINTR) {
+			syserrlog(d->trk, "%s", "io_uring_enter()");
+			return -1;
+		}
+		fileout_uring_reap(f);
+	}
+	return (f->err) ? -1 : 0;
+}
+
+/** Copy data to the current buffer;  start writing it when it's full.
+Wait for a completion if all buffers are being written. */
+static int fileout_uring_write(fmed_fileout *f, fmed_filt *d)
+{
+	if (f->err)
+		return FMED_RERR;
+
+	while (d->datalen != 0) {
+		databuf *b = &f->wbufs[f->wcur];
+		if (b->busy) {
+			f->want_write = 1;
+			return FMED_RASYNC;
+		}
+
+		size_t n = ffmin(d->datalen, f->wbsize - b->len);
+		ffmemcpy(b->ptr + b->len, d->data, n);
+		b->len += n;
+		d->data += n;
+		d->datalen -= n;
+		d->out_written += n;
+		f->stat.nmwrite++;
+
+		if (b->len == f->wbsize
+			&& 0 != fileout_uring_submitbuf(f, b, d))
+			return FMED_RERR;
+	}
+
+	if (d->flags & FMED_FLAST) {
+		if (0 != fileout_uring_flush(f, d))
+			return FMED_RERR;
+		f->ok = 1;
+		return FMED_RDONE;
+	}
+
+	return FMED_ROK;
+}
+#endif //FF_LINUX
+
 
 static void* file_stdin_open(fmed_filt *d)
 {
@@ -991,3 +1507,34 @@ static int file_stdout_write(void *ctx, fmed_filt *d)
 
 	return FMED_ROK;
 }
+
+
+/** Discard output data. */
+static void* file_null_open(fmed_filt *d)
+{
+	null_ctx *f;
+	if (NULL == (f = ffmem_new(null_ctx)))
+		return NULL;
+	f->trk = d->trk;
+	return f;
+}
+
+static void file_null_close(void *ctx)
+{
+	null_ctx *f = ctx;
+	dbglog(f->trk, "discarded %U bytes", f->size);
+	ffmem_free(f);
+}
+
+static int file_null_write(void *ctx, fmed_filt *d)
+{
+	null_ctx *f = ctx;
+
+	d->output.seek = FMED_NULL;
+	f->size += d->datalen;
+	d->datalen = 0;
+
+	if (d->flags & FMED_FLAST)
+		return FMED_RDONE;
+	return FMED_ROK;
+}
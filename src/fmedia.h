@@ -85,6 +85,11 @@ enum FMED_SIG {
 	/** Add a cross-worker task.
 	args: "fftask *task, uint wid" */
 	FMED_TASK_XPOST,
+
+	/** Get worker's status.
+	args: "uint wid, fmed_worker_info *info"
+	Return 0 on success;  -1 if there's no such worker. */
+	FMED_WORKER_INFO,
 };
 
 enum FMED_FT {
@@ -99,6 +104,11 @@ enum FMED_TASK {
 	FMED_TASK_POST,
 };
 
+typedef struct fmed_worker_info {
+	uint njobs; //number of active tracks
+	uint running :1; //worker's thread is created
+} fmed_worker_info;
+
 typedef struct fmed_modinfo {
 	char *name;
 	void *dl; //ffdl
@@ -162,7 +172,8 @@ struct fmed_core {
 	@cmd: enum FMED_TASK. */
 	void (*task)(fftask *task, uint cmd);
 
-	/** Set timer on the main worker.
+	/** Set timer on the worker running in the current thread (the main worker for a non-worker thread).
+	The timer must be stopped from the same worker.
 	@interval:  >0: periodic;  <0: one-shot;  0: disable.
 	Return 0 on success. */
 	int (*timer)(fftmrq_entry *tmr, int64 interval, uint flags);
@@ -261,6 +272,17 @@ enum FMED_TRACK_CMD {
 
 	/** Start a track in any worker. */
 	FMED_TRACK_XSTART,
+
+	/** Get information about the next active track.  Thread: main.
+	@trk: NULL
+	@param: fmed_trk_info *info.  Set info->trk = NULL to get the first track.
+	Return 0 on success;  1 if there are no more tracks. */
+	FMED_TRACK_INFO,
+
+	/** Post a task to the worker that processes the track.
+	Data used by the track's filters must be modified only from there.
+	@param: fftask *task */
+	FMED_TRACK_XPOST,
 };
 
 enum FMED_TRK_TYPE {
@@ -270,6 +292,7 @@ enum FMED_TRK_TYPE {
 	FMED_TRK_TYPE_MIXIN,
 	FMED_TRK_TYPE_MIXOUT,
 	FMED_TRK_TYPE_NETIN,
+	FMED_TRK_TYPE_TEE, //receives data from #soundmod.tee of another track
 	_FMED_TRK_TYPE_END,
 
 	//obsolete:
@@ -349,6 +372,41 @@ typedef struct fmed_trk_meta {
 	uint flags;
 } fmed_trk_meta;
 
+/** Output buffer statistics of an audio device output. */
+typedef struct fmed_adev_stat {
+	uint xruns; //buffer underruns
+	uint buf_msec; //effective buffer length: device buffer or the adaptive fill limit
+	uint fill; //buffer fill level measured before the last write (%)
+	uint fill_min; //the lowest fill level measured while playing (%)
+} fmed_adev_stat;
+
+/** Filter's profiling counters. */
+typedef struct fmed_trk_filtinfo {
+	const char *name;
+	uint64 usec; //time spent inside the filter (measured with "--profile" or in debug mode)
+	uint64 calls;
+	uint64 in, out; //bytes
+	uint64 rc[_FMED_R_END + 1]; //the number of times each code was returned: [enum FMED_R + 1]
+} fmed_trk_filtinfo;
+
+/** Track state snapshot.
+The data is valid until the next call to FMED_TRACK_INFO. */
+typedef struct fmed_trk_info {
+	void *trk;
+	const ffstr *id;
+	const char *input;
+	uint type; //enum FMED_TRK_TYPE
+	uint worker;
+	uint64 pos; //samples
+	uint64 total; //samples
+	uint sample_rate;
+	uint nfilters;
+	const fmed_trk_filtinfo *filters;
+	fmed_adev_stat adev;
+	uint paused :1;
+	uint stopping :1;
+} fmed_trk_info;
+
 enum FMED_TRK_MON {
 	FMED_TRK_ONCLOSE,
 	FMED_TRK_ONLAST,
@@ -402,6 +460,7 @@ struct fmed_trk {
 		uint bitrate; //bit/s
 		const char *decoder;
 	} audio;
+	fmed_adev_stat adev; //set by audio device output
 
 	struct {
 		ffstr profile;
@@ -428,6 +487,7 @@ struct fmed_trk {
 		uint64 size;
 		uint64 seek;
 	} input, output;
+	uint64 out_written; //bytes passed to the output file (set by file.out)
 	fftime mtime;
 	union {
 	uint bits;
@@ -451,6 +511,7 @@ struct fmed_trk {
 		uint use_dynanorm :1;
 		uint duration_inaccurate :1;
 		uint e_no_source :1; // error: no media source
+		uint loudness :1;
 	};
 	};
 
@@ -467,6 +528,11 @@ struct fmed_trk {
 	void **outni;
 	};
 
+	/* Free space in the audio device buffer, lent by the output filter for the next chunk.
+	The converter may write its output there directly and then it resets a_dstbuf to NULL. */
+	char *a_dstbuf;
+	size_t a_dstcap; //bytes
+
 	uint64 a_prebuffer; //msec
 	float a_start_level; //dB
 	float a_stop_level; //dB
@@ -488,6 +554,7 @@ enum FMED_R {
 	, FMED_RASYNC //an asynchronous operation is scheduled.  The module will call fmed_filt.handler.
 	, FMED_RFIN //close the track
 	, FMED_RSYSERR //system error.  Print error message and close the track.
+	, _FMED_R_END
 	, FMED_RERR = -1 //fatal error, the track will be closed.
 };
 
@@ -606,6 +673,36 @@ typedef struct fmed_adev {
 	void (*listfree)(fmed_adev_ent *ents);
 } fmed_adev;
 
+/** Adaptive fill limit of an audio device output buffer.  Thread: worker.
+The limit starts at 'min' msec and is doubled after each underrun, up to the device buffer length.
+After 'stable' msec of audio is written without underruns, it's halved back, down to 'min'.
+Implemented in adev/adapt.c:  a module using it is linked with adapt.o. */
+typedef struct fmed_adev_adapt {
+	uint min; //msec;  0: disabled, use the whole device buffer
+	uint stable; //msec
+	uint limit; //current fill limit (msec)
+	uint buf_msec; //device buffer length
+	uint64 written; //bytes written since the last change of 'limit'
+	uint running :1; //the buffer was full: measure the lowest fill level.  Reset by user on stop.
+} fmed_adev_adapt;
+
+void fmed_adev_adapt_init(fmed_adev_adapt *a, fmed_filt *d, uint min, uint stable);
+
+/** Update statistics before writing to the device buffer.
+@filled, @bufsize: bytes
+@frsize: bytes per sample (all channels)
+Return the number of bytes that may be written now;  0: wait until the device plays some data. */
+size_t fmed_adev_adapt_update(fmed_adev_adapt *a, fmed_filt *d, size_t filled, size_t bufsize
+	, uint frsize, uint rate);
+
+/** Register an underrun reported by the device. */
+void fmed_adev_adapt_xrun(fmed_adev_adapt *a, fmed_filt *d);
+
+
+/** Add JSON string with escaped characters.
+Implemented in json.c:  a module using it is linked with json.o. */
+void fmed_json_addstr(ffarr *buf, const char *s, size_t len);
+
 
 // QUEUE
 
@@ -695,6 +792,15 @@ enum FMED_QUE {
 	FMED_QUE_DEL_FILTERED,
 	FMED_QUE_LIST_NOFILTER,
 
+	/** Add several items in one operation.
+	@param: fmed_que_entry ents[]
+	@param2: number of items
+	The items are placed one after another after ents[0].prev.
+	Unless FMED_QUE_MORE is set, FMED_QUE_ADD_DONE is signalled after the last item.
+	On return ents[i].prev points to the added item.
+	Return the number of added items;  -1 on error. */
+	FMED_QUE_ADDN,
+
 	_FMED_QUE_LAST
 };
 
@@ -773,6 +879,10 @@ typedef struct fmed_globcmd_iface {
 	@cmd: enum FMED_GLOBCMD. */
 	int (*ctl)(uint cmd, ...);
 	int (*write)(const void *data, size_t len);
+
+	/** Finish sending commands and read the response.
+	Return the number of bytes read;  0 if there's no more data;  -1 on error. */
+	ssize_t (*read)(void *buf, size_t cap);
 } fmed_globcmd_iface;
 
 
@@ -0,0 +1,143 @@
+/** Cache files with the data of input files: MPEG seek index, MP4 header.
+Copyright (c) 2018 Simon Zolin */
+
+#include <fmedia.h>
+#include <format/fcache.h>
+
+#include <FFOS/dir.h>
+#include <FFOS/error.h>
+
+
+struct fcache_hdr {
+	char sig[4];
+	uint ver;
+	uint64 len; //size of data following the header
+};
+
+/** Get absolute and normalized file name. */
+static int path_full(ffarr *a, const char *fn)
+{
+	char cwd[FF_MAXPATH];
+	size_t len = ffsz_len(fn);
+
+	if (ffpath_abs(fn, len)) {
+		if (0 == ffstr_catfmt(a, "%s%Z", fn))
+			return -1;
+	} else {
+		if (NULL == ffdir_cur(cwd, sizeof(cwd)))
+			return -1;
+		if (0 == ffstr_catfmt(a, "%s/%s%Z", cwd, fn))
+			return -1;
+	}
+	a->len = ffpath_norm(a->ptr, a->cap, a->ptr, a->len - 1, 0);
+	a->ptr[a->len] = '\0';
+	return 0;
+}
+
+/** Get the name of cache file for the input file:
+ DIR/HASH-SIZE-MTIME.EXT
+HASH: FNV-1a hash of the absolute file name.
+Return newly allocated string;  NULL if the input isn't a local file. */
+char* fcache_fn(const char *dir, const char *input, const char *ext)
+{
+	fffileinfo fi;
+	ffarr path = {0}, a = {0};
+	char *fn = NULL;
+
+	if (0 != fffile_infofn(input, &fi)
+		|| fffile_isdir(fffile_infoattr(&fi)))
+		return NULL;
+	fftime mtime = fffile_infomtime(&fi);
+
+	if (0 != path_full(&path, input))
+		goto end;
+
+	// FNV-1a
+	uint64 hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0;  i != path.len;  i++) {
+		hash = (hash ^ (byte)path.ptr[i]) * 0x100000001b3ULL;
+	}
+
+	if (0 != ffstr_catfmt(&a, "%s/%016xU-%xU-%xU.%s%Z"
+		, dir, hash, fffile_infosize(&fi), (uint64)fftime_sec(&mtime), ext))
+		fn = a.ptr;
+	else
+		ffarr_free(&a);
+
+end:
+	ffarr_free(&path);
+	return fn;
+}
+
+/** Read cache file.
+@buf: file data;  must be freed by the caller
+@data: the data following the header
+Return 0 on success;  1 if the file doesn't exist;  -1 if the file is invalid. */
+int fcache_load(ffarr *buf, ffstr *data, const char *fn, const char *sig, uint ver, size_t maxsize)
+{
+	const struct fcache_hdr *h;
+
+	if (0 != fffile_readall(buf, fn, maxsize + sizeof(struct fcache_hdr)))
+		return 1;
+
+	h = (void*)buf->ptr;
+	if (buf->len < sizeof(*h)
+		|| ffmemcmp(h->sig, sig, 4)
+		|| h->ver != ver
+		|| h->len != buf->len - sizeof(*h))
+		return -1;
+
+	ffstr_set(data, buf->ptr + sizeof(*h), h->len);
+	return 0;
+}
+
+/** Write cache file.
+The data is written to a temporary file which then replaces the target file,
+ so a reader never sees a partially written file.
+@parts: data following the header
+Return 0 on success. */
+int fcache_save(const char *fn, const char *sig, uint ver, const ffstr *parts, uint nparts)
+{
+	struct fcache_hdr h = {0};
+	ffarr tmp = {0};
+	fffd f = FF_BADFD;
+	int rc = -1;
+
+	if (0 == ffstr_catfmt(&tmp, "%s.tmp%Z", fn))
+		return -1;
+
+	f = fffile_open(tmp.ptr, O_CREAT | O_TRUNC | O_WRONLY);
+	if (f == FF_BADFD && fferr_nofile(fferr_last())) {
+		if (0 != ffdir_make_path(tmp.ptr, 0))
+			goto end;
+		f = fffile_open(tmp.ptr, O_CREAT | O_TRUNC | O_WRONLY);
+	}
+	if (f == FF_BADFD)
+		goto end;
+
+	ffmemcpy(h.sig, sig, 4);
+	h.ver = ver;
+	for (uint i = 0;  i != nparts;  i++) {
+		h.len += parts[i].len;
+	}
+	if (sizeof(h) != (size_t)fffile_write(f, &h, sizeof(h)))
+		goto end;
+	for (uint i = 0;  i != nparts;  i++) {
+		if (parts[i].len != (size_t)fffile_write(f, parts[i].ptr, parts[i].len))
+			goto end;
+	}
+	fffile_close(f);
+	f = FF_BADFD;
+
+	if (0 != fffile_rename(tmp.ptr, fn))
+		goto end;
+	rc = 0;
+
+end:
+	if (f != FF_BADFD)
+		fffile_close(f);
+	if (rc != 0)
+		fffile_rm(tmp.ptr);
+	ffarr_free(&tmp);
+	return rc;
+}
@@ -0,0 +1,12 @@
+/** Cache files with the data of input files: MPEG seek index, MP4 header.
+Implemented in fcache.c: a module using them is linked with fcache.o.
+Copyright (c) 2018 Simon Zolin */
+
+#pragma once
+
+#include <FF/array.h>
+
+
+char* fcache_fn(const char *dir, const char *input, const char *ext);
+int fcache_load(ffarr *buf, ffstr *data, const char *fn, const char *sig, uint ver, size_t maxsize);
+int fcache_save(const char *fn, const char *sig, uint ver, const ffstr *parts, uint nparts);
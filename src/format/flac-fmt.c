@@ -22,6 +22,7 @@ Copyright (c) 2018 Simon Zolin */
 
 extern const fmed_core *core;
 extern const fmed_queue *qu;
+extern size_t flac_frame_renumber(byte *dst, const byte *fr, size_t len, uint64 num);
 
 
 //IN
@@ -44,13 +45,23 @@ const fmed_filter fmed_flac_output = {
 struct flac {
 	ffflac fl;
 	int64 abs_seek;
+	ffflac_info info; //stream copy: info block passed to flac.out
 	uint seek_ready :1;
+	uint stmcopy :1;
 };
 
 
 typedef struct flac_out {
 	ffflac_cook fl;
 	uint state;
+
+	//stream copy:
+	ffflac_info info;
+	ffarr buf; //renumbered frame
+	uint64 nframes;
+	uint64 nsamples;
+	uint minframe, maxframe; //sizes of the renumbered frames
+	uint stmcopy :1;
 } flac_out;
 
 static int flac_out_addmeta(flac_out *f, fmed_filt *d);
@@ -166,7 +177,10 @@ static int flac_in_read(void *ctx, fmed_filt *d)
 			fmed_setval("flac.in.minblock", f->fl.info.minblock);
 			fmed_setval("flac.in.maxblock", f->fl.info.maxblock);
 
-			if (0 != d->track->cmd2(d->trk, FMED_TRACK_ADDFILT, "flac.decode"))
+			if (d->stream_copy) {
+				d->audio.convfmt = d->audio.fmt;
+				f->stmcopy = 1;
+			} else if (0 != d->track->cmd2(d->trk, FMED_TRACK_ADDFILT, "flac.decode"))
 				return FMED_RERR;
 
 			f->seek_ready = 1;
@@ -176,6 +190,16 @@ static int flac_in_read(void *ctx, fmed_filt *d)
 				ffflac_seek(&f->fl, f->abs_seek + ffpcm_samples(d->audio.seek, f->fl.fmt.sample_rate));
 				d->audio.seek = FMED_NULL;
 			}
+
+			if (f->stmcopy) {
+				// frames may be cut by seek/until, so MD5 and frame sizes can't be preserved
+				f->info = f->fl.info;
+				ffmem_zero(f->info.md5, sizeof(f->info.md5));
+				f->info.minframe = 0;
+				f->info.maxframe = 0;
+				d->out = (void*)&f->info,  d->outlen = sizeof(ffflac_info);
+				return FMED_RDATA;
+			}
 			break;
 
 		case FFFLAC_RDATA:
@@ -205,7 +229,10 @@ data:
 		, f->fl.frame.samples, ffflac_cursample(&f->fl));
 	d->audio.pos = ffflac_cursample(&f->fl) - f->abs_seek;
 
-	fmed_setval("flac.in.frsamples", f->fl.frame.samples);
+	if (f->stmcopy)
+		fmed_setval("flac_in_frsamples", f->fl.frame.samples);
+	else
+		fmed_setval("flac.in.frsamples", f->fl.frame.samples);
 	fmed_setval("flac.in.frpos", f->fl.frame.pos);
 	if (f->fl.seek_ok)
 		fmed_setval("flac.in.seeksample", f->fl.seeksample);
@@ -330,9 +357,37 @@ static void flac_out_free(void *ctx)
 {
 	flac_out *f = ctx;
 	ffflac_wclose(&f->fl);
+	ffarr_free(&f->buf);
 	ffmem_free(f);
 }
 
+/** Pass the frame to writer, setting a new frame/sample number in its header. */
+static int flac_out_copyframe(flac_out *f, fmed_filt *d)
+{
+	uint samples = fmed_getval("flac_in_frsamples");
+	const byte *fr = (void*)d->data;
+	uint64 num = (d->datalen > 1 && (fr[1] & 0x01)) ? f->nsamples : f->nframes;
+
+	if (NULL == ffarr_realloc(&f->buf, d->datalen + 6)) {
+		syserrlog(d->trk, "%s", ffmem_alloc_S);
+		return -1;
+	}
+	f->buf.len = flac_frame_renumber((void*)f->buf.ptr, fr, d->datalen, num);
+	if (f->buf.len == 0) {
+		errlog(d->trk, "invalid frame #%U", f->nframes);
+		return -1;
+	}
+
+	if (f->nframes == 0 || f->buf.len < f->minframe)
+		f->minframe = f->buf.len;
+	f->maxframe = ffmax(f->maxframe, f->buf.len);
+
+	f->nframes++;
+	f->nsamples += samples;
+	ffstr_set(&f->fl.in, f->buf.ptr, f->buf.len);
+	return 0;
+}
+
 static int flac_out_encode(void *ctx, fmed_filt *d)
 {
 	enum { I_FIRST, I_INIT, I_DATA0, I_DATA };
@@ -341,10 +396,16 @@ static int flac_out_encode(void *ctx, fmed_filt *d)
 
 	switch (f->state) {
 	case I_FIRST:
-		if (0 != d->track->cmd2(d->trk, FMED_TRACK_ADDFILT_PREV, "flac.encode"))
-			return FMED_RERR;
-		f->state = I_INIT;
-		return FMED_RMORE;
+		if (d->stream_copy && ffsz_eq(d->datatype, "flac")) {
+			f->stmcopy = 1;
+			f->state = I_INIT;
+			// fall through
+		} else {
+			if (0 != d->track->cmd2(d->trk, FMED_TRACK_ADDFILT_PREV, "flac.encode"))
+				return FMED_RERR;
+			f->state = I_INIT;
+			return FMED_RMORE;
+		}
 
 	case I_INIT:
 		if (!ffsz_eq(d->datatype, "flac")) {
@@ -363,6 +424,9 @@ static int flac_out_encode(void *ctx, fmed_filt *d)
 			return FMED_RERR;
 		}
 
+		if (f->stmcopy)
+			f->info = *(ffflac_info*)d->data;
+
 		if (0 != ffflac_wnew(&f->fl, (void*)d->data)) {
 			errlog(d->trk, "ffflac_wnew(): %s", ffflac_out_errstr(&f->fl));
 			return FMED_RERR;
@@ -379,7 +443,20 @@ static int flac_out_encode(void *ctx, fmed_filt *d)
 		break;
 	}
 
-	if (d->flags & FMED_FFWD) {
+	if (f->stmcopy) {
+		if (d->flags & FMED_FFWD) {
+			if (d->datalen != 0 && 0 != flac_out_copyframe(f, d))
+				return FMED_RERR;
+			if (d->flags & FMED_FLAST) {
+				// the source STREAMINFO describes the whole input, not the frames we've copied
+				f->info.total_samples = f->nsamples;
+				f->info.minframe = f->minframe;
+				f->info.maxframe = f->maxframe;
+				ffflac_wfin(&f->fl, &f->info);
+			}
+		}
+
+	} else if (d->flags & FMED_FFWD) {
 		ffstr_set(&f->fl.in, (const void**)d->datani, d->datalen);
 		if (d->flags & FMED_FLAST) {
 			if (d->datalen != sizeof(ffflac_info)) {
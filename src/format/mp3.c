@@ -7,6 +7,8 @@ Copyright (c) 2017 Simon Zolin */
 #include <FF/audio/pcm.h>
 #include <FF/mtags/mmtag.h>
 #include <FF/array.h>
+#include <FFOS/dir.h>
+#include <format/fcache.h>
 
 
 extern const fmed_core *core;
@@ -20,15 +22,52 @@ const fmed_filter fmed_mpeg_input = {
 	&mpeg_open, &mpeg_process, &mpeg_close
 };
 
+/* Seek index: "sample -> file offset" pairs of MPEG frames collected while the file is read sequentially.
+It's stored in a cache directory, so a seek in a VBR file without TOC requires just 1 read. */
+struct seekpt {
+	uint64 sample;
+	uint64 off;
+};
+
+struct seekidx {
+	ffarr pts; //struct seekpt[]
+	size_t nsaved; //number of points in the index file
+	uint64 next_sample; //add a new point when reaching this sample
+	uint interval; //samples
+	uint building :1 //the file is being read sequentially from the beginning
+		, complete :1 //the index covers the whole file
+		, saved_complete :1
+		;
+};
+
 typedef struct mpeg_in {
 	ffmpgfile mpg;
 	uint state;
 	uint have_id32tag :1
 		, seeking :1
+		, restarted :1 //the reader is restarted from a seek point
+		, reopened :1 //the reader is restarted from the beginning of the file
 		;
+	uint64 base; //the sample number at which the reader was restarted
+	uint64 base_off; //the file offset at which the reader was restarted
+	uint options; //FFMPG_O_*: the reader options set on open
+	char *sidx_fn;
+	struct seekidx sidx;
 } mpeg_in;
 
 static void mpeg_meta(mpeg_in *m, fmed_filt *d, uint type);
+static int mpeg_sidx_seek(mpeg_in *m, fmed_filt *d, uint64 sample);
+static void mpeg_sidx_add(mpeg_in *m, fmed_filt *d);
+
+static struct mpeg_in_conf_t {
+	byte seek_index;
+	char *seek_index_dir;
+} mpeg_in_conf;
+
+static const ffpars_arg mpeg_in_conf_args[] = {
+	{ "seek_index",	FFPARS_TBOOL | FFPARS_F8BIT,  FFPARS_DSTOFF(struct mpeg_in_conf_t, seek_index) },
+	{ "seek_index_dir",	FFPARS_TCHARPTR | FFPARS_FSTRZ | FFPARS_FCOPY | FFPARS_FNOTEMPTY,  FFPARS_DSTOFF(struct mpeg_in_conf_t, seek_index_dir) },
+};
 
 //OUTPUT
 static void* mpeg_out_open(fmed_filt *d);
@@ -68,6 +107,197 @@ typedef struct mpeg_copy {
 } mpeg_copy;
 
 
+int mpeg_in_config(ffpars_ctx *ctx)
+{
+	mpeg_in_conf.seek_index = 0;
+	ffpars_setargs(ctx, &mpeg_in_conf, mpeg_in_conf_args, FFCNT(mpeg_in_conf_args));
+	return 0;
+}
+
+void mpeg_in_conf_destroy(void)
+{
+	ffmem_safefree0(mpeg_in_conf.seek_index_dir);
+}
+
+enum {
+	SIDX_VER = 2,
+	SIDX_PREROLL = 4 * 1152, //samples: frames before the target that may hold its bit reservoir
+};
+
+struct seekidx_hdr {
+	uint interval;
+	uint complete;
+	// struct seekpt[]
+};
+
+/** Get the name of index file for the input file. */
+static char* sidx_fn(fmed_filt *d)
+{
+	const char *in;
+	char *dir, *fn;
+
+	if (FMED_PNULL == (in = d->track->getvalstr(d->trk, "input")))
+		return NULL;
+
+	if (mpeg_in_conf.seek_index_dir != NULL)
+		dir = core->env_expand(NULL, 0, mpeg_in_conf.seek_index_dir);
+	else
+		dir = core->env_expand(NULL, 0, FFDIR_USER_CONFIG "/fmedia/seekidx");
+	if (dir == NULL)
+		return NULL;
+
+	fn = fcache_fn(dir, in, "mp3idx");
+	ffmem_free(dir);
+	return fn;
+}
+
+static void sidx_load(mpeg_in *m, fmed_filt *d)
+{
+	ffarr buf = {0};
+	ffstr data;
+	const struct seekidx_hdr *h;
+	int r;
+
+	if (0 != (r = fcache_load(&buf, &data, m->sidx_fn, "FMSI", SIDX_VER, 64 * 1024 * 1024))) {
+		if (r < 0)
+			goto bad;
+		goto end; //no index yet
+	}
+
+	h = (void*)data.ptr;
+	if (data.len < sizeof(*h)
+		|| h->interval == 0
+		|| (data.len - sizeof(*h)) % sizeof(struct seekpt) != 0)
+		goto bad;
+	size_t n = (data.len - sizeof(*h)) / sizeof(struct seekpt);
+
+	if (NULL == ffarr_allocT(&m->sidx.pts, n, struct seekpt))
+		goto end;
+	ffmemcpy(m->sidx.pts.ptr, data.ptr + sizeof(*h), n * sizeof(struct seekpt));
+	m->sidx.pts.len = n;
+	m->sidx.nsaved = n;
+	m->sidx.interval = h->interval;
+	m->sidx.complete = m->sidx.saved_complete = !!h->complete;
+	dbglog(core, d->trk, "mpeg", "loaded seek index: %s: %L points, complete:%u"
+		, m->sidx_fn, m->sidx.pts.len, m->sidx.complete);
+	goto end;
+
+bad:
+	warnlog(core, d->trk, "mpeg", "%s: bad seek index", m->sidx_fn);
+
+end:
+	ffarr_free(&buf);
+}
+
+/** Write index file, if there's new data. */
+static void sidx_save(mpeg_in *m)
+{
+	struct seekidx *si = &m->sidx;
+	struct seekidx_hdr h = {0};
+	ffstr parts[2];
+
+	if (si->pts.len == si->nsaved && si->complete == si->saved_complete)
+		return;
+
+	h.interval = si->interval;
+	h.complete = si->complete;
+	ffstr_set(&parts[0], &h, sizeof(h));
+	ffstr_set(&parts[1], si->pts.ptr, si->pts.len * sizeof(struct seekpt));
+	if (0 != fcache_save(m->sidx_fn, "FMSI", SIDX_VER, parts, FFCNT(parts)))
+		return;
+	dbglog(core, NULL, "mpeg", "saved seek index: %s: %L points"
+		, m->sidx_fn, si->pts.len);
+}
+
+/** Don't use seek index for this file. */
+static void sidx_close(mpeg_in *m)
+{
+	ffmem_free0(m->sidx_fn);
+	ffarr_free(&m->sidx.pts);
+	m->sidx.building = 0;
+}
+
+/** Add a seek point for the current frame. */
+static void mpeg_sidx_add(mpeg_in *m, fmed_filt *d)
+{
+	struct seekidx *si = &m->sidx;
+	uint64 pos = ffmpg_cursample(&m->mpg.rdr);
+	if (pos < si->next_sample)
+		return;
+
+	struct seekpt *pt = ffarr_pushgrowT(&si->pts, 256, struct seekpt);
+	if (pt == NULL) {
+		si->building = 0;
+		return;
+	}
+	pt->sample = pos;
+	pt->off = m->mpg.rdr.off - m->mpg.frame.len;
+	si->next_sample = pos + si->interval;
+}
+
+/** Restart the reader at file offset 'off': the data from 'off' is read as a new stream. */
+static void mpeg_restart(mpeg_in *m, fmed_filt *d, uint opts, uint64 off)
+{
+	uint cp = m->mpg.codepage;
+	ffmpg_fclose(&m->mpg);
+	ffmpg_fopen(&m->mpg);
+	m->mpg.options = opts;
+	m->mpg.codepage = cp;
+	ffmpg_setsize(&m->mpg.rdr, d->input.size - off);
+	m->base_off = off;
+	d->input.seek = off;
+}
+
+/** Seek using the index: restart the reader from the nearest point before the target sample.
+The decoder skips the samples before the target.
+Return 0 if the seek is scheduled. */
+static int mpeg_sidx_seek(mpeg_in *m, fmed_filt *d, uint64 sample)
+{
+	struct seekidx *si = &m->sidx;
+	const struct seekpt *pts = (void*)si->pts.ptr, *pt = NULL;
+	size_t i;
+
+	si->building = 0;
+	if (si->pts.len == 0)
+		return -1;
+
+	if (!si->complete
+		&& sample >= pts[si->pts.len - 1].sample + si->interval) {
+		if (!m->restarted)
+			return -1; //not covered by the index: let the reader find the position
+
+		// The reader restarted from a seek point doesn't know the stream header.
+		// Restart it from the beginning, then let it find the position.
+		mpeg_restart(m, d, m->options, 0);
+		m->restarted = 0;
+		m->reopened = 1;
+		m->base = 0;
+		dbglog(core, d->trk, "mpeg", "seek index: sample %U isn't covered", sample);
+		return 0;
+	}
+
+	// binary search for the last point at least SIDX_PREROLL samples before the target
+	uint64 target = (sample > SIDX_PREROLL) ? sample - SIDX_PREROLL : 0;
+	size_t lo = 0, hi = si->pts.len;
+	while (lo != hi) {
+		i = (lo + hi) / 2;
+		if (pts[i].sample <= target)
+			lo = i + 1;
+		else
+			hi = i;
+	}
+	pt = &pts[(lo != 0) ? lo - 1 : 0];
+
+	// The tags are already processed, and there's no ID3v2 tag at the seek point
+	mpeg_restart(m, d, m->options & ~(FFMPG_O_ID3V2 | FFMPG_O_APETAG | FFMPG_O_ID3V1), pt->off);
+	m->restarted = 1;
+	m->reopened = 0;
+	m->base = pt->sample;
+	dbglog(core, d->trk, "mpeg", "seek index: sample %U -> point %U, offset %xU"
+		, sample, pt->sample, pt->off);
+	return 0;
+}
+
 static void* mpeg_open(fmed_filt *d)
 {
 	if (d->stream_copy && !d->track->cmd(d->trk, FMED_TRACK_META_HAVEUSER)) {
@@ -86,6 +316,17 @@ static void* mpeg_open(fmed_filt *d)
 	if ((int64)d->input.size != FMED_NULL) {
 		ffmpg_setsize(&m->mpg.rdr, d->input.size);
 		m->mpg.options = FFMPG_O_ID3V2 | FFMPG_O_APETAG | FFMPG_O_ID3V1;
+		m->options = m->mpg.options;
+
+		if (mpeg_in_conf.seek_index && !d->stream_copy
+			&& NULL != (m->sidx_fn = sidx_fn(d))) {
+			sidx_load(m, d);
+			m->sidx.building = !m->sidx.complete;
+			if (m->sidx.pts.len != 0) {
+				const struct seekpt *last = (struct seekpt*)m->sidx.pts.ptr + m->sidx.pts.len - 1;
+				m->sidx.next_sample = last->sample + m->sidx.interval;
+			}
+		}
 	}
 
 	return m;
@@ -94,6 +335,11 @@ static void* mpeg_open(fmed_filt *d)
 static void mpeg_close(void *ctx)
 {
 	mpeg_in *m = ctx;
+	if (m->sidx_fn != NULL) {
+		sidx_save(m);
+		ffmem_free(m->sidx_fn);
+	}
+	ffarr_free(&m->sidx.pts);
 	ffmpg_fclose(&m->mpg);
 	ffmem_free(m);
 }
@@ -151,7 +397,10 @@ again:
 	case I_DATA:
 		if ((int64)d->audio.seek != FMED_NULL && !m->seeking) {
 			m->seeking = 1;
-			ffmpg_rseek(&m->mpg.rdr, ffpcm_samples(d->audio.seek, ffmpg_fmt(&m->mpg.rdr).sample_rate));
+			uint64 sample = ffpcm_samples(d->audio.seek, d->audio.fmt.sample_rate);
+			if (m->sidx_fn != NULL && 0 == mpeg_sidx_seek(m, d, sample))
+				return FMED_RMORE;
+			ffmpg_rseek(&m->mpg.rdr, sample);
 			if (d->stream_copy)
 				d->audio.seek = FMED_NULL;
 		}
@@ -171,12 +420,16 @@ again:
 					errlog(core, d->trk, NULL, "no MPEG header");
 					return FMED_RERR;
 				}
+				if (m->sidx.building)
+					m->sidx.complete = 1;
 				d->outlen = 0;
 				return FMED_RDONE;
 			}
 			return FMED_RMORE;
 
 		case FFMPG_RDONE:
+			if (m->sidx.building)
+				m->sidx.complete = 1;
 			d->outlen = 0;
 			return FMED_RLASTOUT;
 
@@ -184,6 +437,14 @@ again:
 			continue;
 
 		case FFMPG_RHDR:
+			if (m->restarted)
+				continue; //the reader is restarted from a seek point
+			if (m->reopened) {
+				// the stream header is already processed: seek again
+				m->reopened = 0;
+				m->seeking = 0;
+				goto again;
+			}
 			dbglog(core, d->trk, NULL, "preset:%s  tool:%s  xing-frames:%u"
 				, ffmpg_isvbr(&m->mpg.rdr) ? "VBR" : "CBR", m->mpg.rdr.lame.id, m->mpg.rdr.xing.frames);
 			ffpcm_fmtcopy(&d->audio.fmt, &ffmpg_fmt(&m->mpg.rdr));
@@ -200,13 +461,25 @@ again:
 			m->state = I_DATA;
 			fmed_setval("mpeg_delay", m->mpg.rdr.delay);
 
-			if (!d->stream_copy
+			if (!d->stream_copy && !d->input_info
 				&& 0 != d->track->cmd2(d->trk, FMED_TRACK_ADDFILT, "mpeg.decode"))
 				return FMED_RERR;
 
+			if (m->sidx_fn != NULL) {
+				if (!ffmpg_isvbr(&m->mpg.rdr)
+					|| (m->mpg.rdr.xing.flags & FFMPG_XING_TOC)) {
+					// the reader seeks by itself as fast as with the index
+					sidx_close(m);
+				} else if (m->sidx.interval == 0)
+					m->sidx.interval = ffmpg_fmt(&m->mpg.rdr).sample_rate; //1 point per second
+			}
+
 			if ((int64)d->audio.seek != FMED_NULL && !m->seeking) {
 				m->seeking = 1;
-				ffmpg_rseek(&m->mpg.rdr, ffpcm_samples(d->audio.seek, ffmpg_fmt(&m->mpg.rdr).sample_rate));
+				uint64 sample = ffpcm_samples(d->audio.seek, ffmpg_fmt(&m->mpg.rdr).sample_rate);
+				if (m->sidx_fn != NULL && 0 == mpeg_sidx_seek(m, d, sample))
+					return FMED_RMORE;
+				ffmpg_rseek(&m->mpg.rdr, sample);
 			}
 
 			goto again;
@@ -214,11 +487,12 @@ again:
 		case FFMPG_RID31:
 		case FFMPG_RID32:
 		case FFMPG_RAPETAG:
-			mpeg_meta(m, d, r);
+			if (!m->reopened)
+				mpeg_meta(m, d, r);
 			break;
 
 		case FFMPG_RSEEK:
-			d->input.seek = ffmpg_seekoff(&m->mpg);
+			d->input.seek = m->base_off + ffmpg_seekoff(&m->mpg);
 			return FMED_RMORE;
 
 		case FFMPG_RWARN:
@@ -231,13 +505,13 @@ again:
 				continue;
 			}
 			warnlog(core, d->trk, "mpeg", "ffmpg_read(): %s. Near sample %U, offset %U"
-				, ffmpg_ferrstr(&m->mpg), ffmpg_cursample(&m->mpg.rdr), ffmpg_seekoff(&m->mpg));
+				, ffmpg_ferrstr(&m->mpg), ffmpg_cursample(&m->mpg.rdr), m->base_off + ffmpg_seekoff(&m->mpg));
 			break;
 
 		case FFMPG_RERR:
 		default:
 			errlog(core, d->trk, "mpeg", "ffmpg_read(): %s. Near sample %U, offset %U"
-				, ffmpg_ferrstr(&m->mpg), ffmpg_cursample(&m->mpg.rdr), ffmpg_seekoff(&m->mpg));
+				, ffmpg_ferrstr(&m->mpg), ffmpg_cursample(&m->mpg.rdr), m->base_off + ffmpg_seekoff(&m->mpg));
 			return FMED_RERR;
 		}
 	}
@@ -245,12 +519,14 @@ again:
 data:
 	if (m->seeking)
 		m->seeking = 0;
+	if (m->sidx.building)
+		mpeg_sidx_add(m, d);
 	d->out = m->mpg.frame.ptr;
 	d->outlen = m->mpg.frame.len;
-	d->audio.pos = ffmpg_cursample(&m->mpg.rdr);
+	d->audio.pos = m->base + ffmpg_cursample(&m->mpg.rdr);
 	dbglog(core, d->trk, NULL, "passing frame #%u  samples:%u[%U]  size:%u  br:%u  off:%xU"
 		, m->mpg.rdr.frno, (uint)m->mpg.rdr.frsamps, d->audio.pos, (uint)m->mpg.frame.len
-		, ffmpg_hdr_bitrate((void*)m->mpg.frame.ptr), m->mpg.rdr.off - m->mpg.frame.len);
+		, ffmpg_hdr_bitrate((void*)m->mpg.frame.ptr), m->base_off + m->mpg.rdr.off - m->mpg.frame.len);
 	return FMED_RDATA;
 }
 
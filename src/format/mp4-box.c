@@ -0,0 +1,42 @@
+/** MP4 box data: helpers shared by the MP4 writer and the tag editor.
+Copyright (c) 2018 Simon Zolin */
+
+#include <fmedia.h>
+#include <format/mp4-box.h>
+
+
+int mp4_shift_offsets(char *moov, size_t off, size_t end, int64 delta)
+{
+	static const char *const containers[] = { "trak", "mdia", "minf", "stbl" };
+	int r;
+	while (off + 8 <= end) {
+		size_t n = ffint_ntoh32(*(uint*)(moov + off));
+		if (n < 8 || n > end - off)
+			return -1;
+		const char *type = moov + off + 4;
+
+		if (0 <= ffs_findarrz(containers, FFCNT(containers), type, 4)) {
+			if (0 != (r = mp4_shift_offsets(moov, off + 8, off + n, delta)))
+				return r;
+
+		} else if (!ffmemcmp(type, "stco", 4) && n >= 16) {
+			uint cnt = ffmin(ffint_ntoh32(*(uint*)(moov + off + 12)), (n - 16) / 4);
+			char *p = moov + off + 16;
+			for (uint i = 0;  i != cnt;  i++, p += 4) {
+				int64 v = (int64)ffint_ntoh32(*(uint*)p) + delta;
+				if (v < 0 || v > 0xffffffff)
+					return -2;
+				*(uint*)p = ffint_hton32(v);
+			}
+
+		} else if (!ffmemcmp(type, "co64", 4) && n >= 16) {
+			uint cnt = ffmin(ffint_ntoh32(*(uint*)(moov + off + 12)), (n - 16) / 8);
+			char *p = moov + off + 16;
+			for (uint i = 0;  i != cnt;  i++, p += 8)
+				*(uint64*)p = ffint_hton64(ffint_ntoh64(*(uint64*)p) + delta);
+		}
+
+		off += n;
+	}
+	return 0;
+}
@@ -0,0 +1,12 @@
+/** MP4 box data: helpers shared by the MP4 writer and the tag editor.
+Implemented in mp4-box.c: a module using them is linked with mp4-box.o.
+Copyright (c) 2018 Simon Zolin */
+
+#pragma once
+
+#include <FF/number.h>
+
+
+/** Add 'delta' to chunk offsets in all "stco" and "co64" boxes within moov[off..end).
+Return 0 on success;  -1 on a bad box;  -2 if a 32-bit chunk offset overflows. */
+int mp4_shift_offsets(char *moov, size_t off, size_t end, int64 delta);
@@ -5,31 +5,92 @@ Copyright (c) 2016 Simon Zolin */
 
 #include <FF/mformat/mp4.h>
 #include <FF/mtags/mmtag.h>
+#include <FFOS/dir.h>
+#include <format/fcache.h>
+#include <format/mp4-box.h>
 
 
 static const fmed_core *core;
 static const fmed_queue *qu;
 
 
+/* Header cache: the file regions consumed by the MP4 reader until the first audio frame
+ (ftyp, moov with the sample tables).
+When the same file is opened again (e.g. the next CUE entry or chapter of an audiobook),
+ the reader gets these regions from memory and doesn't read the file or seek to its end.
+Entries are shared by all tracks in the process and optionally stored in a cache directory.
+The cache is disabled by default.
+Note: the sample tables themselves are built inside ffmp4 reader which has no interface to export or import them,
+ so the cache holds the header boxes the reader consumes, not the parsed sample index. */
+struct hc_seg {
+	uint64 off; //file offset
+	uint64 len;
+	uint64 pos; //offset in hc_ent.data
+};
+
+struct hc_ent {
+	char *fn; //cache file name: identifies the input file by its absolute path, size and modification time
+	ffarr segs; //struct hc_seg[]
+	ffarr data;
+	uint refs;
+	uint64 used; //for LRU eviction
+};
+
+enum HC_STATE {
+	HC_OFF,
+	HC_RECORD, //save the data consumed by the reader
+	HC_REPLAY, //feed the reader from cache
+};
+
 typedef struct mp4 {
 	ffmp4 mp;
 	uint state;
+	uint64 in_off; //file offset of mp.data
+	struct hc_ent *hc;
+	uint hc_state; //enum HC_STATE
 	uint seeking :1;
+	uint hc_seek :1; //the reader has switched from cache to file: seek the input on the next request
 } mp4;
 
+static struct mp4_in_conf_t {
+	byte header_cache;
+	byte header_cache_disk;
+	char *header_cache_dir;
+} mp4_in_conf;
+
+enum {
+	HC_MAXENTS = 8,
+	HC_MAXSIZE = 32 * 1024 * 1024,
+	HC_VER = 2,
+};
+
+/** Process-wide header cache. */
+static struct {
+	fflock lk;
+	struct hc_ent *ents[HC_MAXENTS];
+	uint64 counter;
+} hc;
+
 typedef struct mp4_out {
 	uint state;
 	ffmp4_cook mp;
+	fmed_filt *d;
+	uint fin :1;
 } mp4_out;
 
+static struct mp4_out_conf_t {
+	byte fast_start;
+} mp4_out_conf;
+
 
 //FMEDIA MODULE
 static const void* mp4_iface(const char *name);
+static int mp4_conf(const char *name, ffpars_ctx *ctx);
 static int mp4_sig(uint signo);
 static void mp4_destroy(void);
 static const fmed_mod fmed_mp4_mod = {
 	.ver = FMED_VER_FULL, .ver_core = FMED_VER_CORE,
-	&mp4_iface, &mp4_sig, &mp4_destroy
+	&mp4_iface, &mp4_sig, &mp4_destroy, &mp4_conf
 };
 
 //INPUT
@@ -39,6 +100,20 @@ static int mp4_in_decode(void *ctx, fmed_filt *d);
 static const fmed_filter fmed_mp4_input = {
 	&mp4_in_create, &mp4_in_decode, &mp4_in_free
 };
+static int mp4_in_config(ffpars_ctx *ctx);
+
+static const ffpars_arg mp4_in_conf_args[] = {
+	{ "header_cache",	FFPARS_TBOOL8,  FFPARS_DSTOFF(struct mp4_in_conf_t, header_cache) },
+	{ "header_cache_disk",	FFPARS_TBOOL8,  FFPARS_DSTOFF(struct mp4_in_conf_t, header_cache_disk) },
+	{ "header_cache_dir",	FFPARS_TCHARPTR | FFPARS_FSTRZ | FFPARS_FCOPY | FFPARS_FNOTEMPTY,  FFPARS_DSTOFF(struct mp4_in_conf_t, header_cache_dir) },
+};
+
+static void hc_open(mp4 *m, fmed_filt *d);
+static void hc_record(mp4 *m, const char *data, size_t len);
+static void hc_fin(mp4 *m, fmed_filt *d);
+static int hc_feed(mp4 *m);
+static void hc_release(struct hc_ent *e);
+static void hc_free(struct hc_ent *e);
 
 //OUTPUT
 static void* mp4_out_create(fmed_filt *d);
@@ -47,6 +122,13 @@ static int mp4_out_encode(void *ctx, fmed_filt *d);
 static const fmed_filter mp4_output = {
 	&mp4_out_create, &mp4_out_encode, &mp4_out_free
 };
+static int mp4_out_config(ffpars_ctx *ctx);
+
+static const ffpars_arg mp4_out_conf_args[] = {
+	{ "fast_start",	FFPARS_TBOOL8,  FFPARS_DSTOFF(struct mp4_out_conf_t, fast_start) },
+};
+
+static int mp4_faststart(const char *fn, void *trk);
 
 static void mp4_meta(mp4 *m, fmed_filt *d);
 static int mp4_out_addmeta(mp4_out *m, fmed_filt *d);
@@ -68,11 +150,21 @@ static const void* mp4_iface(const char *name)
 	return NULL;
 }
 
+static int mp4_conf(const char *name, ffpars_ctx *ctx)
+{
+	if (!ffsz_cmp(name, "input"))
+		return mp4_in_config(ctx);
+	else if (!ffsz_cmp(name, "output"))
+		return mp4_out_config(ctx);
+	return -1;
+}
+
 static int mp4_sig(uint signo)
 {
 	switch (signo) {
 	case FMED_SIG_INIT:
 		ffmem_init();
+		fflk_init(&hc.lk);
 		return 0;
 
 	case FMED_OPEN:
@@ -84,6 +176,20 @@ static int mp4_sig(uint signo)
 
 static void mp4_destroy(void)
 {
+	for (uint i = 0;  i != HC_MAXENTS;  i++) {
+		hc_free(hc.ents[i]);
+		hc.ents[i] = NULL;
+	}
+	ffmem_safefree0(mp4_in_conf.header_cache_dir);
+}
+
+
+static int mp4_in_config(ffpars_ctx *ctx)
+{
+	mp4_in_conf.header_cache = 0;
+	mp4_in_conf.header_cache_disk = 0;
+	ffpars_setargs(ctx, &mp4_in_conf, mp4_in_conf_args, FFCNT(mp4_in_conf_args));
+	return 0;
 }
 
 
@@ -95,8 +201,11 @@ static void* mp4_in_create(fmed_filt *d)
 
 	ffmp4_init(&m->mp);
 
-	if ((int64)d->input.size != FMED_NULL)
+	if ((int64)d->input.size != FMED_NULL) {
 		m->mp.total_size = d->input.size;
+		if (mp4_in_conf.header_cache)
+			hc_open(m, d);
+	}
 
 	return m;
 }
@@ -105,9 +214,344 @@ static void mp4_in_free(void *ctx)
 {
 	mp4 *m = ctx;
 	ffmp4_close(&m->mp);
+	if (m->hc_state == HC_RECORD)
+		hc_free(m->hc);
+	else
+		hc_release(m->hc);
 	ffmem_free(m);
 }
 
+static void hc_free(struct hc_ent *e)
+{
+	if (e == NULL)
+		return;
+	ffarr_free(&e->segs);
+	ffarr_free(&e->data);
+	ffmem_safefree(e->fn);
+	ffmem_free(e);
+}
+
+static void hc_release(struct hc_ent *e)
+{
+	if (e == NULL)
+		return;
+	fflk_lock(&hc.lk);
+	e->refs--;
+	fflk_unlock(&hc.lk);
+}
+
+/** Get the name of cache file for the input file. */
+static char* hc_fn(const char *input)
+{
+	char *dir, *fn;
+
+	if (mp4_in_conf.header_cache_dir != NULL)
+		dir = core->env_expand(NULL, 0, mp4_in_conf.header_cache_dir);
+	else
+		dir = core->env_expand(NULL, 0, FFDIR_USER_CONFIG "/fmedia/mp4hdr");
+	if (dir == NULL)
+		return NULL;
+
+	fn = fcache_fn(dir, input, "mp4hdr");
+	ffmem_free(dir);
+	return fn;
+}
+
+/* Cache file data (after fcache header):
+struct hc_filehdr
+struct hc_seg[nsegs]
+data[] */
+struct hc_filehdr {
+	uint64 nsegs;
+};
+
+static struct hc_ent* hc_load(const char *fn, void *trk)
+{
+	ffarr buf = {0};
+	ffstr data;
+	struct hc_ent *e = NULL;
+	const struct hc_filehdr *h;
+	int r;
+
+	if (0 != (r = fcache_load(&buf, &data, fn, "FMHC", HC_VER, HC_MAXSIZE + 4096))) {
+		if (r < 0)
+			warnlog(core, trk, "mp4", "%s: bad header cache file", fn);
+		goto end;
+	}
+
+	h = (void*)data.ptr;
+	if (data.len < sizeof(*h)
+		|| h->nsegs > HC_MAXSIZE / 4096
+		|| data.len < sizeof(*h) + h->nsegs * sizeof(struct hc_seg)) {
+		warnlog(core, trk, "mp4", "%s: bad header cache file", fn);
+		goto end;
+	}
+	const struct hc_seg *segs = (void*)(data.ptr + sizeof(*h));
+	size_t datalen = data.len - sizeof(*h) - h->nsegs * sizeof(struct hc_seg);
+	for (uint64 i = 0;  i != h->nsegs;  i++) {
+		if (segs[i].pos + segs[i].len > datalen) {
+			warnlog(core, trk, "mp4", "%s: bad header cache file", fn);
+			goto end;
+		}
+	}
+
+	if (NULL == (e = ffmem_new(struct hc_ent))
+		|| NULL == ffarr_allocT(&e->segs, h->nsegs, struct hc_seg)
+		|| NULL == ffarr_alloc(&e->data, datalen)) {
+		hc_free(e);
+		e = NULL;
+		goto end;
+	}
+	ffmemcpy(e->segs.ptr, segs, h->nsegs * sizeof(struct hc_seg));
+	e->segs.len = h->nsegs;
+	ffmemcpy(e->data.ptr, (char*)segs + h->nsegs * sizeof(struct hc_seg), datalen);
+	e->data.len = datalen;
+	dbglog(core, trk, "mp4", "loaded header cache: %s: %L bytes", fn, e->data.len);
+
+end:
+	ffarr_free(&buf);
+	return e;
+}
+
+static void hc_save(const struct hc_ent *e)
+{
+	struct hc_filehdr h = {};
+	ffstr parts[3];
+
+	h.nsegs = e->segs.len;
+	ffstr_set(&parts[0], &h, sizeof(h));
+	ffstr_set(&parts[1], e->segs.ptr, e->segs.len * sizeof(struct hc_seg));
+	ffstr_set(&parts[2], e->data.ptr, e->data.len);
+	if (0 != fcache_save(e->fn, "FMHC", HC_VER, parts, FFCNT(parts)))
+		return;
+	dbglog(core, NULL, "mp4", "saved header cache: %s: %L bytes", e->fn, e->data.len);
+}
+
+/** Add entry to the memory cache, replacing the least recently used unreferenced entry.
+Return 0 if added.  Thread: any, hc.lk is locked. */
+static int hc_insert(struct hc_ent *e)
+{
+	int k = -1;
+	for (uint i = 0;  i != HC_MAXENTS;  i++) {
+		if (hc.ents[i] == NULL) {
+			k = i;
+			break;
+		}
+		if (hc.ents[i]->refs == 0
+			&& (k == -1 || hc.ents[i]->used < hc.ents[k]->used))
+			k = i;
+	}
+	if (k == -1)
+		return -1;
+	hc_free(hc.ents[k]);
+	hc.ents[k] = e;
+	e->used = ++hc.counter;
+	return 0;
+}
+
+/** Find the file in cache and start replaying its header, or start recording. */
+static void hc_open(mp4 *m, fmed_filt *d)
+{
+	struct hc_ent *e = NULL;
+	const char *in;
+	char *fn;
+
+	if (FMED_PNULL == (in = d->track->getvalstr(d->trk, "input")))
+		return;
+	if (NULL == (fn = hc_fn(in)))
+		return; // not a local file
+
+	fflk_lock(&hc.lk);
+	for (uint i = 0;  i != HC_MAXENTS;  i++) {
+		struct hc_ent *it = hc.ents[i];
+		if (it != NULL && ffsz_eq(it->fn, fn)) {
+			e = it;
+			break;
+		}
+	}
+	if (e != NULL) {
+		e->refs++;
+		e->used = ++hc.counter;
+	}
+	fflk_unlock(&hc.lk);
+
+	if (e == NULL && mp4_in_conf.header_cache_disk
+		&& NULL != (e = hc_load(fn, d->trk))) {
+		e->fn = fn;
+		fn = NULL;
+		fflk_lock(&hc.lk);
+		if (0 == hc_insert(e))
+			e->refs++;
+		else {
+			hc_free(e);
+			e = NULL;
+		}
+		fflk_unlock(&hc.lk);
+	}
+
+	if (e != NULL) {
+		dbglog(core, d->trk, "mp4", "using header cache: %L bytes", e->data.len);
+		m->hc = e;
+		m->hc_state = HC_REPLAY;
+		ffmem_safefree(fn);
+		return;
+	}
+
+	if (fn == NULL || NULL == (e = ffmem_new(struct hc_ent))) {
+		ffmem_safefree(fn);
+		return;
+	}
+	e->fn = fn;
+	m->hc = e;
+	m->hc_state = HC_RECORD;
+}
+
+/** Save the data consumed by the reader at the current offset. */
+static void hc_record(mp4 *m, const char *data, size_t len)
+{
+	struct hc_ent *e = m->hc;
+	struct hc_seg *seg = (struct hc_seg*)e->segs.ptr + e->segs.len - 1;
+
+	if (e->data.len + len > HC_MAXSIZE) {
+		hc_free(e);
+		m->hc = NULL;
+		m->hc_state = HC_OFF;
+		return;
+	}
+
+	if (e->segs.len != 0 && seg->off + seg->len == m->in_off) {
+		seg->len += len;
+	} else {
+		if (NULL == (seg = ffarr_pushgrowT(&e->segs, 8, struct hc_seg)))
+			goto err;
+		seg->off = m->in_off;
+		seg->len = len;
+		seg->pos = e->data.len;
+	}
+	if (NULL == ffarr_append(&e->data, data, len))
+		goto err;
+	return;
+
+err:
+	hc_free(e);
+	m->hc = NULL;
+	m->hc_state = HC_OFF;
+}
+
+/** The reader has returned the first audio frame: stop recording or replaying. */
+static void hc_fin(mp4 *m, fmed_filt *d)
+{
+	struct hc_ent *e = m->hc;
+
+	if (m->hc_state == HC_REPLAY) {
+		m->hc_state = HC_OFF;
+		m->hc_seek = 1;
+		return; // the entry is released in mp4_in_free(): the reader may still use its data
+	}
+
+	m->hc_state = HC_OFF;
+	m->hc = NULL;
+	dbglog(core, d->trk, "mp4", "header: %L bytes in %L regions", e->data.len, e->segs.len);
+
+	if (mp4_in_conf.header_cache_disk)
+		hc_save(e);
+
+	fflk_lock(&hc.lk);
+	int r = hc_insert(e);
+	fflk_unlock(&hc.lk);
+	if (r != 0)
+		hc_free(e);
+}
+
+/** Pass the cached data at the current offset to the reader.
+Return 0 on success;  -1 if the region isn't cached. */
+static int hc_feed(mp4 *m)
+{
+	const struct hc_seg *seg;
+	FFARR_WALKT(&m->hc->segs, seg, struct hc_seg) {
+		if (seg->off <= m->in_off && m->in_off < seg->off + seg->len) {
+			uint64 skip = m->in_off - seg->off;
+			m->mp.data = m->hc->data.ptr + seg->pos + skip;
+			m->mp.datalen = seg->len - skip;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+struct bitreader {
+	uint64 bits;
+	uint off;
+	uint size;
+};
+
+static uint bits_get(struct bitreader *br, uint n)
+{
+	if (br->off + n > br->size) {
+		br->off = br->size + 1;
+		return 0;
+	}
+	uint r = (uint)((br->bits << br->off) >> (64 - n));
+	br->off += n;
+	return r;
+}
+
+/** Get the number of PCM samples per AAC frame from AudioSpecificConfig.
+@rate: output sample rate of the track
+Return 0 if unknown. */
+static uint aac_asc_frame_samples(const ffstr *asc, uint rate)
+{
+	static const uint rates[] = {
+		96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+	};
+	struct bitreader br = {0};
+	uint aot, ifreq, core_rate, n;
+
+	br.size = ffmin(asc->len, 8) * 8;
+	for (uint i = 0;  i != br.size / 8;  i++) {
+		br.bits |= (uint64)(byte)asc->ptr[i] << (56 - i * 8);
+	}
+
+	aot = bits_get(&br, 5);
+	if (aot == 31)
+		aot = 32 + bits_get(&br, 6);
+	ifreq = bits_get(&br, 4);
+	if (ifreq == 15)
+		core_rate = bits_get(&br, 24);
+	else if (ifreq < FFCNT(rates))
+		core_rate = rates[ifreq];
+	else
+		return 0;
+	bits_get(&br, 4); //channel configuration
+
+	if (aot == 5 || aot == 29) {
+		// explicit SBR (HE-AAC) or PS (HE-AACv2): the core object type follows
+		if (15 == bits_get(&br, 4))
+			bits_get(&br, 24);
+		aot = bits_get(&br, 5);
+	}
+
+	switch (aot) {
+	case 1: //AAC Main
+	case 2: //AAC LC
+	case 3: //AAC SSR
+	case 4: //AAC LTP
+	case 6: //AAC Scalable
+		n = bits_get(&br, 1) ? 960 : 1024; //frameLengthFlag
+		break;
+	default:
+		return 0;
+	}
+	if (br.off > br.size)
+		return 0;
+
+	// with SBR the decoder outputs twice as many samples as the core codec:
+	//  the frame length is 2048 if the track's sample rate is the output rate
+	if (core_rate != 0 && rate >= core_rate * 2)
+		n *= 2;
+	return n;
+}
+
 static void mp4_meta(mp4 *m, fmed_filt *d)
 {
 	ffstr name, val;
@@ -132,8 +576,12 @@ static int mp4_in_decode(void *ctx, fmed_filt *d)
 		return FMED_RLASTOUT;
 	}
 
-	m->mp.data = d->data;
-	m->mp.datalen = d->datalen;
+	if (m->hc_state == HC_REPLAY) {
+		m->mp.datalen = 0; // the data from file is ignored, hc_feed() is called when the reader needs more
+	} else {
+		m->mp.data = d->data;
+		m->mp.datalen = d->datalen;
+	}
 
 	for (;;) {
 
@@ -151,10 +599,33 @@ static int mp4_in_decode(void *ctx, fmed_filt *d)
 			return FMED_RDATA;
 		}
 
-	case I_HDR:
+	case I_HDR: {
+		const char *data = m->mp.data;
+		size_t datalen = m->mp.datalen;
 		r = ffmp4_read(&m->mp);
+		size_t n = datalen - m->mp.datalen;
+		if (m->hc_state == HC_RECORD && n != 0)
+			hc_record(m, data, n);
+		m->in_off += n;
+		}
+
 		switch (r) {
 		case FFMP4_RMORE:
+			if (m->hc_state == HC_REPLAY) {
+				if (0 == hc_feed(m))
+					continue;
+				// not cached: continue reading from file
+				m->hc_state = HC_OFF;
+				d->input.seek = m->in_off;
+				d->datalen = 0;
+				return FMED_RMORE;
+			}
+			if (m->hc_seek) {
+				m->hc_seek = 0;
+				d->input.seek = m->in_off;
+				d->datalen = 0;
+				return FMED_RMORE;
+			}
 			if (d->flags & FMED_FLAST) {
 				warnlog(core, d->trk, "mp4", "file is incomplete");
 				d->outlen = 0;
@@ -186,7 +657,29 @@ static int mp4_in_decode(void *ctx, fmed_filt *d)
 				errlog(core, d->trk, "mp4", "%s: decoding unsupported", ffmp4_codec(m->mp.codec));
 				return FMED_RERR;
 			}
-			if (0 != d->track->cmd2(d->trk, FMED_TRACK_ADDFILT, (void*)filt))
+
+			if (d->stream_copy) {
+				if (m->mp.codec != FFMP4_AAC) {
+					errlog(core, d->trk, "mp4", "%s: stream copy unsupported", ffmp4_codec(m->mp.codec));
+					return FMED_RERR;
+				}
+				// the first output block is AAC ASC, then raw AAC frames
+				d->datatype = "aac";
+				d->audio.convfmt = d->audio.fmt;
+				ffstr asc;
+				ffstr_set(&asc, m->mp.out, m->mp.outlen);
+				uint frsamps = aac_asc_frame_samples(&asc, d->audio.fmt.sample_rate);
+				if (frsamps == 0) {
+					errlog(core, d->trk, "mp4", "unsupported AAC configuration: %*xb", asc.len, asc.ptr);
+					return FMED_RERR;
+				}
+				fmed_setval("audio_frame_samples", frsamps);
+
+			} else if (d->input_info) {
+				// the decoder isn't needed to get the header info
+				d->audio.decoder = ffmp4_codec(m->mp.codec);
+
+			} else if (0 != d->track->cmd2(d->trk, FMED_TRACK_ADDFILT, (void*)filt))
 				return FMED_RERR;
 			d->data = m->mp.data,  d->datalen = m->mp.datalen;
 			d->out = m->mp.out,  d->outlen = m->mp.outlen;
@@ -199,6 +692,8 @@ static int mp4_in_decode(void *ctx, fmed_filt *d)
 			break;
 
 		case FFMP4_RMETAFIN:
+			if (m->hc_state != HC_OFF)
+				hc_fin(m, d);
 			if (d->input_info)
 				return FMED_ROK;
 
@@ -206,6 +701,8 @@ static int mp4_in_decode(void *ctx, fmed_filt *d)
 			continue;
 
 		case FFMP4_RDATA:
+			if (m->hc_state != HC_OFF)
+				hc_fin(m, d);
 			d->audio.pos = ffmp4_cursample(&m->mp);
 			dbglog(core, d->trk, NULL, "passing %L bytes at position #%U"
 				, m->mp.outlen, d->audio.pos);
@@ -219,6 +716,12 @@ static int mp4_in_decode(void *ctx, fmed_filt *d)
 			return FMED_RLASTOUT;
 
 		case FFMP4_RSEEK:
+			m->in_off = m->mp.off;
+			m->hc_seek = 0;
+			if (m->hc_state == HC_REPLAY) {
+				m->mp.datalen = 0;
+				continue;
+			}
 			d->input.seek = m->mp.off;
 			return FMED_RMORE;
 
@@ -240,18 +743,38 @@ static int mp4_in_decode(void *ctx, fmed_filt *d)
 }
 
 
+static int mp4_out_config(ffpars_ctx *ctx)
+{
+	mp4_out_conf.fast_start = 0;
+	ffpars_setargs(ctx, &mp4_out_conf, mp4_out_conf_args, FFCNT(mp4_out_conf_args));
+	return 0;
+}
+
 static void* mp4_out_create(fmed_filt *d)
 {
 	mp4_out *m = ffmem_tcalloc1(mp4_out);
 	if (m == NULL)
 		return NULL;
+	m->d = d;
 	return m;
 }
 
+/* The output file is already closed:
+ the filters following us in the chain are closed before us. */
 static void mp4_out_free(void *ctx)
 {
 	mp4_out *m = ctx;
+	fmed_filt *d = m->d;
 	ffmp4_wclose(&m->mp);
+
+	if (m->fin && mp4_out_conf.fast_start
+		&& d->out_seekable && !d->out_file_del
+		&& FMED_NULL == d->track->getval(d->trk, "error")) {
+		const char *fn = d->track->getvalstr(d->trk, "output");
+		if (fn != FMED_PNULL)
+			mp4_faststart(fn, d->trk);
+	}
+
 	ffmem_free(m);
 }
 
@@ -370,6 +893,7 @@ static int mp4_out_encode(void *ctx, fmed_filt *d)
 
 		case FFMP4_RDONE:
 			d->outlen = 0;
+			m->fin = 1;
 			core->log(FMED_LOG_INFO, d->trk, NULL, "MP4: frames:%u, overhead: %.2F%%"
 				, m->mp.frameno
 				, (double)m->mp.mp4_size * 100 / (m->mp.mp4_size + m->mp.mdat_size));
@@ -385,3 +909,107 @@ static int mp4_out_encode(void *ctx, fmed_filt *d)
 		}
 	}
 }
+
+
+static int mp4_fread(fffd f, uint64 off, void *buf, size_t n)
+{
+	if (0 > fffile_seek(f, off, SEEK_SET)
+		|| n != (size_t)fffile_read(f, buf, n))
+		return -1;
+	return 0;
+}
+
+static int mp4_fwrite(fffd f, uint64 off, const void *buf, size_t n)
+{
+	if (0 > fffile_seek(f, off, SEEK_SET)
+		|| n != (size_t)fffile_write(f, buf, n))
+		return -1;
+	return 0;
+}
+
+#define MP4_MOVE_BUF  (1 * 1024 * 1024)
+
+/** Place "moov" box before "mdat" so that the file can be played by a sequential reader.
+The chunk offsets are shifted by the size of moov, then the data between "mdat" and "moov"
+ is moved forward in one pass from the end, and moov is written in the freed space.
+The file isn't modified if the offsets can't be shifted. */
+static int mp4_faststart(const char *fn, void *trk)
+{
+	fffd f;
+	char hdr[16];
+	uint64 fsize, off = 0, moov_off = 0, moov_size = 0, mdat_off = (uint64)-1;
+	ffarr moov = {}, buf = {};
+	int rc = -1;
+
+	if (FF_BADFD == (f = fffile_open(fn, O_RDWR))) {
+		syserrlog(core, trk, "mp4", "%s: %s", fffile_open_S, fn);
+		return -1;
+	}
+	fsize = fffile_size(f);
+
+	while (off + 8 <= fsize) {
+		size_t hdrlen = ffmin(sizeof(hdr), fsize - off);
+		if (0 != mp4_fread(f, off, hdr, hdrlen))
+			goto syserr;
+		uint64 n = ffint_ntoh32(*(uint*)hdr);
+		if (n == 1 && hdrlen == 16)
+			n = ffint_ntoh64(*(uint64*)(hdr + 8));
+		else if (n == 0)
+			n = fsize - off;
+		if (n < 8 || n > fsize - off) {
+			errlog(core, trk, "mp4", "%s: fast-start: bad box size", fn);
+			goto end;
+		}
+		if (!ffmemcmp(hdr + 4, "moov", 4)) {
+			moov_off = off;
+			moov_size = n;
+		} else if (!ffmemcmp(hdr + 4, "mdat", 4) && mdat_off == (uint64)-1)
+			mdat_off = off;
+		off += n;
+	}
+
+	if (moov_size == 0 || mdat_off == (uint64)-1 || moov_off < mdat_off) {
+		dbglog(core, trk, "mp4", "fast-start: moov is already before mdat");
+		rc = 0;
+		goto end;
+	}
+
+	if (moov_size > 0xffffffff
+		|| NULL == ffarr_alloc(&moov, moov_size)
+		|| 0 != mp4_fread(f, moov_off, moov.ptr, moov_size)
+		|| ffint_ntoh32(*(uint*)moov.ptr) != moov_size) {
+		errlog(core, trk, "mp4", "%s: fast-start: can't read moov box", fn);
+		goto end;
+	}
+	if (0 != mp4_shift_offsets(moov.ptr, 8, moov_size, (int64)moov_size)) {
+		errlog(core, trk, "mp4", "%s: fast-start: can't shift chunk offsets", fn);
+		goto end;
+	}
+
+	if (NULL == ffarr_alloc(&buf, ffmin(MP4_MOVE_BUF, moov_off - mdat_off)))
+		goto syserr;
+	for (off = moov_off;  off != mdat_off;  ) {
+		size_t n = ffmin(buf.cap, off - mdat_off);
+		off -= n;
+		if (0 != mp4_fread(f, off, buf.ptr, n)
+			|| 0 != mp4_fwrite(f, off + moov_size, buf.ptr, n))
+			goto syserr;
+	}
+
+	if (0 != mp4_fwrite(f, mdat_off, moov.ptr, moov_size))
+		goto syserr;
+
+	dbglog(core, trk, "mp4", "fast-start: moved moov (%U bytes) before mdat, %U bytes shifted"
+		, moov_size, moov_off - mdat_off);
+	rc = 0;
+	goto end;
+
+syserr:
+	syserrlog(core, trk, "mp4", "%s: fast-start: file I/O", fn);
+
+end:
+	ffarr_free(&moov);
+	ffarr_free(&buf);
+	fffile_close(f);
+	return rc;
+}
@@ -0,0 +1,1596 @@
+/** Edit tags in place without re-encoding: FLAC Vorbis comment, ID3v2, APEv2, MP4 ilst.
+The new tags are written over the old ones if they fit into the existing tag area and padding
+ (the original data is kept in a journal file until the write is complete),
+ otherwise the file is rewritten into a new file which then replaces the original one.
+Copyright (c) 2018 Simon Zolin */
+
+#include <fmedia.h>
+
+#include <FF/mtags/id3.h>
+#include <FF/mtags/vorbistag.h>
+#include <FF/mtags/mmtag.h>
+#include <FF/array.h>
+#include <FF/path.h>
+#include <format/mp4-box.h>
+#include <FFOS/file.h>
+#include <FFOS/error.h>
+
+
+#undef dbglog
+#undef warnlog
+#undef errlog
+#undef syserrlog
+#define dbglog(trk, ...)  fmed_dbglog(core, trk, "tag", __VA_ARGS__)
+#define infolog(trk, ...)  fmed_infolog(core, trk, "tag", __VA_ARGS__)
+#define warnlog(trk, ...)  fmed_warnlog(core, trk, "tag", __VA_ARGS__)
+#define errlog(trk, ...)  fmed_errlog(core, trk, "tag", __VA_ARGS__)
+#define syserrlog(trk, ...)  fmed_syserrlog(core, trk, "tag", __VA_ARGS__)
+
+
+static const fmed_core *core;
+static const fmed_queue *qu;
+
+static struct tag_conf_t {
+	uint padding;
+	size_t bufsize;
+} tag_conf;
+
+static const ffpars_arg tag_conf_args[] = {
+	{ "padding",  FFPARS_TINT,  FFPARS_DSTOFF(struct tag_conf_t, padding) },
+	{ "buffer_size",  FFPARS_TSIZE | FFPARS_FNOTZERO,  FFPARS_DSTOFF(struct tag_conf_t, bufsize) },
+};
+
+//FMEDIA MODULE
+static const void* tag_iface(const char *name);
+static int tag_sig(uint signo);
+static void tag_destroy(void);
+static int tag_conf(const char *name, ffpars_ctx *ctx);
+static const fmed_mod fmed_tag_mod = {
+	.ver = FMED_VER_FULL, .ver_core = FMED_VER_CORE,
+	&tag_iface, &tag_sig, &tag_destroy, &tag_conf
+};
+
+//EDIT
+static void* tag_open(fmed_filt *d);
+static void tag_close(void *ctx);
+static int tag_process(void *ctx, fmed_filt *d);
+static const fmed_filter fmed_tag_edit = {
+	&tag_open, &tag_process, &tag_close
+};
+
+
+struct tag_kv {
+	ffstr name;
+	ffstr val; //empty: remove the tag
+};
+
+struct tagedit {
+	void *trk;
+	const char *fn;
+	fffd fd;
+	uint64 fsize;
+	fftime mtime;
+	uint fmt; //enum TAG_F
+	ffarr kv; //struct tag_kv[]
+	ffarr buf; //data read from file
+	ffarr out; //new tag data
+	uint clear :1; //remove all text tags from file
+	uint preserve_date :1;
+};
+
+enum TAG_F {
+	TAG_FLAC = 1,
+	TAG_ID3V2,
+	TAG_APE,
+	TAG_MP4,
+};
+
+static const char* const tag_exts[] = {
+	"flac", "mp3", "ape", "wv", "mpc", "m4a", "mp4", "m4b",
+};
+static const byte tag_ext_fmt[] = {
+	TAG_FLAC, TAG_ID3V2, TAG_APE, TAG_APE, TAG_APE, TAG_MP4, TAG_MP4, TAG_MP4,
+};
+
+/** Tag names used by fmedia and the corresponding IDs in each format.
+The same table is used to find the existing tags and to write the new ones,
+ so a tag that isn't listed here is stored as a freeform item (TXXX, APE key, "----"). */
+struct tag_name {
+	const char *name;
+	const char *id3;
+	const char *ape;
+	const char *mp4;
+};
+
+static const struct tag_name tag_names[] = {
+	{ "album",	"TALB", "Album",	"\251alb" },
+	{ "albumartist",	"TPE2", "Album Artist",	"aART" },
+	{ "artist",	"TPE1", "Artist",	"\251ART" },
+	{ "comment",	"COMM", "Comment",	"\251cmt" },
+	{ "composer",	"TCOM", "Composer",	"\251wrt" },
+	{ "copyright",	"TCOP", "Copyright",	"cprt" },
+	{ "date",	"TDRC", "Year",	"\251day" },
+	{ "discnumber",	"TPOS", "Disc",	"disk" },
+	{ "encoder",	"TSSE", "Encoder",	"\251too" },
+	{ "genre",	"TCON", "Genre",	"\251gen" },
+	{ "lyrics",	"USLT", "Lyrics",	"\251lyr" },
+	{ "publisher",	"TPUB", "Publisher",	NULL },
+	{ "title",	"TIT2", "Title",	"\251nam" },
+	{ "tracknumber",	"TRCK", "Track",	"trkn" },
+};
+
+enum FIELD { F_ID3, F_APE, F_MP4 };
+
+static const struct tag_name* tag_byname(const ffstr *name)
+{
+	for (uint i = 0;  i != FFCNT(tag_names);  i++) {
+		if (ffstr_ieqz(name, tag_names[i].name))
+			return &tag_names[i];
+	}
+	return NULL;
+}
+
+static const char* tag_field(const struct tag_name *tn, uint field)
+{
+	switch (field) {
+	case F_ID3:
+		return tn->id3;
+	case F_APE:
+		return tn->ape;
+	}
+	return tn->mp4;
+}
+
+/** Get fmedia tag name by format-specific ID. */
+static const char* tag_byid(const char *id, size_t len, uint field)
+{
+	ffstr sid;
+	ffstr_set(&sid, id, len);
+	for (uint i = 0;  i != FFCNT(tag_names);  i++) {
+		const char *s = tag_field(&tag_names[i], field);
+		if (s == NULL)
+			continue;
+		if ((field == F_APE) ? ffstr_ieqz(&sid, s) : ffstr_eqz(&sid, s))
+			return tag_names[i].name;
+	}
+	return NULL;
+}
+
+/** Find the user-specified tag. */
+static struct tag_kv* tag_find(struct tagedit *t, const char *name, size_t len)
+{
+	struct tag_kv *kv;
+	FFARR_WALKT(&t->kv, kv, struct tag_kv) {
+		if (ffstr_ieq(&kv->name, name, len))
+			return kv;
+	}
+	return NULL;
+}
+
+/** Return TRUE if the existing tag must be removed. */
+static ffbool tag_replaced(struct tagedit *t, const char *name, size_t len, ffbool text)
+{
+	return (t->clear && text) || (len != 0 && NULL != tag_find(t, name, len));
+}
+
+
+/** Append data to the output buffer. */
+static int out_add(ffarr *a, const void *data, size_t len)
+{
+	if (NULL == ffarr_grow(a, len, 256))
+		return -1;
+	ffmemcpy(ffarr_end(a), data, len);
+	a->len += len;
+	return 0;
+}
+
+static int out_zero(ffarr *a, size_t len)
+{
+	if (NULL == ffarr_grow(a, len, 256))
+		return -1;
+	ffmem_zero(ffarr_end(a), len);
+	a->len += len;
+	return 0;
+}
+
+static int out_be32(ffarr *a, uint v)
+{
+	v = ffint_hton32(v);
+	return out_add(a, &v, 4);
+}
+
+static int out_le32(ffarr *a, uint v)
+{
+	v = ffint_htol32(v);
+	return out_add(a, &v, 4);
+}
+
+
+static int tag_read(struct tagedit *t, uint64 off, size_t n, ffarr *buf)
+{
+	if (NULL == ffarr_realloc(buf, n)) {
+		syserrlog(t->trk, "%s", ffmem_alloc_S);
+		return -1;
+	}
+	buf->len = 0;
+	if (0 > fffile_seek(t->fd, off, SEEK_SET)) {
+		syserrlog(t->trk, "%s: %s", fffile_seek_S, t->fn);
+		return -1;
+	}
+	ssize_t r = fffile_read(t->fd, buf->ptr, n);
+	if (r < 0) {
+		syserrlog(t->trk, "%s: %s", fffile_read_S, t->fn);
+		return -1;
+	} else if ((size_t)r != n) {
+		errlog(t->trk, "%s: unexpected end of file", t->fn);
+		return -1;
+	}
+	buf->len = n;
+	return 0;
+}
+
+static int tag_write(struct tagedit *t, fffd fd, uint64 off, const void *data, size_t n)
+{
+	if (0 > fffile_seek(fd, off, SEEK_SET)) {
+		syserrlog(t->trk, "%s: %s", fffile_seek_S, t->fn);
+		return -1;
+	}
+	if (n != (size_t)fffile_write(fd, data, n)) {
+		syserrlog(t->trk, "%s: %s", fffile_write_S, t->fn);
+		return -1;
+	}
+	return 0;
+}
+
+/** Copy data block-wise from the input file. */
+static int tag_copy(struct tagedit *t, fffd dst, uint64 off, uint64 size)
+{
+	ffarr buf = {};
+	int rc = -1;
+	if (size == 0)
+		return 0;
+	if (NULL == ffarr_alloc(&buf, ffmin(size, tag_conf.bufsize))) {
+		syserrlog(t->trk, "%s", ffmem_alloc_S);
+		goto end;
+	}
+	if (0 > fffile_seek(t->fd, off, SEEK_SET)) {
+		syserrlog(t->trk, "%s: %s", fffile_seek_S, t->fn);
+		goto end;
+	}
+
+	while (size != 0) {
+		ssize_t r = fffile_read(t->fd, buf.ptr, ffmin(size, buf.cap));
+		if (r <= 0) {
+			if (r == 0)
+				errlog(t->trk, "%s: unexpected end of file", t->fn);
+			else
+				syserrlog(t->trk, "%s: %s", fffile_read_S, t->fn);
+			goto end;
+		}
+		if (r != fffile_write(dst, buf.ptr, r)) {
+			syserrlog(t->trk, "%s: %s", fffile_write_S, t->fn);
+			goto end;
+		}
+		size -= r;
+	}
+	rc = 0;
+
+end:
+	ffarr_free(&buf);
+	return rc;
+}
+
+/* Journal: the original data of the region overwritten in place.
+It's removed after the new data is written.
+If the write is interrupted, the original data is restored when the file is opened the next time. */
+struct tag_journal {
+	char sig[4]; //"FMTJ"
+	uint ver;
+	uint64 off; //offset of the region
+	uint64 fsize; //original file size
+	// data[]
+};
+
+enum {
+	JOURNAL_VER = 1,
+	JOURNAL_MAXSIZE = 256 * 1024 * 1024,
+};
+
+static char* tag_journal_fn(struct tagedit *t)
+{
+	ffarr fn = {};
+	if (0 == ffstr_catfmt(&fn, "%s.fmedia-tag-journal%Z", t->fn)) {
+		syserrlog(t->trk, "%s", ffmem_alloc_S);
+		return NULL;
+	}
+	return fn.ptr;
+}
+
+/** Save the original data of the region [off..off+len) into a journal file. */
+static int tag_journal_write(struct tagedit *t, const char *jfn, uint64 off, size_t len)
+{
+	struct tag_journal j = {};
+	ffarr orig = {};
+	fffd f = FF_BADFD;
+	int rc = -1;
+
+	if (0 != tag_read(t, off, len, &orig))
+		goto end;
+
+	if (FF_BADFD == (f = fffile_open(jfn, FFO_CREATENEW | O_WRONLY))) {
+		syserrlog(t->trk, "%s: %s", fffile_open_S, jfn);
+		goto end;
+	}
+	ffmemcpy(j.sig, "FMTJ", 4);
+	j.ver = JOURNAL_VER;
+	j.off = off;
+	j.fsize = t->fsize;
+	if (sizeof(j) != (size_t)fffile_write(f, &j, sizeof(j))
+		|| orig.len != (size_t)fffile_write(f, orig.ptr, orig.len)) {
+		syserrlog(t->trk, "%s: %s", fffile_write_S, jfn);
+		goto end;
+	}
+	if (0 != fffile_close(f)) {
+		f = FF_BADFD;
+		syserrlog(t->trk, "%s: %s", fffile_close_S, jfn);
+		goto end;
+	}
+	f = FF_BADFD;
+	rc = 0;
+
+end:
+	if (f != FF_BADFD) {
+		fffile_close(f);
+		fffile_rm(jfn);
+	}
+	ffarr_free(&orig);
+	return rc;
+}
+
+/** Restore the original data from the journal left by an interrupted edit. */
+static int tag_journal_restore(struct tagedit *t)
+{
+	char *jfn;
+	ffarr buf = {};
+	const struct tag_journal *j;
+	int rc = -1;
+
+	if (NULL == (jfn = tag_journal_fn(t)))
+		return -1;
+	if (!fffile_exists(jfn)) {
+		rc = 0;
+		goto end;
+	}
+
+	if (0 != fffile_readall(&buf, jfn, JOURNAL_MAXSIZE)) {
+		syserrlog(t->trk, "%s: %s", fffile_read_S, jfn);
+		goto end;
+	}
+	j = (void*)buf.ptr;
+	if (buf.len < sizeof(*j)
+		|| ffmemcmp(j->sig, "FMTJ", 4)
+		|| j->ver != JOURNAL_VER
+		|| j->off + (buf.len - sizeof(*j)) < j->off) {
+		errlog(t->trk, "%s: bad journal file", jfn);
+		goto end;
+	}
+
+	warnlog(t->trk, "%s: restoring the data from an interrupted tag edit", t->fn);
+	if (0 != tag_write(t, t->fd, j->off, buf.ptr + sizeof(*j), buf.len - sizeof(*j)))
+		goto end;
+	if (0 != fffile_trunc(t->fd, j->fsize)) {
+		syserrlog(t->trk, "%s: %s", "file truncate", t->fn);
+		goto end;
+	}
+	t->fsize = j->fsize;
+	if (0 != fffile_rm(jfn)) {
+		syserrlog(t->trk, "%s: %s", fffile_rm_S, jfn);
+		goto end;
+	}
+	rc = 0;
+
+end:
+	ffarr_free(&buf);
+	ffmem_free(jfn);
+	return rc;
+}
+
+/** Write new tag data over the old one.
+The original data is saved to a journal first, so an interrupted write can be rolled back.
+@trunc: truncate the file after the new data */
+static int tag_write_inplace(struct tagedit *t, uint64 off, const ffarr *data, ffbool trunc)
+{
+	char *jfn;
+	int rc = -1;
+
+	uint64 end = (trunc) ? t->fsize : ffmin(off + data->len, t->fsize);
+	if (NULL == (jfn = tag_journal_fn(t)))
+		return -1;
+	if (0 != tag_journal_write(t, jfn, off, end - off))
+		goto end;
+
+	if (0 != tag_write(t, t->fd, off, data->ptr, data->len))
+		goto end;
+	if (trunc && off + data->len < t->fsize
+		&& 0 != fffile_trunc(t->fd, off + data->len)) {
+		syserrlog(t->trk, "%s: %s", "file truncate", t->fn);
+		goto end;
+	}
+	rc = 0;
+	infolog(t->trk, "%s: written %L bytes in place", t->fn, data->len);
+
+end:
+	if (rc == 0)
+		fffile_rm(jfn);
+	// otherwise the journal is left, so the original data is restored on the next edit
+	ffmem_free(jfn);
+	return rc;
+}
+
+/** Replace the original file with the new one. */
+static int tag_replace(struct tagedit *t, const char *newfn)
+{
+#ifdef FF_WIN
+	// rename() doesn't replace an existing file: move the original out of the way first
+	ffarr old = {};
+	int rc = -1;
+	if (0 == ffstr_catfmt(&old, "%s.fmedia-tag-old%Z", t->fn))
+		return -1;
+	if (0 != fffile_rename(t->fn, old.ptr)) {
+		syserrlog(t->trk, "rename: %s -> %s", t->fn, old.ptr);
+		goto end;
+	}
+	if (0 != fffile_rename(newfn, t->fn)) {
+		syserrlog(t->trk, "rename: %s -> %s", newfn, t->fn);
+		fffile_rename(old.ptr, t->fn);
+		goto end;
+	}
+	if (0 != fffile_rm(old.ptr))
+		syserrlog(t->trk, "%s: %s", fffile_rm_S, old.ptr);
+	rc = 0;
+
+end:
+	ffarr_free(&old);
+	return rc;
+
+#else
+	if (0 != fffile_rename(newfn, t->fn)) {
+		syserrlog(t->trk, "rename: %s -> %s", newfn, t->fn);
+		return -1;
+	}
+	return 0;
+#endif
+}
+
+/** Rewrite the whole file: [0..off) + data + [tail_off..EOF).
+The new file is written next to the original one, then it replaces the original. */
+static int tag_rewrite(struct tagedit *t, uint64 off, const ffarr *data, uint64 tail_off)
+{
+	int rc = -1;
+	ffarr fn = {};
+	fffd f = FF_BADFD;
+
+	if (0 == ffstr_catfmt(&fn, "%s.fmedia-tag%Z", t->fn))
+		goto end;
+	if (FF_BADFD == (f = fffile_open(fn.ptr, FFO_CREATENEW | O_WRONLY))) {
+		if (fferr_exist(fferr_last())) {
+			// a leftover from an interrupted edit
+			fffile_rm(fn.ptr);
+			f = fffile_open(fn.ptr, FFO_CREATENEW | O_WRONLY);
+		}
+		if (f == FF_BADFD) {
+			syserrlog(t->trk, "%s: %s", fffile_open_S, fn.ptr);
+			goto end;
+		}
+	}
+
+#ifdef FF_UNIX
+	// the new file replaces the original one: keep its permissions and owner
+	fffileinfo fi;
+	if (0 != fffile_info(t->fd, &fi)) {
+		syserrlog(t->trk, "%s: %s", fffile_info_S, t->fn);
+		goto end;
+	}
+	if (0 != fchmod(f, fffile_infoattr(&fi) & 07777)) {
+		syserrlog(t->trk, "fchmod: %s", fn.ptr);
+		goto end;
+	}
+	if (0 != fchown(f, fi.st_uid, fi.st_gid)) {
+		syserrlog(t->trk, "fchown: %s", fn.ptr);
+		goto end;
+	}
+#endif
+
+	if (0 != tag_copy(t, f, 0, off))
+		goto end;
+	if (data->len != (size_t)fffile_write(f, data->ptr, data->len)) {
+		syserrlog(t->trk, "%s: %s", fffile_write_S, fn.ptr);
+		goto end;
+	}
+	if (0 != tag_copy(t, f, tail_off, t->fsize - tail_off))
+		goto end;
+
+	if (t->preserve_date)
+		fffile_settime(f, &t->mtime);
+	if (0 != fffile_close(f)) {
+		f = FF_BADFD;
+		syserrlog(t->trk, "%s: %s", fffile_close_S, fn.ptr);
+		goto end;
+	}
+	f = FF_BADFD;
+
+	// the original file must be closed before it's replaced (Windows)
+	fffile_close(t->fd);
+	t->fd = FF_BADFD;
+	if (0 != tag_replace(t, fn.ptr))
+		goto end;
+
+	infolog(t->trk, "%s: rewritten file: %L bytes of tags, %U bytes of data copied"
+		, t->fn, data->len, off + t->fsize - tail_off);
+	rc = 0;
+
+end:
+	if (f != FF_BADFD)
+		fffile_close(f);
+	if (rc != 0 && fn.len != 0)
+		fffile_rm(fn.ptr);
+	ffarr_free(&fn);
+	return rc;
+}
+
+
+enum {
+	ID3_FFOOTER = 0x10,
+};
+
+/** Get the whole size of ID3v2 tag (with footer).
+Return 0 if there's no tag. */
+static uint id3_tagsize(const ffid3_hdr *h)
+{
+	if (ffmemcmp(h->id3, "ID3", 3))
+		return 0;
+	uint n = sizeof(ffid3_hdr) + ffid3_size(h);
+	if (h->flags & ID3_FFOOTER)
+		n += sizeof(ffid3_hdr);
+	return n;
+}
+
+/** Add frame as is.  Frame size is written as a 7-bit number (ID3v2.4). */
+static int id3_addraw(ffarr *a, const char id[4], const ffstr *data)
+{
+	byte h[10];
+	uint n = data->len;
+	ffmemcpy(h, id, 4);
+	h[4] = (n >> 21) & 0x7f;  h[5] = (n >> 14) & 0x7f;  h[6] = (n >> 7) & 0x7f;  h[7] = n & 0x7f;
+	h[8] = h[9] = 0;
+	if (0 != out_add(a, h, sizeof(h))
+		|| 0 != out_add(a, data->ptr, data->len))
+		return -1;
+	return 0;
+}
+
+/** Get TXXX description. */
+static void id3_txxx_desc(const ffstr *data, ffarr *buf)
+{
+	buf->len = 0;
+	if (data->len == 0
+		|| 0 > ffid3_getdata(data->ptr + 1, data->len - 1, (byte)data->ptr[0], core->getval("codepage"), buf))
+		return;
+	buf->len = ffs_find(buf->ptr, buf->len, '\0') - buf->ptr; //"DESC \0 VALUE"
+}
+
+/** Get the value of track number frame from user tags: "N[/TOTAL]". */
+static const ffstr* tag_tracknumber(struct tagedit *t, ffarr *buf)
+{
+	struct tag_kv *num = tag_find(t, "tracknumber", 11), *total = tag_find(t, "tracktotal", 10);
+	if (total == NULL || total->val.len == 0)
+		return &num->val;
+	buf->len = 0;
+	if (0 == ffstr_catfmt(buf, "%S/%S", &num->val, &total->val))
+		return NULL;
+	return (ffstr*)buf;
+}
+
+/** Copy the existing frames that aren't replaced.
+The frames are parsed by FF: unsynchronisation and extended header are handled there,
+ so the frames are written back in their plain form. */
+static int id3_copyframes(struct tagedit *t, ffid3_cook *id3, const ffstr *tag)
+{
+	ffid3 p;
+	ffstr in = *tag;
+	ffarr desc = {};
+	int rc = -1, r;
+
+	ffid3_parseinit(&p);
+	p.flags |= FFID3_FWHOLE;
+
+	for (;;) {
+		size_t n = in.len;
+		r = ffid3_parse(&p, in.ptr, &n);
+		ffstr_shift(&in, n);
+
+		switch (r) {
+		case FFID3_RHDR:
+		case FFID3_RFRAME:
+			continue;
+
+		case FFID3_RDATA:
+			break;
+
+		case FFID3_RDONE:
+			rc = 0;
+			goto end;
+
+		case FFID3_RMORE:
+			if (in.len == 0) {
+				errlog(t->trk, "%s: ID3v2: incomplete tag", t->fn);
+				goto end;
+			}
+			continue;
+
+		case FFID3_RNO:
+			rc = 0; //no tag
+			goto end;
+
+		default:
+			errlog(t->trk, "%s: ID3v2: %s", t->fn, ffid3_errstr(p.err));
+			goto end;
+		}
+
+		const char *id = p.fr.id;
+		const char *name = NULL;
+		size_t name_len = 0;
+		ffbool text = (id[0] == 'T' || !ffmemcmp(id, "COMM", 4));
+		if (!ffmemcmp(id, "TXXX", 4)) {
+			id3_txxx_desc((ffstr*)&p.data, &desc);
+			name = desc.ptr;
+			name_len = desc.len;
+		} else if (!ffmemcmp(id, "TYER", 4)) {
+			name = "date";
+		} else {
+			name = tag_byid(id, 4, F_ID3);
+		}
+		if (name != NULL && name_len == 0)
+			name_len = ffsz_len(name);
+
+		if (tag_replaced(t, name, name_len, text)) {
+			dbglog(t->trk, "removing frame %*s", (size_t)4, id);
+			continue;
+		}
+		if (0 != id3_addraw(&id3->buf, id, (ffstr*)&p.data))
+			goto end;
+	}
+
+end:
+	ffid3_parsefin(&p);
+	ffarr_free(&desc);
+	return rc;
+}
+
+/** Add user tags. */
+static int id3_addtags(struct tagedit *t, ffid3_cook *id3)
+{
+	const struct tag_kv *kv;
+	ffarr trk = {}, txxx = {};
+	int rc = -1;
+
+	if (NULL != tag_find(t, "tracktotal", 10) && NULL == tag_find(t, "tracknumber", 11))
+		warnlog(t->trk, "%s: ID3v2: tracktotal is written only together with tracknumber", t->fn);
+
+	FFARR_WALKT(&t->kv, kv, struct tag_kv) {
+		if (kv->val.len == 0 || ffstr_ieqz(&kv->name, "tracktotal"))
+			continue;
+
+		// only the tags from tag_names[] are written as their own frames: id3_copyframes() finds them by ID
+		const ffstr *val = &kv->val;
+		const struct tag_name *tn = tag_byname(&kv->name);
+		int tag = -1;
+		if (tn != NULL && tn->id3 != NULL)
+			tag = ffs_findarrz(ffmmtag_str, FFCNT(ffmmtag_str), tn->name, ffsz_len(tn->name));
+		if (tag == FFMMTAG_TRACKNO && NULL == (val = tag_tracknumber(t, &trk)))
+			goto end;
+
+		if (tag > 0) {
+			if (0 == ffid3_add(id3, tag, val->ptr, val->len))
+				goto err;
+		} else {
+			// "DESC \0 VALUE"
+			txxx.len = 0;
+			if (0 == ffstr_catfmt(&txxx, "%S%Z%S", &kv->name, val))
+				goto err;
+			if (0 == ffid3_addframe(id3, "TXXX", txxx.ptr, txxx.len, 0))
+				goto err;
+		}
+	}
+	rc = 0;
+	goto end;
+
+err:
+	syserrlog(t->trk, "can't add tag: %S", &kv->name);
+
+end:
+	ffarr_free(&trk);
+	ffarr_free(&txxx);
+	return rc;
+}
+
+static int id3_edit(struct tagedit *t)
+{
+	uint size = 0;
+	ffstr tag = {};
+	ffid3_cook id3 = {};
+	int rc = -1;
+
+	if (0 != tag_read(t, 0, ffmin(sizeof(ffid3_hdr), t->fsize), &t->buf))
+		return -1;
+
+	if (t->buf.len == sizeof(ffid3_hdr)
+		&& 0 != (size = id3_tagsize((ffid3_hdr*)t->buf.ptr))) {
+		if (size > t->fsize) {
+			errlog(t->trk, "%s: ID3v2: bad tag size", t->fn);
+			return -1;
+		}
+		if (0 != tag_read(t, 0, size, &t->buf))
+			return -1;
+		ffstr_set2(&tag, &t->buf);
+	}
+
+	// the header is written by ffid3_fin()
+	if (0 != out_zero(&id3.buf, sizeof(ffid3_hdr)))
+		goto end;
+	if (tag.len != 0
+		&& 0 != id3_copyframes(t, &id3, &tag))
+		goto end;
+	if (0 != id3_addtags(t, &id3))
+		goto end;
+
+	size_t n = id3.buf.len - sizeof(ffid3_hdr);
+	ffbool inplace = (size != 0 && n <= size - sizeof(ffid3_hdr));
+	// fill the old tag area, or add padding for the next edits
+	size_t pad = (inplace) ? size - sizeof(ffid3_hdr) - n : tag_conf.padding;
+	if (!inplace && n + pad >= 0x0fffffff) {
+		errlog(t->trk, "%s: ID3v2: tag is too large", t->fn);
+		goto end;
+	}
+	if (0 != out_zero(&id3.buf, pad))
+		goto end;
+	ffid3_fin(&id3);
+
+	if (inplace)
+		rc = tag_write_inplace(t, 0, &id3.buf, 0);
+	else
+		rc = tag_rewrite(t, 0, &id3.buf, size);
+
+end:
+	ffarr_free(&id3.buf);
+	return rc;
+}
+
+
+enum {
+	FLAC_PADDING = 1,
+	FLAC_VORBISCMT = 4,
+	FLAC_LAST = 0x80,
+	FLAC_MAXBLOCK = 0xffffff,
+};
+
+static void flac_sethdr(byte *h, uint type, uint len)
+{
+	h[0] = type;
+	h[1] = len >> 16;  h[2] = len >> 8;  h[3] = len;
+}
+
+/** Build Vorbis comment block from the existing one and the user tags. */
+static int flac_vorbiscmt(struct tagedit *t, ffstr vc)
+{
+	ffvorbtag vt = {};
+	ffvorbtag_cook vw = {};
+	ffstr vendor;
+	ffarr name = {};
+	int rc = -1, r;
+
+	ffstr_setz(&vendor, "fmedia");
+	vt.data = vc.ptr;
+	vt.datalen = vc.len;
+
+	// the vendor string is the first entry
+	if (vc.len != 0 && FFVORBTAG_OK == ffvorbtag_parse(&vt) && vt.tag == FFMMTAG_VENDOR)
+		vendor = vt.val;
+	if (0 != ffvorbtag_add(&vw, NULL, vendor.ptr, vendor.len))
+		goto err;
+
+	while (vc.len != 0) {
+		r = ffvorbtag_parse(&vt);
+		if (r == FFVORBTAG_DONE)
+			break;
+		else if (r == FFVORBTAG_ERR) {
+			errlog(t->trk, "%s: Vorbis comment: bad entry", t->fn);
+			goto end;
+		}
+
+		if (tag_replaced(t, vt.name.ptr, vt.name.len, 1)) {
+			dbglog(t->trk, "removing tag %S", &vt.name);
+			continue;
+		}
+		name.len = 0;
+		if (0 == ffstr_catfmt(&name, "%S%Z", &vt.name)
+			|| 0 != ffvorbtag_add(&vw, name.ptr, vt.val.ptr, vt.val.len))
+			goto err;
+	}
+
+	const struct tag_kv *kv;
+	FFARR_WALKT(&t->kv, kv, struct tag_kv) {
+		if (kv->val.len == 0)
+			continue;
+		name.len = 0;
+		if (0 == ffstr_catfmt(&name, "%S%Z", &kv->name))
+			goto err;
+		for (size_t i = 0;  i != name.len;  i++) {
+			if (name.ptr[i] >= 'a' && name.ptr[i] <= 'z')
+				name.ptr[i] -= 0x20;
+		}
+		if (0 != ffvorbtag_add(&vw, name.ptr, kv->val.ptr, kv->val.len))
+			goto err;
+	}
+	ffvorbtag_fin(&vw);
+
+	if (vw.out.len > FLAC_MAXBLOCK) {
+		errlog(t->trk, "%s: Vorbis comment is too large", t->fn);
+		goto end;
+	}
+	size_t off = t->out.len;
+	if (0 != out_zero(&t->out, 4)
+		|| 0 != out_add(&t->out, vw.out.ptr, vw.out.len))
+		goto err;
+	flac_sethdr((byte*)t->out.ptr + off, FLAC_VORBISCMT, vw.out.len);
+	rc = 0;
+	goto end;
+
+err:
+	syserrlog(t->trk, "%s", ffmem_alloc_S);
+
+end:
+	ffarr_free(&vw.out);
+	ffarr_free(&name);
+	return rc;
+}
+
+static int flac_edit(struct tagedit *t)
+{
+	uint64 base = 0, off;
+	byte h[4];
+	ffbool vc_done = 0;
+
+	// skip ID3v2 tag
+	if (0 != tag_read(t, 0, ffmin(sizeof(ffid3_hdr), t->fsize), &t->buf))
+		return -1;
+	if (t->buf.len == sizeof(ffid3_hdr))
+		base = id3_tagsize((ffid3_hdr*)t->buf.ptr);
+
+	// find the end of meta blocks
+	if (0 != tag_read(t, base, 4, &t->buf))
+		return -1;
+	if (ffmemcmp(t->buf.ptr, "fLaC", 4)) {
+		errlog(t->trk, "%s: not a FLAC file", t->fn);
+		return -1;
+	}
+	off = base + 4;
+	for (;;) {
+		if (0 != tag_read(t, off, 4, &t->buf))
+			return -1;
+		ffmemcpy(h, t->buf.ptr, 4);
+		uint len = (h[1] << 16) | (h[2] << 8) | h[3];
+		if (off + 4 + len > t->fsize) {
+			errlog(t->trk, "%s: bad meta block size", t->fn);
+			return -1;
+		}
+		off += 4 + len;
+		if (h[0] & FLAC_LAST)
+			break;
+	}
+
+	size_t region = off - base;
+	if (0 != tag_read(t, base, region, &t->buf))
+		return -1;
+	ffstr d;
+	ffstr_set(&d, t->buf.ptr + 4, t->buf.len - 4);
+
+	t->out.len = 0;
+	if (0 != out_add(&t->out, "fLaC", 4))
+		return -1;
+	size_t last = 0;
+
+	while (d.len != 0) {
+		const byte *b = (byte*)d.ptr;
+		uint type = b[0] & ~FLAC_LAST, n = (b[1] << 16) | (b[2] << 8) | b[3];
+		ffstr data;
+		ffstr_set(&data, d.ptr + 4, n);
+		ffstr_shift(&d, 4 + n);
+
+		if (type == FLAC_PADDING)
+			continue;
+
+		last = t->out.len;
+		if (type == FLAC_VORBISCMT) {
+			if (0 != flac_vorbiscmt(t, data))
+				return -1;
+			vc_done = 1;
+			continue;
+		}
+
+		if (0 != out_add(&t->out, b, 4 + n))
+			return -1;
+		t->out.ptr[last] &= ~FLAC_LAST;
+	}
+
+	if (!vc_done) {
+		ffstr empty = {};
+		last = t->out.len;
+		if (0 != flac_vorbiscmt(t, empty))
+			return -1;
+	}
+
+	if (t->out.len == region) {
+		t->out.ptr[last] |= FLAC_LAST;
+		return tag_write_inplace(t, base, &t->out, 0);
+
+	} else if (t->out.len + 4 <= region && region - t->out.len - 4 <= FLAC_MAXBLOCK) {
+		size_t n = region - t->out.len - 4;
+		if (0 != out_zero(&t->out, 4 + n))
+			return -1;
+		flac_sethdr((byte*)t->out.ptr + region - n - 4, FLAC_PADDING | FLAC_LAST, n);
+		return tag_write_inplace(t, base, &t->out, 0);
+	}
+
+	size_t n = ffmin(tag_conf.padding, FLAC_MAXBLOCK);
+	if (0 != out_zero(&t->out, 4 + n))
+		return -1;
+	flac_sethdr((byte*)t->out.ptr + t->out.len - n - 4, FLAC_PADDING | FLAC_LAST, n);
+	return tag_rewrite(t, base, &t->out, off);
+}
+
+
+enum {
+	APE_HDR = 32,
+	APE_VER = 2000,
+	APE_FHAVEHDR = 0x80000000,
+	APE_FISHDR = 0x20000000,
+	APE_FBINARY = 0x06, //item type: binary or external
+};
+
+static int ape_hdr(ffarr *a, uint size, uint cnt, uint flags)
+{
+	if (0 != out_add(a, "APETAGEX", 8)
+		|| 0 != out_le32(a, APE_VER)
+		|| 0 != out_le32(a, size)
+		|| 0 != out_le32(a, cnt)
+		|| 0 != out_le32(a, flags)
+		|| 0 != out_zero(a, 8))
+		return -1;
+	return 0;
+}
+
+static int ape_additem(ffarr *a, const char *key, size_t key_len, const ffstr *val)
+{
+	if (0 != out_le32(a, val->len)
+		|| 0 != out_le32(a, 0)
+		|| 0 != out_add(a, key, key_len)
+		|| 0 != out_zero(a, 1)
+		|| 0 != out_add(a, val->ptr, val->len))
+		return -1;
+	return 0;
+}
+
+/** APEv2 tag is at the end of file (before ID3v1):
+ the whole file after the tag start is rewritten, and that is always bounded by the tag size. */
+static int ape_edit(struct tagedit *t)
+{
+	uint64 end = t->fsize, tag_off;
+	byte id3v1[128];
+	ffbool have_id3v1 = 0;
+	ffstr items = {};
+	uint cnt = 0;
+	ffarr trk = {};
+	int rc = -1;
+
+	if (end >= sizeof(id3v1)) {
+		if (0 != tag_read(t, end - sizeof(id3v1), sizeof(id3v1), &t->buf))
+			return -1;
+		if (!ffmemcmp(t->buf.ptr, "TAG", 3)) {
+			ffmemcpy(id3v1, t->buf.ptr, sizeof(id3v1));
+			have_id3v1 = 1;
+			end -= sizeof(id3v1);
+		}
+	}
+
+	tag_off = end;
+	if (end >= APE_HDR) {
+		if (0 != tag_read(t, end - APE_HDR, APE_HDR, &t->buf))
+			return -1;
+		const char *f = t->buf.ptr;
+		if (!ffmemcmp(f, "APETAGEX", 8)) {
+			uint size = ffint_ltoh32(*(uint*)(f + 12)), flags = ffint_ltoh32(*(uint*)(f + 20));
+			if (size < APE_HDR || size > end) {
+				errlog(t->trk, "%s: APEv2: bad tag size", t->fn);
+				return -1;
+			}
+			tag_off = end - size;
+			if (flags & APE_FHAVEHDR) {
+				if (tag_off < APE_HDR) {
+					errlog(t->trk, "%s: APEv2: bad tag size", t->fn);
+					return -1;
+				}
+				tag_off -= APE_HDR;
+			}
+			if (0 != tag_read(t, end - size, size - APE_HDR, &t->buf))
+				return -1;
+			ffstr_set2(&items, &t->buf);
+		}
+	}
+
+	t->out.len = 0;
+	if (0 != out_zero(&t->out, APE_HDR))
+		goto end;
+
+	while (items.len >= 8 + 1) {
+		uint n = ffint_ltoh32(*(uint*)items.ptr), flags = ffint_ltoh32(*(uint*)(items.ptr + 4));
+		const char *key = items.ptr + 8;
+		size_t key_len = ffs_find(key, items.len - 8, '\0') - key;
+		if (key_len == items.len - 8 || n > items.len - 8 - key_len - 1) {
+			errlog(t->trk, "%s: APEv2: bad item", t->fn);
+			goto end;
+		}
+		size_t item_len = 8 + key_len + 1 + n;
+
+		const char *name = tag_byid(key, key_len, F_APE);
+		size_t name_len = (name != NULL) ? ffsz_len(name) : key_len;
+		if (name == NULL)
+			name = key;
+		if (!tag_replaced(t, name, name_len, !(flags & APE_FBINARY))) {
+			if (0 != out_add(&t->out, items.ptr, item_len))
+				goto end;
+			cnt++;
+		} else
+			dbglog(t->trk, "removing tag %*s", key_len, key);
+		ffstr_shift(&items, item_len);
+	}
+
+	const struct tag_kv *kv;
+	FFARR_WALKT(&t->kv, kv, struct tag_kv) {
+		if (kv->val.len == 0 || ffstr_ieqz(&kv->name, "tracktotal"))
+			continue;
+		const struct tag_name *tn = tag_byname(&kv->name);
+		const ffstr *val = &kv->val;
+		int r;
+		if (tn == NULL)
+			r = ape_additem(&t->out, kv->name.ptr, kv->name.len, val);
+		else {
+			if (!ffsz_cmp(tn->name, "tracknumber") && NULL == (val = tag_tracknumber(t, &trk)))
+				goto end;
+			r = ape_additem(&t->out, tn->ape, ffsz_len(tn->ape), val);
+		}
+		if (r != 0)
+			goto end;
+		cnt++;
+	}
+
+	if (cnt == 0) {
+		t->out.len = 0; // no tags: remove APEv2 tag
+	} else {
+		uint size = t->out.len - APE_HDR + APE_HDR;
+		t->out.len = 0;
+		if (0 != ape_hdr(&t->out, size, cnt, APE_FHAVEHDR | APE_FISHDR))
+			goto end;
+		t->out.len = t->out.len + size - APE_HDR;
+		if (0 != ape_hdr(&t->out, size, cnt, APE_FHAVEHDR))
+			goto end;
+	}
+
+	if (have_id3v1 && 0 != out_add(&t->out, id3v1, sizeof(id3v1)))
+		goto end;
+
+	if (0 != tag_write_inplace(t, tag_off, &t->out, 1))
+		goto end;
+	rc = 0;
+
+end:
+	ffarr_free(&trk);
+	return rc;
+}
+
+
+/** MP4 box. */
+struct mp4box {
+	size_t off; //offset of box header within moov
+	size_t size; //the whole box size
+	uint hdr; //header length
+};
+
+/** Find child box.
+@data: parent's data */
+static int mp4_find(const char *moov, size_t off, size_t end, const char *type, struct mp4box *box)
+{
+	while (off + 8 <= end) {
+		size_t n = ffint_ntoh32(*(uint*)(moov + off));
+		if (n < 8 || n > end - off)
+			return -1;
+		if (!ffmemcmp(moov + off + 4, type, 4)) {
+			box->off = off;
+			box->size = n;
+			box->hdr = 8;
+			return 0;
+		}
+		off += n;
+	}
+	return -1;
+}
+
+/** Get the name of an ilst item. */
+static size_t mp4_itemname(const char *item, size_t len, const char **name)
+{
+	if (!ffmemcmp(item + 4, "gnre", 4)) {
+		*name = "genre";
+		return 5;
+
+	} else if (!ffmemcmp(item + 4, "----", 4)) {
+		struct mp4box box;
+		if (0 != mp4_find(item, 8, len, "name", &box) || box.size < 12)
+			return 0;
+		*name = item + box.off + 12;
+		return box.size - 12;
+	}
+
+	if (NULL == (*name = tag_byid(item + 4, 4, F_MP4)))
+		return 0;
+	return ffsz_len(*name);
+}
+
+static int mp4_addbox(ffarr *a, const char *type, const void *data, size_t len)
+{
+	if (0 != out_be32(a, 8 + len)
+		|| 0 != out_add(a, type, 4)
+		|| 0 != out_add(a, data, len))
+		return -1;
+	return 0;
+}
+
+/** Add "data" box: type, locale, value. */
+static int mp4_adddata(ffarr *a, uint type, const void *data, size_t len)
+{
+	if (0 != out_be32(a, 8 + 8 + len)
+		|| 0 != out_add(a, "data", 4)
+		|| 0 != out_be32(a, type)
+		|| 0 != out_be32(a, 0)
+		|| 0 != out_add(a, data, len))
+		return -1;
+	return 0;
+}
+
+static int mp4_additem(struct tagedit *t, ffarr *a, const struct tag_kv *kv)
+{
+	size_t off = a->len;
+	const struct tag_name *tn = tag_byname(&kv->name);
+	if (tn != NULL && tn->mp4 == NULL)
+		tn = NULL;
+	if (0 != out_zero(a, 4)
+		|| 0 != out_add(a, (tn != NULL) ? tn->mp4 : "----", 4))
+		return -1;
+
+	if (tn == NULL) {
+		// freeform item
+		byte verflags[4] = {};
+		if (0 != out_be32(a, 8 + 4 + FFSLEN("com.apple.iTunes"))
+			|| 0 != out_add(a, "mean", 4)
+			|| 0 != out_add(a, verflags, 4)
+			|| 0 != out_add(a, "com.apple.iTunes", FFSLEN("com.apple.iTunes"))
+			|| 0 != out_be32(a, 8 + 4 + kv->name.len)
+			|| 0 != out_add(a, "name", 4)
+			|| 0 != out_add(a, verflags, 4)
+			|| 0 != out_add(a, kv->name.ptr, kv->name.len))
+			return -1;
+	}
+
+	if (tn != NULL && !ffsz_cmp(tn->name, "discnumber")) {
+		// "disk": 0, 0, DISC(2), TOTAL(2)
+		byte disk[6] = {};
+		uint num = 0;
+		ffstr_toint(&kv->val, &num, FFS_INT32);
+		disk[2] = num >> 8;  disk[3] = num;
+		if (0 != mp4_adddata(a, 0, disk, sizeof(disk)))
+			return -1;
+	} else if (tn != NULL && !ffsz_cmp(tn->name, "tracknumber")) {
+		// "trkn": 0, 0, TRACK(2), TOTAL(2), 0, 0
+		byte trkn[8] = {};
+		struct tag_kv *total = tag_find(t, "tracktotal", 10);
+		uint num = 0, tot = 0;
+		ffstr_toint(&kv->val, &num, FFS_INT32);
+		if (total != NULL)
+			ffstr_toint(&total->val, &tot, FFS_INT32);
+		trkn[2] = num >> 8;  trkn[3] = num;
+		trkn[4] = tot >> 8;  trkn[5] = tot;
+		if (0 != mp4_adddata(a, 0, trkn, sizeof(trkn)))
+			return -1;
+	} else if (0 != mp4_adddata(a, 1, kv->val.ptr, kv->val.len))
+		return -1;
+
+	*(uint*)(a->ptr + off) = ffint_hton32(a->len - off);
+	return 0;
+}
+
+/** Build a new "ilst" box from the existing one and the user tags. */
+static int mp4_ilst(struct tagedit *t, ffarr *a, const char *ilst, size_t len)
+{
+	size_t off = a->len;
+	if (0 != out_zero(a, 4)
+		|| 0 != out_add(a, "ilst", 4))
+		return -1;
+
+	size_t i = 8;
+	while (i + 8 <= len) {
+		size_t n = ffint_ntoh32(*(uint*)(ilst + i));
+		if (n < 8 || n > len - i) {
+			errlog(t->trk, "%s: MP4: bad ilst item", t->fn);
+			return -1;
+		}
+		const char *name;
+		size_t name_len = mp4_itemname(ilst + i, n, &name);
+		if (!tag_replaced(t, name, name_len, !!ffmemcmp(ilst + i + 4, "covr", 4))) {
+			if (0 != out_add(a, ilst + i, n))
+				return -1;
+		} else
+			dbglog(t->trk, "removing tag %*s", (size_t)4, ilst + i + 4);
+		i += n;
+	}
+
+	const struct tag_kv *kv;
+	FFARR_WALKT(&t->kv, kv, struct tag_kv) {
+		if (kv->val.len == 0
+			|| (ffstr_ieqz(&kv->name, "tracktotal") && NULL != tag_find(t, "tracknumber", 11)))
+			continue;
+		if (0 != mp4_additem(t, a, kv))
+			return -1;
+	}
+
+	*(uint*)(a->ptr + off) = ffint_hton32(a->len - off);
+	return 0;
+}
+
+/** Add "free" box. */
+static int mp4_addfree(ffarr *a, size_t n)
+{
+	if (n < 8)
+		return 0;
+	if (0 != out_be32(a, n)
+		|| 0 != out_add(a, "free", 4)
+		|| 0 != out_zero(a, n - 8))
+		return -1;
+	return 0;
+}
+
+/** Add a new "meta" box with "hdlr" and "ilst". */
+static int mp4_addmeta(struct tagedit *t, ffarr *a)
+{
+	static const byte hdlr[] = {
+		0,0,0,0, 0,0,0,0, 'm','d','i','r', 'a','p','p','l', 0,0,0,0, 0,0,0,0, 0
+	};
+	size_t off = a->len;
+	if (0 != out_zero(a, 4)
+		|| 0 != out_add(a, "meta", 4)
+		|| 0 != out_zero(a, 4)
+		|| 0 != mp4_addbox(a, "hdlr", hdlr, sizeof(hdlr))
+		|| 0 != mp4_ilst(t, a, "\0\0\0\x08ilst", 8)
+		|| 0 != mp4_addfree(a, tag_conf.padding))
+		return -1;
+	*(uint*)(a->ptr + off) = ffint_hton32(a->len - off);
+	return 0;
+}
+
+static int mp4_edit(struct tagedit *t)
+{
+	uint64 off = 0, moov_off = 0, moov_size = 0, mdat_off = (uint64)-1;
+	ffarr moov2 = {};
+	int rc = -1;
+
+	// find "moov" and "mdat"
+	while (off + 8 <= t->fsize) {
+		if (0 != tag_read(t, off, ffmin(16, t->fsize - off), &t->buf))
+			return -1;
+		uint64 n = ffint_ntoh32(*(uint*)t->buf.ptr);
+		if (n == 1 && t->buf.len == 16)
+			n = ffint_ntoh64(*(uint64*)(t->buf.ptr + 8));
+		else if (n == 0)
+			n = t->fsize - off;
+		if (n < 8 || n > t->fsize - off) {
+			errlog(t->trk, "%s: MP4: bad box size", t->fn);
+			return -1;
+		}
+		if (!ffmemcmp(t->buf.ptr + 4, "moov", 4)) {
+			moov_off = off;
+			moov_size = n;
+		} else if (!ffmemcmp(t->buf.ptr + 4, "mdat", 4) && mdat_off == (uint64)-1)
+			mdat_off = off;
+		off += n;
+	}
+	if (moov_size == 0) {
+		errlog(t->trk, "%s: MP4: no moov box", t->fn);
+		return -1;
+	}
+	if (moov_size > 0xffffffff) {
+		errlog(t->trk, "%s: MP4: moov box is too large", t->fn);
+		return -1;
+	}
+
+	if (0 != tag_read(t, moov_off, moov_size, &t->buf))
+		return -1;
+	char *moov = t->buf.ptr;
+	if (ffint_ntoh32(*(uint*)moov) == 1) {
+		errlog(t->trk, "%s: MP4: 64-bit moov box size isn't supported", t->fn);
+		return -1;
+	}
+
+	// moov -> udta -> meta -> ilst (+ free)
+	struct mp4box udta, meta, ilst, fre;
+	size_t parents[3], nparents = 0;
+	size_t splice_off, splice_end;
+	uint found = 0;
+	parents[nparents++] = 0;
+	if (0 == mp4_find(moov, 8, moov_size, "udta", &udta)) {
+		found++;
+		parents[nparents++] = udta.off;
+		if (0 == mp4_find(moov, udta.off + 8, udta.off + udta.size, "meta", &meta) && meta.size >= 12) {
+			found++;
+			parents[nparents++] = meta.off;
+			if (0 == mp4_find(moov, meta.off + 12, meta.off + meta.size, "ilst", &ilst))
+				found++;
+		}
+	}
+
+	t->out.len = 0;
+	if (found == 3) {
+		if (0 != mp4_ilst(t, &t->out, moov + ilst.off, ilst.size))
+			goto end;
+
+		// try to fit the new ilst into the old ilst + the following "free" box
+		size_t avail = ilst.size;
+		splice_off = ilst.off;
+		splice_end = ilst.off + ilst.size;
+		if (0 == mp4_find(moov, splice_end, meta.off + meta.size, "free", &fre) && fre.off == splice_end) {
+			avail += fre.size;
+			splice_end += fre.size;
+		}
+
+		if (t->out.len == avail || t->out.len + 8 <= avail) {
+			if (0 != mp4_addfree(&t->out, avail - t->out.len))
+				goto end;
+			rc = tag_write_inplace(t, moov_off + ilst.off, &t->out, 0);
+			goto end;
+		}
+
+		if (0 != mp4_addfree(&t->out, tag_conf.padding))
+			goto end;
+
+	} else if (found == 2) {
+		splice_off = splice_end = meta.off + meta.size;
+		if (0 != mp4_ilst(t, &t->out, "\0\0\0\x08ilst", 8)
+			|| 0 != mp4_addfree(&t->out, tag_conf.padding))
+			goto end;
+
+	} else if (found == 1) {
+		splice_off = splice_end = udta.off + udta.size;
+		if (0 != mp4_addmeta(t, &t->out))
+			goto end;
+
+	} else {
+		splice_off = splice_end = moov_size;
+		if (0 != out_zero(&t->out, 4)
+			|| 0 != out_add(&t->out, "udta", 4)
+			|| 0 != mp4_addmeta(t, &t->out))
+			goto end;
+		*(uint*)t->out.ptr = ffint_hton32(t->out.len);
+	}
+
+	// new moov = moov[0..splice_off) + new data + moov[splice_end..)
+	int64 delta = (int64)t->out.len - (int64)(splice_end - splice_off);
+	if (0 != out_add(&moov2, moov, splice_off)
+		|| 0 != out_add(&moov2, t->out.ptr, t->out.len)
+		|| 0 != out_add(&moov2, moov + splice_end, moov_size - splice_end))
+		goto end;
+	for (size_t i = 0;  i != nparents;  i++) {
+		char *p = moov2.ptr + parents[i];
+		*(uint*)p = ffint_hton32(ffint_ntoh32(*(uint*)p) + delta);
+	}
+
+	if (moov_off < mdat_off && mdat_off != (uint64)-1) {
+		// audio data will be moved
+		int r = mp4_shift_offsets(moov2.ptr, 8, moov2.len, delta);
+		if (r != 0) {
+			errlog(t->trk, "%s: MP4: %s", t->fn
+				, (r == -2) ? "chunk offset is out of 32-bit range" : "bad box size");
+			goto end;
+		}
+	}
+
+	if (moov_off + moov_size == t->fsize) {
+		// moov is the last box: no need to copy audio data
+		rc = tag_write_inplace(t, moov_off, &moov2, 1);
+		goto end;
+	}
+
+	rc = tag_rewrite(t, moov_off, &moov2, moov_off + moov_size);
+
+end:
+	ffarr_free(&moov2);
+	return rc;
+}
+
+
+FF_EXP const fmed_mod* fmed_getmod(const fmed_core *_core)
+{
+	core = _core;
+	return &fmed_tag_mod;
+}
+
+static const void* tag_iface(const char *name)
+{
+	if (ffsz_eq(name, "edit"))
+		return &fmed_tag_edit;
+	return NULL;
+}
+
+static int tag_sig(uint signo)
+{
+	switch (signo) {
+	case FMED_SIG_INIT:
+		ffmem_init();
+		return 0;
+
+	case FMED_OPEN:
+		qu = core->getmod("#queue.queue");
+		break;
+	}
+	return 0;
+}
+
+static void tag_destroy(void)
+{
+}
+
+static int tag_conf(const char *name, ffpars_ctx *ctx)
+{
+	if (ffsz_eq(name, "edit")) {
+		tag_conf.padding = 1000;
+		tag_conf.bufsize = 1 * 1024 * 1024;
+		ffpars_setargs(ctx, &tag_conf, tag_conf_args, FFCNT(tag_conf_args));
+		return 0;
+	}
+	return -1;
+}
+
+
+/** Get tags specified by user (--meta). */
+static int tag_usermeta(struct tagedit *t, fmed_filt *d)
+{
+	void *qent;
+	ffstr name, *val, s, m;
+	const char *smeta;
+
+	if (FMED_PNULL != (smeta = d->track->getvalstr(d->trk, "meta"))) {
+		ffstr_setz(&s, smeta);
+		while (s.len != 0) {
+			ffstr_shift(&s, ffstr_nextval(s.ptr, s.len, &m, ';'));
+			if (ffstr_eqcz(&m, "clear"))
+				t->clear = 1;
+		}
+	}
+
+	if (FMED_PNULL == (qent = (void*)fmed_getval("queue_item")))
+		return 0;
+
+	for (uint i = 0;  NULL != (val = qu->meta(qent, i, &name, FMED_QUE_UNIQ | FMED_QUE_NO_TMETA));  i++) {
+		if (val == FMED_QUE_SKIP)
+			continue;
+		if (ffstr_eqcz(&name, "picture")) {
+			warnlog(d->trk, "picture: not supported in tag editing mode");
+			continue;
+		}
+		struct tag_kv *kv = ffarr_pushgrowT(&t->kv, 8, struct tag_kv);
+		if (kv == NULL)
+			return -1;
+		kv->name = name;
+		kv->val = *val;
+	}
+	return 0;
+}
+
+static void* tag_open(fmed_filt *d)
+{
+	struct tagedit *t = ffmem_new(struct tagedit);
+	if (t == NULL)
+		return NULL;
+	t->fd = FF_BADFD;
+	t->trk = d->trk;
+	t->fn = d->track->getvalstr(d->trk, "input");
+	t->preserve_date = d->out_preserve_date;
+
+	ffstr ext;
+	ffpath_splitname(t->fn, ffsz_len(t->fn), NULL, &ext);
+	for (uint i = 0;  i != FFCNT(tag_exts);  i++) {
+		if (ffstr_ieqz(&ext, tag_exts[i])) {
+			t->fmt = tag_ext_fmt[i];
+			break;
+		}
+	}
+	if (t->fmt == 0) {
+		errlog(d->trk, "%s: tag editing isn't supported for this file format", t->fn);
+		goto err;
+	}
+
+	if (0 != tag_usermeta(t, d))
+		goto err;
+	if (t->kv.len == 0 && !t->clear) {
+		errlog(d->trk, "no tags specified (use --meta)");
+		goto err;
+	}
+
+	if (FF_BADFD == (t->fd = fffile_open(t->fn, O_RDWR))) {
+		d->e_no_source = (fferr_last() == ENOENT);
+		syserrlog(d->trk, "%s: %s", fffile_open_S, t->fn);
+		goto err;
+	}
+	fffileinfo fi;
+	if (0 != fffile_info(t->fd, &fi)) {
+		syserrlog(d->trk, "%s: %s", fffile_info_S, t->fn);
+		goto err;
+	}
+	t->fsize = fffile_infosize(&fi);
+	t->mtime = fffile_infomtime(&fi);
+
+	if (0 != tag_journal_restore(t))
+		goto err;
+	return t;
+
+err:
+	tag_close(t);
+	return NULL;
+}
+
+static void tag_close(void *ctx)
+{
+	struct tagedit *t = ctx;
+	if (t->fd != FF_BADFD)
+		fffile_close(t->fd);
+	ffarr_free(&t->kv);
+	ffarr_free(&t->buf);
+	ffarr_free(&t->out);
+	ffmem_free(t);
+}
+
+static int tag_process(void *ctx, fmed_filt *d)
+{
+	struct tagedit *t = ctx;
+	int r;
+
+	switch (t->fmt) {
+	case TAG_FLAC:
+		r = flac_edit(t);
+		break;
+	case TAG_ID3V2:
+		r = id3_edit(t);
+		break;
+	case TAG_APE:
+		r = ape_edit(t);
+		break;
+	case TAG_MP4:
+		r = mp4_edit(t);
+		break;
+	default:
+		return FMED_RERR;
+	}
+
+	if (r != 0)
+		return FMED_RERR;
+
+	if (t->preserve_date && t->fd != FF_BADFD)
+		fffile_settime(t->fd, &t->mtime);
+	return FMED_RFIN;
+}
@@ -3,7 +3,10 @@ Copyright (c) 2016 Simon Zolin */
 
 #include <fmedia.h>
 #include <FF/data/conf.h>
+#include <FF/audio/pcm.h>
+#include <FF/list.h>
 #include <FFOS/asyncio.h>
+#include <FFOS/sig.h>
 
 
 static const fmed_core *core;
@@ -24,12 +27,14 @@ static const fmed_mod fmed_globcmd_mod = {
 // GLOBCMD IFACE
 static int globcmd_ctl(uint cmd, ...);
 static int globcmd_write(const void *data, size_t len);
+static ssize_t globcmd_read(void *buf, size_t cap);
 static const fmed_globcmd_iface fmed_globcmd = {
-	&globcmd_ctl, &globcmd_write
+	&globcmd_ctl, &globcmd_write, &globcmd_read
 };
 
 enum {
 	GCMD_PIPE_IN_BUFSIZE = 1028,
+	GCMD_OUT_MAX = 1 * 1024 * 1024, //max. size of unsent response data
 };
 
 typedef struct globcmd {
@@ -38,6 +43,10 @@ typedef struct globcmd {
 	ffarr pipename_full;
 	char *pipe_name;
 	const fmed_track *track;
+	fflist clients; //gcmd_client[]
+	fflist closed; //gcmd_client[] detached from kqueue, but not yet freed
+	fftmrq_entry tmr_closed; //frees 'closed'
+	uint opened_wr_shut :1;
 } globcmd;
 
 static globcmd *g;
@@ -59,10 +68,29 @@ typedef struct cmd_parser {
 	uint cmd;
 	const fmed_queue *qu;
 	const fmed_que_entry *first;
+	ffarr out; //response data
 } cmd_parser;
 
+static void cmd_parser_init(cmd_parser *c);
+static void cmd_parser_close(cmd_parser *c);
 static int globcmd_parse(cmd_parser *c, const ffstr *in);
 
+/** Connected client which is served asynchronously. */
+typedef struct gcmd_client {
+	fflist_item sib;
+	ffkevent kev;
+	cmd_parser c;
+	ffarr buf;
+	size_t out_off; //number of sent bytes in c.out
+	uint eof :1;
+} gcmd_client;
+
+static void client_add(fffd peer);
+static void client_close(gcmd_client *cl);
+static void client_free(gcmd_client *cl);
+static void client_io(void *udata);
+static int client_flush(gcmd_client *cl);
+
 
 const fmed_mod* fmed_getmod_globcmd(const fmed_core *_core)
 {
@@ -150,6 +178,31 @@ static int globcmd_write(const void *data, size_t len)
 	return 0;
 }
 
+static ssize_t globcmd_read(void *buf, size_t cap)
+{
+#ifdef FF_UNIX
+	if (!g->opened_wr_shut) {
+		// signal the end of commands, so the server sends the response and closes connection
+		g->opened_wr_shut = 1;
+		if (0 != shutdown(g->opened_fd, SHUT_WR)) {
+			syserrlog(core, NULL, "globcmd", "%s", "shutdown()");
+			return -1;
+		}
+	}
+
+	ssize_t r = ffpipe_read(g->opened_fd, buf, cap);
+	if (r < 0) {
+		syserrlog(core, NULL, "globcmd", "%s", fffile_read_S);
+		return -1;
+	}
+	dbglog(core, NULL, "globcmd", "read %L bytes", r);
+	return r;
+
+#else
+	return 0; //responses aren't supported with named pipes
+#endif
+}
+
 
 static int globcmd_init(void)
 {
@@ -157,6 +210,8 @@ static int globcmd_init(void)
 		return -1;
 	g->opened_fd = FF_BADFD;
 	ffkev_init(&g->kev);
+	fflist_init(&g->clients);
+	fflist_init(&g->closed);
 	return 0;
 }
 
@@ -180,6 +235,16 @@ static int globcmd_prep(const char *pipename)
 
 static void globcmd_free(void)
 {
+	gcmd_client *cl;
+	fflist_item *next;
+	FFLIST_WALKSAFE(&g->clients, cl, sib, next) {
+		client_close(cl);
+	}
+	core->timer(&g->tmr_closed, 0, 0);
+	FFLIST_WALKSAFE(&g->closed, cl, sib, next) {
+		client_free(cl);
+	}
+
 	if (g->kev.fd != FF_BADFD) {
 		ffpipe_close(g->kev.fd);
 #ifdef FF_UNIX
@@ -200,6 +265,12 @@ static int globcmd_listen(void)
 	}
 	dbglog(core, NULL, "globcmd", "created pipe: %s", g->pipename_full.ptr);
 
+#ifdef FF_UNIX
+	// a client may disconnect before we send the response
+	static const int sigs_pipe[] = { SIGPIPE };
+	ffsig_mask(SIG_BLOCK, sigs_pipe, FFCNT(sigs_pipe));
+#endif
+
 	g->kev.udata = g;
 	g->kev.oneshot = 0;
 	if (0 != ffkev_attach(&g->kev, core->kq, FFKQU_READ)) {
@@ -233,11 +304,180 @@ static int globcmd_accept1(void)
 		dbglog(core, NULL, "globcmd", "listening");
 		return -1;
 	}
+#ifdef FF_UNIX
+	client_add(peer);
+#else
 	globcmd_onaccept(peer);
 	ffpipe_peer_close(peer);
+#endif
 	return 0;
 }
 
+static void cmd_parser_init(cmd_parser *c)
+{
+	ffmem_tzero(c);
+	c->qu = core->getmod("#queue.queue");
+	ffconf_parseinit(&c->conf);
+}
+
+static void cmd_parser_close(cmd_parser *c)
+{
+	ffconf_parseclose(&c->conf);
+	ffarr_free(&c->out);
+}
+
+/** Start serving a new client.  The client's socket is processed asynchronously,
+ so a slow client doesn't block the main worker. */
+static void client_add(fffd peer)
+{
+	gcmd_client *cl;
+
+	dbglog(core, NULL, "globcmd", "accepted client");
+
+	if (NULL == (cl = ffmem_new(gcmd_client))) {
+		syserrlog(core, NULL, "globcmd", "%s", ffmem_alloc_S);
+		ffpipe_peer_close(peer);
+		return;
+	}
+	cmd_parser_init(&cl->c);
+	fflist_ins(&g->clients, &cl->sib);
+
+	ffkev_init(&cl->kev);
+	cl->kev.oneshot = 0;
+	cl->kev.fd = peer;
+	cl->kev.handler = &client_io;
+	cl->kev.udata = cl;
+
+	if (NULL == ffarr_alloc(&cl->buf, GCMD_PIPE_IN_BUFSIZE)) {
+		syserrlog(core, NULL, "globcmd", "%s", ffmem_alloc_S);
+		goto err;
+	}
+
+	if (0 != fffile_nblock(peer, 1)) {
+		syserrlog(core, NULL, "globcmd", "%s", "fffile_nblock()");
+		goto err;
+	}
+
+	if (0 != ffkev_attach(&cl->kev, core->kq, FFKQU_READ | FFKQU_WRITE)) {
+		syserrlog(core, NULL, "globcmd", "%s", "ffkev_attach()");
+		goto err;
+	}
+
+	client_io(cl);
+	return;
+
+err:
+	client_close(cl);
+}
+
+/** Handler for the events received after the client is closed. */
+static void client_stale(void *udata)
+{
+}
+
+/** Free the closed clients: the events that refer to them have been processed by now. */
+static void client_freeclosed(void *udata)
+{
+	gcmd_client *cl;
+	fflist_item *next;
+	FFLIST_WALKSAFE(&g->closed, cl, sib, next) {
+		client_free(cl);
+	}
+}
+
+/** Stop serving the client.
+Closing the descriptor detaches it from kqueue, but the events already received in the current batch
+ may still refer to the object, so it's freed later. */
+static void client_close(gcmd_client *cl)
+{
+	fflist_rm(&g->clients, &cl->sib);
+	FF_SAFECLOSE(cl->kev.fd, FF_BADFD, ffpipe_peer_close);
+	cl->kev.handler = &client_stale;
+	cmd_parser_close(&cl->c);
+	ffarr_free(&cl->buf);
+	dbglog(core, NULL, "globcmd", "done with client");
+
+	fflist_ins(&g->closed, &cl->sib);
+	g->tmr_closed.handler = &client_freeclosed;
+	core->timer(&g->tmr_closed, -1000, 0);
+}
+
+static void client_free(gcmd_client *cl)
+{
+	fflist_rm(&g->closed, &cl->sib);
+	ffmem_free(cl);
+}
+
+/** Send pending response data.
+Return 0 on success or if the operation would block;  -1 on error. */
+static int client_flush(gcmd_client *cl)
+{
+	ffarr *out = &cl->c.out;
+
+	while (cl->out_off != out->len) {
+		ssize_t r = fffile_write(cl->kev.fd, out->ptr + cl->out_off, out->len - cl->out_off);
+		if (r < 0) {
+			if (fferr_again(fferr_last()))
+				return 0;
+			syserrlog(core, NULL, "globcmd", "%s", fffile_write_S);
+			return -1;
+		}
+		cl->out_off += r;
+	}
+
+	out->len = 0;
+	cl->out_off = 0;
+	return 0;
+}
+
+/** Read commands from client and send responses.  Thread: main. */
+static void client_io(void *udata)
+{
+	gcmd_client *cl = udata;
+	ffstr in;
+	ssize_t r;
+
+	for (;;) {
+
+		if (0 != client_flush(cl))
+			goto done;
+
+		if (cl->eof) {
+			if (cl->c.out.len != 0)
+				return; //wait until the client reads the response
+			goto done;
+		}
+
+		if (cl->c.out.len > GCMD_OUT_MAX) {
+			warnlog(core, NULL, "globcmd", "client doesn't read responses");
+			goto done;
+		}
+
+		r = ffpipe_read(cl->kev.fd, cl->buf.ptr, cl->buf.cap);
+		if (r < 0) {
+			if (fferr_again(fferr_last()))
+				return;
+			syserrlog(core, NULL, "globcmd", "%s", fffile_read_S);
+			goto done;
+
+		} else if (r == 0) {
+			cl->eof = 1;
+			ffstr_setcz(&in, "\n");
+
+		} else {
+			ffstr_set(&in, cl->buf.ptr, r);
+			dbglog(core, NULL, "globcmd", "read %L bytes", r);
+		}
+
+		if (0 != globcmd_parse(&cl->c, &in))
+			cl->eof = 1;
+	}
+
+done:
+	client_close(cl);
+}
+
+/** Serve client synchronously. */
 static void globcmd_onaccept(fffd peer)
 {
 	ffarr buf = {0};
@@ -247,10 +487,7 @@ static void globcmd_onaccept(fffd peer)
 
 	dbglog(core, NULL, "globcmd", "accepted client");
 
-	ffmem_tzero(&c);
-	c.qu = core->getmod("#queue.queue");
-	ffmem_tzero(&c.conf);
-	ffconf_parseinit(&c.conf);
+	cmd_parser_init(&c);
 
 	if (NULL == ffarr_alloc(&buf, GCMD_PIPE_IN_BUFSIZE)) {
 		syserrlog(core, NULL, "globcmd", "single instance mode: %e", FFERR_BUFALOC);
@@ -278,27 +515,106 @@ static void globcmd_onaccept(fffd peer)
 	}
 
 done:
+	if (c.out.len != 0)
+		fffile_write(peer, c.out.ptr, c.out.len);
 	ffarr_free(&buf);
-	ffconf_parseclose(&c.conf);
+	cmd_parser_close(&c);
 	dbglog(core, NULL, "globcmd", "done with client");
 }
 
 enum CMDS {
 	CMD_ADD,
 	CMD_CLEAR,
+	CMD_LIST,
 	CMD_PLAY,
 	CMD_QUIT,
 	CMD_STOP,
+	CMD_TRACKS,
+	CMD_WORKERS,
 };
 
 static const char* const cmds_str[] = {
 	"add", // "add INPUT..."
 	"clear",
+	"list",
 	"play", // "play INPUT..."
 	"quit",
 	"stop",
+	"tracks",
+	"workers",
+};
+
+/* Query commands.
+The response is a set of lines "KEY=VAL..." terminated by an empty line.
+The data is read on the main thread from the state snapshots, so the audio processing isn't blocked. */
+
+/** "list": entries of the current playlist */
+static void gcmd_list(cmd_parser *c)
+{
+	fmed_que_entry *e = NULL;
+	uint i = 1;
+	while (0 != c->qu->cmd2(FMED_QUE_LIST, &e, 0)) {
+		ffstr_catfmt(&c->out, "entry=%u dur=%d url=%S\n"
+			, i++, e->dur, &e->url);
+	}
+	ffstr_catfmt(&c->out, "\n");
+}
+
+// enum FMED_TRK_TYPE
+static const char *const trk_type_str[] = {
+	"none", "playback", "record", "mix-in", "mix-out", "net-in", "tee",
 };
 
+/** "tracks": active tracks, their positions, time spent inside each filter
+ and output buffer statistics of audio devices */
+static void gcmd_tracks(cmd_parser *c)
+{
+	fmed_trk_info ti;
+	ffmem_tzero(&ti);
+	while (0 == g->track->cmd(NULL, FMED_TRACK_INFO, &ti)) {
+		uint64 pos = 0, total = 0;
+		if (ti.sample_rate != 0) {
+			pos = ffpcm_time(ti.pos, ti.sample_rate);
+			if ((int64)ti.total != FMED_NULL)
+				total = ffpcm_time(ti.total, ti.sample_rate);
+		}
+
+		ffstr_catfmt(&c->out, "track=%S type=%s state=%s worker=%u pos_msec=%U total_msec=%U input=%s\n"
+			, ti.id
+			, (ti.type < FFCNT(trk_type_str)) ? trk_type_str[ti.type] : ""
+			, (ti.stopping) ? "stopping" : (ti.paused) ? "paused" : "active"
+			, ti.worker, pos, total
+			, (ti.input != NULL) ? ti.input : "");
+
+		for (uint i = 0;  i != ti.nfilters;  i++) {
+			const fmed_trk_filtinfo *fi = &ti.filters[i];
+			ffstr_catfmt(&c->out, "filter=%s track=%S calls=%U usec=%U in=%U out=%U rc="
+				, fi->name, ti.id, fi->calls, fi->usec, fi->in, fi->out);
+			for (uint k = 0;  k != FFCNT(fi->rc);  k++) {
+				ffstr_catfmt(&c->out, "%s%U", (k != 0) ? "," : "", fi->rc[k]);
+			}
+			ffstr_catfmt(&c->out, "\n");
+		}
+
+		if (ti.adev.buf_msec != 0) {
+			ffstr_catfmt(&c->out, "device track=%S xruns=%u buffer_msec=%u fill=%u fill_min=%u\n"
+				, ti.id, ti.adev.xruns, ti.adev.buf_msec, ti.adev.fill, ti.adev.fill_min);
+		}
+	}
+	ffstr_catfmt(&c->out, "\n");
+}
+
+/** "workers": the number of tracks on each worker */
+static void gcmd_workers(cmd_parser *c)
+{
+	fmed_worker_info wi;
+	for (uint i = 0;  0 == core->cmd(FMED_WORKER_INFO, i, &wi);  i++) {
+		ffstr_catfmt(&c->out, "worker=%u running=%u tracks=%u\n"
+			, i, wi.running, wi.njobs);
+	}
+	ffstr_catfmt(&c->out, "\n");
+}
+
 /** Parse commands.  Format:
 CMD [PARAMS] \n
 ...
@@ -346,6 +662,18 @@ static int globcmd_parse(cmd_parser *c, const ffstr *in)
 			case CMD_QUIT:
 				g->track->cmd((void*)-1, FMED_TRACK_STOPALL_EXIT);
 				break;
+
+			case CMD_LIST:
+				gcmd_list(c);
+				break;
+
+			case CMD_TRACKS:
+				gcmd_tracks(c);
+				break;
+
+			case CMD_WORKERS:
+				gcmd_workers(c);
+				break;
 			}
 			break;
 
@@ -0,0 +1,23 @@
+/** JSON output helpers.
+Copyright (c) 2018 Simon Zolin */
+
+#include <fmedia.h>
+
+
+void fmed_json_addstr(ffarr *buf, const char *s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	ffarr_append(buf, "\"", 1);
+	for (size_t i = 0;  i != len;  i++) {
+		byte c = s[i];
+		if (c == '"' || c == '\\') {
+			char esc[] = { '\\', c };
+			ffarr_append(buf, esc, 2);
+		} else if (c < 0x20) {
+			char esc[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0f] };
+			ffarr_append(buf, esc, sizeof(esc));
+		} else
+			ffarr_append(buf, &c, 1);
+	}
+	ffarr_append(buf, "\"", 1);
+}
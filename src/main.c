@@ -14,9 +14,32 @@ Copyright (c) 2015 Simon Zolin */
 #include <FFOS/error.h>
 #include <FFOS/process.h>
 
+#ifdef FF_LINUX
+#include <sched.h>
+#endif
+#ifdef FF_UNIX
+#include <pthread.h>
+#endif
+
 
 #define FMED_CMDHELP_FILE  "help.txt"
 
+enum {
+	LOG_RINGS = 16, //max. number of threads with their own log buffer
+	LOG_RING_SIZE = 64 * 1024, //must be a power of 2
+	LOG_FLUSH_PERIOD = 50, //msec
+};
+
+/** Log buffer filled by one thread and drained by the flusher thread.
+Record: [fd index (1 byte)] [length (2 bytes)] [data] */
+struct logring {
+	ffatomic used; //owned by a thread
+	ffatomic exited; //the owner thread has exited: the buffer is free after it's drained
+	ffatomic w; //write position (not wrapped)
+	ffatomic r; //read position (not wrapped)
+	char *data;
+};
+
 struct gctx {
 	ffsignal sigs_task;
 	fmed_cmd *cmd;
@@ -26,6 +49,25 @@ struct gctx {
 	ffdl core_dl;
 	fmed_core* (*core_init)(fmed_cmd **ptr, char **argv, char **env);
 	void (*core_free)(void);
+
+	struct logring logrings[LOG_RINGS];
+	fflock log_lk; //the buffers are drained by one thread at a time
+	char *log_out; //output buffer for log_flush()
+	ffatomic log_wake; //the flusher thread is woken up
+#ifdef FF_WIN
+	DWORD log_key;
+	HANDLE log_evt; //wakes the flusher thread
+#else
+	pthread_key_t log_key; //thread -> struct logring*
+	pthread_mutex_t log_mtx;
+	pthread_cond_t log_cond; //wakes the flusher thread
+#endif
+	ffthd log_thd;
+	uint log_stop;
+	uint log_async; //messages are put into the buffers
+	uint log_thd_started :1;
+	uint log_key_valid :1;
+	uint log_sync_valid :1;
 };
 static struct gctx *g;
 static fmed_core *core;
@@ -38,6 +80,7 @@ static int fmed_arg_listdev(void);
 static int arg_flist(ffparser_schem *p, void *obj, const char *fn);
 static int arg_finclude(ffparser_schem *p, void *obj, const ffstr *val);
 static int arg_astoplev(ffparser_schem *p, void *obj, const ffstr *val);
+static int arg_splitsil(ffparser_schem *p, void *obj, const ffstr *val);
 static int fmed_arg_seek(ffparser_schem *p, void *obj, const ffstr *val);
 static int fmed_arg_until(ffparser_schem *p, void *obj, const ffstr *val);
 static int fmed_arg_install(ffparser_schem *p, void *obj, const ffstr *val);
@@ -60,6 +103,14 @@ static void std_log(uint flags, fmed_logdata *ld);
 static const fmed_log std_logger = {
 	&std_log
 };
+static int log_start(void);
+static void log_stop(void);
+static void log_free(void);
+static void bench_pin(uint cpu);
+static int log_put(uint to_stdout, const char *d, size_t n);
+static void log_flush(char *out, size_t cap);
+static void log_flush_locked(void);
+static void log_wakeup(void);
 
 
 #define OFF(member)  FFPARS_DSTOFF(fmed_cmd, member)
@@ -92,12 +143,17 @@ static const ffpars_arg fmed_cmdline_args[] = {
 	{ "seek",	FFPARS_TSTR | FFPARS_FNOTEMPTY,  FFPARS_DST(&fmed_arg_seek) },
 	{ "until",	FFPARS_TSTR | FFPARS_FNOTEMPTY,  FFPARS_DST(&fmed_arg_until) },
 	{ "prebuffer",	FFPARS_TSTR | FFPARS_FNOTEMPTY,  FFPARS_DST(&fmed_arg_seek) },
+	{ "split",	FFPARS_TSTR | FFPARS_FNOTEMPTY,  FFPARS_DST(&fmed_arg_seek) },
+	{ "split-size",	FFPARS_TSIZE | FFPARS_F64BIT | FFPARS_FNOTZERO,  OFF(split_size) },
+	{ "split-silence",	FFPARS_TSTR | FFPARS_FNOTEMPTY,  FFPARS_DST(&arg_splitsil) },
 	{ "start-dblevel",	FFPARS_TFLOAT | FFPARS_FSIGN,  OFF(start_level) },
 	{ "stop-dblevel",	FFPARS_TSTR,  FFPARS_DST(&arg_astoplev) },
 	{ "fseek",	FFPARS_TINT | FFPARS_F64BIT,  OFF(fseek) },
 	{ "info",	FFPARS_SETVAL('i') | FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(info) },
+	{ "probe",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(probe) },
 	{ "tags",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(tags) },
 	{ "meta",	FFPARS_TSTR | FFPARS_FCOPY | FFPARS_FSTRZ,  OFF(meta) },
+	{ "edit-tags",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(edit_tags) },
 
 	//FILTERS
 	{ "volume",	FFPARS_TINT8,  OFF(volume) },
@@ -105,6 +161,7 @@ static const ffpars_arg fmed_cmdline_args[] = {
 	{ "dynanorm",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(dynanorm) },
 	{ "pcm-peaks",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(pcm_peaks) },
 	{ "pcm-crc",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(pcm_crc) },
+	{ "loudness",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(loudness) },
 
 	//ENCODING
 	{ "vorbis.quality",	FFPARS_TFLOAT | FFPARS_FSIGN,  OFF(vorbis_qual) },
@@ -132,9 +189,15 @@ static const ffpars_arg fmed_cmdline_args[] = {
 	{ "notui",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(notui) },
 	{ "gui",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(gui) },
 	{ "print-time",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(print_time) },
+	{ "decode-only",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(decode_only) },
+	{ "bench",	FFPARS_TINT | FFPARS_FNOTZERO,  OFF(bench) },
+	{ "bench-cpu",	FFPARS_TINT,  OFF(bench_cpu) },
+	{ "profile",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(profile) },
+	{ "profile-json",	FFPARS_TCHARPTR | FFPARS_FSTRZ | FFPARS_FCOPY | FFPARS_FNOTEMPTY,  OFF(profile_json) },
 	{ "debug",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(debug) },
 	{ "help",	FFPARS_SETVAL('h') | FFPARS_TBOOL | FFPARS_FALONE,  FFPARS_DST(&fmed_arg_usage) },
 	{ "cue-gaps",	FFPARS_TINT8,  OFF(cue_gaps) },
+	{ "cue-split",	FFPARS_TBOOL8 | FFPARS_FALONE,  OFF(cue_split) },
 
 	//INSTALL
 	{ "install",	FFPARS_TBOOL | FFPARS_FALONE,  FFPARS_DST(&fmed_arg_install) },
@@ -280,27 +343,29 @@ static int fmed_arg_out_copy(ffparser_schem *p, void *obj, const ffstr *val)
 	return 0;
 }
 
-/** Read file line by line and add filenames as input arguments. */
-static int arg_flist(ffparser_schem *p, void *obj, const char *fn)
+enum {
+	FLIST_CHUNK_MIN = 1 * 1024 * 1024, //don't use threads for smaller file lists
+	FLIST_MAXTHD = 8,
+};
+
+/** A line-aligned part of a file list. */
+struct flist_chunk {
+	ffstr data;
+	ffarr names; //char*[]
+	ffthd thd;
+	uint err :1;
+};
+
+/** Split data into lines and copy non-empty ones. */
+static FFTHDCALL int flist_parse(void *param)
 {
-	int r = FFPARS_ESYS;
-	uint cnt = 0;
-	ssize_t n;
-	fffd f = FF_BADFD;
-	ffarr buf = {0};
+	struct flist_chunk *c = param;
 	ffstr line;
 	const char *d, *end, *lf, *ln_end;
+	char **fn;
 
-	dbglog(core, NULL, "core", "opening file %s", fn);
-
-	if (FF_BADFD == (f = fffile_open(fn, O_RDONLY | O_NOATIME)))
-		goto done;
-	if (NULL == ffarr_alloc(&buf, fffile_size(f)))
-		goto done;
-	if (0 > (n = fffile_read(f, buf.ptr, buf.cap)))
-		goto done;
-	d = buf.ptr;
-	end = buf.ptr + n;
+	d = c->data.ptr;
+	end = c->data.ptr + c->data.len;
 	while (d != end) {
 		lf = ffs_find(d, end - d, '\n');
 		d = ffs_skipof(d, lf - d, " \t", 2);
@@ -312,16 +377,113 @@ static int arg_flist(ffparser_schem *p, void *obj, const char *fn)
 			d = lf;
 		if (line.len == 0)
 			continue;
-		if (0 != fmed_arg_infile(p, obj, &line))
+		if (NULL == (fn = ffarr_pushgrowT(&c->names, 1024, char*))
+			|| NULL == (*fn = ffsz_alcopystr(&line))) {
+			c->err = 1;
+			break;
+		}
+	}
+	return 0;
+}
+
+/** Read file line by line and add filenames as input arguments.
+The file is mapped into memory.  A large file is split into line-aligned chunks which are parsed in parallel;
+ the results are appended in the original order. */
+static int arg_flist(ffparser_schem *p, void *obj, const char *fn)
+{
+	fmed_cmd *cmd = obj;
+	int r = FFPARS_ESYS;
+	size_t cnt = 0;
+	ssize_t n;
+	uint64 fsize = 0;
+	fffd f = FF_BADFD, hmap = FF_BADFD;
+	void *map = NULL;
+	ffarr buf = {0};
+	ffstr data;
+	struct flist_chunk chunks[FLIST_MAXTHD] = {}, *c;
+	uint nchunks = 1, i;
+
+	dbglog(core, NULL, "core", "opening file %s", fn);
+
+	if (FF_BADFD == (f = fffile_open(fn, O_RDONLY | O_NOATIME)))
+		goto done;
+	fsize = fffile_size(f);
+	if (fsize == 0) {
+		r = 0;
+		goto done;
+	}
+
+	if (FF_BADFD != (hmap = ffmap_create(f, fsize, FFMAP_PAGEREAD))
+		&& NULL != (map = ffmap_open(hmap, 0, fsize, PROT_READ, MAP_SHARED))) {
+		ffstr_set(&data, map, fsize);
+
+	} else {
+		// fall back to reading into memory
+		if (NULL == ffarr_alloc(&buf, fsize))
+			goto done;
+		if (0 > (n = fffile_read(f, buf.ptr, buf.cap)))
+			goto done;
+		ffstr_set(&data, buf.ptr, n);
+	}
+
+	if (data.len >= 2 * FLIST_CHUNK_MIN) {
+		ffsysconf sc;
+		ffsc_init(&sc);
+		nchunks = ffmax(ffsc_get(&sc, _SC_NPROCESSORS_ONLN), 1);
+		nchunks = ffmin(nchunks, ffmin(FLIST_MAXTHD, data.len / FLIST_CHUNK_MIN));
+	}
+
+	// split at line boundaries
+	for (i = 0;  i != nchunks;  i++) {
+		size_t len = data.len;
+		if (i != nchunks - 1) {
+			len = data.len / (nchunks - i);
+			const char *lf = ffs_find(data.ptr + len, data.len - len, '\n');
+			len = (lf != ffarr_end(&data)) ? lf + 1 - data.ptr : data.len;
+		}
+		ffstr_set(&chunks[i].data, data.ptr, len);
+		ffstr_shift(&data, len);
+		chunks[i].thd = FFTHD_INV;
+	}
+
+	for (i = 1;  i < nchunks;  i++) {
+		c = &chunks[i];
+		if (FFTHD_INV == (c->thd = ffthd_create(&flist_parse, c, 0)))
+			flist_parse(c);
+	}
+	flist_parse(&chunks[0]);
+	for (i = 1;  i < nchunks;  i++) {
+		if (chunks[i].thd != FFTHD_INV)
+			ffthd_join(chunks[i].thd, -1, NULL);
+	}
+
+	for (i = 0;  i != nchunks;  i++) {
+		if (chunks[i].err)
 			goto done;
-		cnt++;
+		cnt += chunks[i].names.len;
 	}
 
-	dbglog(core, NULL, "core", "added %u filenames from %s", cnt, fn);
+	if (NULL == ffarr_growT(&cmd->in_files, cnt, 4, char*))
+		goto done;
+	for (i = 0;  i != nchunks;  i++) {
+		c = &chunks[i];
+		ffmemcpy((char**)cmd->in_files.ptr + cmd->in_files.len, c->names.ptr, c->names.len * sizeof(char*));
+		cmd->in_files.len += c->names.len;
+		c->names.len = 0;
+	}
+
+	dbglog(core, NULL, "core", "added %L filenames from %s (%u threads)", cnt, fn, nchunks);
 
 	r = 0;
 
 done:
+	for (i = 0;  i != nchunks;  i++) {
+		FFARR_FREE_ALL_PTR(&chunks[i].names, ffmem_free, char*);
+	}
+	if (map != NULL)
+		ffmap_unmap(map, fsize);
+	if (hmap != FF_BADFD)
+		ffmap_close(hmap);
 	FF_SAFECLOSE(f, FF_BADFD, fffile_close);
 	ffarr_free(&buf);
 	return r;
@@ -387,6 +549,31 @@ static int arg_astoplev(ffparser_schem *p, void *obj, const ffstr *val)
 	return 0;
 }
 
+/* "DB[;TIME]" */
+static int arg_splitsil(ffparser_schem *p, void *obj, const ffstr *val)
+{
+	fmed_cmd *cmd = obj;
+	ffstr db, time;
+	ffdtm dt;
+	fftime t;
+	ffs_split2by(val->ptr, val->len, ';', &db, &time);
+
+	double f;
+	if (db.len == 0 || db.len != ffs_tofloat(db.ptr, db.len, &f, 0) || f == 0)
+		return FFPARS_EBADVAL;
+	cmd->split_silence = f;
+
+	if (time.len != 0) {
+		if (time.len != fftime_fromstr(&dt, time.ptr, time.len, FFTIME_HMS_MSEC_VAR))
+			return FFPARS_EBADVAL;
+
+		fftime_join(&t, &dt, FFTIME_TZNODATE);
+		cmd->split_silence_time = fftime_ms(&t);
+	}
+
+	return 0;
+}
+
 static int fmed_arg_seek(ffparser_schem *p, void *obj, const ffstr *val)
 {
 	fmed_cmd *cmd = obj;
@@ -403,6 +590,8 @@ static int fmed_arg_seek(ffparser_schem *p, void *obj, const ffstr *val)
 		cmd->seek_time = i;
 	else if (!ffsz_cmp(p->curarg->name, "until"))
 		cmd->until_time = i;
+	else if (!ffsz_cmp(p->curarg->name, "split"))
+		cmd->split_time = i;
 	else
 		cmd->prebuffer = i;
 	return 0;
@@ -541,8 +730,293 @@ static void std_log(uint flags, fmed_logdata *ld)
 	*s++ = '\n';
 
 	uint lev = flags & _FMED_LOG_LEVMASK;
-	fffd fd = (lev > FMED_LOG_USER && !core->props->stdout_busy) ? ffstdout : ffstderr;
-	ffstd_write(fd, buf, s - buf);
+	uint to_stdout = (lev > FMED_LOG_USER && !core->props->stdout_busy);
+	if (FF_READONCE(&g->log_async) && 0 == log_put(to_stdout, buf, s - buf)) {
+		if (!FF_READONCE(&g->log_async))
+			log_flush_locked(); // the flusher thread has been stopped
+		else if (lev <= FMED_LOG_USER)
+			log_wakeup(); // errors, warnings and user messages aren't delayed
+		return;
+	}
+
+	if (g->log_out != NULL) {
+		// write the buffered messages first, so the order is kept
+		fflk_lock(&g->log_lk);
+		log_flush(g->log_out, LOG_RING_SIZE);
+		ffstd_write((to_stdout) ? ffstdout : ffstderr, buf, s - buf);
+		fflk_unlock(&g->log_lk);
+		return;
+	}
+	ffstd_write((to_stdout) ? ffstdout : ffstderr, buf, s - buf);
+}
+
+#ifdef FF_WIN
+static void WINAPI log_ring_release(void *param)
+#else
+static void log_ring_release(void *param)
+#endif
+{
+	struct logring *lr = param;
+	if (lr == NULL)
+		return;
+	ffatom_fence_rel();
+	ffatom_set(&lr->exited, 1);
+}
+
+/** Get log buffer of the current thread.
+A thread takes a free buffer on its first message and releases it on exit. */
+static struct logring* log_ring(void)
+{
+	struct logring *lr;
+#ifdef FF_WIN
+	lr = FlsGetValue(g->log_key);
+#else
+	lr = pthread_getspecific(g->log_key);
+#endif
+	if (lr != NULL)
+		return lr;
+
+	FFARRS_FOREACH(g->logrings, lr) {
+		if (ffatom_cmpset(&lr->used, 0, 1)) {
+#ifdef FF_WIN
+			FlsSetValue(g->log_key, lr);
+#else
+			pthread_setspecific(g->log_key, lr);
+#endif
+			return lr;
+		}
+	}
+	return NULL;
+}
+
+static void ring_write(char *ring, size_t off, const void *d, size_t n)
+{
+	off &= LOG_RING_SIZE - 1;
+	size_t n1 = ffmin(n, LOG_RING_SIZE - off);
+	ffmemcpy(ring + off, d, n1);
+	ffmemcpy(ring, (char*)d + n1, n - n1);
+}
+
+static void ring_read(const char *ring, size_t off, void *d, size_t n)
+{
+	off &= LOG_RING_SIZE - 1;
+	size_t n1 = ffmin(n, LOG_RING_SIZE - off);
+	ffmemcpy(d, ring + off, n1);
+	ffmemcpy((char*)d + n1, ring, n - n1);
+}
+
+/** Add message to the current thread's log buffer without blocking.
+Return 0 on success;  -1 if the message must be written synchronously. */
+static int log_put(uint to_stdout, const char *d, size_t n)
+{
+	struct logring *lr;
+	if (NULL == (lr = log_ring()))
+		return -1;
+
+	size_t w = ffatom_get(&lr->w);
+	size_t r = ffatom_get(&lr->r);
+	ffatom_fence_acq();
+	if (LOG_RING_SIZE - (w - r) < 3 + n)
+		return -1;
+
+	byte hdr[3] = { to_stdout, (byte)n, (byte)(n >> 8) };
+	ring_write(lr->data, w, hdr, 3);
+	ring_write(lr->data, w + 3, d, n);
+	ffatom_fence_rel();
+	ffatom_set(&lr->w, w + 3 + n);
+	return 0;
+}
+
+/** Write the buffered messages to stdout/stderr.  Messages of the same thread are kept in order. */
+static void log_flush(char *out, size_t cap)
+{
+	size_t len = 0;
+	uint cur_stdout = 0;
+	struct logring *lr;
+
+	FFARRS_FOREACH(g->logrings, lr) {
+		if (!ffatom_get(&lr->used))
+			continue;
+		uint exited = ffatom_get(&lr->exited);
+		size_t w = ffatom_get(&lr->w);
+		ffatom_fence_acq();
+		size_t r = ffatom_get(&lr->r);
+
+		while (r != w) {
+			byte hdr[3];
+			ring_read(lr->data, r, hdr, 3);
+			size_t dlen = hdr[1] | (hdr[2] << 8);
+
+			if (len != 0 && (hdr[0] != cur_stdout || len + dlen > cap)) {
+				ffstd_write((cur_stdout) ? ffstdout : ffstderr, out, len);
+				len = 0;
+			}
+			cur_stdout = hdr[0];
+			ring_read(lr->data, r + 3, out + len, dlen);
+			len += dlen;
+			r += 3 + dlen;
+		}
+
+		ffatom_fence_rel();
+		ffatom_set(&lr->r, r);
+
+		if (exited) {
+			// the owner has exited and its messages are written: the buffer may be taken by another thread
+			ffatom_set(&lr->exited, 0);
+			ffatom_fence_rel();
+			ffatom_set(&lr->used, 0);
+		}
+	}
+
+	if (len != 0)
+		ffstd_write((cur_stdout) ? ffstdout : ffstderr, out, len);
+}
+
+/** Write the buffered messages now. */
+static void log_flush_locked(void)
+{
+	fflk_lock(&g->log_lk);
+	log_flush(g->log_out, LOG_RING_SIZE);
+	fflk_unlock(&g->log_lk);
+}
+
+/** Wake the flusher thread to write the buffered messages without waiting for the next period. */
+static void log_wakeup(void)
+{
+	if (!ffatom_cmpset(&g->log_wake, 0, 1))
+		return; // already woken
+
+#ifdef FF_WIN
+	SetEvent(g->log_evt);
+#else
+	pthread_mutex_lock(&g->log_mtx);
+	pthread_cond_signal(&g->log_cond);
+	pthread_mutex_unlock(&g->log_mtx);
+#endif
+}
+
+/** Wait until the flusher thread is woken or 'msec' passes. */
+static void log_wait(uint msec)
+{
+#ifdef FF_WIN
+	WaitForSingleObject(g->log_evt, msec);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += msec / 1000;
+	ts.tv_nsec += (msec % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&g->log_mtx);
+	if (!ffatom_get(&g->log_wake))
+		pthread_cond_timedwait(&g->log_cond, &g->log_mtx, &ts);
+	pthread_mutex_unlock(&g->log_mtx);
+#endif
+	ffatom_set(&g->log_wake, 0);
+}
+
+static FFTHDCALL int log_flusher(void *param)
+{
+	while (!FF_READONCE(&g->log_stop)) {
+		log_wait(LOG_FLUSH_PERIOD);
+		log_flush_locked();
+	}
+	log_flush_locked();
+	return 0;
+}
+
+/** Start writing log messages asynchronously:
+ each thread puts messages into its own buffer without taking a lock,
+ and the flusher thread writes them to stdout/stderr.
+Errors, warnings and user messages wake the flusher thread up.
+If a buffer is full, the message is written synchronously under the lock. */
+static int log_start(void)
+{
+	fflk_init(&g->log_lk);
+#ifdef FF_WIN
+	if (NULL == (g->log_evt = CreateEvent(NULL, 0, 0, NULL)))
+		goto err;
+#else
+	pthread_mutex_init(&g->log_mtx, NULL);
+	pthread_cond_init(&g->log_cond, NULL);
+#endif
+	g->log_sync_valid = 1;
+	struct logring *lr;
+	FFARRS_FOREACH(g->logrings, lr) {
+		if (NULL == (lr->data = ffmem_alloc(LOG_RING_SIZE)))
+			goto err;
+	}
+	if (NULL == (g->log_out = ffmem_alloc(LOG_RING_SIZE)))
+		goto err;
+
+#ifdef FF_WIN
+	if (FLS_OUT_OF_INDEXES == (g->log_key = FlsAlloc(&log_ring_release)))
+		goto err;
+#else
+	if (0 != pthread_key_create(&g->log_key, &log_ring_release))
+		goto err;
+#endif
+	g->log_key_valid = 1;
+
+	if (FFTHD_INV == (g->log_thd = ffthd_create(&log_flusher, NULL, 0)))
+		goto err;
+	g->log_thd_started = 1;
+	g->log_async = 1;
+	return 0;
+
+err:
+	syserrlog(core, NULL, "core", "async log: %s", "init");
+	log_stop();
+	log_free();
+	return -1;
+}
+
+/** Stop the flusher thread and write all pending messages.
+The messages logged after this are written synchronously. */
+static void log_stop(void)
+{
+	if (g->log_thd_started) {
+		FF_WRITEONCE(&g->log_async, 0);
+		FF_WRITEONCE(&g->log_stop, 1);
+		log_wakeup();
+		ffthd_join(g->log_thd, -1, NULL);
+		g->log_thd_started = 0;
+	}
+}
+
+/** Free the log buffers.  No other threads must be running. */
+static void log_free(void)
+{
+	if (g->log_out != NULL)
+		log_flush_locked();
+
+	if (g->log_key_valid) {
+#ifdef FF_WIN
+		FlsFree(g->log_key);
+#else
+		pthread_key_delete(g->log_key);
+#endif
+		g->log_key_valid = 0;
+	}
+
+	if (g->log_sync_valid) {
+#ifdef FF_WIN
+		CloseHandle(g->log_evt);
+#else
+		pthread_cond_destroy(&g->log_cond);
+		pthread_mutex_destroy(&g->log_mtx);
+#endif
+		g->log_sync_valid = 0;
+	}
+
+	struct logring *lr;
+	FFARRS_FOREACH(g->logrings, lr) {
+		ffmem_safefree0(lr->data);
+	}
+	ffmem_safefree0(g->log_out);
 }
 
 
@@ -653,7 +1127,7 @@ static void qu_setprops(fmed_cmd *fmed, const fmed_queue *qu, fmed_que_entry *qe
 
 static void trk_prep(fmed_cmd *fmed, fmed_trk *trk)
 {
-	trk->input_info = fmed->info;
+	trk->input_info = fmed->info || fmed->probe;
 	trk->include_files = fmed->include_files;
 	trk->exclude_files = fmed->exclude_files;
 	if (fmed->fseek != 0)
@@ -677,6 +1151,7 @@ static void trk_prep(fmed_cmd *fmed, fmed_trk *trk)
 
 	trk->pcm_peaks = fmed->pcm_peaks;
 	trk->pcm_peaks_crc = fmed->pcm_crc;
+	trk->loudness = fmed->loudness;
 	trk->use_dynanorm = fmed->dynanorm;
 	trk->a_start_level = ffabs(fmed->start_level);
 	trk->a_stop_level = ffabs(fmed->stop_level);
@@ -712,14 +1187,34 @@ static void trk_prep(fmed_cmd *fmed, fmed_trk *trk)
 		trk->stream_copy = 1;
 }
 
+/** Add the pending input files to queue in one operation. */
+static void open_input_addn(fmed_cmd *fmed, const fmed_queue *qu, ffarr *ents, const fmed_trk *trkinfo, void **first)
+{
+	fmed_que_entry *e = (void*)ents->ptr;
+	if (ents->len == 0)
+		return;
+
+	if (-1 != qu->cmd2(FMED_QUE_ADDN, e, ents->len)) {
+		for (size_t i = 0;  i != ents->len;  i++) {
+			fmed_que_entry *qe = e[i].prev;
+			g->track->copy_info(qe->trk, trkinfo);
+			qu_setprops(fmed, qu, qe);
+		}
+		if (*first == NULL)
+			*first = e[0].prev;
+	}
+	ents->len = 0;
+}
+
 static void open_input(void *udata)
 {
 	char **pfn;
 	const fmed_track *track = g->track;
 	const fmed_queue *qu;
-	fmed_que_entry e, *qe;
+	fmed_que_entry *e;
 	void *first = NULL;
 	fmed_cmd *fmed = udata;
+	ffarr ents = {0}; //fmed_que_entry[]
 
 	if (NULL == (qu = core->getmod("#queue.queue")))
 		goto end;
@@ -728,25 +1223,36 @@ static void open_input(void *udata)
 	track->copy_info(&trkinfo, NULL);
 	trk_prep(fmed, &trkinfo);
 
-	FFARR_WALKT(&fmed->in_files, pfn, char*) {
+	if (fmed->in_files.len != 0
+		&& NULL == ffarr_allocT(&ents, fmed->in_files.len, fmed_que_entry))
+		goto end;
+
+	// "--bench=N": process the input files N times
+	uint nrepeat = ffmax(fmed->bench, 1);
+	for (uint i = 0;  i != nrepeat;  i++) {
+		FFARR_WALKT(&fmed->in_files, pfn, char*) {
 
 #ifdef FF_WIN
-		if (NULL != (qe = open_input_wcard(qu, *pfn, track, &trkinfo))) {
-			if (first == NULL)
-				first = qe;
-			continue;
-		}
+			ffstr s;
+			ffstr_setz(&s, *pfn);
+			if (ffarr_end(&s) != ffs_findof(s.ptr, s.len, "*?", 2)) {
+				fmed_que_entry *qe;
+				open_input_addn(fmed, qu, &ents, &trkinfo, &first);
+				if (NULL != (qe = open_input_wcard(qu, *pfn, track, &trkinfo))) {
+					if (first == NULL)
+						first = qe;
+					continue;
+				}
+			}
 #endif
 
-		ffmem_tzero(&e);
-		ffstr_setz(&e.url, *pfn);
-		qe = qu->add(&e);
-		if (first == NULL)
-			first = qe;
-
-		track->copy_info(qe->trk, &trkinfo);
-		qu_setprops(fmed, qu, qe);
+			e = ffarr_pushT(&ents, fmed_que_entry);
+			ffmem_tzero(e);
+			ffstr_setz(&e->url, *pfn);
+		}
+		open_input_addn(fmed, qu, &ents, &trkinfo, &first);
 	}
+	ffarr_free(&ents);
 	FFARR_FREE_ALL_PTR(&fmed->in_files, ffmem_free, char*);
 
 	if (first != NULL) {
@@ -774,6 +1280,16 @@ static void open_input(void *udata)
 		if (fmed->outfn.len != 0)
 			track->setvalstr(trk, "output", fmed->outfn.ptr);
 
+		if (fmed->split_time != 0)
+			track->setval(trk, "split_time", fmed->split_time);
+		if (fmed->split_size != 0)
+			track->setval(trk, "split_size", fmed->split_size);
+		if (fmed->split_silence != 0) {
+			track->setval(trk, "split_silence", (int64)(ffabs(fmed->split_silence) * 100));
+			if (fmed->split_silence_time != 0)
+				track->setval(trk, "split_silence_time", fmed->split_silence_time);
+		}
+
 		if (fmed->rec)
 			track->setval(trk, "low_latency", 1);
 
@@ -818,12 +1334,51 @@ static void rec_lpback_new_track(fmed_cmd *cmd)
 	track->cmd(trk, FMED_TRACK_START);
 }
 
+/** Run all processing on the specified CPU.
+The main thread is pinned before the worker threads are created, so they inherit its affinity. */
+static void bench_pin(uint cpu)
+{
+#if defined FF_LINUX
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (0 != sched_setaffinity(0, sizeof(set), &set)) {
+		syserrlog(core, NULL, "core", "sched_setaffinity(): CPU #%u", cpu);
+		return;
+	}
+
+#elif defined FF_WIN
+	// worker threads don't inherit the affinity of the main thread: set it for the whole process
+	if (!SetProcessAffinityMask(GetCurrentProcess(), (DWORD_PTR)1 << cpu)) {
+		syserrlog(core, NULL, "core", "SetProcessAffinityMask(): CPU #%u", cpu);
+		return;
+	}
+
+#else
+	warnlog(core, NULL, "core", "--bench-cpu isn't supported on this OS");
+	return;
+#endif
+
+	dbglog(core, NULL, "core", "pinned to CPU #%u", cpu);
+}
+
 static int gcmd_send(const fmed_globcmd_iface *globcmd)
 {
 	if (0 != globcmd->write(g->cmd->globcmd.ptr, g->cmd->globcmd.len)) {
 		return -1;
 	}
 
+	// print the response to query commands
+	char buf[4096];
+	for (;;) {
+		ssize_t r = globcmd->read(buf, sizeof(buf));
+		if (r < 0)
+			return -1;
+		else if (r == 0)
+			break;
+		fffile_write(ffstdout, buf, r);
+	}
+
 	return 0;
 }
 
@@ -949,6 +1504,11 @@ int main(int argc, char **argv, char **env)
 		}
 	}
 
+	log_start();
+
+	if (gcmd->bench_cpu != (uint)-1)
+		bench_pin(gcmd->bench_cpu);
+
 	if (NULL == (g->track = core->getmod("#core.track")))
 		goto end;
 	core->props->list_random = g->cmd->list_random;
@@ -991,10 +1551,12 @@ int main(int argc, char **argv, char **env)
 	rc = 0;
 
 end:
+	log_stop();
 	if (core != NULL) {
 		ffsig_ctl(&g->sigs_task, core->kq, sigs, FFCNT(sigs), NULL);
 		g->core_free();
 	}
+	log_free();
 	FF_SAFECLOSE(g->core_dl, NULL, ffdl_close);
 	ffmem_free(g);
 	return rc;
@@ -21,11 +21,18 @@ typedef struct dirconf_t {
 } dirconf_t;
 dirconf_t dirconf;
 
+/** Playlist entries waiting to be added to queue in one operation. */
+struct plist_pending {
+	ffarr ents; //fmed_que_entry[]
+	ffarr meta; //ffstr[]: artist, title (for each entry)
+};
+
 typedef struct m3u {
 	ffm3u m3u;
 	fmed_que_entry ent;
 	ffpls_entry pls_ent;
 	fmed_que_entry *qu_cur;
+	struct plist_pending pending;
 	uint fin :1;
 } m3u;
 
@@ -33,6 +40,7 @@ typedef struct pls_in {
 	ffpls pls;
 	ffpls_entry pls_ent;
 	fmed_que_entry *qu_cur;
+	struct plist_pending pending;
 } pls_in;
 
 typedef struct cue {
@@ -48,8 +56,14 @@ typedef struct cue {
 	ffarr trackno;
 	uint curtrk;
 
+	//single-pass split: one queue item for all tracks from the same file
+	ffarr split; //"FROM TO\n(NAME\tVAL\n)*\n..."
+	ffstr split_url;
+	uint split_from, split_to;
+
 	uint have_gmeta :1;
 	uint utf8 :1;
+	uint split_mode :1;
 } cue;
 
 
@@ -101,6 +115,9 @@ static int dir_conf(ffpars_ctx *ctx);
 static int dir_open_r(const char *dirname, fmed_filt *d);
 
 static int plist_fullname(fmed_filt *d, const ffstr *name, ffstr *dst);
+static int pending_add(struct plist_pending *p, fmed_filt *d, const ffstr *url, int dur, const ffstr *artist, const ffstr *title);
+static int pending_flush(struct plist_pending *p, fmed_que_entry **qu_cur, uint flags);
+static void pending_free(struct plist_pending *p);
 
 static const ffpars_arg dir_conf_args[] = {
 	{ "expand",  FFPARS_TBOOL8,  FFPARS_DSTOFF(dirconf_t, expand) },
@@ -176,6 +193,89 @@ static int plist_fullname(fmed_filt *d, const ffstr *name, ffstr *dst)
 }
 
 
+/** Store a new entry.
+The entries are added to queue later by pending_flush(), so the queue index is updated once for the whole playlist. */
+static int pending_add(struct plist_pending *p, fmed_filt *d, const ffstr *url, int dur, const ffstr *artist, const ffstr *title)
+{
+	fmed_que_entry *ent;
+	ffstr *meta;
+
+	if (NULL == ffarr_growT(&p->ents, 1, 256, fmed_que_entry)
+		|| NULL == ffarr_growT(&p->meta, 2, 256, ffstr))
+		return -1;
+
+	ent = ffarr_pushT(&p->ents, fmed_que_entry);
+	ffmem_tzero(ent);
+	if (0 != plist_fullname(d, url, &ent->url)) {
+		p->ents.len--;
+		return -1;
+	}
+	ent->dur = dur;
+
+	meta = ffarr_pushT(&p->meta, ffstr);
+	ffstr_null(meta);
+	if (artist != NULL && artist->len != 0)
+		ffstr_copy(meta, artist->ptr, artist->len);
+
+	meta = ffarr_pushT(&p->meta, ffstr);
+	ffstr_null(meta);
+	if (title->len != 0)
+		ffstr_copy(meta, title->ptr, title->len);
+	return 0;
+}
+
+/** Add the stored entries to queue after *qu_cur.
+@flags: FMED_QUE_MORE: passed to the onchange handler for each entry */
+static int pending_flush(struct plist_pending *p, fmed_que_entry **qu_cur, uint flags)
+{
+	fmed_que_entry *ents = (void*)p->ents.ptr;
+	ffstr *m = (void*)p->meta.ptr, meta[2];
+	int rc = 0;
+
+	if (p->ents.len == 0)
+		return 0;
+
+	ents[0].prev = *qu_cur;
+	if (-1 == qu->cmd2(FMED_QUE_ADDN | FMED_QUE_NO_ONCHANGE | FMED_QUE_COPY_PROPS, ents, p->ents.len)) {
+		rc = -1;
+		goto end;
+	}
+
+	for (size_t i = 0;  i != p->ents.len;  i++) {
+		fmed_que_entry *cur = ents[i].prev;
+
+		if (m[i * 2].len != 0) {
+			ffstr_setcz(&meta[0], "artist");
+			meta[1] = m[i * 2];
+			qu->cmd2(FMED_QUE_METASET | (FMED_QUE_TMETA << 16), cur, (size_t)meta);
+		}
+
+		if (m[i * 2 + 1].len != 0) {
+			ffstr_setcz(&meta[0], "title");
+			meta[1] = m[i * 2 + 1];
+			qu->cmd2(FMED_QUE_METASET | (FMED_QUE_TMETA << 16), cur, (size_t)meta);
+		}
+
+		qu->cmd2(FMED_QUE_ADD | flags | FMED_QUE_ADD_DONE, cur, 0);
+		*qu_cur = cur;
+	}
+
+end:
+	pending_free(p);
+	return rc;
+}
+
+static void pending_free(struct plist_pending *p)
+{
+	fmed_que_entry *e;
+	FFARR_WALKT(&p->ents, e, fmed_que_entry) {
+		ffstr_free(&e->url);
+	}
+	ffarr_free(&p->ents);
+	FFARR_FREE_ALL(&p->meta, ffstr_free, ffstr);
+}
+
+
 static void* m3u_open(fmed_filt *d)
 {
 	m3u *m;
@@ -191,6 +291,7 @@ static void m3u_close(void *ctx)
 	m3u *m = ctx;
 	ffm3u_close(&m->m3u);
 	ffpls_entry_free(&m->pls_ent);
+	pending_free(&m->pending);
 	ffmem_free(m);
 }
 
@@ -214,6 +315,8 @@ static int m3u_process(void *ctx, fmed_filt *d)
 			continue;
 		}
 
+		if (0 != pending_flush(&m->pending, &m->qu_cur, FMED_QUE_MORE))
+			return FMED_RERR;
 		qu->cmd(FMED_QUE_ADD | FMED_QUE_ADD_DONE, NULL);
 		qu->cmd(FMED_QUE_RM, (void*)fmed_getval("queue_item"));
 		return FMED_RFIN;
@@ -222,34 +325,12 @@ static int m3u_process(void *ctx, fmed_filt *d)
 	r2 = ffm3u_entry_get(&m->pls_ent, r, &m->m3u.val);
 
 	if (r2 == 1) {
-		fmed_que_entry ent, *cur;
-		ffstr meta[2];
-		ffmem_tzero(&ent);
-
-		if (0 != plist_fullname(d, (ffstr*)&m->pls_ent.url, &ent.url))
+		ffstr artist, title;
+		ffstr_set2(&artist, &m->pls_ent.artist);
+		ffstr_set2(&title, &m->pls_ent.title);
+		if (0 != pending_add(&m->pending, d, (ffstr*)&m->pls_ent.url
+			, (m->pls_ent.duration != -1) ? m->pls_ent.duration * 1000 : 0, &artist, &title))
 			return FMED_RERR;
-
-		if (m->pls_ent.duration != -1)
-			ent.dur = m->pls_ent.duration * 1000;
-
-		ent.prev = m->qu_cur;
-		cur = (void*)qu->cmd2(FMED_QUE_ADD | FMED_QUE_NO_ONCHANGE | FMED_QUE_COPY_PROPS, &ent, 0);
-		ffstr_free(&ent.url);
-
-		if (m->pls_ent.artist.len != 0) {
-			ffstr_setcz(&meta[0], "artist");
-			ffstr_set2(&meta[1], &m->pls_ent.artist);
-			qu->cmd2(FMED_QUE_METASET | (FMED_QUE_TMETA << 16), cur, (size_t)meta);
-		}
-
-		if (m->pls_ent.title.len != 0) {
-			ffstr_setcz(&meta[0], "title");
-			ffstr_set2(&meta[1], &m->pls_ent.title);
-			qu->cmd2(FMED_QUE_METASET | (FMED_QUE_TMETA << 16), cur, (size_t)meta);
-		}
-
-		qu->cmd2(FMED_QUE_ADD | FMED_QUE_MORE | FMED_QUE_ADD_DONE, cur, 0);
-		m->qu_cur = cur;
 	}
 
 	if (r == FFPARS_MORE) {
@@ -279,6 +360,7 @@ static void pls_close(void *ctx)
 	pls_in *p = ctx;
 	ffpls_close(&p->pls);
 	ffpls_entry_free(&p->pls_ent);
+	pending_free(&p->pending);
 	ffmem_free(p);
 }
 
@@ -308,31 +390,16 @@ static int pls_process(void *ctx, fmed_filt *d)
 	r2 = ffpls_entry_get(&p->pls_ent, r, &p->pls.val);
 
 	if (r2 == 1) {
-		fmed_que_entry ent, *cur;
-		ffstr meta[2];
-		ffmem_tzero(&ent);
-
-		if (0 != plist_fullname(d, (ffstr*)&p->pls_ent.url, &ent.url))
+		ffstr title;
+		ffstr_set2(&title, &p->pls_ent.title);
+		if (0 != pending_add(&p->pending, d, (ffstr*)&p->pls_ent.url
+			, (p->pls_ent.duration != -1) ? p->pls_ent.duration * 1000 : 0, NULL, &title))
 			return FMED_RERR;
-
-		if (p->pls_ent.duration != -1)
-			ent.dur = p->pls_ent.duration * 1000;
-
-		ent.prev = p->qu_cur;
-		cur = (void*)qu->cmd2(FMED_QUE_ADD | FMED_QUE_NO_ONCHANGE | FMED_QUE_COPY_PROPS, &ent, 0);
-		ffstr_free(&ent.url);
-
-		if (p->pls_ent.title.len != 0) {
-			ffstr_setcz(&meta[0], "title");
-			ffstr_set2(&meta[1], &p->pls_ent.title);
-			qu->cmd2(FMED_QUE_METASET | (FMED_QUE_TMETA << 16), cur, (size_t)meta);
-		}
-
-		qu->cmd2(FMED_QUE_ADD | FMED_QUE_ADD_DONE, cur, 0);
-		p->qu_cur = cur;
 	}
 
 	if (r == FFPLS_FIN) {
+		if (0 != pending_flush(&p->pending, &p->qu_cur, 0))
+			return FMED_RERR;
 		qu->cmd(FMED_QUE_RM, (void*)fmed_getval("queue_item"));
 		return FMED_RFIN;
 
@@ -407,6 +474,10 @@ static void* cue_open(fmed_filt *d)
 	c->qu_cur = (void*)fmed_getval("queue_item");
 	c->cu.options = gaps;
 	c->utf8 = 1;
+
+	if (1 == core->getval("cue_split") && !d->stream_copy
+		&& FMED_PNULL != d->track->getvalstr(d->trk, "output"))
+		c->split_mode = 1;
 	return c;
 }
 
@@ -418,6 +489,8 @@ static void cue_close(void *ctx)
 	FFARR_FREE_ALL(&c->gmetas, ffarr_free, ffarr);
 	FFARR_FREE_ALL(&c->metas, ffarr_free, ffarr);
 	ffarr_free(&c->trackno);
+	ffarr_free(&c->split);
+	ffstr_free(&c->split_url);
 	ffmem_free(c);
 }
 
@@ -433,6 +506,117 @@ static ssize_t cue_meta_find(const ffarr *a, size_t n, const ffarr *search)
 	return -1;
 }
 
+/** Add queue item for the whole file with the list of its CUE tracks. */
+static int cue_split_flush(cue *c)
+{
+	fmed_que_entry e, *cur;
+	ffmem_tzero(&e);
+	e.url = c->split_url;
+	e.from = -(int)c->split_from;
+	e.to = -(int)c->split_to;
+	e.dur = (c->split_to != 0) ? (c->split_to - c->split_from) * 1000 / 75 : 0;
+	e.prev = c->qu_cur;
+	cur = (void*)qu->cmd2(FMED_QUE_ADD | FMED_QUE_NO_ONCHANGE | FMED_QUE_COPY_PROPS, &e, 0);
+	if (cur == NULL)
+		return -1;
+
+	const ffarr *m = (void*)c->gmetas.ptr;
+	for (uint i = 0;  i != c->gmetas.len;  i += 2) {
+		ffstr pair[2];
+		ffstr_set2(&pair[0], &m[i]);
+		ffstr_set2(&pair[1], &m[i + 1]);
+		qu->cmd2(FMED_QUE_METASET, cur, (size_t)pair);
+	}
+
+	qu->meta_set(cur, FFSTR("cue_split"), c->split.ptr, c->split.len, FMED_QUE_TRKDICT);
+	qu->cmd2(FMED_QUE_ADD | FMED_QUE_ADD_DONE, cur, 0);
+	c->qu_cur = cur;
+	c->split.len = 0;
+	return 0;
+}
+
+/** Add a field to the CUE tracks list, escaping '\\', TAB and LF with '\\'. */
+static int cue_split_addesc(ffarr *a, const ffstr *s)
+{
+	for (size_t i = 0;  i != s->len;  i++) {
+		char esc[2] = { '\\', s->ptr[i] };
+		const char *p = esc;
+		size_t n = 2;
+		switch (s->ptr[i]) {
+		case '\t':
+			esc[1] = 't';  break;
+		case '\n':
+			esc[1] = 'n';  break;
+		case '\\':
+			break;
+		default:
+			p = &s->ptr[i];
+			n = 1;
+		}
+		if (NULL == ffarr_append(a, p, n))
+			return -1;
+	}
+	return 0;
+}
+
+/** Add "NAME\tVAL\n" line to the CUE tracks list. */
+static int cue_split_addmeta(ffarr *a, const ffstr *name, const ffstr *val)
+{
+	if (0 != cue_split_addesc(a, name)
+		|| NULL == ffarr_append(a, "\t", 1)
+		|| 0 != cue_split_addesc(a, val)
+		|| NULL == ffarr_append(a, "\n", 1))
+		return -1;
+	return 0;
+}
+
+/** Add CUE track to the list for single-pass split. */
+static int cue_split_add(cue *c, const ffcuetrk *ctrk)
+{
+	const ffarr *m;
+	ffstr name, val;
+
+	if (c->split.len != 0 && !ffstr_eq2(&c->split_url, &c->ent.url)) {
+		if (0 != cue_split_flush(c))
+			return -1;
+	}
+
+	if (c->split.len == 0) {
+		ffstr_free(&c->split_url);
+		if (NULL == ffstr_copy(&c->split_url, c->ent.url.ptr, c->ent.url.len))
+			return -1;
+		c->split_from = ctrk->from;
+	}
+	c->split_to = ctrk->to;
+
+	if (0 == ffstr_catfmt(&c->split, "%u %u\n", ctrk->from, ctrk->to))
+		return -1;
+
+	// global meta that isn't set in TRACK context
+	m = (void*)c->gmetas.ptr;
+	for (uint i = 0;  i != c->gmetas.len;  i += 2) {
+		if (cue_meta_find(&c->metas, c->nmeta, &m[i]) >= 0)
+			continue;
+		ffstr_set2(&name, &m[i]);
+		ffstr_set2(&val, &m[i + 1]);
+		if (0 != cue_split_addmeta(&c->split, &name, &val))
+			return -1;
+	}
+
+	// TRACK meta
+	m = (void*)c->metas.ptr;
+	for (uint i = 0;  i != c->nmeta;  i += 2) {
+		ffstr_set2(&name, &m[i]);
+		ffstr_set2(&val, &m[i + 1]);
+		if (0 != cue_split_addmeta(&c->split, &name, &val))
+			return -1;
+	}
+
+	if (NULL == ffarr_append(&c->split, "\n", 1))
+		return -1;
+	return 0;
+}
+
 static int cue_process(void *ctx, fmed_filt *d)
 {
 	cue *c = ctx;
@@ -560,6 +744,12 @@ add:
 			continue;
 		}
 
+		if (c->split_mode) {
+			if (0 != cue_split_add(c, ctrk))
+				goto err;
+			goto next;
+		}
+
 		c->ent.from = -(int)ctrk->from;
 		c->ent.to = -(int)ctrk->to;
 		c->ent.dur = (ctrk->to != 0) ? (ctrk->to - ctrk->from) * 1000 / 75 : 0;
@@ -603,6 +793,9 @@ next:
 		c->nmeta = c->metas.len;
 	}
 
+	if (c->split.len != 0 && 0 != cue_split_flush(c))
+		goto err;
+
 	qu->cmd(FMED_QUE_RM, (void*)fmed_getval("queue_item"));
 	rc = FMED_RFIN;
 
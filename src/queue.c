@@ -44,6 +44,7 @@ typedef struct entry {
 		, trk_stopped :1
 		, trk_err :1
 		, trk_mixed :1
+		, started :1 //batch mode: the track has been started
 		;
 } entry;
 
@@ -76,6 +77,9 @@ typedef struct que {
 		, fmeta_lowprio :1 //meta from file has lower priority
 		, rnd_ready :1
 		, mixing :1;
+
+	uint parallel; //max. number of tracks processed at once (batch mode)
+	uint nactive; //batch mode: number of active tracks
 } que;
 
 static que *qu;
@@ -103,8 +107,10 @@ static const fmed_queue fmed_que_mgr = {
 };
 
 static fmed_que_entry* que_add(fmed_que_entry *ent, uint flags);
+static ssize_t que_addn(fmed_que_entry *ents, size_t n, uint flags);
 static void que_meta_set(fmed_que_entry *ent, const ffstr *name, const ffstr *val, uint flags);
-static void que_play(entry *e);
+static int que_play(entry *e);
+static void que_batch_next(void);
 static void que_save(entry *first, const fflist_item *sentl, const char *fn);
 static void ent_rm(entry *e);
 static void ent_free(entry *e);
@@ -313,17 +319,19 @@ end:
 	return rc;
 }
 
-static void que_play(entry *ent)
+/** Start track for the entry.
+Return 0 if the track is started. */
+static int que_play(entry *ent)
 {
 	fmed_que_entry *e = &ent->e;
 	void *trk = qu->track->create(FMED_TRACK_OPEN, e->url.ptr);
 	uint i;
 
 	if (trk == NULL)
-		return;
+		return -1;
 	else if (trk == FMED_TRK_EFMT) {
 		entry *next;
-		if (NULL != (next = que_getnext(ent))) {
+		if (qu->parallel == 0 && NULL != (next = que_getnext(ent))) {
 			struct quetask *qt = ffmem_new(struct quetask);
 			FF_ASSERT(qt != NULL);
 			qt->cmd = FMED_QUE_PLAY;
@@ -332,7 +340,7 @@ static void que_play(entry *ent)
 		}
 
 		que_cmd(FMED_QUE_RM, e);
-		return;
+		return -1;
 	}
 
 	fmed_trk *t = qu->track->conf(trk);
@@ -359,14 +367,48 @@ static void que_play(entry *ent)
 	const char *smeta = qu->track->getvalstr(trk, "meta");
 	if (smeta != FMED_PNULL && 0 != que_setmeta(ent, smeta, trk)) {
 		que_cmd(FMED_QUE_RM, e);
-		return;
+		return -1;
 	}
 
 	FFARR2_FREE_ALL(&ent->tmeta, ffstr_free, ffstr);
 
 	qu->track->setval(trk, "queue_item", (int64)e);
 	ent_ref(ent);
-	qu->track->cmd(trk, FMED_TRACK_START);
+	// batch mode: distribute the tracks among all workers
+	qu->track->cmd(trk, (qu->parallel != 0) ? FMED_TRACK_XSTART : FMED_TRACK_START);
+	return 0;
+}
+
+/** Batch mode: start the next tracks until there are 'parallel' tracks active.
+The tracks are distributed among worker threads by core.
+The items added by playlist tracks (e.g. .cue) are inserted after them, so the list is walked from the beginning. */
+static void que_batch_next(void)
+{
+	plist *pl = qu->curlist;
+	fflist_item *it = pl->ents.first;
+
+	while (qu->nactive < qu->parallel) {
+		for (;;) {
+			if (it == fflist_sentl(&pl->ents)) {
+				if (qu->nactive == 0) {
+					dbglog(core, NULL, "que", "batch: all tracks are processed");
+					qu->track->cmd(NULL, FMED_TRACK_LAST);
+				}
+				return;
+			}
+			entry *e = FF_GETPTR(entry, sib, it);
+			if (!e->started && !e->rm)
+				break;
+			it = it->next;
+		}
+
+		entry *e = FF_GETPTR(entry, sib, it);
+		it = it->next;
+		e->started = 1;
+		pl->cur = e;
+		if (0 == que_play(e))
+			qu->nactive++;
+	}
 }
 
 /** Save playlist file. */
@@ -500,6 +542,7 @@ static const char *const scmds[] = {
 	"que-new", "que-del", "que-sel", "que-list", "is-curlist",
 	"id", "item",
 	"flt-new", "flt-add", "flt-del", "lst-noflt",
+	"addn",
 };
 
 static ssize_t que_cmdv(uint cmd, ...)
@@ -532,6 +575,18 @@ static ssize_t que_cmd2(uint cmd, void *param, size_t param2)
 		// break
 
 	case FMED_QUE_PLAY:
+		if (qu->parallel == 0) {
+			int n = core->getval("parallel");
+			if (n != FMED_NULL && n > 1) {
+				qu->parallel = n;
+				dbglog(core, NULL, "que", "batch mode: %u tracks at once", n);
+			}
+		}
+		if (qu->parallel != 0) {
+			que_batch_next();
+			break;
+		}
+
 		pl = qu->curlist;
 		if (param != NULL) {
 			e = param;
@@ -588,6 +643,9 @@ static ssize_t que_cmd2(uint cmd, void *param, size_t param2)
 	case FMED_QUE_ADD:
 		return (ssize_t)que_add(param, flags);
 
+	case FMED_QUE_ADDN:
+		return que_addn(param, param2, flags);
+
 	case FMED_QUE_EXPAND: {
 		void *r = param;
 		e = FF_GETPTR(entry, e, r);
@@ -786,28 +844,15 @@ static fmed_que_entry* _que_add(fmed_que_entry *ent)
 	return (void*)que_cmd2(FMED_QUE_ADD, ent, 0);
 }
 
-static fmed_que_entry* que_add(fmed_que_entry *ent, uint flags)
+/** Create a new entry.
+@prev: the item after which the new entry will be placed; its list and (with FMED_QUE_COPY_PROPS) its properties are used. */
+static entry* ent_new(const fmed_que_entry *ent, entry *prev, uint flags)
 {
-	entry *e = NULL;
-
-	if (flags & FMED_QUE_ADD_DONE) {
-		if (ent == NULL) {
-			if (!(flags & FMED_QUE_NO_ONCHANGE) && qu->onchange != NULL)
-				qu->onchange(&e->e, FMED_QUE_ONADD | FMED_QUE_ADD_DONE);
-			return NULL;
-		}
-		e = FF_GETPTR(entry, e, ent);
-		goto done;
-	}
+	entry *e;
 
-	e = ffmem_tcalloc1(entry);
-	if (e == NULL)
+	if (NULL == (e = ffmem_tcalloc1(entry)))
 		return NULL;
-	e->plist = qu->curlist;
-	if (ent->prev != NULL) {
-		entry *prev = FF_GETPTR(entry, e, ent->prev);
-		e->plist = prev->plist;
-	}
+	e->plist = (prev != NULL) ? prev->plist : qu->curlist;
 
 	if (NULL == (e->e.url.ptr = ffsz_alcopy(ent->url.ptr, ent->url.len))) {
 		ent_free(e);
@@ -818,10 +863,9 @@ static fmed_que_entry* que_add(fmed_que_entry *ent, uint flags)
 	e->e.from = ent->from;
 	e->e.to = ent->to;
 	e->e.dur = ent->dur;
-	e->e.prev = ent->prev;
+	e->e.prev = (prev != NULL) ? &prev->e : NULL;
 
-	if ((flags & FMED_QUE_COPY_PROPS) && ent->prev != NULL) {
-		entry *prev = FF_GETPTR(entry, e, ent->prev);
+	if ((flags & FMED_QUE_COPY_PROPS) && prev != NULL) {
 		qu->track->copy_info(&e->trk, &prev->trk);
 
 		ffstr *dict = prev->dict.ptr;
@@ -838,15 +882,35 @@ static fmed_que_entry* que_add(fmed_que_entry *ent, uint flags)
 	} else
 		qu->track->copy_info(&e->trk, NULL);
 	e->e.trk = &e->trk;
+	return e;
+}
 
-	ffchain_append(&e->sib, (ent->prev != NULL) ? &FF_GETPTR(entry, e, ent->prev)->sib : e->plist->ents.last);
+static fmed_que_entry* que_add(fmed_que_entry *ent, uint flags)
+{
+	entry *e = NULL, *prev = NULL;
+
+	if (flags & FMED_QUE_ADD_DONE) {
+		if (ent == NULL) {
+			if (!(flags & FMED_QUE_NO_ONCHANGE) && qu->onchange != NULL)
+				qu->onchange(&e->e, FMED_QUE_ONADD | FMED_QUE_ADD_DONE);
+			return NULL;
+		}
+		e = FF_GETPTR(entry, e, ent);
+		goto done;
+	}
+
+	if (ent->prev != NULL)
+		prev = FF_GETPTR(entry, e, ent->prev);
+	if (NULL == (e = ent_new(ent, prev, flags)))
+		return NULL;
+
+	ffchain_append(&e->sib, (prev != NULL) ? &prev->sib : e->plist->ents.last);
 	e->plist->ents.len++;
 	if (NULL == ffarr_growT(&e->plist->indexes, 1, 16, entry*)) {
 		ent_free(e);
 		return NULL;
 	}
-	if (ent->prev != NULL) {
-		entry *prev = FF_GETPTR(entry, e, ent->prev);
+	if (prev != NULL) {
 		ssize_t i = plist_ent_idx(e->plist, prev);
 		FF_ASSERT(i != -1);
 		if (i != -1) {
@@ -867,6 +931,77 @@ done:
 	return &e->e;
 }
 
+/** Add several items in one operation.
+The new items follow each other after ents[0].prev (or at the end of the current list).
+The list index is extended and shifted only once, so adding N items costs O(N) instead of O(N^2).
+On return ents[i].prev points to the added item.
+Return the number of added items;  -1 on error. */
+static ssize_t que_addn(fmed_que_entry *ents, size_t n, uint flags)
+{
+	entry *prev = NULL, *e, **pe;
+	plist *pl = qu->curlist;
+	ffarr a = {0};
+	ssize_t i, r = -1;
+
+	if (n == 0)
+		return 0;
+	if (ents[0].prev != NULL) {
+		prev = FF_GETPTR(entry, e, ents[0].prev);
+		pl = prev->plist;
+	}
+
+	if (NULL == ffarr_allocT(&a, n, entry*)
+		|| NULL == ffarr_growT(&pl->indexes, n, 16, entry*))
+		goto end;
+
+	// create all entries before modifying the list, so a failure leaves it untouched
+	for (i = 0;  i != (ssize_t)n;  i++) {
+		if (NULL == (e = ent_new(&ents[i], prev, flags)))
+			goto end;
+		*ffarr_pushT(&a, entry*) = e;
+	}
+
+	ffchain_item *after = (prev != NULL) ? &prev->sib : pl->ents.last;
+	i = pl->indexes.len;
+	if (prev != NULL) {
+		i = plist_ent_idx(pl, prev);
+		FF_ASSERT(i != -1);
+		if (i == -1)
+			goto end;
+		i++;
+		_ffarr_shiftr(&pl->indexes, i, n, sizeof(entry*));
+	}
+	ffmemcpy((entry**)pl->indexes.ptr + i, a.ptr, n * sizeof(entry*));
+	pl->indexes.len += n;
+
+	pe = (void*)a.ptr;
+	for (i = 0;  i != (ssize_t)n;  i++) {
+		e = pe[i];
+		ffchain_append(&e->sib, after);
+		after = &e->sib;
+		if (i != 0)
+			e->e.prev = &pe[i - 1]->e;
+		ents[i].prev = &e->e;
+	}
+	pl->ents.len += n;
+	a.len = 0;
+
+	dbglog(core, NULL, "que", "added %L items", n);
+
+	if (!(flags & FMED_QUE_NO_ONCHANGE) && qu->onchange != NULL) {
+		for (i = 0;  i != (ssize_t)n;  i++) {
+			qu->onchange(&pe[i]->e, FMED_QUE_ONADD | FMED_QUE_MORE);
+		}
+		if (!(flags & FMED_QUE_MORE))
+			qu->onchange(&pe[n - 1]->e, FMED_QUE_ONADD | FMED_QUE_ADD_DONE);
+	}
+	r = n;
+
+end:
+	FFARR_FREE_ALL_PTR(&a, ent_free, entry*);
+	return r;
+}
+
 static int que_arrfind(const ffstr *m, uint n, const char *name, size_t name_len)
 {
 	uint i;
@@ -1031,7 +1166,11 @@ static ffstr* que_meta(fmed_que_entry *ent, size_t n, ffstr *name, uint flags)
 
 static void que_ontrkfin(entry *e)
 {
-	if (qu->mixing) {
+	if (qu->parallel != 0) {
+		qu->nactive--;
+		if (!e->trk_stopped)
+			que_batch_next();
+	} else if (qu->mixing) {
 		if (qu->quit_if_done && e->trk_mixed)
 			core->sig(FMED_STOP);
 	} else if (e->stop_after)
@@ -25,11 +25,28 @@ enum {
 	ALLOWSLEEP_TIMEOUT = 5000,
 };
 
+/** Track state published by the worker thread for readers from the main thread. */
+struct trk_snapshot {
+	uint64 pos;
+	uint64 total;
+	uint sample_rate;
+	uint state; //enum TRK_ST
+	uint stopping :1;
+	uint nfilters;
+	fmed_trk_filtinfo filters[N_FILTERS];
+	fmed_adev_stat adev;
+};
+
 struct tracks {
 	ffatomic trkid;
 	fflist trks; //fm_trk[]
+	fflock trks_lk; //protects 'trks': tracks are added by workers, while main thread walks the list
 	const struct fmed_trk_mon *mon;
 	fftmrq_entry allowsleep_tmr;
+	struct trk_snapshot info_snap; //data for FMED_TRACK_INFO
+	ffarr prof_json; //profiling data of the closed tracks for "--profile-json"
+	uint bench_run;
+	uint ndecoded, ndecode_err; //"--decode-only" stats
 	uint stop_sig :1;
 };
 
@@ -44,7 +61,7 @@ typedef struct fmed_f {
 	} d;
 	const char *name;
 	const fmed_filter *filt;
-	fftime clk;
+	fmed_trk_filtinfo prof;
 	unsigned opened :1
 		, newdata :1
 		, want_input :1;
@@ -60,6 +77,23 @@ typedef struct dict_ent {
 	uint acq :1;
 } dict_ent;
 
+enum PROF {
+	PROF_OFF,
+	PROF_COARSE, //cheap low-resolution clock
+	PROF_PRECISE,
+};
+
+#if defined CLOCK_MONOTONIC_COARSE
+/** Get timestamp (usec) from the coarse monotonic clock.
+It's much cheaper than ffclk_get() and its low resolution averages out over many calls. */
+static FFINL uint64 prof_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
 enum TRK_ST {
 	TRK_ST_STOPPED,
 	TRK_ST_ACTIVE,
@@ -78,11 +112,19 @@ typedef struct fm_trk {
 	struct ffps_perf psperf;
 	fftask tsk, tsk_stop;
 	uint wid;
+	uint lowlat :1; //audio device track: run on the low-latency worker
+	uint codec_err :1; //a decoder has reported a bad frame (fmed_trk.codec_err may be reset by a filter)
+	uint prof; //enum PROF
+	fftime bench_start;
 
 	ffstr id;
 	char sid[FFSLEN("*") + FFINT_MAXCHARS];
+	const char *input;
 
 	uint state; //enum TRK_ST
+
+	ffatomic snap_seq; //odd value: the snapshot is being updated
+	struct trk_snapshot snap;
 } fm_trk;
 
 
@@ -99,6 +141,11 @@ static void trk_process(void *udata);
 static void trk_stop(fm_trk *t, uint flags);
 static fmed_f* trk_modbyext(fm_trk *t, uint flags, const ffstr *ext);
 static void trk_printtime(fm_trk *t);
+static void trk_prof_json(fm_trk *t);
+static void trk_bench_report(fm_trk *t);
+static void prof_json_write(void);
+static void trk_snapshot(fm_trk *t);
+static int trk_info(fmed_trk_info *ti);
 static int trk_meta_enum(fm_trk *t, fmed_trk_meta *meta);
 static int trk_meta_copy(fm_trk *t, fm_trk *src);
 static fmed_f* filt_add(fm_trk *t, uint cmd, const char *name);
@@ -137,6 +184,7 @@ int tracks_init(void)
 	if (NULL == (g = ffmem_new(struct tracks)))
 		return -1;
 	fflist_init(&g->trks);
+	fflk_init(&g->trks_lk);
 	return 0;
 }
 
@@ -150,6 +198,11 @@ void tracks_destroy(void)
 	FFLIST_WALKSAFE(&g->trks, t, sib, next) {
 		trk_free(t);
 	}
+	prof_json_write();
+	ffarr_free(&g->prof_json);
+	if (fmed->cmd.decode_only)
+		core->log(FMED_LOG_USER, NULL, "track", "decoded %u tracks, %u with errors"
+			, g->ndecoded, g->ndecode_err);
 	if (g->allowsleep_tmr.handler != NULL)
 		allowsleep(2);
 	ffmem_free0(g);
@@ -186,6 +239,11 @@ static int trk_open(fm_trk *t, const char *fn)
 		return 0;
 	}
 
+	if (fmed->cmd.edit_tags) {
+		addfilter(t, "tag.edit");
+		return 0;
+	}
+
 	if (ffs_match(fn, ffsz_len(fn), "http://", 7)) {
 		addfilter(t, "net.icy");
 	} else {
@@ -193,7 +251,11 @@ static int trk_open(fm_trk *t, const char *fn)
 		ffpath_splitname(name.ptr, name.len, &name, &ext);
 		if (!have_path && ffstr_eqcz(&name, "@stdin"))
 			addfilter(t, "#file.stdin");
-		else
+		else if (!have_path && ffstr_eqcz(&name, "@silgen")) {
+			ffpcm_fmtcopy(&t->props.audio.fmt, &fmed->conf.inp_pcm);
+			addfilter(t, "#soundmod.silgen");
+			return 0;
+		} else
 			addfilter(t, "#file.in");
 
 		if (NULL == trk_modbyext(t, FMED_MOD_INEXT, &ext))
@@ -218,10 +280,36 @@ static void trk_open_capt(fm_trk *t)
 	addfilter(t, "#soundmod.rtpeak");
 }
 
+/** Split "OUT1|OUT2|..." output list: '|' within a name is escaped as "||".
+Return the number of outputs;  @dst: "OUT1\0OUT2\0...\0\0" */
+static int trk_outputs_split(const char *s, ffarr *dst)
+{
+	int n = 0;
+	if (NULL == ffarr_alloc(dst, ffsz_len(s) + 2))
+		return -1;
+	for (;;  s++) {
+		if ((*s == '|' && s[1] != '|') || *s == '\0') {
+			if (dst->len != 0 && dst->ptr[dst->len - 1] != '\0') {
+				dst->ptr[dst->len++] = '\0';
+				n++;
+			}
+			if (*s == '\0')
+				break;
+			continue;
+		}
+		if (*s == '|')
+			s++;
+		dst->ptr[dst->len++] = *s;
+	}
+	dst->ptr[dst->len++] = '\0';
+	return n;
+}
+
 static int trk_setout(fm_trk *t)
 {
 	ffstr name, ext;
 	const char *s;
+	int nout = 1;
 	ffbool stream_copy = t->props.stream_copy;
 
 	if (t->props.type == FMED_TRK_TYPE_NETIN) {
@@ -231,18 +319,29 @@ static int trk_setout(fm_trk *t)
 		if (NULL == trk_modbyext(t, FMED_MOD_INEXT, &ext))
 			return -1;
 
-	} else if (t->props.type == FMED_TRK_TYPE_NONE) {
+	} else if (t->props.type == FMED_TRK_TYPE_NONE || fmed->cmd.edit_tags) {
+		return 0;
+
+	} else if (fmed->cmd.probe && t->props.type == FMED_TRK_TYPE_PLAYBACK) {
+		// header-only probe: no decoding, conversion or output
+		addfilter(t, "tui.probe");
 		return 0;
 
-	} else if (t->props.type != FMED_TRK_TYPE_MIXIN) {
+	} else if (t->props.type != FMED_TRK_TYPE_MIXIN && t->props.type != FMED_TRK_TYPE_TEE) {
 		if (t->props.type != FMED_TRK_TYPE_REC)
 			addfilter(t, "#soundmod.until");
 		if (fmed->cmd.gui)
 			addfilter(t, "gui.gui");
-		else if (!fmed->cmd.notui)
+		else if (!fmed->cmd.notui && fmed->cmd.bench == 0 && !fmed->cmd.decode_only && !fmed->cmd.loudness)
 			addfilter(t, "tui.tui");
 	}
 
+	if (fmed->cmd.decode_only && t->props.type == FMED_TRK_TYPE_PLAYBACK) {
+		// no conversion, encoding or output: just discard decoded data
+		addfilter(t, "#file.null");
+		return 0;
+	}
+
 	if (t->props.a_start_level != 0)
 		addfilter(t, "#soundmod.startlevel");
 
@@ -253,13 +352,63 @@ static int trk_setout(fm_trk *t)
 		addfilter(t, "#soundmod.membuf");
 	}
 
-	if (t->props.type != FMED_TRK_TYPE_MIXOUT && !stream_copy) {
+	if (t->props.type != FMED_TRK_TYPE_MIXOUT && t->props.type != FMED_TRK_TYPE_TEE && !stream_copy) {
 		addfilter(t, "#soundmod.gain");
 	}
 
 	if (t->props.use_dynanorm)
 		addfilter(t, "dynanorm.filter");
 
+	if (t->props.type != FMED_TRK_TYPE_TEE
+		&& FMED_PNULL != (s = trk_getvalstr(t, "output"))) {
+		// "OUT1|OUT2|...": write to OUT1, #soundmod.tee passes the data to the tracks for the other outputs
+		ffarr a = {};
+		if (0 >= (nout = trk_outputs_split(s, &a))) {
+			ffarr_free(&a);
+			return -1;
+		}
+		if (nout > 1) {
+			size_t n = ffsz_len(a.ptr) + 1;
+			char *tee = ffmem_alloc(a.len - n);
+			if (tee == NULL) {
+				ffarr_free(&a);
+				return -1;
+			}
+			ffmemcpy(tee, a.ptr + n, a.len - n);
+			trk_setvalstr4(t, "tee_outputs", tee, FMED_TRK_FACQUIRE);
+		}
+		trk_setvalstr4(t, "output", a.ptr, FMED_TRK_FACQUIRE);
+	}
+
+	if (t->props.type != FMED_TRK_TYPE_MIXIN && !t->props.pcm_peaks && !t->props.loudness && !stream_copy
+		&& FMED_PNULL != trk_getvalstr(t, "cue_split")
+		&& FMED_PNULL != trk_getvalstr(t, "output")) {
+		// the whole CUE image: #soundmod.cuesplit passes the data to a new track for each CUE track
+		if (nout > 1) {
+			errlog(t, "several outputs aren't supported when splitting");
+			return -1;
+		}
+		addfilter(t, "#soundmod.cuesplit");
+		return 0;
+	}
+
+	if (t->props.type == FMED_TRK_TYPE_REC
+		&& (FMED_NULL != trk_getval(t, "split_time") || FMED_NULL != trk_getval(t, "split_size")
+			|| FMED_NULL != trk_getval(t, "split_silence"))
+		&& FMED_PNULL != trk_getvalstr(t, "output")) {
+		// #soundmod.split passes the recorded data to a new track for each output segment
+		if (nout > 1) {
+			errlog(t, "several outputs aren't supported when splitting");
+			return -1;
+		}
+		addfilter(t, "#soundmod.split");
+		return 0;
+	}
+
+	if (t->props.type != FMED_TRK_TYPE_MIXIN && !t->props.pcm_peaks && !t->props.loudness && !stream_copy
+		&& nout > 1)
+		addfilter(t, "#soundmod.tee");
+
 	addfilter(t, "#soundmod.autoconv");
 
 	if (t->props.type == FMED_TRK_TYPE_MIXIN) {
@@ -268,14 +417,23 @@ static int trk_setout(fm_trk *t)
 	} else if (t->props.pcm_peaks) {
 		addfilter(t, "#soundmod.peaks");
 
+	} else if (t->props.loudness) {
+		addfilter(t, "loudness.analyze");
+
 	} else if (FMED_PNULL != (s = trk_getvalstr(t, "output"))) {
 		uint have_path = (NULL != ffpath_split2(s, ffsz_len(s), NULL, &name));
 		ffs_rsplit2by(name.ptr, name.len, '.', &name, &ext);
+		uint null_out = (!have_path && ffstr_eqcz(&name, "@null"));
 
-		if (NULL == trk_modbyext(t, FMED_MOD_OUTEXT, &ext))
+		// "@null" without extension: discard PCM data, don't encode
+		if (!(null_out && ext.len == 0)
+			&& NULL == trk_modbyext(t, FMED_MOD_OUTEXT, &ext))
 			return -1;
 
-		if (!have_path && ffstr_eqcz(&name, "@stdout")) {
+		if (null_out) {
+			addfilter(t, "#file.null");
+			t->props.out_seekable = 1;
+		} else if (!have_path && ffstr_eqcz(&name, "@stdout")) {
 			addfilter(t, "#file.stdout");
 			t->props.out_seekable = 0;
 		} else {
@@ -283,8 +441,13 @@ static int trk_setout(fm_trk *t)
 			t->props.out_seekable = 1;
 		}
 
+	} else if (fmed->cmd.bench != 0) {
+		addfilter(t, "#file.null");
+
 	} else if (fmed->conf.output != NULL) {
 		addfilter1(t, fmed->conf.output);
+		// mixer.out shares data with mixer.in tracks without locking: keep it on their worker
+		t->lowlat = (t->props.type != FMED_TRK_TYPE_MIXOUT);
 	}
 
 	return 0;
@@ -341,7 +504,9 @@ static int trk_opened(fm_trk *t)
 		dbglog(t, "properties: %*xb", sizeof(t->props), &t->props);
 	}
 
+	fflk_lock(&g->trks_lk);
 	fflist_ins(&g->trks, &t->sib);
+	fflk_unlock(&g->trks_lk);
 	allowsleep(0);
 	t->state = TRK_ST_ACTIVE;
 	t->cur = ffchain_first(&t->filt_chain);
@@ -374,6 +539,16 @@ static void* trk_create(uint cmd, const char *fn)
 	t->id.len = ffs_fmt(t->sid, t->sid + sizeof(t->sid), "*%L", ffatom_incret(&g->trkid));
 	t->id.ptr = t->sid;
 
+	if (core->loglev == FMED_LOG_DEBUG || fmed->cmd.bench != 0)
+		t->prof = PROF_PRECISE;
+	else if (fmed->cmd.profile || fmed->cmd.profile_json != NULL) {
+#if defined CLOCK_MONOTONIC_COARSE
+		t->prof = PROF_COARSE;
+#else
+		t->prof = PROF_PRECISE;
+#endif
+	}
+
 	if (NULL == ffarr_allocT((ffarr*)&t->filters, N_FILTERS, fmed_f))
 		goto err;
 
@@ -390,6 +565,7 @@ static void* trk_create(uint cmd, const char *fn)
 	case FMED_TRK_TYPE_REC:
 		trk_open_capt(t);
 		t->props.type = FMED_TRK_TYPE_REC;
+		t->lowlat = 1;
 		break;
 
 	case FMED_TRK_TYPE_MIXOUT:
@@ -466,19 +642,19 @@ static void trk_printtime(fm_trk *t)
 {
 	fmed_f *pf;
 	ffstr3 s = {0};
-	fftime all = {0};
+	uint64 all = 0;
 
 	FFARR_WALK(&t->filters, pf) {
-		fftime_add(&all, &pf->clk);
+		all += pf->prof.usec;
 	}
-	if (fftime_empty(&all))
+	if (all == 0)
 		return;
-	ffstr_catfmt(&s, "time: %u.%06u.  ", (int)fftime_sec(&all), (int)fftime_usec(&all));
+	ffstr_catfmt(&s, "time: %u.%06u.  ", (int)(all / 1000000), (int)(all % 1000000));
 
 	FFARR_WALK(&t->filters, pf) {
-		ffstr_catfmt(&s, "%s: %u.%06u (%u%%), "
-			, pf->name, (int)fftime_sec(&pf->clk), (int)fftime_usec(&pf->clk)
-			, (int)(fftime_mcs(&pf->clk) * 100 / fftime_mcs(&all)));
+		ffstr_catfmt(&s, "%s: %u.%06u (%u%%) calls:%U, "
+			, pf->name, (int)(pf->prof.usec / 1000000), (int)(pf->prof.usec % 1000000)
+			, (int)(pf->prof.usec * 100 / all), pf->prof.calls);
 	}
 	if (s.len > FFSLEN(", "))
 		s.len -= FFSLEN(", ");
@@ -487,6 +663,123 @@ static void trk_printtime(fm_trk *t)
 	ffarr_free(&s);
 }
 
+/** Save the track's profiling data for "--profile-json".  Thread: main. */
+static void trk_prof_json(fm_trk *t)
+{
+	ffarr *buf = &g->prof_json;
+	const fmed_f *pf;
+	const char *input = (t->input != NULL) ? t->input : "";
+
+	ffstr_catfmt(buf, "%s{\"track\":\"%S\",\"input\":"
+		, (buf->len != 0) ? ",\n" : "", &t->id);
+	fmed_json_addstr(buf, input, ffsz_len(input));
+	ffstr_catfmt(buf, ",\"filters\":[");
+
+	FFARR_WALK(&t->filters, pf) {
+		ffstr_catfmt(buf, "%s\n {\"name\":\"%s\",\"calls\":%U,\"usec\":%U,\"in\":%U,\"out\":%U,\"rc\":{"
+			, (pf != t->filters.ptr) ? "," : ""
+			, pf->name, pf->prof.calls, pf->prof.usec, pf->prof.in, pf->prof.out);
+		uint n = 0;
+		for (uint i = 0;  i != FFCNT(pf->prof.rc);  i++) {
+			if (pf->prof.rc[i] == 0)
+				continue;
+			ffstr_catfmt(buf, "%s\"%s\":%U"
+				, (n++ != 0) ? "," : "", fmed_retstr[i], pf->prof.rc[i]);
+		}
+		ffstr_catfmt(buf, "}}");
+	}
+
+	ffstr_catfmt(buf, "]}");
+}
+
+/** Print the results of one benchmark run as a JSON object on a single line.  Thread: main. */
+static void trk_bench_report(fm_trk *t)
+{
+	ffarr buf = {0};
+	const fmed_f *pf, *in = NULL;
+	fftime stop;
+	uint64 usec, bytes = 0, samples = 0;
+	uint rate = t->props.audio.fmt.sample_rate;
+
+	if (fftime_empty(&t->bench_start))
+		return;
+	ffclk_get(&stop);
+	ffclk_diff(&t->bench_start, &stop);
+	usec = ffmax(fftime_mcs(&stop), 1);
+
+	// the amount of data produced by the input filter (file reader or generator)
+	FFARR_WALK(&t->filters, pf) {
+		if (!ffsz_eq(pf->name, "#queue.track")) {
+			in = pf;
+			break;
+		}
+	}
+	if (in != NULL)
+		bytes = in->prof.out;
+
+	if ((int64)t->props.audio.pos != FMED_NULL)
+		samples = t->props.audio.pos;
+
+	uint64 mb_s = bytes * 100 / usec; //bytes per usec = MB/sec, with 2 decimal digits
+	uint64 rt = (rate != 0) ? samples * 1000000 / rate * 100 / usec : 0;
+
+	const char *input = (t->input != NULL) ? t->input : "";
+	ffstr_catfmt(&buf, "{\"bench\":%u,\"input\":", ++g->bench_run);
+	fmed_json_addstr(&buf, input, ffsz_len(input));
+	ffstr_catfmt(&buf, ",\"bytes\":%U,\"samples\":%U,\"sample_rate\":%u,\"usec\":%U"
+		",\"mb_s\":%U.%02u,\"realtime\":%U.%02u,\"filters\":["
+		, bytes, samples, rate, usec
+		, mb_s / 100, (uint)(mb_s % 100), rt / 100, (uint)(rt % 100));
+
+	FFARR_WALK(&t->filters, pf) {
+		ffstr_catfmt(&buf, "%s{\"name\":\"%s\",\"calls\":%U,\"usec\":%U,\"ns_per_sample\":%U}"
+			, (pf != t->filters.ptr) ? "," : ""
+			, pf->name, pf->prof.calls, pf->prof.usec
+			, (samples != 0) ? pf->prof.usec * 1000 / samples : 0);
+	}
+
+	ffstr_catfmt(&buf, "]}\n");
+	fffile_write(ffstdout, buf.ptr, buf.len);
+	ffarr_free(&buf);
+}
+
+/** Print a JSON record for the input that failed before "tui.probe" was reached,
+ so that "--probe" prints one line per input.  Thread: main. */
+static void trk_probe_err(fm_trk *t)
+{
+	ffarr buf = {0};
+	const char *input = (t->input != NULL) ? t->input : "";
+	ffstr_catfmt(&buf, "{\"input\":");
+	fmed_json_addstr(&buf, input, ffsz_len(input));
+	ffstr_catfmt(&buf, ",\"error\":\"%s\"}\n"
+		, (t->props.e_no_source) ? "no such file" : "can't open or parse the input");
+	fffile_write(ffstdout, buf.ptr, buf.len);
+	ffarr_free(&buf);
+}
+
+/** Write profiling data of all tracks to file. */
+static void prof_json_write(void)
+{
+	const char *fn = fmed->cmd.profile_json;
+	fffd f;
+
+	if (fn == NULL)
+		return;
+
+	if (FF_BADFD == (f = fffile_open(fn, O_CREAT | O_TRUNC | O_WRONLY))) {
+		syserrlog(core, NULL, "track", "%s: %s", fffile_open_S, fn);
+		return;
+	}
+
+	ffstr_catfmt(&g->prof_json, "\n]\n");
+	if (1 != fffile_write(f, "[", 1)
+		|| g->prof_json.len != (size_t)fffile_write(f, g->prof_json.ptr, g->prof_json.len))
+		syserrlog(core, NULL, "track", "%s: %s", fffile_write_S, fn);
+
+	fffile_close(f);
+	dbglog(NULL, "saved profiling data to %s", fn);
+}
+
 static void dict_ent_free(dict_ent *e)
 {
 	if (e->acq)
@@ -499,9 +792,29 @@ static void trk_free_tsk(void *param)
 	trk_free(param);
 }
 
+/** Close all filters. */
+static void trk_closefilters(fm_trk *t)
+{
+	fmed_f *pf;
+	dbglog(t, "closing...");
+	FFARR_RWALK(&t->filters, pf) {
+		if (pf->ctx != NULL) {
+			t->cur = &pf->sib;
+			pf->filt->close(pf->ctx);
+			pf->ctx = NULL;
+		}
+	}
+}
+
 /** Finish processing for the track.  Thread: worker. */
 static void trk_fin(fm_trk *t)
 {
+	if (t->lowlat && t->wid != 0) {
+		/* Audio device filters arm their timers on this worker:
+		 they must be stopped here, not on the main worker. */
+		trk_closefilters(t);
+	}
+
 	t->tsk.handler = &trk_free_tsk;
 	core->task(&t->tsk, FMED_TASK_POST);
 }
@@ -509,11 +822,9 @@ static void trk_fin(fm_trk *t)
 /** Free memory associated with the track.  Thread: main. */
 static void trk_free(fm_trk *t)
 {
-	fmed_f *pf;
 	dict_ent *e;
 	fftree_node *node, *next;
 
-	core->task(&t->tsk, FMED_TASK_DEL);
 	core->task(&t->tsk_stop, FMED_TASK_DEL);
 
 	if (fmed->cmd.print_time) {
@@ -530,16 +841,23 @@ static void trk_free(fm_trk *t)
 			);
 	}
 
-	dbglog(t, "closing...");
-	FFARR_RWALK(&t->filters, pf) {
-		if (pf->ctx != NULL) {
-			t->cur = &pf->sib;
-			pf->filt->close(pf->ctx);
-		}
-	}
+	trk_closefilters(t);
+	// a filter may wake the track from its own thread until it's closed
+	core->task(&t->tsk, FMED_TASK_DEL);
 
 	if (core->loglev == FMED_LOG_DEBUG)
 		trk_printtime(t);
+	if (fmed->cmd.profile_json != NULL)
+		trk_prof_json(t);
+	if (fmed->cmd.bench != 0 && t->state != TRK_ST_ERR)
+		trk_bench_report(t);
+	if (fmed->cmd.probe && t->props.type == FMED_TRK_TYPE_PLAYBACK && t->state == TRK_ST_ERR)
+		trk_probe_err(t);
+	if (fmed->cmd.decode_only && t->props.type == FMED_TRK_TYPE_PLAYBACK) {
+		g->ndecoded++;
+		if (t->state == TRK_ST_ERR || t->codec_err)
+			g->ndecode_err++;
+	}
 
 	ffarr_free(&t->filters);
 
@@ -555,8 +873,14 @@ static void trk_free(fm_trk *t)
 		dict_ent_free(e);
 	}
 
-	if (fflist_exists(&g->trks, &t->sib)) {
+	fflk_lock(&g->trks_lk);
+	ffbool listed = fflist_exists(&g->trks, &t->sib);
+	if (listed)
 		fflist_rm(&g->trks, &t->sib);
+	uint ntrks = g->trks.len;
+	fflk_unlock(&g->trks_lk);
+
+	if (listed) {
 		core_job_done(t->wid);
 		allowsleep(1);
 	}
@@ -567,31 +891,39 @@ static void trk_free(fm_trk *t)
 	dbglog(t, "closed");
 	ffmem_free(t);
 
-	if (g->stop_sig && g->trks.len == 0)
+	if (g->stop_sig && ntrks == 0)
 		core->sig(FMED_STOP);
 }
 
-#ifdef _DEBUG
 // enum FMED_R
 static const char *const fmed_retstr[] = {
 	"err", "ok", "data", "done", "last-out",
 	"more", "back",
 	"async", "fin", "syserr",
 };
-#endif
 
 static int filt_call(fm_trk *t, fmed_f *f)
 {
 	int r;
 	fftime t1, t2;
+	uint64 c1 = 0;
 
 #ifdef _DEBUG
 	dbglog(t, "%s calling %s, input: %L"
 		, (f->newdata) ? ">>" : "<<", f->name, f->d.datalen);
 #endif
-	if (core->loglev == FMED_LOG_DEBUG) {
+	switch (t->prof) {
+#if defined CLOCK_MONOTONIC_COARSE
+	case PROF_COARSE:
+		c1 = prof_clock();
+		break;
+#endif
+	case PROF_PRECISE:
 		ffclk_get(&t1);
+		break;
 	}
+	f->prof.calls++;
+	f->prof.in += f->d.datalen;
 
 	ffint_bitmask(&t->props.flags, FMED_FFWD, f->newdata);
 	f->newdata = 0;
@@ -621,10 +953,21 @@ static int filt_call(fm_trk *t, fmed_f *f)
 	r = f->filt->process(f->ctx, &t->props);
 	f->d.data = t->props.data,  f->d.datalen = t->props.datalen;
 
-	if (core->loglev == FMED_LOG_DEBUG) {
+	f->prof.out += t->props.outlen;
+	if ((uint)(r + 1) < FFCNT(f->prof.rc))
+		f->prof.rc[r + 1]++;
+
+	switch (t->prof) {
+#if defined CLOCK_MONOTONIC_COARSE
+	case PROF_COARSE:
+		f->prof.usec += prof_clock() - c1;
+		break;
+#endif
+	case PROF_PRECISE:
 		ffclk_get(&t2);
 		ffclk_diff(&t1, &t2);
-		fftime_add(&f->clk, &t2);
+		f->prof.usec += fftime_mcs(&t2);
+		break;
 	}
 
 #ifdef _DEBUG
@@ -648,17 +991,19 @@ static void trk_process(void *udata)
 		if (t->state != TRK_ST_ACTIVE) {
 			if (t->state == TRK_ST_ERR)
 				goto fin;
-			return;
+			goto end;
 		}
 
 		if (core_job_shouldyield(t->wid, &jobdata)) {
 			trk_cmd(t, FMED_TRACK_WAKE);
-			return;
+			goto end;
 		}
 
 		f = FF_GETPTR(fmed_f, sib, t->cur);
 
 		e = filt_call(t, f);
+		if (t->props.codec_err)
+			t->codec_err = 1;
 
 		switch (e) {
 		case FMED_RSYSERR:
@@ -669,7 +1014,7 @@ static void trk_process(void *udata)
 			goto fin;
 
 		case FMED_RASYNC:
-			return;
+			goto end;
 
 		case FMED_RMORE:
 			FF_ASSERT(t->props.outlen == 0);
@@ -760,15 +1105,90 @@ shift:
 		}
 	}
 
+end:
+	trk_snapshot(t);
 	return;
 
 fin:
 	if (t->state == TRK_ST_ERR)
 		trk_setval(t, "error", 1);
 
+	trk_snapshot(t);
 	trk_fin(t);
 }
 
+/** Publish the current track state for readers from other threads.  Thread: worker. */
+static void trk_snapshot(fm_trk *t)
+{
+	struct trk_snapshot *s = &t->snap;
+	const fmed_f *pf;
+	uint i = 0;
+
+	ffatom_incret(&t->snap_seq);
+	s->pos = t->props.audio.pos;
+	s->total = t->props.audio.total;
+	s->sample_rate = t->props.audio.fmt.sample_rate;
+	s->state = t->state;
+	s->stopping = !!(t->props.flags & FMED_FSTOP);
+	s->adev = t->props.adev;
+	FFARR_WALK(&t->filters, pf) {
+		s->filters[i] = pf->prof;
+		s->filters[i].name = pf->name;
+		i++;
+	}
+	s->nfilters = i;
+	ffatom_incret(&t->snap_seq);
+}
+
+/** Get a consistent copy of the track state without blocking the worker. */
+static void trk_snapshot_read(fm_trk *t, struct trk_snapshot *dst)
+{
+	for (;;) {
+		size_t seq = ffatom_get(&t->snap_seq);
+		ffatom_fence_acq();
+		if (seq & 1)
+			continue;
+		ffmemcpy(dst, &t->snap, sizeof(*dst));
+		ffatom_fence_acq();
+		if (seq == ffatom_get(&t->snap_seq))
+			break;
+	}
+}
+
+/** Get information about the next active track.  Thread: main. */
+static int trk_info(fmed_trk_info *ti)
+{
+	FF_ASSERT(core_ismainthr());
+	fflist_item *it;
+	fm_trk *t;
+
+	// the tracks are removed only on main thread, so 'ti->trk' is still valid
+	fflk_lock(&g->trks_lk);
+	it = (ti->trk == NULL) ? g->trks.first : ((fm_trk*)ti->trk)->sib.next;
+	fflk_unlock(&g->trks_lk);
+	if (it == fflist_sentl(&g->trks))
+		return 1;
+	t = FF_GETPTR(fm_trk, sib, it);
+
+	struct trk_snapshot *s = &g->info_snap;
+	trk_snapshot_read(t, s);
+
+	ti->trk = t;
+	ti->id = &t->id;
+	ti->input = t->input;
+	ti->type = t->props.type;
+	ti->worker = t->wid;
+	ti->pos = s->pos;
+	ti->total = s->total;
+	ti->sample_rate = s->sample_rate;
+	ti->nfilters = s->nfilters;
+	ti->filters = s->filters;
+	ti->adev = s->adev;
+	ti->paused = (s->state == TRK_ST_PAUSED);
+	ti->stopping = s->stopping;
+	return 0;
+}
+
 
 static dict_ent* dict_findstr(fm_trk *t, const ffstr *name)
 {
@@ -987,12 +1407,14 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 
 	case FMED_TRACK_STOPALL:
 		FF_ASSERT(core_ismainthr());
+		fflk_lock(&g->trks_lk);
 		FFLIST_WALKSAFE(&g->trks, t, sib, next) {
 			if (t->props.type == FMED_TRK_TYPE_REC && trk == NULL)
 				continue;
 
 			trk_stop(t, cmd);
 		}
+		fflk_unlock(&g->trks_lk);
 		break;
 
 	case FMED_TRACK_STOP:
@@ -1013,11 +1435,20 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 
 		if (fmed->cmd.print_time)
 			ffps_perf(&t->psperf, FFPS_PERF_REALTIME | FFPS_PERF_CPUTIME | FFPS_PERF_RUSAGE);
+		if (fmed->cmd.bench != 0)
+			ffclk_get(&t->bench_start);
+
+		if (FMED_PNULL == (t->input = trk_getvalstr(t, "input")))
+			t->input = NULL;
+		trk_snapshot(t);
 
-		if (cmd == FMED_TRACK_XSTART)
-			t->wid = core_job_new(1);
+		if (t->lowlat)
+			t->wid = core_job_new(CORE_JOB_LOWLAT);
+		else if (cmd == FMED_TRACK_XSTART)
+			t->wid = core_job_new(CORE_JOB_ANY);
 		else
-			t->wid = core_job_new(0);
+			t->wid = core_job_new(CORE_JOB_MAIN);
+		dbglog(t, "starting in worker #%u", t->wid);
 		core->cmd(FMED_TASK_XPOST, &t->tsk, t->wid);
 		break;
 
@@ -1026,7 +1457,8 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 		break;
 	case FMED_TRACK_UNPAUSE:
 		t->state = TRK_ST_ACTIVE;
-		trk_process(t);
+		// the track is processed in its own worker
+		core->cmd(FMED_TASK_XPOST, &t->tsk, t->wid);
 		break;
 
 	case FMED_TRACK_LAST:
@@ -1119,6 +1551,18 @@ static ssize_t trk_cmd(void *trk, uint cmd, ...)
 		r = (size_t)core->kq;
 		break;
 
+	case FMED_TRACK_INFO: {
+		fmed_trk_info *ti = va_arg(va, fmed_trk_info*);
+		r = trk_info(ti);
+		break;
+	}
+
+	case FMED_TRACK_XPOST: {
+		fftask *task = va_arg(va, fftask*);
+		core->cmd(FMED_TASK_XPOST, task, t->wid);
+		break;
+	}
+
 	default:
 		errlog(t, "invalid command:%u", cmd);
 	}
@@ -116,6 +116,14 @@ static const fmed_filter fmed_tui = {
 	&tui_open, &tui_process, &tui_close
 };
 
+//PROBE
+static void* probe_open(fmed_filt *d);
+static int probe_process(void *ctx, fmed_filt *d);
+static void probe_close(void *ctx);
+static const fmed_filter fmed_tui_probe = {
+	&probe_open, &probe_process, &probe_close
+};
+
 static void tui_info(tui *t, fmed_filt *d);
 static void tui_cmdread(void *param);
 static void tui_help(uint cmd);
@@ -124,6 +132,7 @@ static int tui_setvol(tui *t, uint vol);
 static void tui_vol(tui *t, uint cmd);
 static void tui_seek(tui *t, uint cmd, void *udata);
 static void tui_op_trk(struct tui *t, uint cmd);
+static void tui_trkcmd_add(tui *t, uint cmd, int64 val);
 
 struct key;
 static void tui_corecmd(void *param);
@@ -146,7 +155,8 @@ static const void* tui_iface(const char *name)
 {
 	if (!ffsz_cmp(name, "tui")) {
 		return &fmed_tui;
-	}
+	} else if (!ffsz_cmp(name, "probe"))
+		return &fmed_tui_probe;
 	return NULL;
 }
 
@@ -354,6 +364,113 @@ static void tui_info(tui *t, fmed_filt *d)
 	t->buf.len = 0;
 }
 
+
+struct probe {
+	ffarr buf;
+};
+
+static void* probe_open(fmed_filt *d)
+{
+	struct probe *p = ffmem_new(struct probe);
+	if (p == NULL)
+		return NULL;
+	return p;
+}
+
+static void probe_close(void *ctx)
+{
+	struct probe *p = ctx;
+	ffarr_free(&p->buf);
+	ffmem_free(p);
+}
+
+/** Print format info and tags of the input file as a JSON object on a single line.
+The track is closed as soon as the header is processed. */
+static int probe_process(void *ctx, fmed_filt *d)
+{
+	struct probe *p = ctx;
+	ffarr *buf = &p->buf;
+	const char *input = d->track->getvalstr(d->trk, "input");
+	const char *decoder = (d->audio.decoder != NULL) ? d->audio.decoder : "";
+	uint64 total = ((int64)d->audio.total != FMED_NULL) ? d->audio.total : 0;
+	uint64 size = ((int64)d->input.size != FMED_NULL) ? d->input.size : 0;
+	uint rate = d->audio.fmt.sample_rate;
+
+	ffstr_catfmt(buf, "{\"input\":");
+	fmed_json_addstr(buf, input, ffsz_len(input));
+	ffstr_catfmt(buf, ",\"size\":%U,\"format\":", size);
+	fmed_json_addstr(buf, decoder, ffsz_len(decoder));
+	ffstr_catfmt(buf, ",\"bitrate\":%u,\"sample_rate\":%u,\"channels\":%u,\"samples\":%U,\"duration_msec\":%U,\"tags\":{"
+		, d->audio.bitrate, rate, d->audio.fmt.channels
+		, total, (rate != 0) ? ffpcm_time(total, rate) : (uint64)0);
+
+	fmed_trk_meta meta;
+	ffmem_tzero(&meta);
+	uint n = 0;
+	while (0 == d->track->cmd2(d->trk, FMED_TRACK_META_ENUM, &meta)) {
+		if (n++ != 0)
+			ffarr_append(buf, ",", 1);
+		fmed_json_addstr(buf, meta.name.ptr, meta.name.len);
+		ffarr_append(buf, ":", 1);
+		fmed_json_addstr(buf, meta.val.ptr, meta.val.len);
+	}
+
+	ffstr_catfmt(buf, "}}\n");
+	// one write per line: lines from parallel tracks don't interleave
+	fffile_write(ffstdout, buf->ptr, buf->len);
+	return FMED_RFIN;
+}
+
+/** Command for the current track.  It's executed in the track's worker. */
+struct trkcmd {
+	fftask tsk;
+	tui *t;
+	uint cmd;
+	int64 val;
+};
+
+static void tui_trkcmd(void *param)
+{
+	struct trkcmd *c = param;
+
+	fflk_lock(&gt->lktrk);
+	tui *t = gt->curtrk;
+	if (t != c->t)
+		goto done; // the track is closed
+
+	switch (c->cmd) {
+	case CMD_SEEKRIGHT:
+	case CMD_SEEKLEFT:
+		t->d->audio.seek = c->val;
+		t->d->snd_output_clear = 1;
+		t->goback = 1;
+		break;
+
+	case CMD_PLAY:
+		t->d->snd_output_pause = c->val;
+		break;
+	}
+
+done:
+	fflk_unlock(&gt->lktrk);
+	ffmem_free(c);
+}
+
+static void tui_trkcmd_add(tui *t, uint cmd, int64 val)
+{
+	struct trkcmd *c = ffmem_tcalloc1(struct trkcmd);
+	if (c == NULL) {
+		syserrlog(core, NULL, "tui", "alloc");
+		return;
+	}
+	c->tsk.handler = &tui_trkcmd;
+	c->tsk.param = c;
+	c->t = t;
+	c->cmd = cmd;
+	c->val = val;
+	gt->track->cmd(t->trk, FMED_TRACK_XPOST, &c->tsk);
+}
+
 static void tui_seek(tui *t, uint cmd, void *udata)
 {
 	int64 pos = (uint64)t->lastpos * 1000;
@@ -375,9 +492,7 @@ static void tui_seek(tui *t, uint cmd, void *udata)
 		pos += by;
 	else
 		pos = ffmax(pos - by, 0);
-	t->d->audio.seek = pos;
-	t->d->snd_output_clear = 1;
-	t->goback = 1;
+	tui_trkcmd_add(t, cmd, pos);
 }
 
 static void tui_vol(tui *t, uint cmd)
@@ -574,12 +689,12 @@ static void tui_op(uint cmd)
 
 		if (gt->curtrk->paused) {
 			gt->curtrk->paused = 0;
-			gt->curtrk->d->snd_output_pause = 0;
+			tui_trkcmd_add(gt->curtrk, CMD_PLAY, 0);
 			gt->track->cmd(gt->curtrk->trk, FMED_TRACK_UNPAUSE);
 			break;
 		}
 
-		gt->curtrk->d->snd_output_pause = 1;
+		tui_trkcmd_add(gt->curtrk, CMD_PLAY, 1);
 		gt->curtrk->paused = 1;
 		break;
 